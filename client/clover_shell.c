@@ -24,6 +24,9 @@ void usage(void)
 	fprintf(stderr, "\t\t\tLevel:0-5\n");
 	fprintf(stderr, "clover_shell --info\n");
 	fprintf(stderr, "\tGet canvas information\n");
+	fprintf(stderr, "clover_shell --timeline\n");
+	fprintf(stderr, "\tDump repaint timeline of each output to "
+			"/tmp/repaint-timeline-N\n");
 	fprintf(stderr, "clover_shell --set-layout=layout_desc\n");
 	fprintf(stderr, "\tSet screen layout\n");
 	fprintf(stderr, "\t\tLayout_desc: Mode:Output-0:Output-1\n");
@@ -51,9 +54,10 @@ static struct option shell_options[] = {
 	{"log", 1, NULL, 'l'},
 	{"info", 0, NULL, 'i'},
 	{"set-layout", 1, NULL, 's'},
+	{"timeline", 0, NULL, 't'},
 };
 
-static char shell_short_options[] = "l:is:";
+static char shell_short_options[] = "l:is:t";
 
 static void parse_log_param(char *param, struct clv_shell_info *si)
 {
@@ -222,7 +226,8 @@ static s32 sock_cb(s32 fd, u32 mask, void *data)
 		if (flag & (1 << CLV_CMD_LINK_ID_ACK_SHIFT)) {
 			so->linkid = clv_client_parse_link_id(so->rx_buf);
 			tx_buf = clv_create_shell_cmd(&so->si, &n);
-			if (so->si.cmd == CLV_SHELL_DEBUG_SETTING)
+			if (so->si.cmd == CLV_SHELL_DEBUG_SETTING
+			    || so->si.cmd == CLV_SHELL_REPAINT_TIMELINE_DUMP)
 				so->run = 0;
 			if (clv_send(fd, tx_buf, n) < 0) {
 				fprintf(stderr, "server exit.\n");
@@ -266,6 +271,9 @@ s32 main(s32 argc, char **argv)
 		case 's':
 			parse_layout_param(optarg, &so.si);
 			break;
+		case 't':
+			so.si.cmd = CLV_SHELL_REPAINT_TIMELINE_DUMP;
+			break;
 		default:
 			usage();
 			return -1;
@@ -94,7 +94,6 @@ struct dmabuf_window;
 struct client_display {
 	struct clv_event_loop *loop;
 	struct clv_event_source *sock_event;
-	struct clv_event_source *repaint_event;
 	struct clv_event_source *collect_event;
 
 	s32 exit;
@@ -115,6 +114,7 @@ struct dmabuf_window {
 	struct dma_buf buf[2];
 	
 	s32 flip_pending;
+	s32 frame_ready; /* frame done received, draw once buffer is free */
 	s32 back_buf;
 
 	u8 *ipc_rx_buf;
@@ -141,6 +141,10 @@ struct dmabuf_window {
 	u8 *commit_tx_cmd;
 	u32 commit_tx_len;
 
+	u8 *frame_tx_cmd_t;
+	u8 *frame_tx_cmd;
+	u32 frame_tx_len;
+
 	u8 *terminate_tx_cmd_t;
 	u8 *terminate_tx_cmd;
 	u32 terminate_tx_len;
@@ -163,11 +167,6 @@ static void destroy_display(struct client_display *disp)
 		disp->sock_event = NULL;
 	}
 
-	if (disp->repaint_event) {
-		clv_event_source_remove(disp->repaint_event);
-		disp->repaint_event = NULL;
-	}
-
 	if (disp->loop) {
 		clv_event_loop_destroy(disp->loop);
 		disp->loop = NULL;
@@ -290,6 +289,7 @@ static struct dmabuf_window *create_dmabuf_window(struct client_display *disp,
 	}
 
 	win->flip_pending = 0;
+	win->frame_ready = 0;
 	win->back_buf = 0;
 
 	win->ipc_rx_buf_sz = 32 * 1024;
@@ -359,6 +359,12 @@ static struct dmabuf_window *create_dmabuf_window(struct client_display *disp,
 	assert(win->commit_tx_cmd);
 	win->commit_tx_len = n;
 
+	win->frame_tx_cmd_t = clv_client_create_frame_cmd(0, &n);
+	assert(win->frame_tx_cmd_t);
+	win->frame_tx_cmd = malloc(n);
+	assert(win->frame_tx_cmd);
+	win->frame_tx_len = n;
+
 	win->terminate_tx_cmd_t = clv_client_create_destroy_cmd(0, &n);
 	assert(win->terminate_tx_cmd_t);
 	win->terminate_tx_cmd = malloc(n);
@@ -395,34 +401,23 @@ static void dmabuf_redraw(void *data)
 	struct client_display *disp = window->disp;
 	struct dma_buf *buffer;
 
-	assert(clv_event_source_timer_update(disp->repaint_event, 8, 0) == 0);
 	buffer = &window->buf[window->back_buf];
 
 	render_gpu(window, buffer);
-	if (window->flip_pending) {
-		assert(clv_event_source_timer_update(disp->repaint_event, 2, 667) ==0);
-//		clv_debug("not commit");
-		return;
-	}
 
 	window->c.bo_id = buffer->id;
+	clv_dup_frame_cmd(window->frame_tx_cmd, window->frame_tx_cmd_t,
+			  window->frame_tx_len, window->s.surface_id);
+	clv_send(disp->sock, window->frame_tx_cmd, window->frame_tx_len);
 	clv_dup_commit_req_cmd(window->commit_tx_cmd, window->commit_tx_cmd_t,
 			       window->commit_tx_len, &window->c);
 	//clv_debug("commit %lu", buffer->id);
 	window->flip_pending = 1;
+	window->frame_ready = 0;
 	window->back_buf = 1 - window->back_buf;
 	clv_send(disp->sock, window->commit_tx_cmd, window->commit_tx_len);
 }
 
-static s32 dmabuf_repaint_cb(void *data)
-{
-	struct client_display *disp = data;
-	struct dmabuf_window *window = disp->dmabuf_window;
-
-	dmabuf_redraw(window);
-	return 0;
-}
-
 static s32 collect_cb(void *data)
 {
 	struct client_display *disp = data;
@@ -502,6 +497,8 @@ static s32 dmabuf_client_event_cb(s32 fd, u32 mask, void *data)
 				return -1;
 			}
 			window->s.surface_id = id;
+			window->v.surface_id = id;
+			window->c.surface_id = id;
 			clv_debug("create surface ok, surface_id = 0x%08lX",
 				  window->s.surface_id);
 			(void)clv_dup_create_view_cmd(
@@ -605,6 +602,14 @@ static s32 dmabuf_client_event_cb(s32 fd, u32 mask, void *data)
 			//clv_debug("receive bo complete %lu", id);
 			frame_cnt++;
 			window->flip_pending = 0;
+			if (window->frame_ready)
+				dmabuf_redraw(window);
+		} else if (flag & (1 << CLV_CMD_FRAME_DONE_SHIFT)) {
+			clv_client_parse_frame_done_cmd(window->ipc_rx_buf);
+			/* draw only when the compositor will use the frame */
+			window->frame_ready = 1;
+			if (!window->flip_pending)
+				dmabuf_redraw(window);
 		} else if (flag & (1 << CLV_CMD_SHELL_SHIFT)) {
 			clv_debug("receive shell event");
 		} else if (flag & (1 << CLV_CMD_DESTROY_ACK_SHIFT)) {
@@ -648,11 +653,6 @@ void run_dmabuf_client(void)
 						    dmabuf_client_event_cb,
 						    display);
 	assert(display->sock_event);
-	display->repaint_event = clv_event_loop_add_timer(display->loop,
-							  dmabuf_repaint_cb,
-							  display);
-	assert(display->repaint_event);
-
 	display->collect_event = clv_event_loop_add_timer(display->loop,
 							  collect_cb,
 							  display);
@@ -11,6 +11,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <time.h>
 #include <assert.h>
 #include <linux/input.h>
 #include <libudev.h>
@@ -20,6 +22,9 @@
 #include <clover_log.h>
 #include <clover_utils.h>
 #include <clover_protocal.h>
+#include <clover_input_ring.h>
+#include <clover_cursor_state.h>
+#include <clover_pixel.h>
 
 #define CURSOR_MAX_WIDTH 64
 #define CURSOR_MAX_HEIGHT 64
@@ -29,6 +34,14 @@
 #define CURSOR_ACCEL_THRESHOLD_C 40
 #define CURSOR_ACCEL_THRESHOLD_D 50
 
+/*
+ * Retry period of what is held back for a busy client, doubled on each retry.
+ * Neither a socket nor a ring tells when the client has read, so give up
+ * after a few retries, the next event tries again.
+ */
+#define MOTION_FLUSH_MS 1
+#define MOTION_FLUSH_RETRIES 6
+
 /*
  * multi-kbd support
  * static s32 has_kbd = 0;
@@ -64,6 +77,14 @@ struct input_client {
 	struct input_cmd cmd_rx;
 	struct input_display *disp;
 	struct list_head link;
+
+	s32 use_ring;
+	struct clv_input_ring ring;
+	s32 use_ts; /* sends clv_input_event_ts, not clv_input_event */
+
+	/* motion held back until the client has read what was sent */
+	s32 has_motion;
+	struct clv_input_event_ts motion;
 };
 
 struct input_display {
@@ -71,6 +92,8 @@ struct input_display {
 	struct udev_monitor *udev_monitor;
 	struct clv_shm accel_fac_shm;
 	float *accel_fac;
+	struct clv_shm cursor_state_shm;
+	struct clv_cursor_state *cursor_state;
 	struct clv_rect global_area[MAX_DESKTOP_NR];
 	struct clv_rect area[MAX_DESKTOP_NR];
 	s32 count_areas;
@@ -84,6 +107,9 @@ struct input_display {
 	struct clv_event_source *server_source;
 	struct clv_event_source *repaint_source;
 	struct clv_event_source *timeout_source;
+	struct clv_event_source *motion_source;
+	u32 motion_flush_ms;
+	s32 motion_retries;
 	s32 repaint_damage;
 	s32 server_sock;
 	struct list_head clients;
@@ -95,8 +121,10 @@ struct input_display {
 	struct input_event *buffer;
 	s32 buffer_sz;
 
-	struct clv_input_event *tx_buf;
+	struct clv_input_event_ts *tx_buf;
 	s32 tx_buf_sz;
+	/* tx_buf without timestamps, for the clients which did not ask */
+	struct clv_input_event *tx_legacy;
 
 	u32 abs_x, abs_y; /* cursor pos */
 	s32 screen_x, screen_y; /* cursor pos */
@@ -203,10 +231,182 @@ static void input_client_destroy(struct input_client *client)
 {
 	clv_event_source_remove(client->client_source);
 	close(client->sock);
+	if (client->use_ring)
+		clv_input_ring_release(&client->ring);
 	list_del(&client->link);
 	free(client);
 }
 
+static void input_client_subscribe_ring(struct input_client *client, u32 size)
+{
+	u32 len = CLV_INPUT_RING_HANDOVER;
+
+	if (client->use_ring)
+		return;
+
+	if (clv_input_ring_create(&client->ring, size) < 0) {
+		clv_err("failed to create input ring, keep the socket.");
+		return;
+	}
+
+	if (clv_send(client->sock, &len, sizeof(u32)) < 0
+	    || clv_send_fd(client->sock, client->ring.fd) < 0
+	    || clv_send_fd(client->sock, client->ring.efd) < 0) {
+		clv_err("failed to hand the input ring over.");
+		clv_input_ring_release(&client->ring);
+		return;
+	}
+
+	clv_debug("input client switched to ring, %u records",
+		  client->ring.mask + 1);
+	client->use_ring = 1;
+}
+
+static void input_client_subscribe_ts(struct input_client *client)
+{
+	u32 len = CLV_INPUT_TIMESTAMP_SWITCH;
+	u32 rec_size = sizeof(struct clv_input_event_ts);
+
+	/* the ring always carries timestamps */
+	if (client->use_ts || client->use_ring)
+		return;
+
+	if (clv_send(client->sock, &len, sizeof(u32)) < 0
+	    || clv_send(client->sock, &rec_size, sizeof(u32)) < 0) {
+		clv_err("failed to switch input client to timestamps.");
+		return;
+	}
+
+	clv_debug("input client switched to timestamps");
+	client->use_ts = 1;
+}
+
+/* retry what is held back for the busy clients, from the shortest period */
+static void schedule_motion_flush(struct input_display *disp)
+{
+	disp->motion_flush_ms = MOTION_FLUSH_MS;
+	disp->motion_retries = 0;
+	clv_event_source_timer_update(disp->motion_source,
+				      disp->motion_flush_ms, 0);
+}
+
+static void input_client_write(struct input_client *client,
+			       struct clv_input_event_ts *evts, u32 count)
+{
+	struct clv_input_event *legacy = client->disp->tx_legacy;
+	u32 len, i;
+
+	if (client->use_ring) {
+		if (clv_input_ring_push(&client->ring, evts, count) < count) {
+			clv_debug("input ring overflow %llu coalesced %llu",
+				  (unsigned long long)
+					client->ring.shared->overflow,
+				  (unsigned long long)
+					client->ring.shared->coalesced);
+		}
+		return;
+	}
+
+	if (client->use_ts) {
+		len = sizeof(struct clv_input_event_ts) * count;
+		clv_send(client->sock, &len, sizeof(u32));
+		/* send raw event */
+		clv_send(client->sock, evts, len);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		legacy[i] = evts[i].evt;
+	len = sizeof(struct clv_input_event) * count;
+	clv_send(client->sock, &len, sizeof(u32));
+	/* send raw event */
+	clv_send(client->sock, legacy, len);
+}
+
+/* the ring was full, it holds some events back */
+static inline s32 input_client_held(struct input_client *client)
+{
+	return client->use_ring
+		&& (client->ring.backlog_len || client->ring.has_pending);
+}
+
+/* the client has not read everything sent to it yet */
+static s32 input_client_busy(struct input_client *client)
+{
+	s32 n;
+
+	if (client->use_ring)
+		return clv_input_ring_queued(&client->ring) > 0;
+
+	if (ioctl(client->sock, SIOCOUTQ, &n) < 0)
+		return 0;
+
+	return n > 0;
+}
+
+static void input_client_flush_motion(struct input_client *client)
+{
+	struct clv_input_event_ts evts[2];
+
+	if (!client->has_motion)
+		return;
+
+	evts[0] = client->motion;
+	clv_input_make_syn(&evts[1], &client->motion);
+	client->has_motion = 0;
+	input_client_write(client, evts, 2);
+}
+
+static void input_client_fold_motion(struct input_client *client,
+				     struct clv_input_event_ts *evt)
+{
+	if (client->has_motion) {
+		if (!clv_input_fold_motion(&client->motion, evt))
+			return;
+		/* the deltas would overflow, send what was folded so far */
+		input_client_flush_motion(client);
+	}
+
+	client->motion = *evt;
+	client->has_motion = 1;
+}
+
+/*
+ * All the motion between two reads of the client is merged into one event,
+ * latest position and accumulated deltas. Any other event flushes the merged
+ * motion first, so keys and buttons are never lost nor reordered.
+ */
+static void input_client_send(struct input_client *client,
+			      struct clv_input_event_ts *evts, u32 count)
+{
+	s32 busy;
+	u32 i;
+
+	if (!clv_input_is_motion_batch(evts, count)) {
+		input_client_flush_motion(client);
+		input_client_write(client, evts, count);
+		goto out;
+	}
+
+	busy = input_client_busy(client);
+	if (!busy && !client->has_motion) {
+		input_client_write(client, evts, count);
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (clv_input_is_motion(&evts[i]))
+			input_client_fold_motion(client, &evts[i]);
+	}
+
+	if (!busy)
+		input_client_flush_motion(client);
+
+out:
+	if (client->has_motion || input_client_held(client))
+		schedule_motion_flush(client->disp);
+}
+
 static void redraw_cursor(struct input_display *disp, s32 damage, u8 *data,
 			  u32 w, u32 h);
 
@@ -248,6 +448,13 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 		memcpy(disp->global_area, client->cmd_rx.c.range.global_area,
 			sizeof(struct clv_rect) * MAX_DESKTOP_NR);
 		break;
+	case INPUT_CMD_TYPE_SUBSCRIBE_RING:
+		input_client_subscribe_ring(client,
+					    client->cmd_rx.c.ring.size);
+		break;
+	case INPUT_CMD_TYPE_SUBSCRIBE_TIMESTAMP:
+		input_client_subscribe_ts(client);
+		break;
 	default:
 		printf("Unkown cursor cmd! %u\n", client->cmd_rx.type);
 		return -1;
@@ -294,6 +501,9 @@ static void input_display_destroy(struct input_display *disp)
 	if (disp->timeout_source)
 		clv_event_source_remove(disp->timeout_source);
 
+	if (disp->motion_source)
+		clv_event_source_remove(disp->motion_source);
+
 	if (disp->server_source)
 		clv_event_source_remove(disp->server_source);
 	if (disp->server_sock)
@@ -360,7 +570,12 @@ static void input_display_destroy(struct input_display *disp)
 	if (disp->tx_buf)
 		free(disp->tx_buf);
 
+	if (disp->tx_legacy)
+		free(disp->tx_legacy);
+
 	clv_shm_release(&disp->accel_fac_shm);
+	if (disp->cursor_state)
+		clv_shm_release(&disp->cursor_state_shm);
 
 	free(disp);
 }
@@ -545,23 +760,29 @@ static void reset_mouse_pos(struct input_display *disp)
 	redraw_cursor(disp, 0, NULL, 64, 64);
 }
 
+static inline u64 evdev_time_us(struct input_event *evt)
+{
+	return (u64)evt->time.tv_sec * 1000000ull + evt->time.tv_usec;
+}
+
 static void send_mouse_pos_manually(struct input_display *disp)
 {
-	struct clv_input_event event;
+	struct clv_input_event_ts event;
 	struct input_client *client;
-	u32 len = sizeof(event);
+	struct timespec now;
 
 	memset(&event, 0, sizeof(event));
-	event.type = EV_ABS;
-	event.code = ABS_X | ABS_Y;
-	event.v.pos.x = disp->abs_x;
-	event.v.pos.y = disp->abs_x;
-	event.v.pos.dx = 0;
-	event.v.pos.dy = 0;
+	event.evt.type = EV_ABS;
+	event.evt.code = ABS_X | ABS_Y;
+	event.evt.v.pos.x = disp->abs_x;
+	event.evt.v.pos.y = disp->abs_x;
+	event.evt.v.pos.dx = 0;
+	event.evt.v.pos.dy = 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	event.time = (u64)now.tv_sec * 1000000ull + now.tv_nsec / 1000;
 
 	list_for_each_entry(client, &disp->clients, link) {
-		clv_send(client->sock, &len, sizeof(u32));
-		clv_send(client->sock, &event, len);
+		input_client_send(client, &event, 1);
 	}
 }
 
@@ -670,28 +891,32 @@ static void event_proc(struct input_display *disp, struct input_event *evts,
 {
 	s32 src, dst;
 	s32 dx, dy;
+	u64 time;
 	struct input_client *client;
 
 	dx = dy = 0;
 	dst = 0;
 
 	for (src = 0; src < cnt; src++) {
+		time = evdev_time_us(&disp->buffer[src]);
 		switch (disp->buffer[src].type) {
 		case EV_SYN:
 			if (dx || dy) {
 				cursor_accel_set(&dx, &dy, *disp->accel_fac);
 				mouse_move_proc(disp, dx, dy);
-				disp->tx_buf[dst].type = EV_ABS;
-				disp->tx_buf[dst].code = ABS_X | ABS_Y;
-				disp->tx_buf[dst].v.pos.x = disp->abs_x;
-				disp->tx_buf[dst].v.pos.y = disp->abs_y;
-				disp->tx_buf[dst].v.pos.dx = (s16)dx;
-				disp->tx_buf[dst].v.pos.dy = (s16)dy;
+				disp->tx_buf[dst].evt.type = EV_ABS;
+				disp->tx_buf[dst].evt.code = ABS_X | ABS_Y;
+				disp->tx_buf[dst].evt.v.pos.x = disp->abs_x;
+				disp->tx_buf[dst].evt.v.pos.y = disp->abs_y;
+				disp->tx_buf[dst].evt.v.pos.dx = (s16)dx;
+				disp->tx_buf[dst].evt.v.pos.dy = (s16)dy;
+				disp->tx_buf[dst].time = time;
 				dst++;
 			}
-			disp->tx_buf[dst].type = EV_SYN;
-			disp->tx_buf[dst].code = disp->buffer[src].code;
-			disp->tx_buf[dst].v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].evt.type = EV_SYN;
+			disp->tx_buf[dst].evt.code = disp->buffer[src].code;
+			disp->tx_buf[dst].evt.v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].time = time;
 			dst++;
 			break;
 		case EV_MSC:
@@ -699,24 +924,27 @@ static void event_proc(struct input_display *disp, struct input_event *evts,
 		case EV_LED:
 			break;
 		case EV_KEY:
-			disp->tx_buf[dst].type = EV_KEY;
-			disp->tx_buf[dst].code = disp->buffer[src].code;
-			disp->tx_buf[dst].v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].evt.type = EV_KEY;
+			disp->tx_buf[dst].evt.code = disp->buffer[src].code;
+			disp->tx_buf[dst].evt.v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].time = time;
 			dst++;
 			break;
 		case EV_REP:
-			disp->tx_buf[dst].type = EV_REP;
-			disp->tx_buf[dst].code = disp->buffer[src].code;
-			disp->tx_buf[dst].v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].evt.type = EV_REP;
+			disp->tx_buf[dst].evt.code = disp->buffer[src].code;
+			disp->tx_buf[dst].evt.v.value = disp->buffer[src].value;
+			disp->tx_buf[dst].time = time;
 			dst++;
 			break;
 		case EV_REL:
 			switch (disp->buffer[src].code) {
 			case REL_WHEEL:
-				disp->tx_buf[dst].type = EV_REL;
-				disp->tx_buf[dst].code = REL_WHEEL;
-				disp->tx_buf[dst].v.value =
+				disp->tx_buf[dst].evt.type = EV_REL;
+				disp->tx_buf[dst].evt.code = REL_WHEEL;
+				disp->tx_buf[dst].evt.v.value =
 					disp->buffer[src].value;
+				disp->tx_buf[dst].time = time;
 				dst++;
 				break;
 			case REL_X:
@@ -735,10 +963,7 @@ static void event_proc(struct input_display *disp, struct input_event *evts,
 	}
 
 	list_for_each_entry(client, &disp->clients, link) {
-		u32 len = sizeof(struct clv_input_event) * dst;
-		clv_send(client->sock, &len, sizeof(u32));
-		/* send raw event */
-		clv_send(client->sock, disp->tx_buf, len);
+		input_client_send(client, disp->tx_buf, dst);
 	}
 }
 
@@ -762,6 +987,7 @@ static void add_input_device(struct input_display *disp, const char *devpath)
 	struct input_device *dev, *b;
 	enum input_type type;
 	s32 fd;
+	s32 clk_id = CLOCK_MONOTONIC;
 	char cmd[64];
 
 	type = test_dev(devpath);
@@ -788,6 +1014,11 @@ static void add_input_device(struct input_display *disp, const char *devpath)
 		}
 	}
 
+	/* time stamp the events like the clients' clock_gettime() */
+	if (ioctl(fd, EVIOCSCLOCKID, &clk_id) < 0)
+		clv_warn("failed to set monotonic clock of %s, %s", devpath,
+			 strerror(errno));
+
 	dev = calloc(1, sizeof(*dev));
 	if (!dev)
 		return;
@@ -862,19 +1093,59 @@ static s32 timeout_proc(void *data)
 	return 0;
 }
 
+static s32 motion_flush_proc(void *data)
+{
+	struct input_display *disp = data;
+	struct input_client *client;
+	s32 give_up, rearm = 0;
+
+	clv_event_source_timer_update(disp->motion_source, 0, 0);
+	give_up = ++disp->motion_retries >= MOTION_FLUSH_RETRIES;
+	list_for_each_entry(client, &disp->clients, link) {
+		if (client->use_ring)
+			clv_input_ring_flush(&client->ring);
+		if (client->has_motion
+		    && (give_up || !input_client_busy(client)))
+			input_client_flush_motion(client);
+		/* a ring keeps what it holds until the next push */
+		if (client->has_motion || input_client_held(client))
+			rearm = 1;
+	}
+
+	if (rearm && !give_up) {
+		disp->motion_flush_ms <<= 1;
+		clv_event_source_timer_update(disp->motion_source,
+					      disp->motion_flush_ms, 0);
+	}
+
+	return 0;
+}
+
 static void schedule_repaint_cursor(struct input_display *disp)
 {
 	clv_event_source_timer_update(disp->repaint_source, 1, 0);
 }
 
+static void publish_cursor_state(struct input_display *disp)
+{
+	if (!disp->cursor_state)
+		return;
+
+	clv_cursor_state_write(disp->cursor_state,
+			       disp->screen_x, disp->screen_y,
+			       disp->hot_x, disp->hot_y);
+}
+
 static void redraw_cursor(struct input_display *disp, s32 damage, u8 *data,
 			  u32 w, u32 h)
 {
 	struct shm_buf *buffer;
 	u8 *dst;
-	s32 i;
 	u32 width, height;
 
+	/* the compositor picks the position up even if the commit waits */
+	publish_cursor_state(disp);
+
 	if (!damage && disp->repaint_damage)
 		damage = 1;
 	//clv_debug("redraw_cursor damage: %d, data: %p, disp: %p",
@@ -884,15 +1155,20 @@ static void redraw_cursor(struct input_display *disp, s32 damage, u8 *data,
 		if (data) {
 			//clv_debug("copy info cursor buf %lu", buffer->id);
 			dst = buffer->shm.map;
-			memset(dst, 0, buffer->stride * buffer->h);
 			width = MIN(w, 64);
 			width = MIN(width, buffer->w);
 			height = MIN(h, 64);
 			height = MIN(height, buffer->h);
-			for (i = 0; i < height; i++) {
-				memcpy(dst, data + i * w * 4, width * 4);
-				dst += buffer->stride;
-			}
+			/* only clear what the image does not cover */
+			clv_pixel_copy_rect(dst, buffer->stride, data, w * 4,
+					    width * 4, height);
+			if (width < buffer->w)
+				clv_pixel_fill32(dst + width * 4,
+						 buffer->stride,
+						 buffer->w - width, height, 0);
+			clv_pixel_fill32(dst + height * buffer->stride,
+					 buffer->stride, buffer->w,
+					 buffer->h - height, 0);
 		}
 	} else {
 		buffer = &disp->bufs[1 - disp->back_buf];
@@ -940,6 +1216,7 @@ static void redraw_cursor(struct input_display *disp, s32 damage, u8 *data,
 		disp->hot_x = disp->hot_x_pending;
 		disp->hot_y = disp->hot_y_pending;
 		disp->hot_x_pending = disp->hot_y_pending = 0;
+		publish_cursor_state(disp);
 	}
 
 	disp->c.view_x = disp->screen_x;
@@ -1053,6 +1330,8 @@ static s32 clv_event_proc(s32 fd, u32 mask, void *data)
 				return -1;
 			}
 			disp->s.surface_id = id;
+			disp->v.surface_id = id;
+			disp->c.surface_id = id;
 			clv_debug("create surface ok, surface_id = 0x%08lX",
 				  disp->s.surface_id);
 			(void)clv_dup_create_view_cmd(
@@ -1284,6 +1563,14 @@ static struct input_display *input_display_create(void)
 	disp->accel_fac = (float *)disp->accel_fac_shm.map;
 	*disp->accel_fac = 1.0f;
 
+	/* created by the compositor, which is up before the input server */
+	if (clv_shm_init(&disp->cursor_state_shm, CLV_CURSOR_STATE_SHM,
+			 sizeof(struct clv_cursor_state), 0) < 0) {
+		clv_warn("no cursor state page, position is only committed.");
+	} else {
+		disp->cursor_state = disp->cursor_state_shm.map;
+	}
+
 	disp->buffer_sz = sizeof(struct input_event) * 1024;
 	disp->buffer = (struct input_event *)malloc(disp->buffer_sz);
 	if (!disp->buffer)
@@ -1291,11 +1578,15 @@ static struct input_display *input_display_create(void)
 
 	memset(disp->buffer, 0, disp->buffer_sz);
 
-	disp->tx_buf_sz = sizeof(struct clv_input_event) * 1024;
-	disp->tx_buf = (struct clv_input_event *)malloc(disp->tx_buf_sz);
+	disp->tx_buf_sz = sizeof(struct clv_input_event_ts) * 1024;
+	disp->tx_buf = (struct clv_input_event_ts *)malloc(disp->tx_buf_sz);
 	if (!disp->tx_buf)
 		goto err;
 
+	disp->tx_legacy = calloc(1024, sizeof(struct clv_input_event));
+	if (!disp->tx_legacy)
+		goto err;
+
 	memset(disp->tx_buf, 0, disp->tx_buf_sz);
 
 	disp->loop = clv_event_loop_create();
@@ -1332,6 +1623,11 @@ static struct input_display *input_display_create(void)
 	if (!disp->timeout_source)
 		goto err;
 
+	disp->motion_source = clv_event_loop_add_timer(disp->loop,
+						       motion_flush_proc, disp);
+	if (!disp->motion_source)
+		goto err;
+
 	INIT_LIST_HEAD(&disp->devs);
 
 	disp->clv_sock = clv_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <assert.h>
+#include <linux/input.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_ipc.h>
+#include <clover_event.h>
+#include <clover_protocal.h>
+#include <clover_input_ring.h>
+
+/* as many as the input server sends at once */
+#define MAX_EVTS 1024
+
+void usage(void)
+{
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "clover_input_monitor\n");
+	fprintf(stderr, "\tPrint the events of the input server.\n");
+	fprintf(stderr, "clover_input_monitor --timestamp\n");
+	fprintf(stderr, "\tPrint the events with their latency.\n");
+	fprintf(stderr, "clover_input_monitor --ring[=size]\n");
+	fprintf(stderr, "\tRead the events from a shared memory ring of size "
+			"records,\n");
+	fprintf(stderr, "\twith their latency.\n");
+}
+
+static struct option monitor_options[] = {
+	{"timestamp", 0, NULL, 't'},
+	{"ring", 2, NULL, 'r'},
+	{0, 0, NULL, 0},
+};
+
+static char monitor_short_options[] = "tr::";
+
+struct monitor_obj {
+	s32 sock;
+	struct input_cmd cmd;
+	struct clv_event_loop *loop;
+	struct clv_event_source *source;
+	struct clv_event_source *ring_source;
+	struct clv_input_ring ring;
+	s32 use_ring;
+	s32 use_ts;
+	u64 overflow, coalesced;
+	u8 *rx_buf;
+	s32 run;
+};
+
+static u64 now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+/* latency in us, negative if the event has no timestamp */
+static void print_event(struct clv_input_event *evt, s64 latency)
+{
+	switch (evt->type) {
+	case EV_SYN:
+		printf("SYN");
+		break;
+	case EV_KEY:
+		printf("KEY %u %u", evt->code, evt->v.value);
+		break;
+	case EV_REP:
+		printf("REP %u %u", evt->code, evt->v.value);
+		break;
+	case EV_REL:
+		printf("REL %u %d", evt->code, (s32)evt->v.value);
+		break;
+	case EV_ABS:
+		printf("MOTION %u,%u %d,%d", evt->v.pos.x, evt->v.pos.y,
+		       evt->v.pos.dx, evt->v.pos.dy);
+		break;
+	default:
+		printf("type %u code %u value 0x%08X", evt->type, evt->code,
+		       evt->v.value);
+		break;
+	}
+
+	if (latency >= 0)
+		printf(" (%lld us)", (long long)latency);
+	printf("\n");
+}
+
+static s32 ring_cb(s32 fd, u32 mask, void *data)
+{
+	struct monitor_obj *mo = data;
+	struct clv_input_event_ts *evts;
+	u32 n, i;
+	u64 now;
+
+	evts = (struct clv_input_event_ts *)mo->rx_buf;
+	clv_input_ring_clear_doorbell(&mo->ring);
+	while ((n = clv_input_ring_pop(&mo->ring, evts, MAX_EVTS))) {
+		now = now_us();
+		for (i = 0; i < n; i++)
+			print_event(&evts[i].evt, now - evts[i].time);
+	}
+
+	if (mo->ring.shared->overflow != mo->overflow
+	    || mo->ring.shared->coalesced != mo->coalesced) {
+		mo->overflow = mo->ring.shared->overflow;
+		mo->coalesced = mo->ring.shared->coalesced;
+		printf("ring overflow %llu coalesced %llu\n",
+		       (unsigned long long)mo->overflow,
+		       (unsigned long long)mo->coalesced);
+	}
+
+	return 0;
+}
+
+static s32 ring_handover(struct monitor_obj *mo)
+{
+	s32 fd, efd;
+
+	fd = clv_recv_fd(mo->sock);
+	if (fd < 0)
+		return -1;
+
+	efd = clv_recv_fd(mo->sock);
+	if (efd < 0) {
+		close(fd);
+		return -1;
+	}
+
+	if (clv_input_ring_map(&mo->ring, fd, efd) < 0)
+		return -1;
+
+	mo->ring_source = clv_event_loop_add_fd(mo->loop, efd,
+						CLV_EVT_READABLE, ring_cb, mo);
+	if (!mo->ring_source) {
+		clv_input_ring_release(&mo->ring);
+		return -1;
+	}
+
+	/* events may have been queued before the doorbell was watched */
+	mo->use_ring = 1;
+	ring_cb(efd, CLV_EVT_READABLE, mo);
+
+	return 0;
+}
+
+static s32 sock_cb(s32 fd, u32 mask, void *data)
+{
+	struct monitor_obj *mo = data;
+	struct clv_input_event_ts *evt_ts;
+	u32 len, rec_size, i;
+	u64 now;
+
+	if (clv_recv(fd, &len, sizeof(len)) < 0)
+		goto err;
+
+	if (len == CLV_INPUT_RING_HANDOVER) {
+		if (ring_handover(mo) < 0) {
+			fprintf(stderr, "failed to map input ring\n");
+			goto err;
+		}
+		printf("switched to ring, %u records\n", mo->ring.mask + 1);
+		return 0;
+	}
+
+	if (len == CLV_INPUT_TIMESTAMP_SWITCH) {
+		if (clv_recv(fd, &rec_size, sizeof(rec_size)) < 0)
+			goto err;
+		if (rec_size != sizeof(struct clv_input_event_ts)) {
+			fprintf(stderr, "unknown input record size %u\n",
+				rec_size);
+			goto err;
+		}
+		mo->use_ts = 1;
+		return 0;
+	}
+
+	rec_size = mo->use_ts ? sizeof(struct clv_input_event_ts)
+			      : sizeof(struct clv_input_event);
+	if (len > MAX_EVTS * sizeof(struct clv_input_event_ts)
+	    || len % rec_size) {
+		fprintf(stderr, "illegal event batch length %u\n", len);
+		goto err;
+	}
+
+	if (clv_recv(fd, mo->rx_buf, len) < 0)
+		goto err;
+
+	now = now_us();
+	for (i = 0; i < len / rec_size; i++) {
+		if (mo->use_ts) {
+			evt_ts = (struct clv_input_event_ts *)mo->rx_buf + i;
+			print_event(&evt_ts->evt, now - evt_ts->time);
+		} else {
+			print_event((struct clv_input_event *)mo->rx_buf + i,
+				    -1);
+		}
+	}
+
+	return 0;
+
+err:
+	fprintf(stderr, "input server exit.\n");
+	mo->run = 0;
+	return -1;
+}
+
+s32 main(s32 argc, char **argv)
+{
+	s32 ch;
+	struct monitor_obj mo;
+
+	memset(&mo, 0, sizeof(mo));
+	while ((ch = getopt_long(argc, argv, monitor_short_options,
+				 monitor_options, NULL)) != -1) {
+		switch (ch) {
+		case 't':
+			mo.cmd.type = INPUT_CMD_TYPE_SUBSCRIBE_TIMESTAMP;
+			break;
+		case 'r':
+			mo.cmd.type = INPUT_CMD_TYPE_SUBSCRIBE_RING;
+			if (optarg)
+				mo.cmd.c.ring.size = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	mo.rx_buf = malloc(MAX_EVTS * sizeof(struct clv_input_event_ts));
+	if (!mo.rx_buf)
+		exit(1);
+
+	mo.loop = clv_event_loop_create();
+	assert(mo.loop);
+
+	mo.sock = clv_socket_cloexec(PF_LOCAL, SOCK_STREAM, 0);
+	if (clv_socket_connect(mo.sock, "/tmp/CLV_INPUT_SERVER") < 0) {
+		fprintf(stderr, "failed to connect input server\n");
+		exit(1);
+	}
+
+	if (mo.cmd.type != INPUT_CMD_TYPE_UNKNOWN
+	    && clv_send(mo.sock, &mo.cmd, sizeof(mo.cmd)) < 0) {
+		fprintf(stderr, "failed to subscribe\n");
+		exit(1);
+	}
+
+	mo.source = clv_event_loop_add_fd(mo.loop, mo.sock, CLV_EVT_READABLE,
+					  sock_cb, &mo);
+
+	mo.run = 1;
+	while (mo.run) {
+		clv_event_loop_dispatch(mo.loop, -1);
+	}
+
+	if (mo.use_ring) {
+		clv_event_source_remove(mo.ring_source);
+		clv_input_ring_release(&mo.ring);
+	}
+	clv_event_source_remove(mo.source);
+	clv_event_loop_destroy(mo.loop);
+
+	close(mo.sock);
+	free(mo.rx_buf);
+	return 0;
+}
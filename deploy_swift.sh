@@ -20,6 +20,7 @@ if [ -d "$1/out/for_deploy" ]; then
 	cp server/compositor/drm_backend/libclover_drm_backend.so $1/out/for_deploy/usr/lib
 	cp server/renderer/libclover_renderer.so $1/out/for_deploy/usr/lib
 	cp server/renderer/gl_renderer/libclover_gl_renderer.so $1/out/for_deploy/usr/lib
+	cp server/renderer/sw_renderer/libclover_sw_renderer.so $1/out/for_deploy/usr/lib
 	rm -rf $1/out/for_deploy/etc
 	mkdir -p $1/out/for_deploy/etc
 	cp clover_extended.xml $1/out/for_deploy/etc
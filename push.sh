@@ -11,6 +11,7 @@ adb push server/compositor/libclover_compositor.so /tmp/
 adb push server/compositor/drm_backend/libclover_drm_backend.so /tmp/
 adb push server/renderer/libclover_renderer.so /tmp/
 adb push server/renderer/gl_renderer/libclover_gl_renderer.so /tmp/
+adb push server/renderer/sw_renderer/libclover_sw_renderer.so /tmp/
 adb push clover_extended.xml /tmp/
 adb push clover_duplicated.xml /tmp/
 adb push set_rk3399_env /tmp/
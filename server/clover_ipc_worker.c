@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2019 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_ipc.h>
+#include <clover_event.h>
+#include <clover_protocal.h>
+#include <clover_compositor.h>
+#include "clover_ipc_worker.h"
+
+static u8 ipc_dbg = 0;
+
+#define ipc_debug(fmt, ...) do { \
+	if (ipc_dbg >= 3) { \
+		clv_debug("[IPC ] " fmt, ##__VA_ARGS__); \
+	} \
+} while (0);
+
+#define ipc_info(fmt, ...) do { \
+	if (ipc_dbg >= 2) { \
+		clv_info("[IPC ] " fmt, ##__VA_ARGS__); \
+	} \
+} while (0);
+
+#define ipc_err(fmt, ...) do { \
+	clv_err("[IPC ] " fmt, ##__VA_ARGS__); \
+} while (0);
+
+void clv_ipc_worker_set_dbg(u32 flags)
+{
+	ipc_dbg = flags & 0x0F;
+}
+
+static struct clv_ipc_msg *ipc_msg_alloc(struct clv_ipc_link *link,
+					 enum clv_ipc_msg_type type)
+{
+	struct clv_ipc_msg *msg = calloc(1, sizeof(*msg));
+
+	assert(msg);
+	msg->type = type;
+	msg->link = link;
+	msg->dmabuf_fd = -1;
+	return msg;
+}
+
+void clv_ipc_msg_free(struct clv_ipc_msg *msg)
+{
+	if (msg->dmabuf_fd >= 0)
+		close(msg->dmabuf_fd);
+	if (msg->shm_buf)
+		shm_buffer_destroy(msg->shm_buf);
+	free(msg->tx_data);
+	free(msg);
+}
+
+static void main_work_cb(struct clv_event_work *work, void *data);
+static void worker_work_cb(struct clv_event_work *work, void *data);
+
+static void post_to_main(struct clv_ipc_worker *w, struct clv_ipc_msg *msg)
+{
+	msg->work.cb = main_work_cb;
+	clv_event_source_queue_post(w->to_main, &msg->work);
+}
+
+static void post_to_worker(struct clv_ipc_worker *w, struct clv_ipc_msg *msg)
+{
+	msg->work.cb = worker_work_cb;
+	clv_event_source_queue_post(w->to_worker, &msg->work);
+}
+
+/* worker thread: stop reading the link, the compositor gets a HANGUP */
+static void link_hangup(struct clv_ipc_link *link)
+{
+	if (!link->source)
+		return;
+
+	clv_event_source_remove(link->source);
+	link->source = NULL;
+	post_to_main(link->worker, ipc_msg_alloc(link, CLV_IPC_MSG_HANGUP));
+}
+
+static s32 link_decode(struct clv_ipc_link *link, struct clv_ipc_msg *msg,
+		       u32 n)
+{
+	u8 *buf = link->rx_buf;
+	u32 flag = *((u32 *)buf);
+	enum clv_cmd_shift shift;
+	void *payload;
+
+	msg->flag = flag;
+	if (flag & (1 << CLV_CMD_CREATE_SURFACE_SHIFT)) {
+		shift = CLV_CMD_CREATE_SURFACE_SHIFT;
+		payload = &msg->u.si;
+	} else if (flag & (1 << CLV_CMD_CREATE_VIEW_SHIFT)) {
+		shift = CLV_CMD_CREATE_VIEW_SHIFT;
+		payload = &msg->u.vi;
+	} else if (flag & (1 << CLV_CMD_CREATE_BO_SHIFT)) {
+		shift = CLV_CMD_CREATE_BO_SHIFT;
+		payload = &msg->u.bi;
+	} else if (flag & (1 << CLV_CMD_DESTROY_BO_SHIFT)) {
+		shift = CLV_CMD_DESTROY_BO_SHIFT;
+		payload = &msg->u.id;
+	} else if (flag & (1 << CLV_CMD_FRAME_SHIFT)) {
+		shift = CLV_CMD_FRAME_SHIFT;
+		payload = &msg->u.id;
+	} else if (flag & (1 << CLV_CMD_COMMIT_SHIFT)) {
+		shift = CLV_CMD_COMMIT_SHIFT;
+		payload = &msg->u.ci;
+	} else if (flag & (1 << CLV_CMD_TRANSACTION_SHIFT)) {
+		shift = CLV_CMD_TRANSACTION_SHIFT;
+		payload = &msg->u.ti;
+	} else if (flag & (1 << CLV_CMD_SHELL_SHIFT)) {
+		shift = CLV_CMD_SHELL_SHIFT;
+		payload = &msg->u.shell;
+	} else {
+		ipc_err("unknown command 0x%08X", flag);
+		return 1;
+	}
+
+	/* an id stays 0 if its command is malformed */
+	msg->ret = clv_cmd_decode(buf, n, shift, payload);
+	if (msg->ret < 0 || shift != CLV_CMD_CREATE_BO_SHIFT)
+		return 0;
+
+	if (msg->u.bi.type == CLV_BUF_TYPE_SHM) {
+		/* map the shared memory off the compositor thread */
+		msg->shm_buf = shm_buffer_create(&msg->u.bi);
+		assert(msg->shm_buf);
+	} else if (msg->u.bi.type == CLV_BUF_TYPE_DMA) {
+		msg->dmabuf_fd = clv_recv_fd(link->sock);
+		ipc_debug("receive dma buf fd %d", msg->dmabuf_fd);
+		if (msg->dmabuf_fd < 0) {
+			ipc_err("dmabuf illegal %d", msg->dmabuf_fd);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static s32 link_sock_cb(s32 fd, u32 mask, void *data)
+{
+	struct clv_ipc_link *link = data;
+	struct clv_ipc_msg *msg;
+	struct clv_tlv *tlv;
+	u8 *rx_p;
+	s32 ret;
+	u8 peek;
+
+	/*
+	 * The link is edge triggered, we are called until all the pending
+	 * commands are consumed.
+	 */
+	ret = recv(fd, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return CLV_EVT_DRAINED;
+
+	ret = clv_recv(fd, link->rx_buf, sizeof(*tlv) + sizeof(u32));
+	if (ret < 0) {
+		if (ret == -1) {
+			ipc_info("client exit.");
+		} else {
+			ipc_err("failed to receive client cmd");
+		}
+		link_hangup(link);
+		return -1;
+	}
+
+	tlv = (struct clv_tlv *)(link->rx_buf + sizeof(u32));
+	if (tlv->length > link->rx_buf_sz - sizeof(*tlv) - sizeof(u32)) {
+		ipc_err("command too long %u", tlv->length);
+		link_hangup(link);
+		return -1;
+	}
+
+	rx_p = link->rx_buf + sizeof(u32) + sizeof(*tlv);
+	ret = clv_recv(fd, rx_p, tlv->length);
+	if (ret < 0) {
+		if (ret == -1) {
+			ipc_info("client exit.");
+		} else {
+			ipc_err("failed to receive client cmd");
+		}
+		link_hangup(link);
+		return -1;
+	}
+
+	if (tlv->tag != CLV_TAG_WIN) {
+		ipc_err("invalid TAG, not a win. 0x%08X", tlv->tag);
+		return -1;
+	}
+
+	msg = ipc_msg_alloc(link, CLV_IPC_MSG_CMD);
+	ret = link_decode(link, msg, sizeof(u32) + sizeof(*tlv) + tlv->length);
+	if (ret) {
+		clv_ipc_msg_free(msg);
+		if (ret < 0)
+			link_hangup(link);
+		return -1;
+	}
+
+	post_to_main(link->worker, msg);
+	return CLV_EVT_AGAIN;
+}
+
+static s32 link_tx_cb(s32 fd, u32 mask, void *data);
+
+/* worker thread: write what the socket takes, watch it for the rest */
+static void link_flush(struct clv_ipc_link *link)
+{
+	ssize_t ret;
+
+	while (link->tx_len) {
+		ret = send(link->sock, link->tx_buf, link->tx_len,
+			   MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			ipc_info("failed to send to client. %m");
+			link->tx_len = 0;
+			link_hangup(link);
+			break;
+		}
+		link->tx_len -= ret;
+		memmove(link->tx_buf, link->tx_buf + ret, link->tx_len);
+	}
+
+	if (link->tx_len && !link->tx_source) {
+		link->tx_source = clv_event_loop_add_fd(link->worker->loop,
+							link->sock,
+							CLV_EVT_WRITABLE,
+							link_tx_cb, link);
+		assert(link->tx_source);
+	} else if (!link->tx_len && link->tx_source) {
+		clv_event_source_remove(link->tx_source);
+		link->tx_source = NULL;
+	}
+}
+
+static s32 link_tx_cb(s32 fd, u32 mask, void *data)
+{
+	link_flush(data);
+	return 0;
+}
+
+/* worker thread */
+static void link_send(struct clv_ipc_link *link, u8 *data, u32 n)
+{
+	u32 cap = link->tx_cap;
+	u8 *p;
+
+	/* nobody is listening any more */
+	if (!link->source)
+		return;
+
+	if (link->tx_len + n > CLV_IPC_TX_MAX) {
+		ipc_err("client does not read, %u bytes left", link->tx_len);
+		link->tx_len = 0;
+		link_hangup(link);
+		return;
+	}
+
+	if (link->tx_len + n > cap) {
+		if (!cap)
+			cap = 1024;
+		while (cap < link->tx_len + n)
+			cap <<= 1;
+		p = realloc(link->tx_buf, cap);
+		assert(p);
+		link->tx_buf = p;
+		link->tx_cap = cap;
+	}
+
+	memcpy(link->tx_buf + link->tx_len, data, n);
+	link->tx_len += n;
+	link_flush(link);
+}
+
+static s32 server_sock_cb(s32 fd, u32 mask, void *data)
+{
+	struct clv_ipc_worker *w = data;
+	struct clv_ipc_link *link;
+	s32 sock;
+
+	sock = clv_socket_accept(fd);
+	if (sock < 0) {
+		ipc_err("failed to accept client");
+		return -1;
+	}
+
+	link = calloc(1, sizeof(*link));
+	assert(link);
+	link->worker = w;
+	link->sock = sock;
+	link->rx_buf_sz = 32 * 1024;
+	link->rx_buf = malloc(link->rx_buf_sz);
+	assert(link->rx_buf);
+	link->source = clv_event_loop_add_fd(w->loop, sock,
+					     CLV_EVT_READABLE | CLV_EVT_EDGE,
+					     link_sock_cb, link);
+	assert(link->source);
+
+	ipc_info("a new client connected. sock = %d", sock);
+	post_to_main(w, ipc_msg_alloc(link, CLV_IPC_MSG_LINKUP));
+
+	return 0;
+}
+
+/* worker thread: the agent is gone, close the link */
+static void link_close(struct clv_ipc_link *link)
+{
+	struct clv_ipc_worker *w = link->worker;
+
+	if (link->source) {
+		clv_event_source_remove(link->source);
+		link->source = NULL;
+	}
+	if (link->tx_source) {
+		clv_event_source_remove(link->tx_source);
+		link->tx_source = NULL;
+	}
+	close(link->sock);
+	link->sock = -1;
+	free(link->rx_buf);
+	link->rx_buf = NULL;
+	free(link->tx_buf);
+	link->tx_buf = NULL;
+	link->tx_len = link->tx_cap = 0;
+	post_to_main(w, ipc_msg_alloc(link, CLV_IPC_MSG_RELEASED));
+}
+
+/* worker thread */
+static void worker_work_cb(struct clv_event_work *work, void *data)
+{
+	struct clv_ipc_worker *w = data;
+	struct clv_ipc_msg *msg = container_of(work, struct clv_ipc_msg, work);
+
+	if (msg->type == CLV_IPC_MSG_SEND)
+		link_send(msg->link, msg->tx_data, msg->tx_len);
+	else if (msg->type == CLV_IPC_MSG_CLOSE)
+		link_close(msg->link);
+	else if (msg->type == CLV_IPC_MSG_QUIT)
+		w->exit = 1;
+	free(msg->tx_data);
+	free(msg);
+}
+
+/* compositor thread */
+static void main_work_cb(struct clv_event_work *work, void *data)
+{
+	struct clv_ipc_worker *w = data;
+	struct clv_ipc_msg *msg = container_of(work, struct clv_ipc_msg, work);
+
+	if (msg->type == CLV_IPC_MSG_RELEASED) {
+		free(msg->link);
+		free(msg);
+		return;
+	}
+
+	if (msg->type == CLV_IPC_MSG_HANGUP && msg->link->agent) {
+		/* the destroy listener asks the worker to close */
+		client_agent_destroy(msg->link->agent);
+		free(msg);
+		return;
+	}
+
+	if (msg->type == CLV_IPC_MSG_LINKUP || msg->link->agent) {
+		w->msg_cb(msg, w->msg_cb_data);
+		return;
+	}
+
+	/* the agent was destroyed while the message was queued */
+	clv_ipc_msg_free(msg);
+}
+
+static void *ipc_worker_proc(void *data)
+{
+	struct clv_ipc_worker *w = data;
+	sigset_t set;
+
+	/* signals are handled by the compositor loop */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (!w->exit)
+		clv_event_loop_dispatch_all(w->loop, -1);
+
+	return NULL;
+}
+
+static void agent_destroy_cb(struct clv_listener *listener, void *data)
+{
+	struct clv_ipc_link *link = container_of(listener,
+						 struct clv_ipc_link,
+						 agent_destroy_listener);
+	struct clv_ipc_worker *w = link->worker;
+
+	link->agent = NULL;
+	if (w->running) {
+		post_to_worker(w, ipc_msg_alloc(link, CLV_IPC_MSG_CLOSE));
+		return;
+	}
+
+	/* the worker has stopped, the link is ours */
+	if (link->sock >= 0)
+		close(link->sock);
+	free(link->rx_buf);
+	free(link->tx_buf);
+	free(link);
+}
+
+/* compositor thread: hand a copy of the command to the worker */
+static s32 agent_send(void *data, u8 *buf, u32 n)
+{
+	struct clv_ipc_link *link = data;
+	struct clv_ipc_worker *w = link->worker;
+	struct clv_ipc_msg *msg;
+
+	if (!w->running)
+		return -1;
+
+	msg = ipc_msg_alloc(link, CLV_IPC_MSG_SEND);
+	msg->tx_data = malloc(n);
+	assert(msg->tx_data);
+	memcpy(msg->tx_data, buf, n);
+	msg->tx_len = n;
+	post_to_worker(w, msg);
+
+	return 0;
+}
+
+void clv_ipc_link_set_agent(struct clv_ipc_link *link,
+			    struct clv_client_agent *agent)
+{
+	agent->send = agent_send;
+	agent->send_data = link;
+	link->agent = agent;
+	link->agent_destroy_listener.notify = agent_destroy_cb;
+	clv_signal_add(&agent->destroy_signal, &link->agent_destroy_listener);
+}
+
+struct clv_ipc_worker *clv_ipc_worker_create(struct clv_event_loop *main_loop,
+					     s32 server_sock,
+					     clv_ipc_msg_cb_t msg_cb,
+					     void *data)
+{
+	struct clv_ipc_worker *w;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+
+	w->server_sock = server_sock;
+	w->msg_cb = msg_cb;
+	w->msg_cb_data = data;
+
+	w->loop = clv_event_loop_create();
+	if (!w->loop)
+		goto error;
+
+	w->to_worker = clv_event_loop_add_queue(w->loop, w);
+	if (!w->to_worker)
+		goto error;
+
+	w->to_main = clv_event_loop_add_queue(main_loop, w);
+	if (!w->to_main)
+		goto error;
+
+	w->server_source = clv_event_loop_add_fd(w->loop, server_sock,
+						 CLV_EVT_READABLE,
+						 server_sock_cb, w);
+	if (!w->server_source)
+		goto error;
+
+	w->running = 1;
+	if (pthread_create(&w->tid, NULL, ipc_worker_proc, w)) {
+		ipc_err("failed to create IPC worker thread");
+		w->running = 0;
+		goto error;
+	}
+
+	return w;
+
+error:
+	ipc_err("failed to create IPC worker");
+	if (w->server_source)
+		clv_event_source_remove(w->server_source);
+	if (w->to_main)
+		clv_event_source_remove(w->to_main);
+	if (w->to_worker)
+		clv_event_source_remove(w->to_worker);
+	if (w->loop)
+		clv_event_loop_destroy(w->loop);
+	free(w);
+	return NULL;
+}
+
+void clv_ipc_worker_destroy(struct clv_ipc_worker *w)
+{
+	struct clv_event_work *work;
+	struct clv_ipc_msg *msg;
+
+	post_to_worker(w, ipc_msg_alloc(NULL, CLV_IPC_MSG_QUIT));
+	pthread_join(w->tid, NULL);
+	w->running = 0;
+
+	/*
+	 * The agents are destroyed ahead of the worker, what is left are the
+	 * links nobody has taken yet and the messages of dead links.
+	 */
+	while ((work = clv_event_source_queue_take(w->to_worker))) {
+		msg = container_of(work, struct clv_ipc_msg, work);
+		if (msg->type == CLV_IPC_MSG_CLOSE)
+			link_close(msg->link);
+		free(msg->tx_data);
+		free(msg);
+	}
+	while ((work = clv_event_source_queue_take(w->to_main))) {
+		msg = container_of(work, struct clv_ipc_msg, work);
+		if (msg->type == CLV_IPC_MSG_RELEASED) {
+			free(msg->link);
+		} else if (msg->type == CLV_IPC_MSG_LINKUP) {
+			link_close(msg->link);
+		}
+		clv_ipc_msg_free(msg);
+	}
+
+	clv_event_source_remove(w->server_source);
+	clv_event_source_remove(w->to_worker);
+	clv_event_source_remove(w->to_main);
+	clv_event_loop_destroy(w->loop);
+	free(w);
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2019 Ruinan Duan, duanruinan@zoho.com 
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+#ifndef CLOVER_IPC_WORKER_H
+#define CLOVER_IPC_WORKER_H
+
+#include <pthread.h>
+#include <clover_utils.h>
+#include <clover_event.h>
+#include <clover_protocal.h>
+#include <clover_compositor.h>
+
+/*
+ * The IPC worker runs its own event loop on its own thread. It accepts the
+ * client links, receives the commands with their fds, decodes them and
+ * maps the SHM buffers. The decoded commands are handed to the compositor
+ * thread through a work queue source of the compositor's loop.
+ *
+ * A link is always freed on the compositor thread, by the RELEASED message
+ * the worker sends once it has closed the socket. Messages of the link which
+ * were queued before are therefore never left with a dangling link.
+ *
+ * The commands sent to the client go the other way, as SEND messages. The
+ * worker writes them without blocking and keeps what the socket does not
+ * take until it is writable again. A client which lets more than
+ * CLV_IPC_TX_MAX bytes pile up is hung up.
+ */
+
+#define CLV_IPC_TX_MAX (256 * 1024)
+
+enum clv_ipc_msg_type {
+	/* worker -> compositor */
+	CLV_IPC_MSG_LINKUP = 0,
+	CLV_IPC_MSG_CMD,
+	CLV_IPC_MSG_HANGUP,
+	CLV_IPC_MSG_RELEASED,
+	/* compositor -> worker */
+	CLV_IPC_MSG_SEND,
+	CLV_IPC_MSG_CLOSE,
+	CLV_IPC_MSG_QUIT,
+};
+
+struct clv_ipc_worker;
+
+struct clv_ipc_link {
+	struct clv_ipc_worker *worker;
+	s32 sock;
+
+	/* compositor thread */
+	struct clv_client_agent *agent;
+	struct clv_listener agent_destroy_listener;
+
+	/* worker thread */
+	struct clv_event_source *source;
+	u8 *rx_buf;
+	u32 rx_buf_sz;
+	/* not sent yet, watched by tx_source */
+	struct clv_event_source *tx_source;
+	u8 *tx_buf;
+	u32 tx_len, tx_cap;
+};
+
+struct clv_ipc_msg {
+	struct clv_event_work work;
+	enum clv_ipc_msg_type type;
+	struct clv_ipc_link *link;
+
+	/* CLV_IPC_MSG_CMD */
+	u32 flag; /* command flag of the protocol head */
+	s32 ret; /* < 0 if the command failed to be parsed */
+	union {
+		struct clv_surface_info si;
+		struct clv_view_info vi;
+		struct clv_bo_info bi;
+		struct clv_commit_info ci;
+		struct clv_transaction_info ti;
+		struct clv_shell_info shell;
+		u64 id;
+	} u;
+	s32 dmabuf_fd; /* DMA-BUF BO */
+	struct clv_buffer *shm_buf; /* SHM BO, mapped by the worker */
+
+	/* CLV_IPC_MSG_SEND */
+	u8 *tx_data;
+	u32 tx_len;
+};
+
+typedef void (*clv_ipc_msg_cb_t)(struct clv_ipc_msg *msg, void *data);
+
+struct clv_ipc_worker {
+	pthread_t tid;
+	struct clv_event_loop *loop;
+	s32 exit;
+	s32 running;
+
+	s32 server_sock;
+	struct clv_event_source *server_source;
+
+	/* work queue sources */
+	struct clv_event_source *to_worker;
+	struct clv_event_source *to_main;
+
+	clv_ipc_msg_cb_t msg_cb;
+	void *msg_cb_data;
+};
+
+struct clv_ipc_worker *clv_ipc_worker_create(struct clv_event_loop *main_loop,
+					     s32 server_sock,
+					     clv_ipc_msg_cb_t msg_cb,
+					     void *data);
+void clv_ipc_worker_destroy(struct clv_ipc_worker *w);
+
+/*
+ * Bind a link to the agent created for it. The socket is closed by the
+ * worker once the agent is destroyed.
+ */
+void clv_ipc_link_set_agent(struct clv_ipc_link *link,
+			    struct clv_client_agent *agent);
+
+/* release the resources a message carries, then free it */
+void clv_ipc_msg_free(struct clv_ipc_msg *msg);
+
+void clv_ipc_worker_set_dbg(u32 flags);
+
+#endif
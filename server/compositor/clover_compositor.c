@@ -29,6 +29,7 @@
 #include <clover_event.h>
 #include <clover_signal.h>
 #include <clover_ipc.h>
+#include <clover_pixel.h>
 #include <clover_compositor.h>
 
 #define LIB_NAME "libclover_drm_backend.so"
@@ -158,6 +159,7 @@ void clv_display_destroy(struct clv_display *display)
 struct clv_display *clv_display_create(void)
 {
 	struct clv_display *display;
+	char *batch_value;
 
 	display = calloc(1, sizeof(*display));
 	if (!display)
@@ -167,6 +169,13 @@ struct clv_display *clv_display_create(void)
 	display->loop = clv_event_loop_create();
 	if (!display->loop)
 		goto error;
+
+	batch_value = getenv("CLOVER_EVENT_BATCH");
+	if (batch_value) {
+		if (clv_event_loop_set_batch_size(display->loop,
+						  atoi(batch_value)) < 0)
+			clv_err("illegal CLOVER_EVENT_BATCH %s", batch_value);
+	}
 	
 	return display;
 
@@ -178,7 +187,7 @@ error:
 void clv_display_run(struct clv_display *display)
 {
 	while (!display->exit) {
-		clv_event_loop_dispatch(display->loop, -1);
+		clv_event_loop_dispatch_all(display->loop, -1);
 	}
 }
 
@@ -190,14 +199,27 @@ void clv_display_stop(struct clv_display *display)
 void clv_compositor_destroy(struct clv_compositor *c)
 {
 	struct clv_plane *pl, *next;
+	struct clv_output *output;
 
 	clv_signal_emit(&c->destroy_signal, c);
 
+	list_for_each_entry(output, &c->outputs, link) {
+		if (output->repaint_timer) {
+			clv_event_source_remove(output->repaint_timer);
+			output->repaint_timer = NULL;
+		}
+	}
+
 	if (c->backend) {
 		c->backend->destroy(c);
 		c->backend = NULL;
 	}
 
+	if (c->cursor_state) {
+		clv_shm_release(&c->cursor_state_shm);
+		c->cursor_state = NULL;
+	}
+
 	list_for_each_entry_safe(pl, next, &c->planes, link) {
 		list_del(&pl->link);
 		if (pl != &c->primary_plane) {
@@ -205,6 +227,8 @@ void clv_compositor_destroy(struct clv_compositor *c)
 			free(pl);
 		}
 	}
+
+	clv_arena_release(&c->frame_arena);
 }
 
 static s32 clv_compositor_backend_create(struct clv_compositor *c)
@@ -249,8 +273,6 @@ static void clv_compositor_init_dummy_cursor(struct clv_compositor *c)
 
 static void clv_compositor_init_background(struct clv_compositor *c)
 {
-	u32 *pixel;
-
 	cmp_debug("init background layer...");
 	memset(&c->bg_surf, 0, sizeof(c->bg_surf));
 	c->bg_surf.is_bg = 1;
@@ -286,23 +308,23 @@ static void clv_compositor_init_background(struct clv_compositor *c)
 	unlink(c->bg_buf.base.name);
 	clv_shm_init(&c->bg_buf.shm, c->bg_buf.base.name,
 		     c->bg_buf.base.size, 1);
-	pixel = (u32 *)c->bg_buf.shm.map;
-	for (s32 i = 0; i < c->bg_buf.base.size / 4; i++)
-		pixel[i] = 0xFF404040;
+	clv_pixel_fill32(c->bg_buf.shm.map, c->bg_buf.base.stride,
+			 c->bg_buf.base.w, c->bg_buf.base.h, 0xFF404040);
 
 	c->renderer->attach_buffer(&c->bg_surf, &c->bg_buf.base);
 	c->renderer->flush_damage(&c->bg_surf);
 }
 
 static s32 output_repaint_timer_handler(void *data);
+static void clv_compositor_apply_transactions(struct clv_compositor *c);
+static void clv_output_send_frame_done(struct clv_output *output);
 
 static s32 clover_delay = -11;
 
 struct clv_compositor *clv_compositor_create(struct clv_display *display)
 {
 	struct clv_compositor *c = calloc(1, sizeof(*c));
-	struct clv_event_loop *loop = clv_display_get_event_loop(display);
-	char *delay_value;
+	char *delay_value, *window_value;
 
 	if (!c)
 		return NULL;
@@ -315,14 +337,14 @@ struct clv_compositor *clv_compositor_create(struct clv_display *display)
 	INIT_LIST_HEAD(&c->outputs);
 	INIT_LIST_HEAD(&c->heads);
 	INIT_LIST_HEAD(&c->planes);
+	INIT_LIST_HEAD(&c->transactions);
+
+	clv_arena_init(&c->frame_arena, 4096);
 
 	memset(&c->primary_plane, 0, sizeof(c->primary_plane));
 	strcpy(c->primary_plane.name, "Root");
 	list_add_tail(&c->primary_plane.link, &c->planes);
 
-	c->repaint_timer = clv_event_loop_add_timer(loop,
-					output_repaint_timer_handler, c);
-
 	clv_signal_init(&c->heads_changed_signal);
 
 	if (clv_compositor_backend_create(c) < 0) {
@@ -333,11 +355,28 @@ struct clv_compositor *clv_compositor_create(struct clv_display *display)
 	clv_compositor_init_background(c);
 	//clv_compositor_init_dummy_cursor(c);
 
+	if (clv_shm_init(&c->cursor_state_shm, CLV_CURSOR_STATE_SHM,
+			 sizeof(struct clv_cursor_state), 1) < 0) {
+		cmp_warn("no cursor state page, cursor follows commits only.");
+	} else {
+		c->cursor_state = c->cursor_state_shm.map;
+	}
+
 	delay_value = getenv("CLOVER_DELAY");
 	if (delay_value)
 		clover_delay = atoi(delay_value);
 	clv_debug("CLOVER_DELAY: %d", clover_delay);
 
+	/*
+	 * outputs whose next repaint falls in this window are repainted
+	 * together and submitted in a single atomic commit.
+	 */
+	c->repaint_window_msec = 1;
+	window_value = getenv("CLOVER_REPAINT_WINDOW");
+	if (window_value)
+		c->repaint_window_msec = atoi(window_value);
+	clv_debug("CLOVER_REPAINT_WINDOW: %d", c->repaint_window_msec);
+
 	return c;
 
 error:
@@ -516,18 +555,11 @@ static void idle_repaint(void *data)
 	output->start_repaint_loop(output);
 }
 
-void clv_output_schedule_repaint(struct clv_output *output, s32 cnt)
+static void output_schedule_repaint(struct clv_output *output, s32 cnt)
 {
 	struct clv_compositor *c = output->c;
 	struct clv_event_loop *loop;
 
-	//printf("schedule output[%u]'s repaint\n", output->index);
-	if (!output->enabled) {
-		//cmp_warn("output %u is disabled.!", output->index);
-		return;
-	}
-	cmp_debug("repaint scheduled...");
-	output->primary_dirty = 1;
 	loop = clv_display_get_event_loop(c->display);
 	if (output->repaint_status != REPAINT_NOT_SCHEDULED) {
 		//printf("output[%u]'s repaint already started.\n");
@@ -546,6 +578,30 @@ void clv_output_schedule_repaint(struct clv_output *output, s32 cnt)
 	cmp_debug("repaint loop begin...");
 }
 
+void clv_output_schedule_repaint(struct clv_output *output, s32 cnt)
+{
+	//printf("schedule output[%u]'s repaint\n", output->index);
+	if (!output->enabled) {
+		//cmp_warn("output %u is disabled.!", output->index);
+		return;
+	}
+	cmp_debug("repaint scheduled...");
+	output->primary_dirty = 1;
+	output_schedule_repaint(output, cnt);
+}
+
+/*
+ * Only the cursor moved or changed its image, the primary plane is not
+ * damaged. The backend reuses the current primary fb for such a frame.
+ */
+void clv_output_schedule_cursor_repaint(struct clv_output *output)
+{
+	if (!output->enabled)
+		return;
+	cmp_debug("cursor repaint scheduled...");
+	output_schedule_repaint(output, 1);
+}
+
 void clv_compositor_schedule_repaint(struct clv_compositor *c)
 {
 	struct clv_output *output;
@@ -577,37 +633,97 @@ void clv_view_schedule_repaint(struct clv_view *view)
 	}
 }
 
-static void output_repaint_timer_arm(struct clv_compositor *c)
+void clv_view_schedule_cursor_repaint(struct clv_view *view)
 {
 	struct clv_output *output;
-	s32 any_should_repaint = 0;
+
+	list_for_each_entry(output, &view->surface->c->outputs, link) {
+		if (view->output_mask & (1 << output->index))
+			clv_output_schedule_cursor_repaint(output);
+	}
+}
+
+static const char *repaint_event_names[] = {
+	[CLV_REPAINT_EVT_SCHEDULE] = "SCHEDULE",
+	[CLV_REPAINT_EVT_TIMER] = "TIMER",
+	[CLV_REPAINT_EVT_REPAINT] = "REPAINT",
+	[CLV_REPAINT_EVT_SKIP] = "SKIP",
+	[CLV_REPAINT_EVT_FLUSH] = "FLUSH",
+	[CLV_REPAINT_EVT_CANCEL] = "CANCEL",
+	[CLV_REPAINT_EVT_FLIP] = "FLIP",
+};
+
+static void clv_output_timeline_add(struct clv_output *output,
+				    enum clv_repaint_event event, u32 group)
+{
+	struct clv_repaint_timeline *tl = &output->timeline;
+	struct clv_repaint_timeline_entry *e;
+
+	e = &tl->entries[tl->head];
+	e->event = event;
+	e->group = group;
+	clock_gettime(output->c->clk_id, &e->ts);
+	e->next_repaint = output->next_repaint;
+	tl->head = (tl->head + 1) % CLV_REPAINT_TIMELINE_LEN;
+	if (tl->count < CLV_REPAINT_TIMELINE_LEN)
+		tl->count++;
+}
+
+void clv_output_dump_repaint_timeline(struct clv_output *output, FILE *fp)
+{
+	struct clv_repaint_timeline *tl = &output->timeline;
+	struct clv_repaint_timeline_entry *e;
+	u32 i, index;
+
+	fprintf(fp, "output[%u] repaint timeline (%u events):\n",
+		output->index, tl->count);
+	index = (tl->head + CLV_REPAINT_TIMELINE_LEN - tl->count)
+			% CLV_REPAINT_TIMELINE_LEN;
+	for (i = 0; i < tl->count; i++) {
+		e = &tl->entries[index];
+		fprintf(fp, "%5ld.%06ld %-8s group: 0x%02X "
+			"next_repaint: %ld.%06ld\n",
+			e->ts.tv_sec, e->ts.tv_nsec / 1000l,
+			repaint_event_names[e->event], e->group,
+			e->next_repaint.tv_sec,
+			e->next_repaint.tv_nsec / 1000l);
+		index = (index + 1) % CLV_REPAINT_TIMELINE_LEN;
+	}
+}
+
+static void output_repaint_timer_arm(struct clv_output *output)
+{
+	struct clv_compositor *c = output->c;
+	struct clv_event_loop *loop;
 	struct timespec now;
-	s64 msec_to_next = INT64_MAX;
-	s64 msec_to_this;
+	s64 msec_to_next;
 
-	clock_gettime(c->clk_id, &now);
-	list_for_each_entry(output, &c->outputs, link) {
-		if (output->repaint_status != REPAINT_SCHEDULED)
-			continue;
-		msec_to_this = timespec_sub_to_msec(&output->next_repaint,
-						    &now);
-		if (!any_should_repaint || msec_to_this < msec_to_next) {
-			msec_to_next = msec_to_this;
-		}
-		any_should_repaint = 1;
+	if (!output->repaint_timer) {
+		loop = clv_display_get_event_loop(c->display);
+		output->repaint_timer = clv_event_loop_add_timer(loop,
+					output_repaint_timer_handler, output);
+		assert(output->repaint_timer);
 	}
 
-	if (!any_should_repaint)
+	if (output->repaint_status != REPAINT_SCHEDULED) {
+		clv_event_source_timer_update(output->repaint_timer, 0, 0);
 		return;
+	}
 
+	clock_gettime(c->clk_id, &now);
+	msec_to_next = timespec_sub_to_msec(&output->next_repaint, &now);
 	if (msec_to_next < 1) {
-		timer_info("msec_to_next = %ld", msec_to_next);
+		timer_info("[OUTPUT: %u] msec_to_next = %ld",
+			   output->index, msec_to_next);
 		msec_to_next = 1;
 	}
-	timer_debug("timer update to %ld", msec_to_next);
-	clv_event_source_timer_update(c->repaint_timer, msec_to_next, 0);
+	timer_debug("[OUTPUT: %u] timer update to %ld", output->index,
+		    msec_to_next);
+	clv_event_source_timer_update(output->repaint_timer, msec_to_next, 0);
 }
 
+static void clv_compositor_check_cursor(struct clv_compositor *c);
+
 void clv_output_finish_frame(struct clv_output *output, struct timespec *stamp)
 {
 	struct clv_compositor *c = output->c;
@@ -637,6 +753,7 @@ void clv_output_finish_frame(struct clv_output *output, struct timespec *stamp)
 	} else {
 		clv_signal_emit(&output->flip_signal, output);
 	}
+	clv_output_send_frame_done(output);
 //	clv_debug("----- emit flip event over");
 	timer_debug("[OUTPUT: %u] repaint finished! refresh: %u",
 		    output->index, refresh_nsec / 1000000);
@@ -668,7 +785,11 @@ void clv_output_finish_frame(struct clv_output *output, struct timespec *stamp)
 out:
 	output->repaint_status = REPAINT_SCHEDULED;
 //	output->repaint_needed = 1;
-	output_repaint_timer_arm(c);
+	clv_output_timeline_add(output, stamp ? CLV_REPAINT_EVT_FLIP
+					      : CLV_REPAINT_EVT_SCHEDULE, 0);
+	output_repaint_timer_arm(output);
+	/* a pointer move gets the next frame without waiting for its commit */
+	clv_compositor_check_cursor(c);
 }
 
 void clv_output_schedule_repaint_reset(struct clv_output *output)
@@ -683,11 +804,6 @@ static s32 clv_output_repaint(struct clv_output *output, void *repaint_data)
 	//struct clv_compositor *c = output->c;
 	s32 ret;
 	//struct timespec t1, t2;
-	
-	cmp_debug("output assign plane");
-	if (output->assign_planes) {
-		output->assign_planes(output, repaint_data);
-	}
 
 	cmp_debug("output repaint");
 	//clock_gettime(c->clk_id, &t1);
@@ -703,23 +819,13 @@ static s32 clv_output_repaint(struct clv_output *output, void *repaint_data)
 	return ret;
 }
 
-static s32 clv_output_maybe_repaint(struct clv_output *output,
-				    struct timespec *now, void *repaint_data)
+/* Return 1 if the output has to be repainted in this cycle */
+static s32 clv_output_need_repaint(struct clv_output *output, u32 group)
 {
-	//struct clv_compositor *c = output->c;
-	s32 ret = 0;
-	s64 msec_to_repaint;
-	//struct timespec t1, t2;
-
 	if (output->repaint_status != REPAINT_SCHEDULED)
-		return ret;
-
-	msec_to_repaint = timespec_sub_to_msec(&output->next_repaint, now);
-	if (msec_to_repaint > 1)
-		return ret;
+		return 0;
 
 	cmp_debug("repaint_needed = %d", output->repaint_needed);
-	//clock_gettime(c->clk_id, &t1);
 	if (!output->repaint_needed) {
 		if (output->repaint_pending) {
 			cmp_debug("there are repaint event pending.");
@@ -727,50 +833,133 @@ static s32 clv_output_maybe_repaint(struct clv_output *output,
 			output->repaint_needed = 1;
 		} else {
 			cmp_debug("do not need repaint");
-			goto error;
+			clv_output_timeline_add(output, CLV_REPAINT_EVT_SKIP,
+						group);
+			clv_output_schedule_repaint_reset(output);
+			return 0;
 		}
 	}
 
-	ret = clv_output_repaint(output, repaint_data);
-	//clock_gettime(c->clk_id, now);
-	//timer_debug("render %u spent %ld ms", output->index,
-	//	    timespec_sub_to_msec(now, &t1));
-	//printf("render %u spent %ld ms\n", output->index,
-	//	    timespec_sub_to_msec(now, &t1));
-	if (ret)
-		goto error;
+	return 1;
+}
 
-	output->repainted = 1;
-	timer_debug("output [%u] render complete.", output->index);
-	return ret;
+/*
+ * Move the active cursor view to the latest position of the cursor state
+ * page. Done after the transactions, a commit of the cursor surface carries
+ * an older position than the page. The hotspot is left to the commits, it
+ * has to change in the same frame as the image it belongs to.
+ */
+static void clv_compositor_sample_cursor(struct clv_compositor *c)
+{
+	struct clv_cursor_state st;
+	struct clv_view *v = c->cursor_view;
 
-error:
-	clv_output_schedule_repaint_reset(output);
-	return ret;
+	if (!c->cursor_state || !v)
+		return;
+
+	if (clv_cursor_state_read(c->cursor_state, &st) < 0 || !st.serial)
+		return;
+
+	v->area.pos.x = st.x;
+	v->area.pos.y = st.y;
+	c->cursor_serial = st.serial;
 }
 
+/* the pointer moved since the last sample, the cursor has to follow */
+static void clv_compositor_check_cursor(struct clv_compositor *c)
+{
+	struct clv_cursor_state st;
+
+	if (!c->cursor_state || !c->cursor_view)
+		return;
+
+	if (clv_cursor_state_read(c->cursor_state, &st) < 0 || !st.serial)
+		return;
+
+	if (st.serial != c->cursor_serial)
+		clv_view_schedule_cursor_repaint(c->cursor_view);
+}
+
+/*
+ * Each output has its own repaint timer. When one fires, every output
+ * whose next repaint falls inside the repaint window is repainted in the
+ * same cycle and flushed as one atomic commit. An output which is still
+ * waiting for its page flip is never part of a group, so there is at most
+ * one atomic commit in flight per CRTC.
+ */
 static s32 output_repaint_timer_handler(void *data)
 {
-	struct clv_compositor *c = data;
-	struct clv_output *output;
+	struct clv_output *output = data;
+	struct clv_compositor *c = output->c;
+	struct clv_output *o;
 	struct timespec now, t1, t2;
-	void *repaint_data;
+	void *repaint_data = NULL;
+	u32 group = 0, repaint_mask = 0;
 	s32 ret = 0;
 
 	clock_gettime(c->clk_id, &now);
-	timer_debug("timer handler %ld, %ld...",
+	timer_debug("[OUTPUT: %u] timer handler %ld, %ld...", output->index,
 		    now.tv_sec, now.tv_nsec / 1000000l);
+
+	list_for_each_entry(o, &c->outputs, link) {
+		if (!o->enabled)
+			continue;
+		if (!o->render_area.w || !o->render_area.h)
+			continue;
+		if (o->repaint_status != REPAINT_SCHEDULED)
+			continue;
+		if (timespec_sub_to_msec(&o->next_repaint, &now)
+				> c->repaint_window_msec)
+			continue;
+		group |= (1 << o->index);
+	}
+
+	if (!group) {
+		output_repaint_timer_arm(output);
+		return 0;
+	}
+
+	clv_compositor_apply_transactions(c);
+	clv_compositor_sample_cursor(c);
+
 	if (c->backend->repaint_begin)
 		repaint_data = c->backend->repaint_begin(c);
 
-	list_for_each_entry(output, &c->outputs, link) {
-		if (!output->enabled)
+	/*
+	 * Planes of all the outputs are assigned before any of them starts
+	 * painting, the renderer may already read the views on its threads.
+	 */
+	list_for_each_entry(o, &c->outputs, link) {
+		if (!(group & (1 << o->index)))
+			continue;
+		clv_output_timeline_add(o, CLV_REPAINT_EVT_TIMER, group);
+		if (!clv_output_need_repaint(o, group))
 			continue;
-		if (!output->render_area.w || !output->render_area.h)
+		repaint_mask |= (1 << o->index);
+		cmp_debug("output assign plane");
+		if (o->assign_planes)
+			o->assign_planes(o, repaint_data);
+	}
+
+	list_for_each_entry(o, &c->outputs, link) {
+		if (!(repaint_mask & (1 << o->index)))
 			continue;
-		ret = clv_output_maybe_repaint(output, &now, repaint_data);
-		if (ret)
+		clv_output_timeline_add(o, CLV_REPAINT_EVT_REPAINT, group);
+		ret = clv_output_repaint(o, repaint_data);
+		if (ret) {
+			clv_output_schedule_repaint_reset(o);
 			break;
+		}
+		o->repainted = 1;
+		timer_debug("output [%u] render started.", o->index);
+	}
+
+	/* every output which started painting is finished, even on error */
+	list_for_each_entry(o, &c->outputs, link) {
+		if (!o->repainted || !o->repaint_finish)
+			continue;
+		if (o->repaint_finish(o, repaint_data) < 0)
+			ret = -1;
 	}
 
 	if (ret == 0) {
@@ -780,24 +969,50 @@ static s32 output_repaint_timer_handler(void *data)
 		clock_gettime(c->clk_id, &t2);
 		timer_debug("scanout spent %ld ms",
 			    timespec_sub_to_msec(&t2, &t1));
+		list_for_each_entry(o, &c->outputs, link) {
+			if (o->repainted)
+				clv_output_timeline_add(o, CLV_REPAINT_EVT_FLUSH,
+							group);
+		}
 	} else {
-		list_for_each_entry(output, &c->outputs, link) {
-			if (output->repainted)
-				clv_output_schedule_repaint_reset(output);
+		list_for_each_entry(o, &c->outputs, link) {
+			if (!o->repainted)
+				continue;
+			clv_output_timeline_add(o, CLV_REPAINT_EVT_CANCEL,
+						group);
+			clv_output_schedule_repaint_reset(o);
 		}
 		if (c->backend->repaint_cancel)
 			c->backend->repaint_cancel(c, repaint_data);
 	}
+	clv_arena_reset(&c->frame_arena);
 
-	list_for_each_entry(output, &c->outputs, link)
-		output->repainted = 0;
-	output_repaint_timer_arm(c);
+	list_for_each_entry(o, &c->outputs, link) {
+		o->repainted = 0;
+		if (group & (1 << o->index))
+			output_repaint_timer_arm(o);
+	}
 
 	return 0;
 }
 
 void clv_surface_destroy(struct clv_surface *s)
 {
+	struct clv_surface *sub, *next;
+
+	/* orphan sub-surfaces, they become top level surfaces */
+	list_for_each_entry_safe(sub, next, &s->subsurfaces, sub_link) {
+		list_del(&sub->sub_link);
+		INIT_LIST_HEAD(&sub->sub_link);
+		sub->parent = NULL;
+	}
+	if (s->parent) {
+		list_del(&s->sub_link);
+		s->parent = NULL;
+	}
+	list_del(&s->link);
+	if (s->agent)
+		clv_handle_free(&s->agent->handles, s->id);
 /*
 	clv_debug("----- destroy surface: %p", s);
 	clv_debug("----- del flip_listener %p", &s->flip_listener);
@@ -846,6 +1061,8 @@ void clv_surface_destroy(struct clv_surface *s)
 	clv_signal_emit(&s->destroy_signal, NULL);
 
 	if (s->view) {
+		if (s->c->cursor_view == s->view)
+			s->c->cursor_view = NULL;
 		s->view->surface = NULL;
 	}
 	clv_region_fini(&s->opaque);
@@ -860,6 +1077,8 @@ void clv_view_destroy(struct clv_view *v)
 {
 //	clv_debug("----- destroy view: %p", v);
 	if (v->surface) {
+		if (v->surface->c->cursor_view == v)
+			v->surface->c->cursor_view = NULL;
 		v->surface->view = NULL;
 	}
 	list_del(&v->link);
@@ -870,7 +1089,6 @@ static void surface_flip_proc(struct clv_listener *listener, void *data)
 {
 	struct clv_surface *s = container_of(listener, struct clv_surface,
 					     flip_listener);
-	s32 sock = s->agent->sock;
 	//struct clv_buffer *buffer, *next;
 	//struct clv_output *output = data;
 	//u32 output_mask = s->view->output_mask;
@@ -897,16 +1115,16 @@ static void surface_flip_proc(struct clv_listener *listener, void *data)
 	(void)clv_dup_bo_complete_cmd(s->agent->bo_complete_tx_cmd,
 				      s->agent->bo_complete_tx_cmd_t,
 				      s->agent->bo_complete_tx_len,
-				      0);
+				      s->id);
 	assert(s->view);
 	if (s->view->painted) {
 		s->view->painted = 0;
 		list_del(&listener->link);
 		INIT_LIST_HEAD(&listener->link);
-		cmp_debug("************ Send bo complete sock = %d", sock);
-		//printf("************ Send bo complete sock = %d\n", sock);
-		ret = clv_send(sock, s->agent->bo_complete_tx_cmd,
-				s->agent->bo_complete_tx_len);
+		cmp_debug("************ Send bo complete sock = %d",
+			  s->agent->sock);
+		ret = client_agent_send(s->agent, s->agent->bo_complete_tx_cmd,
+					s->agent->bo_complete_tx_len);
 		if (ret < 0) {
 			cmp_info("send bo complete failed. destroy agent.");
 			client_agent_destroy(s->agent);
@@ -915,6 +1133,95 @@ static void surface_flip_proc(struct clv_listener *listener, void *data)
 //	clv_debug("------ check surface over");
 }
 
+/*
+ * Check whether some part of the view is left on the output once the opaque
+ * area of the views stacked above it has been removed.
+ */
+static s32 clv_view_visible_on_output(struct clv_view *v,
+				      struct clv_output *output)
+{
+	struct clv_compositor *c = output->c;
+	struct clv_view *above;
+	struct clv_region visible, opaque;
+	s32 ret;
+
+	if (!(v->output_mask & (1 << output->index)))
+		return 0;
+
+	if (v->alpha <= 0.0f)
+		return 0;
+
+	clv_region_init_rect(&visible, v->area.pos.x, v->area.pos.y,
+			     v->area.w, v->area.h);
+	clv_region_intersect_rect(&visible, &visible,
+				  output->render_area.pos.x,
+				  output->render_area.pos.y,
+				  output->render_area.w,
+				  output->render_area.h);
+
+	/* the tail of view list is the top most view */
+	above = v;
+	list_for_each_entry_continue(above, &c->views, link) {
+		if (!clv_region_is_not_empty(&visible))
+			break;
+		if (!above->surface || above->type == CLV_VIEW_TYPE_CURSOR)
+			continue;
+		if (!(above->output_mask & (1 << output->index)))
+			continue;
+		if (above->alpha < 1.0f)
+			continue;
+		/* opaque area of a scaled view is not tracked */
+		if (above->area.w != above->surface->w
+		    || above->area.h != above->surface->h)
+			continue;
+		clv_region_init(&opaque);
+		clv_region_copy(&opaque, &above->surface->opaque);
+		clv_region_translate(&opaque, above->area.pos.x,
+				     above->area.pos.y);
+		clv_region_subtract(&visible, &visible, &opaque);
+		clv_region_fini(&opaque);
+	}
+
+	ret = clv_region_is_not_empty(&visible);
+	clv_region_fini(&visible);
+
+	return ret;
+}
+
+/*
+ * Called after the output's page flip. Send frame done to every surface
+ * whose latest buffer has been shown on this output, unless it is fully
+ * occluded. Occluded surfaces keep the request until they become visible.
+ */
+static void clv_output_send_frame_done(struct clv_output *output)
+{
+	struct clv_compositor *c = output->c;
+	struct clv_client_agent *agent;
+	struct clv_surface *s;
+	struct clv_view *v;
+
+	list_for_each_entry(v, &c->views, link) {
+		s = v->surface;
+		if (!s || !s->agent || !s->frame_requested)
+			continue;
+		if (v->need_to_draw)
+			continue;
+		if (!clv_view_visible_on_output(v, output))
+			continue;
+		s->frame_requested = 0;
+		agent = s->agent;
+		(void)clv_dup_frame_done_cmd(agent->frame_done_tx_cmd,
+					     agent->frame_done_tx_cmd_t,
+					     agent->frame_done_tx_len,
+					     s->id);
+		cmp_debug("send frame done of surface %lu", s->id);
+		/* broken link is cleaned up by the socket's callback */
+		if (client_agent_send(agent, agent->frame_done_tx_cmd,
+				      agent->frame_done_tx_len) < 0)
+			cmp_warn("failed to send frame done.");
+	}
+}
+
 void clv_surface_add_flip_listener(struct clv_surface *s)
 {
 	struct clv_compositor *c = s->c;
@@ -988,6 +1295,384 @@ void clv_surface_add_flip_listener(struct clv_surface *s)
 	cmp_debug("output %p %u", s->primary_output, s->primary_output->index);
 }
 
+static void clv_surface_set_position(struct clv_surface *s, s32 x, s32 y)
+{
+	struct clv_view *v = s->view;
+
+	if (s->parent && s->parent->view) {
+		s->sub_x = x;
+		s->sub_y = y;
+		v->area.pos.x = s->parent->view->area.pos.x + s->sub_x;
+		v->area.pos.y = s->parent->view->area.pos.y + s->sub_y;
+	} else {
+		v->area.pos.x = x;
+		v->area.pos.y = y;
+	}
+	cmp_debug("set view %p pos: %d, %d", v, v->area.pos.x, v->area.pos.y);
+}
+
+/* attach the buffer to surface, repaint is not scheduled here. */
+static void clv_surface_attach(struct clv_surface *s, struct clv_buffer *buf,
+			       struct clv_commit_info *ci)
+{
+	struct clv_compositor *c = s->c;
+	struct clv_view *v = s->view;
+	struct timespec t1, t2;
+
+	if (buf->type == CLV_BUF_TYPE_SHM) {
+		cmp_debug("Commit info: 0x%08lX, %d, %d,%d:%ux%u %d "
+			  "damage:%d,%d %ux%u",
+			  ci->bo_id, ci->shown, ci->view_x, ci->view_y,
+			  ci->view_width, ci->view_height, ci->delta_z,
+			  ci->bo_damage.pos.x, ci->bo_damage.pos.y,
+			  ci->bo_damage.w, ci->bo_damage.h);
+		if (v->type == CLV_VIEW_TYPE_CURSOR) {
+			cmp_debug("receive cursor bo %lu's cmt", ci->bo_id);
+			if (v->cursor_buf != buf) {
+				cmp_debug("cursor bo changed.");
+			}
+			v->cursor_buf = buf;
+			c->cursor_view = v;
+		}
+		clv_region_fini(&s->damage);
+		if (ci->bo_damage.w && ci->bo_damage.h)
+			clv_region_init_rect(&s->damage,
+					     ci->bo_damage.pos.x,
+					     ci->bo_damage.pos.y,
+					     ci->bo_damage.w,
+					     ci->bo_damage.h);
+		else
+			clv_region_init(&s->damage);
+		if (v->type == CLV_VIEW_TYPE_PRIMARY) {
+			c->renderer->attach_buffer(s, buf);
+			if (ci->bo_damage.w && ci->bo_damage.h) {
+				clock_gettime(c->clk_id, &t1);
+				c->renderer->flush_damage(s);
+				clock_gettime(c->clk_id, &t2);
+				cmp_debug("[TIMER] flush spent %ld ms",
+					  timespec_sub_to_msec(&t2, &t1));
+			}
+		}
+		clv_region_fini(&s->damage);
+	} else if (buf->type == CLV_BUF_TYPE_DMA) {
+		cmp_debug("Commit info: 0x%08lX, %d, %d,%d:%ux%u %d",
+			  ci->bo_id, ci->shown, ci->view_x, ci->view_y,
+			  ci->view_width, ci->view_height, ci->delta_z);
+		if (v->type == CLV_VIEW_TYPE_PRIMARY) {
+			c->renderer->attach_buffer(s, buf);
+		} else {
+			cmp_debug("attach dma buf %p", buf);
+			v->last_dmafb = v->curr_dmafb;
+			v->curr_dmafb = c->backend->import_dmabuf(c, buf);
+			cmp_debug("view %p's curr_dmafb = %p", v, v->curr_dmafb);
+		}
+	}
+
+	v->plane = &c->primary_plane;
+	if (v->type != CLV_VIEW_TYPE_CURSOR) {
+		cmp_debug("************ add flip listener");
+		clv_surface_add_flip_listener(s);
+	} else {
+		if (ci->bo_damage.w && ci->bo_damage.h) {
+			cmp_debug("****** add flip listener");
+			clv_surface_add_flip_listener(s);
+		}
+	}
+
+	/* plain and transaction commits both arm the frame request */
+	if (s->frame_pending) {
+		s->frame_pending = 0;
+		s->frame_requested = 1;
+	}
+}
+
+static void clv_surface_apply_commit(struct clv_surface *s,
+				     struct clv_buffer *buf,
+				     struct clv_commit_info *ci)
+{
+	clv_surface_set_position(s, ci->view_x, ci->view_y);
+	s->view->hot_x = ci->view_hot_x;
+	s->view->hot_y = ci->view_hot_y;
+	clv_surface_attach(s, buf, ci);
+}
+
+void clv_surface_request_frame(struct clv_surface *s)
+{
+	s->frame_pending = 1;
+}
+
+/*
+ * Sub-surfaces follow their parent. The cached state of every sub-surface
+ * in the tree is applied together with the top level surface's commit, so
+ * that the whole tree shows up in the same frame.
+ *
+ * Return the output mask of the views which should be repainted.
+ */
+static u32 clv_surface_sync_subsurfaces(struct clv_surface *s)
+{
+	struct clv_surface *sub;
+	u32 output_mask = 0;
+
+	list_for_each_entry(sub, &s->subsurfaces, sub_link) {
+		if (!sub->view)
+			continue;
+		if (sub->has_cached) {
+			sub->has_cached = 0;
+			clv_surface_apply_commit(sub, sub->cached_buf,
+						 &sub->cached);
+			sub->cached_buf = NULL;
+		} else {
+			clv_surface_set_position(sub, sub->sub_x, sub->sub_y);
+		}
+		output_mask |= sub->view->output_mask;
+		output_mask |= clv_surface_sync_subsurfaces(sub);
+	}
+
+	return output_mask;
+}
+
+static void clv_compositor_schedule_repaint_mask(struct clv_compositor *c,
+						 u32 output_mask)
+{
+	struct clv_output *output;
+
+	list_for_each_entry(output, &c->outputs, link) {
+		if (output_mask & (1 << output->index))
+			clv_output_schedule_repaint(output, 1);
+	}
+}
+
+s32 clv_surface_commit(struct clv_surface *s, struct clv_buffer *buf,
+		       struct clv_commit_info *ci)
+{
+	u32 output_mask;
+
+	if (!s->view || !buf || buf->surface != s)
+		return -1;
+
+	if (s->parent) {
+		/* cache the state until the parent is commited. */
+		cmp_debug("cache sub-surface %lu's commit", s->id);
+		memcpy(&s->cached, ci, sizeof(*ci));
+		s->cached_buf = buf;
+		s->has_cached = 1;
+		return 0;
+	}
+
+	clv_surface_apply_commit(s, buf, ci);
+	if (s->view->type == CLV_VIEW_TYPE_CURSOR) {
+		clv_view_schedule_cursor_repaint(s->view);
+		return 0;
+	}
+
+	output_mask = s->view->output_mask;
+	output_mask |= clv_surface_sync_subsurfaces(s);
+	clv_compositor_schedule_repaint_mask(s->c, output_mask);
+
+	return 0;
+}
+
+/* keep sub-surfaces' views just above their parent's view */
+static void clv_view_restack_subsurfaces(struct clv_surface *s)
+{
+	struct clv_surface *sub;
+	struct list_head *pos = &s->view->link;
+
+	list_for_each_entry(sub, &s->subsurfaces, sub_link) {
+		if (!sub->view)
+			continue;
+		list_del(&sub->view->link);
+		list_add(&sub->view->link, pos);
+		pos = &sub->view->link;
+		clv_view_restack_subsurfaces(sub);
+	}
+}
+
+static void clv_view_restack(struct clv_view *v, s32 delta_z)
+{
+	struct clv_compositor *c = v->surface->c;
+
+	if (!delta_z)
+		return;
+
+	list_del(&v->link);
+	if (delta_z > 0)
+		list_add_tail(&v->link, &c->views);
+	else
+		list_add(&v->link, &c->bg_view.link);
+	clv_view_restack_subsurfaces(v->surface);
+}
+
+struct clv_transaction_commit {
+	u32 flags;
+	float alpha;
+	struct clv_surface *surface;
+	struct clv_buffer *buf;
+	struct clv_commit_info ci;
+};
+
+struct clv_transaction {
+	struct list_head link; /* link to compositor */
+	struct clv_client_agent *agent;
+	u32 count_commits;
+	struct clv_transaction_commit commits[CLV_TRANSACTION_MAX_ENTRIES];
+};
+
+static void clv_transaction_apply(struct clv_transaction *t)
+{
+	struct clv_transaction_commit *tc;
+	struct clv_view *v;
+	u32 i;
+
+	for (i = 0; i < t->count_commits; i++) {
+		tc = &t->commits[i];
+		v = tc->surface->view;
+		if (!v)
+			continue;
+		if (tc->flags & CLV_COMMIT_SIZE) {
+			v->area.w = tc->ci.view_width;
+			v->area.h = tc->ci.view_height;
+		}
+		if (tc->flags & CLV_COMMIT_ALPHA)
+			v->alpha = tc->alpha;
+		if (tc->flags & CLV_COMMIT_Z)
+			clv_view_restack(v, tc->ci.delta_z);
+		if (tc->flags & CLV_COMMIT_POSITION) {
+			clv_surface_set_position(tc->surface, tc->ci.view_x,
+						 tc->ci.view_y);
+			v->hot_x = tc->ci.view_hot_x;
+			v->hot_y = tc->ci.view_hot_y;
+		}
+		if ((tc->flags & CLV_COMMIT_BUFFER) && tc->buf)
+			clv_surface_attach(tc->surface, tc->buf, &tc->ci);
+		if (!tc->surface->parent)
+			(void)clv_surface_sync_subsurfaces(tc->surface);
+	}
+}
+
+/*
+ * Apply all pending transactions, called at the beginning of each repaint
+ * cycle. The repaint has been scheduled when the transaction was queued.
+ */
+static void clv_compositor_apply_transactions(struct clv_compositor *c)
+{
+	struct clv_transaction *t, *next;
+
+	list_for_each_entry_safe(t, next, &c->transactions, link) {
+		cmp_debug("apply transaction %p (%u commits)", t,
+			  t->count_commits);
+		clv_transaction_apply(t);
+		list_del(&t->link);
+		free(t);
+	}
+}
+
+s32 clv_compositor_queue_transaction(struct clv_client_agent *agent,
+				     struct clv_transaction_info *ti)
+{
+	struct clv_compositor *c = agent->c;
+	struct clv_transaction *t;
+	struct clv_transaction_commit *tc;
+	struct clv_transaction_entry *e;
+	struct clv_surface *sub;
+	struct clv_output *output;
+	u32 i, output_mask = 0;
+	s32 scheduled = 0;
+
+	if (!ti->count_entries
+	    || ti->count_entries > CLV_TRANSACTION_MAX_ENTRIES)
+		return -1;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -1;
+
+	t->agent = agent;
+	for (i = 0; i < ti->count_entries; i++) {
+		e = &ti->entries[i];
+		tc = &t->commits[i];
+		tc->surface = client_agent_find_surface(agent,
+							e->commit.surface_id);
+		if (!tc->surface || !tc->surface->view) {
+			cmp_err("illegal surface id %lu", e->commit.surface_id);
+			goto error;
+		}
+		if (e->flags & CLV_COMMIT_BUFFER) {
+			tc->buf = client_agent_find_buffer(agent,
+							   e->commit.bo_id);
+			if (!tc->buf || tc->buf->surface != tc->surface) {
+				cmp_err("illegal bo id %lu", e->commit.bo_id);
+				goto error;
+			}
+		}
+		/* a sub-surface is stacked by its parent */
+		if ((e->flags & CLV_COMMIT_Z) && tc->surface->parent) {
+			cmp_err("cannot restack sub-surface %lu",
+				tc->surface->id);
+			goto error;
+		}
+		tc->flags = e->flags;
+		tc->alpha = e->alpha;
+		memcpy(&tc->ci, &e->commit, sizeof(tc->ci));
+		output_mask |= tc->surface->view->output_mask;
+		list_for_each_entry(sub, &tc->surface->subsurfaces, sub_link) {
+			if (sub->view)
+				output_mask |= sub->view->output_mask;
+		}
+	}
+	t->count_commits = ti->count_entries;
+
+	list_add_tail(&t->link, &c->transactions);
+
+	/* only one repaint is scheduled for the whole transaction */
+	list_for_each_entry(output, &c->outputs, link) {
+		if (!(output_mask & (1 << output->index)))
+			continue;
+		if (!output->enabled)
+			continue;
+		clv_output_schedule_repaint(output, 1);
+		scheduled = 1;
+	}
+
+	/* no output is going to repaint, apply it right now. */
+	if (!scheduled)
+		clv_compositor_apply_transactions(c);
+
+	return 0;
+
+error:
+	free(t);
+	return -1;
+}
+
+static void clv_compositor_drop_transactions(struct clv_client_agent *agent)
+{
+	struct clv_transaction *t, *next;
+
+	list_for_each_entry_safe(t, next, &agent->c->transactions, link) {
+		if (t->agent != agent)
+			continue;
+		list_del(&t->link);
+		free(t);
+	}
+}
+
+static void clv_compositor_drop_transaction_buf(struct clv_client_agent *agent,
+						struct clv_buffer *buf)
+{
+	struct clv_transaction *t;
+	u32 i;
+
+	list_for_each_entry(t, &agent->c->transactions, link) {
+		if (t->agent != agent)
+			continue;
+		for (i = 0; i < t->count_commits; i++) {
+			if (t->commits[i].buf == buf)
+				t->commits[i].buf = NULL;
+		}
+	}
+}
+
 struct clv_surface *clv_surface_create(struct clv_compositor *c,
 				       struct clv_surface_info *si,
 				       struct clv_client_agent *agent)
@@ -1012,6 +1697,34 @@ struct clv_surface *clv_surface_create(struct clv_compositor *c,
 	s->is_bg = 0;
 
 	INIT_LIST_HEAD(&s->flip_listener.link);
+	INIT_LIST_HEAD(&s->subsurfaces);
+	INIT_LIST_HEAD(&s->sub_link);
+
+	if (si->parent_id) {
+		s->parent = client_agent_find_surface(agent, si->parent_id);
+		if (!s->parent) {
+			cmp_err("cannot find parent surface %lu", si->parent_id);
+			clv_region_fini(&s->damage);
+			clv_region_fini(&s->opaque);
+			free(s);
+			return NULL;
+		}
+		s->sub_x = si->sub_x;
+		s->sub_y = si->sub_y;
+		list_add_tail(&s->sub_link, &s->parent->subsurfaces);
+	}
+
+	s->id = clv_handle_alloc(&agent->handles, s, CLV_HANDLE_SURFACE);
+	if (!s->id) {
+		cmp_err("failed to alloc surface handle");
+		if (s->parent)
+			list_del(&s->sub_link);
+		clv_region_fini(&s->damage);
+		clv_region_fini(&s->opaque);
+		free(s);
+		return NULL;
+	}
+	list_add_tail(&s->link, &agent->surfaces);
 
 //	clv_debug("----- create surface %p", s);
 
@@ -1036,7 +1749,17 @@ struct clv_view *clv_view_create(struct clv_surface *s,
 	memcpy(&v->area, &vi->area, sizeof(v->area));
 	v->alpha = vi->alpha;
 	v->output_mask = vi->output_mask;
-	list_add_tail(&v->link, &s->c->views);
+	if (s->parent && s->parent->view) {
+		/*
+		 * stack sub-surface just above its parent, the views are
+		 * drawn from the tail of the list, the tail is the top most.
+		 */
+		v->area.pos.x = s->parent->view->area.pos.x + s->sub_x;
+		v->area.pos.y = s->parent->view->area.pos.y + s->sub_y;
+		list_add(&v->link, &s->parent->view->link);
+	} else {
+		list_add_tail(&v->link, &s->c->views);
+	}
 
 	list_for_each_entry(output, &s->c->outputs, link) {
 		if (output->index == vi->primary_output) {
@@ -1086,21 +1809,55 @@ struct clv_buffer *shm_buffer_create(struct clv_bo_info *bi)
 	buffer->base.count_planes = bi->count_planes;
 	strcpy(buffer->base.name, bi->name);
 	clv_shm_init(&buffer->shm, bi->name, buffer->base.size, 0);
-	INIT_LIST_HEAD(&buffer->base.link);
 	return &buffer->base;
 }
 
+struct clv_surface *client_agent_find_surface(struct clv_client_agent *agent,
+					      u64 id)
+{
+	struct clv_surface *s;
+
+	if (list_empty(&agent->surfaces))
+		return NULL;
+
+	/* compatible with the clients which have only one surface */
+	if (!id)
+		return list_last_entry(&agent->surfaces, struct clv_surface,
+				       link);
+
+	s = clv_handle_lookup(&agent->handles, id, CLV_HANDLE_SURFACE);
+	return s;
+}
+
+u64 client_agent_add_buffer(struct clv_client_agent *agent,
+			    struct clv_buffer *buf)
+{
+	buf->id = clv_handle_alloc(&agent->handles, buf, CLV_HANDLE_BUFFER);
+	return buf->id;
+}
+
+struct clv_buffer *client_agent_find_buffer(struct clv_client_agent *agent,
+					    u64 id)
+{
+	return clv_handle_lookup(&agent->handles, id, CLV_HANDLE_BUFFER);
+}
+
 void client_destroy_buf(struct clv_client_agent *agent, struct clv_buffer *buf)
 {
 	s32 is_overlay = 0;
 	struct clv_compositor *c = agent->c;
+	struct clv_surface *s = buf->surface;
 
-	if (!buf->link.prev || !buf->link.next) {
-		clv_err("illegal link!!!!!!!!!!!!!!!!!");
+	if (clv_handle_free(&agent->handles, buf->id) != buf) {
+		clv_err("illegal buffer handle 0x%016lX", buf->id);
 		assert(0);
 	}
-	list_del(&buf->link);
-	if (agent->view->type == CLV_VIEW_TYPE_OVERLAY)
+	clv_compositor_drop_transaction_buf(agent, buf);
+	if (s && s->cached_buf == buf) {
+		s->cached_buf = NULL;
+		s->has_cached = 0;
+	}
+	if (s && s->view && s->view->type == CLV_VIEW_TYPE_OVERLAY)
 		is_overlay = 1;
 	if (buf->type == CLV_BUF_TYPE_DMA) {
 		if (is_overlay) {
@@ -1108,9 +1865,8 @@ void client_destroy_buf(struct clv_client_agent *agent, struct clv_buffer *buf)
 			cmp_debug("release drm dma buf! %p",
 				  buf->internal_fb);
 			close(buf->fd);
-			c->backend->dmabuf_destroy(
-				agent->surface->primary_output,
-				buf->internal_fb);
+			c->backend->dmabuf_destroy(s->primary_output,
+						   buf->internal_fb);
 			free(buf);
 		} else {
 			cmp_debug("release gl dma buf");
@@ -1124,55 +1880,71 @@ void client_destroy_buf(struct clv_client_agent *agent, struct clv_buffer *buf)
 
 void client_agent_destroy(struct clv_client_agent *agent)
 {
-	struct clv_buffer *buffer, *next;
+	struct clv_buffer *buffer;
+	struct clv_surface *s, *next_s;
 	struct clv_compositor *c = agent->c;
 	struct clv_output *output;
-	u32 output_mask;
-	s32 is_overlay = 0;
+	u32 output_mask, i;
 
-	close(agent->sock);
-	clv_event_source_remove(agent->client_source);
-	if (!agent->view)
-		goto out;
-	output_mask = agent->view->output_mask;
-	/* destroy view */
-	if (agent->view->type == CLV_VIEW_TYPE_OVERLAY)
-		is_overlay = 1;
-	clv_view_destroy(agent->view);
-	//printf("client destroy schedule output's repaint\n");
-	list_for_each_entry(output, &c->outputs, link) {
-		if (output_mask & (1 << output->index)) {
-			clv_output_schedule_repaint(output, 1);
-		}
+	/* a link owned by the IPC worker is closed by the worker */
+	if (agent->client_source) {
+		close(agent->sock);
+		clv_event_source_remove(agent->client_source);
 	}
+
+	clv_compositor_drop_transactions(agent);
+
 	/* destroy buffers */
-	list_for_each_entry_safe(buffer, next, &agent->buffers, link) {
-		list_del(&buffer->link);
-		if (buffer->type == CLV_BUF_TYPE_DMA) {
-			if (is_overlay) {
-				cmp_debug("release drm dma buf! %p",
-					buffer->internal_fb);
-				close(buffer->fd);
-				c->backend->dmabuf_destroy(
-					agent->surface->primary_output,
-					buffer->internal_fb);
-				free(buffer);
-			} else {
-				cmp_debug("release gl dma buf");
-				c->renderer->release_dmabuf(c, buffer);
+	clv_handle_table_for_each(buffer, i, &agent->handles, CLV_HANDLE_BUFFER)
+		client_destroy_buf(agent, buffer);
+
+	/* destroy sub-surfaces ahead of their parents */
+	list_for_each_entry_reverse_safe(s, next_s, &agent->surfaces, link) {
+		if (s->view) {
+			output_mask = s->view->output_mask;
+			clv_view_destroy(s->view);
+			//printf("client destroy schedule output's repaint\n");
+			list_for_each_entry(output, &c->outputs, link) {
+				if (output_mask & (1 << output->index)) {
+					clv_output_schedule_repaint(output, 1);
+				}
 			}
-		} else if (buffer->type == CLV_BUF_TYPE_SHM) {
-			cmp_debug("release shm buf");
-			shm_buffer_destroy(buffer);
 		}
+		clv_surface_destroy(s);
 	}
-	/* destroy surface */
-	clv_surface_destroy(agent->surface);
-out:
+
+	clv_handle_table_release(&agent->handles);
 	list_del(&agent->link);
+	clv_signal_emit(&agent->destroy_signal, agent);
+
+	free(agent->surface_id_created_tx_cmd_t);
+	free(agent->surface_id_created_tx_cmd);
+	free(agent->view_id_created_tx_cmd_t);
+	free(agent->view_id_created_tx_cmd);
+	free(agent->bo_id_created_tx_cmd_t);
+	free(agent->bo_id_created_tx_cmd);
+	free(agent->commit_ack_tx_cmd_t);
+	free(agent->commit_ack_tx_cmd);
+	free(agent->bo_complete_tx_cmd_t);
+	free(agent->bo_complete_tx_cmd);
+	free(agent->frame_done_tx_cmd_t);
+	free(agent->frame_done_tx_cmd);
+	free(agent->hpd_tx_cmd_t);
+	free(agent->hpd_tx_cmd);
+	free(agent->destroy_ack_tx_cmd_t);
+	free(agent->destroy_ack_tx_cmd);
+	free(agent->ipc_rx_buf);
 	free(agent);
 }
 
+s32 client_agent_send(struct clv_client_agent *agent, u8 *buf, u32 n)
+{
+	if (agent->send)
+		return agent->send(agent->send_data, buf, n);
+
+	return clv_send(agent->sock, buf, n);
+}
+
 struct clv_client_agent *client_agent_create(
 	struct clv_server *s,
 	s32 sock,
@@ -1227,6 +1999,13 @@ struct clv_client_agent *client_agent_create(
 	assert(agent->bo_complete_tx_cmd);
 	agent->bo_complete_tx_len = n;
 
+	agent->frame_done_tx_cmd_t
+		= clv_server_create_frame_done_cmd(0, &n);
+	assert(agent->frame_done_tx_cmd_t);
+	agent->frame_done_tx_cmd = malloc(n);
+	assert(agent->frame_done_tx_cmd);
+	agent->frame_done_tx_len = n;
+
 	agent->hpd_tx_cmd_t
 		= clv_server_create_hpd_cmd(0, &n);
 	assert(agent->hpd_tx_cmd_t);
@@ -1244,14 +2023,15 @@ struct clv_client_agent *client_agent_create(
 	agent->c = s->c;
 	agent->sock = sock;
 	INIT_LIST_HEAD(&agent->link);
-	agent->surface = NULL;
-	agent->view = NULL;
-	INIT_LIST_HEAD(&agent->buffers);
-	agent->client_source = clv_event_loop_add_fd(loop, sock,
-						     CLV_EVT_READABLE,
-						     client_sock_cb,
-						     agent);
-	assert(agent->client_source);
+	INIT_LIST_HEAD(&agent->surfaces);
+	clv_handle_table_init(&agent->handles);
+	clv_signal_init(&agent->destroy_signal);
+	if (client_sock_cb) {
+		agent->client_source = clv_event_loop_add_fd(loop, sock,
+						CLV_EVT_READABLE | CLV_EVT_EDGE,
+						client_sock_cb, agent);
+		assert(agent->client_source);
+	}
 	agent->f = 1;
 	list_add_tail(&agent->link, &s->client_agents);
 
@@ -20,14 +20,18 @@
 #ifndef CLOVER_COMPOSITOR_H
 #define CLOVER_COMPOSITOR_H
 
+#include <stdio.h>
 #include <time.h>
 #include <assert.h>
 #include <clover_utils.h>
+#include <clover_arena.h>
 #include <clover_region.h>
 #include <clover_shm.h>
 #include <clover_signal.h>
 #include <clover_event.h>
 #include <clover_protocal.h>
+#include <clover_handle.h>
+#include <clover_cursor_state.h>
 
 struct clv_renderer;
 struct clv_surface;
@@ -38,6 +42,7 @@ struct clv_output;
 struct clv_head;
 struct clv_plane;
 struct clv_server;
+struct clv_ipc_worker;
 
 enum timing_select_method {
 	USE_PREFERRED = 0,
@@ -87,15 +92,28 @@ struct clv_config {
 
 struct clv_config *load_config_from_file(const char *xml);
 
+enum clv_handle_type {
+	CLV_HANDLE_SURFACE = 1,
+	CLV_HANDLE_BUFFER,
+};
+
 struct clv_client_agent {
 	s32 sock;
 	struct clv_compositor *c;
 	struct list_head link;
-	struct clv_surface *surface;
-	struct clv_view *view;
-	struct list_head buffers;
+	struct list_head surfaces;
+	/* connection scoped ids of surfaces & buffers */
+	struct clv_handle_table handles;
+	/* NULL if the link is read by the IPC worker thread */
 	struct clv_event_source *client_source;
+	/*
+	 * Set if the link is written by the IPC worker thread, the commands
+	 * are queued to the worker and the compositor never waits on a client.
+	 */
+	s32 (*send)(void *data, u8 *buf, u32 n);
+	void *send_data;
 	s32 f;
+	struct clv_signal destroy_signal;
 
 	u8 *ipc_rx_buf;
 	u32 ipc_rx_buf_sz;
@@ -120,6 +138,10 @@ struct clv_client_agent {
 	u8 *bo_complete_tx_cmd;
 	u32 bo_complete_tx_len;
 
+	u8 *frame_done_tx_cmd_t;
+	u8 *frame_done_tx_cmd;
+	u32 frame_done_tx_len;
+
 	u8 *hpd_tx_cmd_t;
 	u8 *hpd_tx_cmd;
 	u32 hpd_tx_len;
@@ -157,6 +179,23 @@ struct clv_surface {
 	struct clv_listener flip_listener;
 	s32 is_bg;
 	struct clv_client_agent *agent;
+	u64 id; /* connection scoped id */
+	struct list_head link; /* link to client agent */
+
+	/* sub-surface */
+	struct clv_surface *parent;
+	struct list_head subsurfaces;
+	struct list_head sub_link; /* link to parent's subsurfaces */
+	s32 sub_x, sub_y; /* relative to parent */
+
+	/* cached state of sub-surface, applied when parent commits */
+	struct clv_commit_info cached;
+	struct clv_buffer *cached_buf;
+	s32 has_cached;
+
+	/* frame notification, armed by the next commit */
+	s32 frame_pending;
+	s32 frame_requested;
 };
 
 struct clv_view {
@@ -187,7 +226,8 @@ struct clv_buffer {
 	char name[CLV_BUFFER_NAME_LEN];
 	s32 fd;
 	void *internal_fb;
-	struct list_head link; /* link to client agent */
+	struct clv_surface *surface; /* surface this buffer was created for */
+	u64 id; /* handle in client agent's table */
 };
 
 struct shm_buffer {
@@ -203,7 +243,8 @@ struct clv_compositor {
 
 	clockid_t clk_id;
 
-	struct clv_event_source *repaint_timer;
+	/* outputs due in this window are repainted in one atomic commit */
+	s32 repaint_window_msec;
 
 	struct clv_renderer *renderer;
 
@@ -214,6 +255,9 @@ struct clv_compositor {
 	struct list_head heads;
 	struct list_head planes;
 
+	/* transactions to be applied at the next repaint */
+	struct list_head transactions;
+
 	/* head change signals used to invoke some callbacks */
 	struct clv_signal heads_changed_signal;
 	/* idle event added by Monitor's Hotplug */
@@ -225,6 +269,20 @@ struct clv_compositor {
 
 	struct clv_surface dummy_cursor_surf;
 	struct clv_view dummy_cursor_view;
+
+	/* cursor position written by the input server */
+	struct clv_shm cursor_state_shm;
+	struct clv_cursor_state *cursor_state;
+	/* the cursor view committed last, the one following the page */
+	struct clv_view *cursor_view;
+	u32 cursor_serial; /* of the last sample */
+
+	/*
+	 * Transient data of a repaint sequence, main thread only. Reset once
+	 * repaint_flush or repaint_cancel returns, what outlives the frame
+	 * is allocated elsewhere.
+	 */
+	struct clv_arena frame_arena;
 };
 
 struct clv_backend {
@@ -245,6 +303,8 @@ struct clv_backend {
 	 *     LCDC timing to get the time of the next frame.
 	 * Condition: Check each output's state, if no repainting request
 	 *            is scheduled, do nothing.
+	 *
+	 * repaint_data and whatever hangs off it may come from c->frame_arena.
 	 */
 	void * (*repaint_begin)(struct clv_compositor *c);
 
@@ -300,6 +360,32 @@ enum clv_dpms {
 	CLV_DPMS_OFF,
 };
 
+enum clv_repaint_event {
+	CLV_REPAINT_EVT_SCHEDULE = 0,
+	CLV_REPAINT_EVT_TIMER,
+	CLV_REPAINT_EVT_REPAINT,
+	CLV_REPAINT_EVT_SKIP,
+	CLV_REPAINT_EVT_FLUSH,
+	CLV_REPAINT_EVT_CANCEL,
+	CLV_REPAINT_EVT_FLIP,
+};
+
+struct clv_repaint_timeline_entry {
+	enum clv_repaint_event event;
+	u32 group; /* mask of outputs repainted in the same commit */
+	struct timespec ts;
+	struct timespec next_repaint;
+};
+
+#define CLV_REPAINT_TIMELINE_LEN 128
+
+/* ring buffer of the latest repaint events, for debugging */
+struct clv_repaint_timeline {
+	u32 head;
+	u32 count;
+	struct clv_repaint_timeline_entry entries[CLV_REPAINT_TIMELINE_LEN];
+};
+
 struct clv_output {
 	struct clv_compositor *c;
 	u32 index;
@@ -312,6 +398,8 @@ struct clv_output {
 		REPAINT_AWAITING_COMPLETION,
 	} repaint_status;
 	struct clv_event_source *idle_repaint_source;
+	struct clv_event_source *repaint_timer;
+	struct clv_repaint_timeline timeline;
 	s32 repaint_needed;
 	s32 repaint_pending;
 	struct timespec next_repaint;
@@ -326,12 +414,18 @@ struct clv_output {
 
 	s32 enabled;
 
+	/* content damaged, cleared once the primary plane is rendered */
 	s32 primary_dirty;
 
 	struct clv_signal flip_signal;
 
 	void (*start_repaint_loop)(struct clv_output *output);
 	s32 (*repaint)(struct clv_output *output, void *repaint_data);
+	/*
+	 * Called once every output of the group has been repainted, so that
+	 * the outputs may render in parallel.
+	 */
+	s32 (*repaint_finish)(struct clv_output *output, void *repaint_data);
 	void (*assign_planes)(struct clv_output *output, void *repaint_data);
 	void (*destroy)(struct clv_output *output);
 	void (*enable)(struct clv_output *output, struct clv_rect *render_area);
@@ -341,7 +435,12 @@ struct clv_output {
 };
 
 struct clv_renderer {
+	/*
+	 * May only queue the paint, call repaint_output_wait before using
+	 * the output's back buffer.
+	 */
 	void (*repaint_output)(struct clv_output *output);
+	void (*repaint_output_wait)(struct clv_output *output);
 	void (*flush_damage)(struct clv_surface *surface);
 	void (*attach_buffer)(struct clv_surface *surface,
 			      struct clv_buffer *buffer);
@@ -364,6 +463,12 @@ struct clv_renderer {
 			       struct clv_buffer *buffer);
 	void (*output_destroy)(struct clv_output *output);
 	clockid_t (*get_clock_type)(struct clv_compositor *c);
+	/*
+	 * CPU renderers only, NULL otherwise. The XRGB8888 buffer of the
+	 * current mode's size the next repaint_output paints in.
+	 */
+	void (*output_set_buffer)(struct clv_output *output, void *pixels,
+				  u32 stride);
 };
 
 struct clv_server {
@@ -378,7 +483,7 @@ struct clv_server {
 
 	struct list_head client_agents;
 	s32 server_sock;
-	struct clv_event_source *server_source;
+	struct clv_ipc_worker *ipc_worker;
 
 	u8 *linkid_created_ack_tx_cmd_t;
 	u8 *linkid_created_ack_tx_cmd;
@@ -466,11 +571,14 @@ void clv_compositor_choose_mode_manually(struct clv_output *output,
 					 struct clv_rect *rc,
 					 enum timing_select_method method);
 void clv_output_schedule_repaint(struct clv_output *output, s32 cnt);
+void clv_output_schedule_cursor_repaint(struct clv_output *output);
 void clv_output_schedule_repaint_reset(struct clv_output *output);
 void clv_compositor_schedule_repaint(struct clv_compositor *c);
 void clv_surface_schedule_repaint(struct clv_surface *surface);
 void clv_view_schedule_repaint(struct clv_view *view);
+void clv_view_schedule_cursor_repaint(struct clv_view *view);
 void clv_output_finish_frame(struct clv_output *output, struct timespec *stamp);
+void clv_output_dump_repaint_timeline(struct clv_output *output, FILE *fp);
 void clv_surface_destroy(struct clv_surface *s);
 struct clv_surface *clv_surface_create(struct clv_compositor *c,
 				       struct clv_surface_info *si,
@@ -479,13 +587,25 @@ void clv_view_destroy(struct clv_view *v);
 struct clv_view *clv_view_create(struct clv_surface *s,
 				 struct clv_view_info *vi);
 void clv_surface_add_flip_listener(struct clv_surface *s);
+void clv_surface_request_frame(struct clv_surface *s);
+s32 clv_surface_commit(struct clv_surface *s, struct clv_buffer *buf,
+		       struct clv_commit_info *ci);
+s32 clv_compositor_queue_transaction(struct clv_client_agent *agent,
+				     struct clv_transaction_info *ti);
 
 struct clv_client_agent *client_agent_create(
 	struct clv_server *s,
 	s32 sock,
 	s32 (*client_sock_cb)(s32 fd, u32 mask, void *data));
+struct clv_surface *client_agent_find_surface(struct clv_client_agent *agent,
+					      u64 id);
+u64 client_agent_add_buffer(struct clv_client_agent *agent,
+			    struct clv_buffer *buf);
+struct clv_buffer *client_agent_find_buffer(struct clv_client_agent *agent,
+					    u64 id);
 void client_destroy_buf(struct clv_client_agent *agent, struct clv_buffer *buf);
 void client_agent_destroy(struct clv_client_agent *agent);
+s32 client_agent_send(struct clv_client_agent *agent, u8 *buf, u32 n);
 struct clv_buffer *shm_buffer_create(struct clv_bo_info *bi);
 void shm_buffer_destroy(struct clv_buffer *buffer);
 void set_compositor_dbg(u32 flags);
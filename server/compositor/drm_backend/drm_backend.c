@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <time.h>
+#include <sys/mman.h>
 #include <libudev.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -37,6 +38,8 @@
 #include <clover_event.h>
 #include <clover_log.h>
 #include <clover_region.h>
+#include <clover_pool.h>
+#include <clover_pixel.h>
 #include <clover_compositor.h>
 
 #ifndef CONFIG_ROCKCHIP_DRM_HWC
@@ -170,6 +173,7 @@ enum drm_fb_type {
 	DRM_BUF_DMABUF, /* for overlay plane */
 	DRM_BUF_GBM_SURFACE, /* internal EGL rendering */
 	DRM_BUF_CURSOR, /* internal cursor */
+	DRM_BUF_DUMB, /* internal CPU rendering */
 };
 
 struct drm_fb {
@@ -186,17 +190,36 @@ struct drm_fb {
 
 	struct gbm_bo *bo;
 	struct gbm_surface *gbm_surface;
+
+	void *map; /* dumb buffer mapping */
+};
+
+#define DRM_CURSOR_CACHE_SIZE 8
+/* one on screen, one queued, one painted */
+#define DRM_DUMB_BUFFERS 3
+
+struct drm_cursor_entry {
+	u64 hash;
+	u32 w, h;
+	u32 *pixels; /* packed, w * h */
+	struct drm_fb *fb;
+	u32 stamp;
+	struct list_head link;
 };
 
 struct drm_pending_state {
 	struct drm_backend *b;
 	struct list_head output_states;
+	/* of a repaint sequence, in the frame arena rather than the pool */
+	s32 in_frame_arena;
 };
 
 struct drm_output_state {
 	struct drm_pending_state *pending_state;
 	struct drm_output *output;
 	enum clv_dpms dpms;
+	/* primary fb reused, only the cursor plane has to be programmed */
+	s32 cursor_only;
 	struct list_head link;
 	struct list_head plane_states;
 };
@@ -236,6 +259,21 @@ struct drm_encoder {
 	struct drm_head *head;
 };
 
+#define DRM_PROP_SHADOWS 16
+
+/*
+ * Property values of a KMS object as the kernel has them. A property whose
+ * value is already there is left out of the atomic request.
+ */
+struct drm_prop_shadow {
+	u32 count;
+	u32 ids[DRM_PROP_SHADOWS];
+	u64 cur[DRM_PROP_SHADOWS];
+	u64 pending[DRM_PROP_SHADOWS];
+	u32 valid; /* cur is known */
+	u32 added; /* pending is in the request being built */
+};
+
 struct drm_plane {
 	struct clv_plane base;
 	struct drm_backend *b;
@@ -254,6 +292,7 @@ struct drm_plane {
 	u32 prop_src_w;
 	u32 prop_src_h;
 	u32 prop_color_space;
+	struct drm_prop_shadow shadow;
 
 	enum drm_plane_type type;
 
@@ -275,6 +314,7 @@ struct drm_head {
 	drmModeObjectProperties *props;
 	u32 prop_crtc_id;
 	u32 prop_hdmi_quant_range;
+	struct drm_prop_shadow shadow;
 
 	struct list_head link;
 
@@ -294,6 +334,7 @@ struct drm_output {
 
 	u32 prop_active;
 	u32 prop_mode_id;
+	struct drm_prop_shadow shadow;
 
 	struct list_head link;
 
@@ -305,27 +346,35 @@ struct drm_output {
 	struct drm_plane *cursor_plane;
 	struct drm_plane *overlay_plane;
 
-	struct drm_fb *cursor_fb[2];
-	s32 cursor_index;
+	/* cursor shapes, most recently used first */
+	struct list_head cursor_cache;
+	u32 cursor_cache_len;
+	u32 cursor_stamp;
+	struct drm_cursor_entry *cursor_cur;
+	/* cursor shown shifted at an edge, written in turns */
+	struct drm_fb *cursor_shift_fb[2];
+	s32 cursor_shift_index;
+	struct drm_cursor_entry *cursor_shift_e;
+	u32 cursor_shift_x, cursor_shift_y;
+	u32 *cursor_staging;
 
 	s32 disable_pending;
 	s32 atomic_complete_pending;
 
 	struct gbm_surface *gbm_surface;
 	uint32_t gbm_bo_flags;
+	/* GL paint queued, the buffer is picked up in repaint_finish */
+	s32 render_pending;
+
+	/* used in place of the gbm surface with a CPU renderer */
+	struct drm_fb *dumb_fb[DRM_DUMB_BUFFERS];
+	struct drm_fb *dumb_cur;
 
 	/* The last state submitted to the kernel for this CRTC. */
 	struct drm_output_state *state_cur;
 	/* The previously-submitted state, where the hardware has not
 	 * yet acknowledged completion of state_cur. */
 	struct drm_output_state *state_last;
-
-#ifdef CONFIG_ROCKCHIP_DRM_HWC
-	/*
-	 * for cursor which has hot_x/hot_y.
-	 */
-	s32 cursor_relocate;
-#endif
 };
 
 struct drm_backend {
@@ -340,6 +389,8 @@ struct drm_backend {
 	s32 fd;
 
 	u32 cursor_width, cursor_height;
+	/* the cursor buffer last hashed into the cursor caches */
+	struct clv_buffer *cursor_buf;
 
 	struct udev *udev;
 	struct clv_event_source *drm_source;
@@ -350,10 +401,14 @@ struct drm_backend {
 
 	struct gbm_device *gbm;
 	u32 gbm_format;
+	/* the renderer paints on the CPU, in dumb buffers */
+	s32 use_dumb;
 
 	void *repaint_data;
 
 	s32 state_invalid;
+	/* rewound and refilled for every commit */
+	drmModeAtomicReq *atomic_req;
 
 	drmModeRes *res;
 	drmModePlaneRes *pres;
@@ -361,6 +416,11 @@ struct drm_backend {
 	struct list_head outputs;
 	struct list_head planes;
 	struct list_head heads;
+
+	/* per-frame state objects, recycled instead of malloc / free */
+	struct clv_pool pending_state_pool;
+	struct clv_pool output_state_pool;
+	struct clv_pool plane_state_pool;
 };
 
 static struct drm_backend *to_drm_backend(struct clv_compositor *c)
@@ -614,6 +674,80 @@ static struct drm_fb *drm_fb_get_from_dmabuf(struct clv_buffer *buffer,
 	return fb;
 }
 
+static void drm_fb_destroy_dumb(struct drm_fb *fb)
+{
+	struct drm_mode_destroy_dumb req;
+
+	if (fb->map)
+		munmap(fb->map, fb->size);
+	/* the kms fb holds its own reference to the buffer */
+	if (fb->handles[0]) {
+		memset(&req, 0, sizeof(req));
+		req.handle = fb->handles[0];
+		drmIoctl(fb->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &req);
+	}
+	drm_fb_destroy(fb);
+}
+
+static struct drm_fb *drm_fb_create_dumb(struct drm_backend *b, u32 w, u32 h)
+{
+	struct drm_mode_create_dumb create_req;
+	struct drm_mode_map_dumb map_req;
+	struct drm_fb *fb;
+
+	fb = calloc(1, sizeof(*fb));
+	if (!fb)
+		return NULL;
+
+	fb->refcnt = 1;
+	fb->type = DRM_BUF_DUMB;
+	fb->fd = b->fd;
+
+	memset(&create_req, 0, sizeof(create_req));
+	create_req.width = w;
+	create_req.height = h;
+	create_req.bpp = 32;
+	if (drmIoctl(b->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_req) < 0) {
+		drm_err("failed to create %ux%u dumb buffer: %s", w, h,
+			strerror(errno));
+		free(fb);
+		return NULL;
+	}
+
+	fb->handles[0] = create_req.handle;
+	fb->strides[0] = create_req.pitch;
+	fb->size = create_req.size;
+	fb->w = w;
+	fb->h = h;
+	fb->drm_fmt = DRM_FORMAT_XRGB8888;
+
+	if (drm_fb_addfb(b, fb) != 0) {
+		drm_err("failed to create kms fb: %s", strerror(errno));
+		goto err;
+	}
+
+	memset(&map_req, 0, sizeof(map_req));
+	map_req.handle = fb->handles[0];
+	if (drmIoctl(b->fd, DRM_IOCTL_MODE_MAP_DUMB, &map_req) < 0) {
+		drm_err("failed to map dumb buffer: %s", strerror(errno));
+		goto err;
+	}
+
+	fb->map = mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       b->fd, map_req.offset);
+	if (fb->map == MAP_FAILED) {
+		drm_err("failed to mmap dumb buffer: %s", strerror(errno));
+		fb->map = NULL;
+		goto err;
+	}
+
+	return fb;
+
+err:
+	drm_fb_destroy_dumb(fb);
+	return NULL;
+}
+
 static void drm_fb_unref(struct drm_fb *fb)
 {
 	if (!fb) {
@@ -644,6 +778,10 @@ static void drm_fb_unref(struct drm_fb *fb)
 		drm_debug("[FB] Real destroy dmabuf bo");
 		drm_fb_destroy_dmabuf(fb);
 		break;
+	case DRM_BUF_DUMB:
+		drm_debug("[FB] Real destroy dumb buffer");
+		drm_fb_destroy_dumb(fb);
+		break;
 	default:
 		assert(NULL);
 		break;
@@ -981,7 +1119,7 @@ static void drm_plane_state_free(struct drm_plane_state *state, s32 force)
 	state->output_state = NULL;
 	if (force || state != state->plane->state_cur) {
 		drm_fb_unref(state->fb);
-		free(state);
+		clv_pool_free(&state->plane->b->plane_state_pool, state);
 	}
 }
 
@@ -1000,7 +1138,7 @@ static void drm_output_state_free(struct drm_output_state *state)
 
 	list_del(&state->link);
 
-	free(state);
+	clv_pool_free(&state->output->b->output_state_pool, state);
 }
 
 static void drm_output_assign_state(struct drm_output_state *state,s32 is_async)
@@ -1047,6 +1185,120 @@ static void drm_output_assign_state(struct drm_output_state *state,s32 is_async)
 
 static s32 drm_mode_ensure_blob(struct drm_backend *b, struct drm_mode *mode);
 
+static struct drm_plane_state *drm_output_state_get_existing_plane(
+				struct drm_output_state *output_state,
+				struct drm_plane *plane);
+
+static s32 drm_plane_state_same(struct drm_plane_state *a,
+				struct drm_plane_state *b)
+{
+	return a && b && a->fb == b->fb
+		&& a->src_x == b->src_x && a->src_y == b->src_y
+		&& a->src_w == b->src_w && a->src_h == b->src_h
+		&& a->crtc_x == b->crtc_x && a->crtc_y == b->crtc_y
+		&& a->crtc_w == b->crtc_w && a->crtc_h == b->crtc_h;
+}
+
+/*
+ * A cursor-only frame leaves the CRTC, the connector and every plane but
+ * the cursor out of the request. The cursor plane must be shown, its
+ * CRTC_ID pulls the CRTC into the commit for the flip event.
+ */
+static s32 drm_output_state_cursor_only(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct drm_plane_state *cursor_state;
+
+	if (!state->cursor_only || output->b->state_invalid
+	    || state->dpms != output->state_cur->dpms
+	    || state->dpms != CLV_DPMS_ON || !output->cursor_plane)
+		return 0;
+
+	cursor_state = drm_output_state_get_existing_plane(state,
+							  output->cursor_plane);
+
+	return cursor_state && cursor_state->fb;
+}
+
+/*
+ * Add a property to the request unless the kernel already has the value.
+ * always forces it in, e.g. FB_ID which brings the CRTC of a plane into the
+ * commit for its flip event. Returns as drmModeAtomicAddProperty, a value
+ * left out counts as added.
+ */
+static s32 drm_prop_add(drmModeAtomicReq *req, struct drm_prop_shadow *sh,
+			u32 obj_id, u32 prop_id, u64 value, s32 always)
+{
+	u32 i, bit;
+
+	for (i = 0; i < sh->count; i++)
+		if (sh->ids[i] == prop_id)
+			break;
+	if (i == sh->count) {
+		if (i == DRM_PROP_SHADOWS)
+			return drmModeAtomicAddProperty(req, obj_id, prop_id,
+							value);
+		sh->ids[i] = prop_id;
+		sh->count++;
+	}
+
+	bit = 1U << i;
+	if (sh->added & bit) {
+		/* the request keeps the last value added */
+		if (sh->pending[i] == value)
+			return 1;
+	} else if (!always && (sh->valid & bit) && sh->cur[i] == value) {
+		return 1;
+	}
+
+	sh->pending[i] = value;
+	sh->added |= bit;
+	return drmModeAtomicAddProperty(req, obj_id, prop_id, value);
+}
+
+/* the request is gone, its values are the kernel's if it was committed */
+static void drm_prop_shadow_done(struct drm_prop_shadow *sh, s32 committed)
+{
+	u32 i;
+
+	if (committed) {
+		for (i = 0; i < sh->count; i++)
+			if (sh->added & (1U << i))
+				sh->cur[i] = sh->pending[i];
+		sh->valid |= sh->added;
+	}
+	sh->added = 0;
+}
+
+static void drm_prop_shadows_done(struct drm_backend *b, s32 committed)
+{
+	struct drm_output *output;
+	struct drm_plane *plane;
+	struct drm_head *head;
+
+	list_for_each_entry(output, &b->outputs, link)
+		drm_prop_shadow_done(&output->shadow, committed);
+	list_for_each_entry(plane, &b->planes, link)
+		drm_prop_shadow_done(&plane->shadow, committed);
+	list_for_each_entry(head, &b->heads, link)
+		drm_prop_shadow_done(&head->shadow, committed);
+}
+
+/* nothing is known of the kernel state, e.g. after a hotplug */
+static void drm_prop_shadows_invalidate(struct drm_backend *b)
+{
+	struct drm_output *output;
+	struct drm_plane *plane;
+	struct drm_head *head;
+
+	list_for_each_entry(output, &b->outputs, link)
+		output->shadow.valid = 0;
+	list_for_each_entry(plane, &b->planes, link)
+		plane->shadow.valid = 0;
+	list_for_each_entry(head, &b->heads, link)
+		head->shadow.valid = 0;
+}
+
 static s32 drm_output_apply_state_atomic(struct drm_output_state *state,
 					 drmModeAtomicReq *req,
 					 u32 *flags)
@@ -1055,6 +1307,8 @@ static s32 drm_output_apply_state_atomic(struct drm_output_state *state,
 	struct drm_backend *b = to_drm_backend(output->base.c);
 	struct drm_plane_state *plane_state, *next;
 	struct drm_mode *current_mode = to_drm_mode(output->base.current_mode);
+	struct drm_plane *plane;
+	s32 cursor_only;
 	s32 ret = 0;
 
 	drm_debug(":::state->dpms = %u output->state_cur->dpms = %u",
@@ -1062,43 +1316,49 @@ static s32 drm_output_apply_state_atomic(struct drm_output_state *state,
 	if (state->dpms != output->state_cur->dpms) {
 		*flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
 		drm_debug("ModeSet!!!");
+		/* a modeset is sent in full */
+		output->shadow.valid = 0;
+		output->head->shadow.valid = 0;
+		list_for_each_entry(plane, &output->planes, output_link)
+			plane->shadow.valid = 0;
 	}
 
-	if (state->dpms == CLV_DPMS_ON) {
+	cursor_only = drm_output_state_cursor_only(state);
+	if (cursor_only) {
+		drm_debug("cursor only frame on output %u", output->index);
+	} else if (state->dpms == CLV_DPMS_ON) {
 		drm_debug("[MODSET] DPMS is set to [ON ] ..................\n");
 		ret = drm_mode_ensure_blob(b, current_mode);
 		if (ret != 0)
 			return ret;
 
 		drm_debug("[MODESET] Set output %u active", output->index);
-		drmModeAtomicAddProperty(req, output->crtc_id,
-					 output->prop_mode_id,
-					 current_mode->blob_id);
-		drmModeAtomicAddProperty(req, output->crtc_id,
-					 output->prop_active,
-					 1);
-		drmModeAtomicAddProperty(req, output->head->connector_id,
-					 output->head->prop_crtc_id,
-					 output->crtc_id);
+		drm_prop_add(req, &output->shadow, output->crtc_id,
+			     output->prop_mode_id, current_mode->blob_id, 0);
+		drm_prop_add(req, &output->shadow, output->crtc_id,
+			     output->prop_active, 1, 0);
+		drm_prop_add(req, &output->head->shadow,
+			     output->head->connector_id,
+			     output->head->prop_crtc_id, output->crtc_id, 0);
 		if (output->head->prop_hdmi_quant_range != ((u32)-1)) {
-			drmModeAtomicAddProperty(
-					req,
-					output->head->connector_id,
-					output->head->prop_hdmi_quant_range, 2);
+			drm_prop_add(req, &output->head->shadow,
+				     output->head->connector_id,
+				     output->head->prop_hdmi_quant_range, 2, 0);
 		}
 	} else {
 		drm_debug("[MODESET] DPMS is set to [OFF] .................\n");
 		drm_debug("[MODESET] Set output %u inactive", output->index);
-		drmModeAtomicAddProperty(req, output->crtc_id,
-					 output->prop_mode_id, 0);
-		drmModeAtomicAddProperty(req, output->crtc_id,
-					 output->prop_active, 0);
-		drmModeAtomicAddProperty(req, output->head->connector_id,
-					 output->head->prop_crtc_id, 0);
+		drm_prop_add(req, &output->shadow, output->crtc_id,
+			     output->prop_mode_id, 0, 0);
+		drm_prop_add(req, &output->shadow, output->crtc_id,
+			     output->prop_active, 0, 0);
+		drm_prop_add(req, &output->head->shadow,
+			     output->head->connector_id,
+			     output->head->prop_crtc_id, 0, 0);
 	}
 
 	list_for_each_entry_safe(plane_state, next, &state->plane_states, link){
-		struct drm_plane *plane = plane_state->plane;
+		plane = plane_state->plane;
 
 		if (plane_state->fb) {
 			if (!plane) {
@@ -1127,58 +1387,53 @@ static s32 drm_output_apply_state_atomic(struct drm_output_state *state,
 		}
 //		if (plane_state->fb)
 //			clv_debug("apply fb's fd %d", plane_state->fb->dma_fd);
+
+		if (cursor_only && plane != output->cursor_plane
+		    && drm_plane_state_same(plane_state, plane->state_cur))
+			continue;
 		
-		drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_fb_id,
-					 plane_state->fb ?
-					     plane_state->fb->fb_id : 0);
+		drm_prop_add(req, &plane->shadow, plane->plane_id,
+			     plane->prop_fb_id,
+			     plane_state->fb ? plane_state->fb->fb_id : 0, 1);
 
 		drm_debug("plane index %u fb_id %u", plane->index,
 			  plane_state->fb ? plane_state->fb->fb_id : 0);
-		drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_crtc_id,
-					 plane_state->fb ?
-					     output->crtc_id : 0);
+		drm_prop_add(req, &plane->shadow, plane->plane_id,
+			     plane->prop_crtc_id,
+			     plane_state->fb ? output->crtc_id : 0, 0);
 		drm_debug("plane index %u crtc index %u crtc_id %u",
 			  plane->index, output->index, plane_state->fb ?
 					     output->crtc_id : 0);
 			  
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					       plane->prop_src_x,
-					       plane_state->src_x);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_src_x, plane_state->src_x, 0);
 		drm_debug("SRC_X %d %d", plane_state->src_x, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_src_y,
-					 plane_state->src_y);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_src_y, plane_state->src_y, 0);
 		drm_debug("SRC_Y %d %d", plane_state->src_y, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_src_w,
-					 plane_state->src_w);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_src_w, plane_state->src_w, 0);
 		drm_debug("SRC_W %u %d", plane_state->src_w, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_src_h,
-					 plane_state->src_h);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_src_h, plane_state->src_h, 0);
 		drm_debug("SRC_H %u %d", plane_state->src_h, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_crtc_x,
-					 plane_state->crtc_x);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_crtc_x, plane_state->crtc_x, 0);
 		drm_debug("CRTC X %d %d", plane_state->crtc_x, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_crtc_y,
-					 plane_state->crtc_y);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_crtc_y, plane_state->crtc_y, 0);
 		drm_debug("CRTC Y %d %d", plane_state->crtc_y, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_crtc_w,
-					 plane_state->crtc_w);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_crtc_w, plane_state->crtc_w, 0);
 		drm_debug("CRTC W %u %d", plane_state->crtc_w, ret);
-		ret = drmModeAtomicAddProperty(req, plane->plane_id,
-					 plane->prop_crtc_h,
-					 plane_state->crtc_h);
+		ret = drm_prop_add(req, &plane->shadow, plane->plane_id,
+				   plane->prop_crtc_h, plane_state->crtc_h, 0);
 		drm_debug("CRTC H %u %d", plane_state->crtc_h, ret);
 		if (plane->prop_color_space != ((u32)-1)) {
-			ret = drmModeAtomicAddProperty(req, plane->plane_id,
-						plane->prop_color_space,
-						V4L2_COLORSPACE_REC709);
+			ret = drm_prop_add(req, &plane->shadow,
+					   plane->plane_id,
+					   plane->prop_color_space,
+					   V4L2_COLORSPACE_REC709, 0);
 			drm_debug("COLOR SPACE %u %d", V4L2_COLORSPACE_REC709,
 					ret);
 		}
@@ -1211,7 +1466,7 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 	struct drm_backend *b = ps->b;
 	struct drm_output_state *output_state, *tmp;
 	struct drm_plane *plane;
-	drmModeAtomicReq *req = drmModeAtomicAlloc();
+	drmModeAtomicReq *req;
 	u32 flags;
 	s32 ret = 0;
 	struct clv_head *head_base;
@@ -1219,8 +1474,14 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 	struct drm_output *output;
 	struct timespec now, t1, t2, t3, t4, t5;
 
-	if (!req)
+	if (!b->atomic_req)
+		b->atomic_req = drmModeAtomicAlloc();
+	req = b->atomic_req;
+	if (!req) {
+		drm_pending_state_free(ps);
 		return -1;
+	}
+	drmModeAtomicSetCursor(req, 0);
 
 	if (is_async) {
 		flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
@@ -1232,6 +1493,8 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 	if (b->state_invalid) {
 		s32 err;
 
+		drm_prop_shadows_invalidate(b);
+
 		list_for_each_entry(head_base, &b->c->heads, link) {
 			drm_debug("<<< head %u's status: %u >>>",
 				  head_base->index, head_base->connected);
@@ -1244,20 +1507,21 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 			drm_debug("\t\t[atomic] disabling inactive head %u",
 				  head_base->index);
 
-			err = drmModeAtomicAddProperty(req, head->connector_id,
-						       head->prop_crtc_id, 0);
+			err = drm_prop_add(req, &head->shadow,
+					   head->connector_id,
+					   head->prop_crtc_id, 0, 0);
 			if (err <= 0)
 				ret = -1;
 
 			output = head->output;
-			err = drmModeAtomicAddProperty(req,
-						       output->crtc_id,
-						       output->prop_active, 0);
+			err = drm_prop_add(req, &output->shadow,
+					   output->crtc_id,
+					   output->prop_active, 0, 0);
 			if (err <= 0)
 				ret = -1;
-			err = drmModeAtomicAddProperty(req,
-						       output->crtc_id,
-						       output->prop_mode_id, 0);
+			err = drm_prop_add(req, &output->shadow,
+					   output->crtc_id,
+					   output->prop_mode_id, 0, 0);
 			if (err <= 0)
 				ret = -1;
 		}
@@ -1268,10 +1532,10 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 			drm_debug("[MODESET] clear output %u's plane %u",
 				  plane->output->index,
 				  plane->index);
-			drmModeAtomicAddProperty(req, plane->plane_id,
-						 plane->prop_crtc_id, 0);
-			drmModeAtomicAddProperty(req, plane->plane_id,
-						 plane->prop_fb_id, 0);
+			drm_prop_add(req, &plane->shadow, plane->plane_id,
+				     plane->prop_crtc_id, 0, 0);
+			drm_prop_add(req, &plane->shadow, plane->plane_id,
+				     plane->prop_fb_id, 0, 0);
 		}
 
 		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
@@ -1326,7 +1590,7 @@ static s32 drm_pending_state_apply_atomic(struct drm_pending_state *ps,
 	timer_debug("is_async = %d, flags = %u", is_async, flags);
 
 out:
-	drmModeAtomicFree(req);
+	drm_prop_shadows_done(b, ret == 0);
 	drm_pending_state_free(ps);
 	return ret;
 }
@@ -1346,7 +1610,7 @@ static struct drm_pending_state *drm_pending_state_alloc(struct drm_backend *b)
 	struct drm_pending_state *ps;
 
 	ps_debug("pending state alloc");
-	ps = calloc(1, sizeof(*(ps)));
+	ps = clv_pool_alloc(&b->pending_state_pool);
 	if (!ps)
 		return NULL;
 
@@ -1368,7 +1632,8 @@ static void drm_pending_state_free(struct drm_pending_state *ps)
 		drm_output_state_free(output_state);
 	}
 
-	free(ps);
+	if (!ps->in_frame_arena)
+		clv_pool_free(&ps->b->pending_state_pool, ps);
 }
 
 static struct drm_output_state *drm_pending_state_get_output(
@@ -1390,7 +1655,16 @@ static void *drm_repaint_begin(struct clv_compositor *c)
 	struct drm_backend *b = to_drm_backend(c);
 	struct drm_pending_state *ps;
 
-	ps = drm_pending_state_alloc(b);
+	/*
+	 * Freed by flush or cancel, before the arena is reset. The output and
+	 * plane states may become state_cur, they stay in their pools.
+	 */
+	ps = clv_arena_alloc(&c->frame_arena, sizeof(*ps));
+	if (ps) {
+		ps->b = b;
+		INIT_LIST_HEAD(&ps->output_states);
+		ps->in_frame_arena = 1;
+	}
 	drm_debug("start pending_state %p", ps);
 	b->repaint_data = ps;
 	return ps;
@@ -1706,25 +1980,20 @@ static void drm_plane_state_put_back(struct drm_plane_state *state)
 	(void)drm_plane_state_alloc(plane, state_output);
 }
 
-static struct drm_fb *drm_output_render_gl(struct drm_output_state *state)
+static struct drm_fb *drm_output_render_gl_finish(struct drm_output *output)
 {
-	struct drm_output *output = state->output;
 	struct drm_backend *b = to_drm_backend(output->base.c);
 	struct gbm_bo *bo;
 	struct drm_fb *ret;
-	//struct timespec t1, t2;
 
-	drm_debug("render gl: %u %d,%d %ux%u",
-		  output->index,
-		  output->base.render_area.pos.x,
-		  output->base.render_area.pos.y,
-		  output->base.render_area.w,
-		  output->base.render_area.h);
-	//clock_gettime(b->c->clk_id, &t1);
-	output->base.c->renderer->repaint_output(&output->base);
-	//clock_gettime(b->c->clk_id, &t2);
-	//printf("renderer repaint %u spent %ld ms\n", output->index,
-	//	    timespec_sub_to_msec(&t2, &t1));
+	if (output->base.c->renderer->repaint_output_wait)
+		output->base.c->renderer->repaint_output_wait(&output->base);
+
+	if (b->use_dumb) {
+		ret = output->dumb_cur;
+		output->dumb_cur = NULL;
+		return ret ? drm_fb_ref(ret) : NULL;
+	}
 
 	bo = gbm_surface_lock_front_buffer(output->gbm_surface);
 	if (!bo) {
@@ -1743,6 +2012,75 @@ static struct drm_fb *drm_output_render_gl(struct drm_output_state *state)
 	return ret;
 }
 
+/* a dumb buffer held by the output only, neither on screen nor queued */
+static struct drm_fb *drm_output_get_dumb(struct drm_output *output)
+{
+	s32 i;
+
+	for (i = 0; i < DRM_DUMB_BUFFERS; i++) {
+		if (output->dumb_fb[i] && output->dumb_fb[i]->refcnt == 1)
+			return output->dumb_fb[i];
+	}
+
+	drm_warn("no free dumb buffer on output %u", output->index);
+	return NULL;
+}
+
+static void drm_output_render_gl(struct drm_output_state *state)
+{
+	struct drm_output *output = state->output;
+	struct clv_renderer *renderer = output->base.c->renderer;
+	struct drm_fb *fb;
+	//struct timespec t1, t2;
+
+	drm_debug("render gl: %u %d,%d %ux%u",
+		  output->index,
+		  output->base.render_area.pos.x,
+		  output->base.render_area.pos.y,
+		  output->base.render_area.w,
+		  output->base.render_area.h);
+	//clock_gettime(b->c->clk_id, &t1);
+	if (output->b->use_dumb) {
+		/* finish hands a NULL fb over if there is none to paint in */
+		fb = output->dumb_cur = drm_output_get_dumb(output);
+		if (fb) {
+			renderer->output_set_buffer(&output->base, fb->map,
+						    fb->strides[0]);
+			renderer->repaint_output(&output->base);
+		}
+	} else {
+		renderer->repaint_output(&output->base);
+	}
+	//clock_gettime(b->c->clk_id, &t2);
+	//printf("renderer repaint %u spent %ld ms\n", output->index,
+	//	    timespec_sub_to_msec(&t2, &t1));
+	output->render_pending = 1;
+}
+
+static void drm_output_set_primary_fb(struct drm_output *output,
+				      struct drm_plane_state *primary_state,
+				      struct drm_fb *fb)
+{
+	if (!fb) {
+		//assert(0);
+		drm_plane_state_put_back(primary_state);
+		return;
+	}
+
+	primary_state->fb = fb;
+	primary_state->output = output;
+
+	primary_state->src_x = 0;
+	primary_state->src_y = 0;
+	primary_state->src_w = output->base.current_mode->w << 16;
+	primary_state->src_h = output->base.current_mode->h << 16;
+
+	primary_state->crtc_x = 0;
+	primary_state->crtc_y = 0;
+	primary_state->crtc_w = primary_state->src_w >> 16;
+	primary_state->crtc_h = primary_state->src_h >> 16;
+}
+
 static void drm_output_render(struct drm_output_state *state)
 {
 	struct drm_output *output = state->output;
@@ -1759,16 +2097,21 @@ static void drm_output_render(struct drm_output_state *state)
 	}
 
 	if (!output->base.primary_dirty && primary_plane->state_cur->fb &&
-	    primary_plane->state_cur->fb->type == DRM_BUF_GBM_SURFACE &&
+	    (primary_plane->state_cur->fb->type == DRM_BUF_GBM_SURFACE ||
+	     primary_plane->state_cur->fb->type == DRM_BUF_DUMB) &&
 	    primary_plane->state_cur->fb->w ==
 		output->base.current_mode->w &&
 	    primary_plane->state_cur->fb->h ==
 		output->base.current_mode->h) {
 		drm_debug("TAG");
 		fb = drm_fb_ref(primary_plane->state_cur->fb);
+		drm_output_set_primary_fb(output, primary_state, fb);
+		state->cursor_only = 1;
 	} else {
 		drm_debug("TAG");
-		fb = drm_output_render_gl(state);
+		state->cursor_only = 0;
+		/* the renderer may paint on its own thread */
+		drm_output_render_gl(state);
 /*
 		if (output->base.changed) {
 			output->base.changed--;
@@ -1776,25 +2119,6 @@ static void drm_output_render(struct drm_output_state *state)
 */
 		output->base.primary_dirty = 0;
 	}
-
-	if (!fb) {
-		//assert(0);
-		drm_plane_state_put_back(primary_state);
-		return;
-	}
-
-	primary_state->fb = fb;
-	primary_state->output = output;
-
-	primary_state->src_x = 0;
-	primary_state->src_y = 0;
-	primary_state->src_w = output->base.current_mode->w << 16;
-	primary_state->src_h = output->base.current_mode->h << 16;
-
-	primary_state->crtc_x = 0;
-	primary_state->crtc_y = 0;
-	primary_state->crtc_w = primary_state->src_w >> 16;
-	primary_state->crtc_h = primary_state->src_h >> 16;
 }
 
 static s32 drm_output_repaint(struct clv_output *base, void *repaint_data)
@@ -1803,6 +2127,7 @@ static s32 drm_output_repaint(struct clv_output *base, void *repaint_data)
 	struct drm_output_state *state;
 	struct drm_pending_state *ps = repaint_data;
 	struct drm_plane_state *primary_state;
+	struct drm_fb *fb;
 
 	if (output->disable_pending) {
 		drm_debug("disable pending, return from output repaint.");
@@ -1811,7 +2136,9 @@ static s32 drm_output_repaint(struct clv_output *base, void *repaint_data)
 
 	drm_debug("output repaint %u, enabled ? %d", base->index,
 		  base->enabled);
+	/* only one atomic commit may be in flight per CRTC */
 	assert(!output->state_last);
+	assert(!output->atomic_complete_pending);
 	state = drm_pending_state_get_output(ps, output);
 	drm_debug("state = %p", state);
 	if (!state) {
@@ -1829,105 +2156,282 @@ static s32 drm_output_repaint(struct clv_output *base, void *repaint_data)
 	return 0;
 
 error:
+	if (output->render_pending) {
+		/* repaint_finish is not called for a failed output */
+		output->render_pending = 0;
+		fb = drm_output_render_gl_finish(output);
+		if (fb)
+			drm_fb_unref(fb);
+	}
 	drm_output_state_free(state);
 	return -1;
 }
 
-static struct drm_plane_state *drm_output_state_get_existing_plane(
-				struct drm_output_state *output_state,
-				struct drm_plane *plane);
+/*
+ * Second half of drm_output_repaint, called after all the outputs of the
+ * repaint group have queued their paint.
+ */
+static s32 drm_output_repaint_finish(struct clv_output *base,
+				     void *repaint_data)
+{
+	struct drm_output *output = to_drm_output(base);
+	struct drm_pending_state *ps = repaint_data;
+	struct drm_output_state *state;
+	struct drm_plane_state *primary_state;
+	struct drm_fb *fb;
 
-static void cursor_update(struct drm_backend *b, struct clv_view *v)
+	if (!output->render_pending)
+		return 0;
+	output->render_pending = 0;
+
+	fb = drm_output_render_gl_finish(output);
+	state = drm_pending_state_get_output(ps, output);
+	assert(state);
+	primary_state = drm_output_state_get_plane(state,output->primary_plane);
+	drm_output_set_primary_fb(output, primary_state, fb);
+
+	return 0;
+}
+
+/*
+ * Cursor image cache.
+ *
+ * Every cursor shape gets its own BO, keyed by a hash of the pixels, so
+ * switching back to a known shape copies nothing and a BO being scanned out
+ * is never written. The HWC cursor plane cannot start left of or above the
+ * CRTC, near those edges the image is shown shifted. There is one shifted
+ * image per pixel of offset, those are not cached but written in turns to
+ * two BOs of the output, the one not on screen.
+ */
+static u64 cursor_hash(u8 *pixels, u32 stride, u32 w, u32 h)
 {
-	struct drm_output *output;
-	struct gbm_bo *bo;
-	struct clv_buffer *buffer = v->cursor_buf;
-	struct shm_buffer *shm_buf = container_of(buffer, struct shm_buffer,
-						  base);
+	u64 hash = 0xcbf29ce484222325ull; /* FNV-1a, a pixel at a time */
+	u32 *row;
+	u32 i, j;
 
-	list_for_each_entry(output, &b->outputs, link) {
-		drm_debug("update output[%d]'s cursor", output->index);
-		output->cursor_index = 1 - output->cursor_index;
-		bo = output->cursor_fb[output->cursor_index]->bo;
-		if (gbm_bo_write(bo, shm_buf->shm.map,
-				buffer->stride * buffer->h) < 0)
-			gbm_err("write cursor bo failed. %s", strerror(errno));
-		clv_region_fini(&v->surface->damage);
-		clv_region_init(&v->surface->damage);
+	for (i = 0; i < h; i++) {
+		row = (u32 *)(pixels + i * stride);
+		for (j = 0; j < w; j++) {
+			hash ^= row[j];
+			hash *= 0x100000001b3ull;
+		}
 	}
+
+	return hash;
 }
 
-#ifdef CONFIG_ROCKCHIP_DRM_HWC
-static void cursor_relocate(struct drm_output *output, struct clv_view *v,
-			    s32 x, s32 y, u32 width, u32 height)
+static struct drm_fb *cursor_fb_create(struct drm_output *output)
 {
+	struct drm_backend *b = output->b;
 	struct gbm_bo *bo;
-	struct clv_buffer *buffer = v->cursor_buf;
-	struct shm_buffer *shm_buf = container_of(buffer, struct shm_buffer,
-						  base);
-	u32 cp_w, cp_h, skip_x, skip_y;
-	s32 i;
-	u32 buf[64*64];
+	struct drm_fb *fb;
 
-	if (width > 64) {
-		drm_err("width illegal %u", width);
-		return;
+	bo = gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
+			   GBM_FORMAT_ARGB8888,
+			   GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+	if (!bo) {
+		drm_err("failed to create cursor bo. %s", strerror(errno));
+		return NULL;
 	}
 
-	if (height > 64) {
-		drm_err("height illegal %u", height);
-		return;
+	fb = drm_fb_get_from_bo(bo, b, 0, DRM_BUF_CURSOR);
+	if (!fb)
+		gbm_bo_destroy(bo);
+
+	return fb;
+}
+
+/* write the image of e shifted by skip_x, skip_y to the BO of fb */
+static s32 cursor_fb_write(struct drm_output *output, struct drm_fb *fb,
+			   struct drm_cursor_entry *e, u32 skip_x, u32 skip_y)
+{
+	struct drm_backend *b = output->b;
+	u32 stride = gbm_bo_get_stride(fb->bo) / 4;
+	u32 size = stride * b->cursor_height * 4;
+
+	/* cursor BOs of an output all have the same stride */
+	if (!output->cursor_staging) {
+		output->cursor_staging = malloc(size);
+		if (!output->cursor_staging)
+			return -1;
 	}
 
-	if (buffer->w == 0 || buffer->w > 64) {
-		drm_err("buffer width illegal %u", buffer->w);
-		return;
+	memset(output->cursor_staging, 0, size);
+	clv_pixel_copy_rect(output->cursor_staging, stride * 4,
+			    e->pixels + skip_y * e->w + skip_x, e->w * 4,
+			    (e->w - skip_x) * 4, e->h - skip_y);
+
+	if (gbm_bo_write(fb->bo, output->cursor_staging, size) < 0) {
+		gbm_err("write cursor bo failed. %s", strerror(errno));
+		return -1;
 	}
 
-	if (buffer->h == 0 || buffer->h > 64) {
-		drm_err("buffer height illegal %u", buffer->h);
-		return;
+	return 0;
+}
+
+static void cursor_entry_destroy(struct drm_output *output,
+				 struct drm_cursor_entry *e)
+{
+	/* plane states keep their own reference until the flip is done */
+	drm_fb_unref(e->fb);
+	if (output->cursor_cur == e)
+		output->cursor_cur = NULL;
+	if (output->cursor_shift_e == e)
+		output->cursor_shift_e = NULL;
+	list_del(&e->link);
+	output->cursor_cache_len--;
+	free(e->pixels);
+	free(e);
+}
+
+static s32 cursor_entry_match(struct drm_cursor_entry *e, u64 hash,
+			      u8 *pixels, u32 stride, u32 w, u32 h)
+{
+	u32 i;
+
+	if (e->hash != hash || e->w != w || e->h != h)
+		return 0;
+
+	for (i = 0; i < h; i++) {
+		if (memcmp(e->pixels + i * w, pixels + i * stride, w * 4))
+			return 0;
 	}
 
-	bo = output->cursor_fb[output->cursor_index]->bo;
+	return 1;
+}
 
-	if (x > 0) {
-		skip_x = 0;
-		cp_w = width;
-	} else {
-		skip_x = -x;
-		if (x < -63) {
-			drm_warn("x = %d", x);
-			return;
+static struct drm_cursor_entry *cursor_cache_get(struct drm_output *output,
+						 u64 hash, u8 *pixels,
+						 u32 stride, u32 w, u32 h)
+{
+	struct drm_cursor_entry *e, *lru = NULL;
+
+	list_for_each_entry(e, &output->cursor_cache, link) {
+		if (cursor_entry_match(e, hash, pixels, stride, w, h)) {
+			drm_debug("cursor cache hit %016llX",
+				  (unsigned long long)hash);
+			e->stamp = ++output->cursor_stamp;
+			return e;
 		}
-		cp_w = width + x;
+		if (!lru || e->stamp < lru->stamp)
+			lru = e;
 	}
 
-	if (y > 0) {
-		skip_y = 0;
-		cp_h = height;
-	} else {
-		skip_y = -y;
-		if (y < -63) {
-			drm_warn("y = %d", y);
-			return;
-		}
-		cp_h = height + y;
+	if (output->cursor_cache_len >= DRM_CURSOR_CACHE_SIZE)
+		cursor_entry_destroy(output, lru);
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	e->pixels = malloc(w * h * 4);
+	if (!e->pixels) {
+		free(e);
+		return NULL;
 	}
+	clv_pixel_copy_rect(e->pixels, w * 4, pixels, stride, w * 4, h);
+	e->hash = hash;
+	e->w = w;
+	e->h = h;
 
-	memset(buf, 0, 64 * 64 * 4);
-	
-	for (i = 0; i < cp_h; i++) {
-		memcpy(buf + i * buffer->w,
-		       shm_buf->shm.map + (i + skip_y) * buffer->stride
-		       		+ skip_x * 4,
-		       cp_w * 4);
+	e->fb = cursor_fb_create(output);
+	if (e->fb && cursor_fb_write(output, e->fb, e, 0, 0) < 0) {
+		drm_fb_unref(e->fb);
+		e->fb = NULL;
+	}
+	if (!e->fb) {
+		free(e->pixels);
+		free(e);
+		return NULL;
 	}
 
-	if (gbm_bo_write(bo, buf, 64*64*4) < 0)
-		gbm_err("write cursor bo failed. %s", strerror(errno));
+	e->stamp = ++output->cursor_stamp;
+	list_add(&e->link, &output->cursor_cache);
+	output->cursor_cache_len++;
+	drm_debug("cursor cache add %016llX, %u entries",
+		  (unsigned long long)hash, output->cursor_cache_len);
+
+	return e;
+}
+
+static void cursor_cache_flush(struct drm_output *output)
+{
+	struct drm_cursor_entry *e, *next;
+	u32 i;
+
+	list_for_each_entry_safe(e, next, &output->cursor_cache, link)
+		cursor_entry_destroy(output, e);
+
+	for (i = 0; i < ARRAY_SIZE(output->cursor_shift_fb); i++) {
+		if (output->cursor_shift_fb[i])
+			drm_fb_unref(output->cursor_shift_fb[i]);
+		output->cursor_shift_fb[i] = NULL;
+	}
+	free(output->cursor_staging);
+	output->cursor_staging = NULL;
+}
+
+/* fb of the current shape shifted by skip_x, skip_y, not referenced */
+static struct drm_fb *cursor_cache_fb(struct drm_output *output,
+				      u32 skip_x, u32 skip_y)
+{
+	struct drm_cursor_entry *e = output->cursor_cur;
+	struct drm_fb **fb;
+
+	if (!e)
+		return NULL;
+
+	if ((!skip_x && !skip_y) || skip_x >= e->w || skip_y >= e->h)
+		return e->fb;
+
+	fb = &output->cursor_shift_fb[output->cursor_shift_index];
+	if (*fb && output->cursor_shift_e == e
+	    && output->cursor_shift_x == skip_x
+	    && output->cursor_shift_y == skip_y)
+		return *fb;
+
+	/* the other BO, the last frame may still be scanning this one out */
+	output->cursor_shift_index = 1 - output->cursor_shift_index;
+	fb = &output->cursor_shift_fb[output->cursor_shift_index];
+	if (!*fb) {
+		*fb = cursor_fb_create(output);
+		if (!*fb)
+			return e->fb;
+	}
+
+	output->cursor_shift_e = NULL;
+	if (cursor_fb_write(output, *fb, e, skip_x, skip_y) < 0)
+		return e->fb;
+	output->cursor_shift_e = e;
+	output->cursor_shift_x = skip_x;
+	output->cursor_shift_y = skip_y;
+
+	return *fb;
+}
+
+static void cursor_update(struct drm_backend *b, struct clv_view *v)
+{
+	struct drm_output *output;
+	struct clv_buffer *buffer = v->cursor_buf;
+	struct shm_buffer *shm_buf = container_of(buffer, struct shm_buffer,
+						  base);
+	u32 w, h;
+	u64 hash;
+
+	w = MIN(buffer->w, b->cursor_width);
+	h = MIN(buffer->h, b->cursor_height);
+	hash = cursor_hash(shm_buf->shm.map, buffer->stride, w, h);
+	b->cursor_buf = buffer;
+	list_for_each_entry(output, &b->outputs, link) {
+		if (!output->cursor_plane)
+			continue;
+		drm_debug("update output[%d]'s cursor", output->index);
+		output->cursor_cur = cursor_cache_get(output, hash,
+						      shm_buf->shm.map,
+						      buffer->stride, w, h);
+	}
+	clv_region_fini(&v->surface->damage);
+	clv_region_init(&v->surface->damage);
 }
-#endif
 
 static struct drm_plane_state * drm_output_prepare_cursor_view(
 					struct drm_output_state *output_state,
@@ -1940,11 +2444,14 @@ static struct drm_plane_state * drm_output_prepare_cursor_view(
 	s32 calc, left, top, x, y, offs_x, offs_y, crtc_w, crtc_h;
 	s32 need_update = 0;
 	u32 width, height;
+	struct drm_fb *fb;
 
 	if (!v->cursor_buf)
 		return NULL;
 
-	if (clv_region_is_not_empty(&v->surface->damage))
+	/* hashed again only when the buffer or its content changed */
+	if (clv_region_is_not_empty(&v->surface->damage)
+	    || v->cursor_buf != b->cursor_buf)
 		need_update = 1;
 
 	if (need_update) {
@@ -2053,24 +2560,18 @@ static struct drm_plane_state * drm_output_prepare_cursor_view(
 	state->v = v;
 
 #ifdef CONFIG_ROCKCHIP_DRM_HWC
-	if (x < 0 || y < 0) {
-		if (state->output) {
-			state->output->cursor_relocate = 1;
-			drm_debug("x %d, y %d, need_update %d", x, y,
-				  need_update);
-			cursor_relocate(output, v, x, y, width, height);
-		}
-	} else {
-		if (state->output && state->output->cursor_relocate) {
-			drm_debug("x %d, y %d, need_update %d", x, y,
-				  need_update);
-			state->output->cursor_relocate = 0;
-			cursor_relocate(output, v, x, y, width, height);
-		}
-	}
+	drm_debug("x %d, y %d, need_update %d", x, y, need_update);
+	fb = cursor_cache_fb(output, x < 0 ? -x : 0, y < 0 ? -y : 0);
+#else
+	fb = cursor_cache_fb(output, 0, 0);
 #endif
+	if (!fb) {
+		/* no cursor BO, the plane is left disabled */
+		state->fb = NULL;
+		return NULL;
+	}
 
-	state->fb = drm_fb_ref(output->cursor_fb[output->cursor_index]);
+	state->fb = drm_fb_ref(fb);
 	//printf("Use Cursor bo %d, fb %u\n", output->cursor_index,
 	//	state->fb->fb_id);
 
@@ -2226,19 +2727,28 @@ static void drm_output_assign_planes(struct clv_output *output_base,
 
 static void drm_output_cursor_bo_destroy(struct drm_output *output)
 {
-	u32 i;
-
 	drm_debug("destroy cursor fb");
-	for (i = 0; i < ARRAY_SIZE(output->cursor_fb); i++) {
-		drm_fb_unref(output->cursor_fb[i]);
-		output->cursor_fb[i] = NULL;
+	cursor_cache_flush(output);
+}
+
+static void drm_output_fini_dumb(struct drm_output *output)
+{
+	s32 i;
+
+	for (i = 0; i < DRM_DUMB_BUFFERS; i++) {
+		if (output->dumb_fb[i]) {
+			drm_fb_unref(output->dumb_fb[i]);
+			output->dumb_fb[i] = NULL;
+		}
 	}
+	output->dumb_cur = NULL;
 }
 
 static void drm_output_fini_egl(struct drm_output *output)
 {
 	if (output->primary_plane->state_cur->fb
-	  && output->primary_plane->state_cur->fb->type == DRM_BUF_GBM_SURFACE){
+	  && (output->primary_plane->state_cur->fb->type == DRM_BUF_GBM_SURFACE
+	   || output->primary_plane->state_cur->fb->type == DRM_BUF_DUMB)) {
 		drm_plane_state_free(output->primary_plane->state_cur, 1);
 		output->primary_plane->state_cur = drm_plane_state_alloc(
 						output->primary_plane, NULL);
@@ -2262,42 +2772,45 @@ static void drm_output_fini_egl(struct drm_output *output)
 		gbm_surface_destroy(output->gbm_surface);
 		output->gbm_surface = NULL;
 	}
+	drm_output_fini_dumb(output);
 }
 
+/* the cursor BOs are created by the cursor cache when a shape shows up */
 static s32 drm_output_cursor_bo_create(struct drm_output *output,
 				       struct drm_backend *b)
 {
-	u32 i;
-	struct gbm_bo *bo;
-
-	drm_debug("create cursor fb");
 	if (!output->cursor_plane) {
 		drm_warn("no cursor plane");
 		return 0;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(output->cursor_fb); i++) {
-		drm_debug("create cursor fb %ux%u", b->cursor_width,
-			  b->cursor_height);
-		bo = gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
-				   GBM_FORMAT_ARGB8888,
-				   GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
-		if (!bo)
-			goto err;
+	drm_debug("cursor bo %ux%u", b->cursor_width, b->cursor_height);
+
+	return 0;
+}
 
-		output->cursor_fb[i] =
-			drm_fb_get_from_bo(bo, b, 0, DRM_BUF_CURSOR);
-		if (!output->cursor_fb[i]) {
-			gbm_bo_destroy(bo);
+static s32 drm_output_init_dumb(struct drm_output *output)
+{
+	struct clv_mode *mode = output->base.current_mode;
+	struct drm_backend *b = output->b;
+	s32 vid, i;
+
+	for (i = 0; i < DRM_DUMB_BUFFERS; i++) {
+		output->dumb_fb[i] = drm_fb_create_dumb(b, mode->w, mode->h);
+		if (!output->dumb_fb[i])
 			goto err;
-		}
+	}
+
+	if (gl_renderer->output_create(&output->base, NULL, NULL,
+				       (s32 *)(&b->gbm_format), 1, &vid) < 0) {
+		drm_err("failed to create renderer output");
+		goto err;
 	}
 
 	return 0;
 
 err:
-	drm_err("cursor buffers unavailable, using gl cursors\n");
-	drm_output_cursor_bo_destroy(output);
+	drm_output_fini_dumb(output);
 	return -1;
 }
 
@@ -2307,6 +2820,9 @@ static s32 drm_output_init_egl(struct drm_output *output)
 	struct drm_backend *b = output->b;
 	s32 vid;
 
+	if (b->use_dumb)
+		return drm_output_init_dumb(output);
+
 	drm_debug("current_mode %u x %u",
 		  output->base.current_mode->w,
 		  output->base.current_mode->h);
@@ -2455,8 +2971,9 @@ static struct drm_plane_state *drm_plane_state_alloc(
 					struct drm_plane *plane,
 					struct drm_output_state *state_output)
 {
-	struct drm_plane_state *state = calloc(1, sizeof(*state));
+	struct drm_plane_state *state;
 
+	state = clv_pool_alloc(&plane->b->plane_state_pool);
 	assert(state);
 	state->output_state = state_output;
 	state->plane = plane;
@@ -2473,10 +2990,11 @@ static struct drm_plane_state *drm_plane_state_dup(
 				struct drm_plane_state *src,
 				struct drm_output_state *state_output)
 {
-	struct drm_plane_state *dst = calloc(1, sizeof(*dst));
+	struct drm_plane_state *dst;
 	struct drm_plane_state *old, *tmp;
 
 	assert(src);
+	dst = clv_pool_alloc(&src->plane->b->plane_state_pool);
 	assert(dst);
 	*dst = *src;
 	INIT_LIST_HEAD(&dst->link);
@@ -2791,6 +3309,7 @@ static void clv_output_init(struct clv_compositor *c, struct clv_output *output,
 	list_add_tail(&output->link, &c->outputs);
 	output->start_repaint_loop = drm_output_start_repaint_loop;
 	output->repaint = drm_output_repaint;
+	output->repaint_finish = drm_output_repaint_finish;
 	output->assign_planes = drm_output_assign_planes;
 	output->destroy = drm_output_destroy;
 	output->enable = drm_output_enable;
@@ -2832,10 +3351,11 @@ static struct drm_plane_state *drm_output_state_get_plane(
 static struct drm_output_state *drm_output_state_alloc(
 		struct drm_output *output, struct drm_pending_state *ps)
 {
-	struct drm_output_state *state = calloc(1, sizeof(*state));
+	struct drm_output_state *state;
 
 	ps_debug("------> alloc output state.. output->index = %u, %p",
 		 output->index, ps);
+	state = clv_pool_alloc(&output->b->output_state_pool);
 	assert(state);
 	state->output = output;
 	state->dpms = CLV_DPMS_OFF;
@@ -2863,15 +3383,17 @@ static struct drm_output_state *drm_output_state_dup(
 				struct drm_pending_state *ps,
 				s32 reset_plane)
 {
-	struct drm_output_state *dst = calloc(1, sizeof(*dst));
+	struct drm_output_state *dst;
 	struct drm_plane_state *state;
 
 	ps_debug("------> dup output state.. output->index = %u, %p src: %p",
 		 src->output->index, ps, src);
 	ps_debug("src->pending_state = %p", src->pending_state);
+	dst = clv_pool_alloc(&src->output->b->output_state_pool);
 	assert(dst);
 
 	*dst = *src;
+	dst->cursor_only = 0;
 
 	if (ps) {
 		struct drm_output_state *o;
@@ -2973,6 +3495,7 @@ static struct clv_output *drm_output_create(struct clv_compositor *c,
 	output->head->encoder = output->encoder;
 
 	INIT_LIST_HEAD(&output->planes);
+	INIT_LIST_HEAD(&output->cursor_cache);
 	for (i = 0; i < head_config->encoder.output.count_layers; i++) {
 		plane = drm_plane_create(c,
 				head_config->encoder.output.layers[i].index,
@@ -3047,12 +3570,20 @@ static void drm_backend_destroy(struct clv_compositor *c)
 		b->res = NULL;
 	}
 
+	if (b->atomic_req) {
+		drmModeAtomicFree(b->atomic_req);
+		b->atomic_req = NULL;
+	}
+
 	if (b->fd > 0) {
 		close(b->fd);
 		b->fd = 0;
 	}
 
 	clv_region_fini(&b->canvas);
+	clv_pool_release(&b->plane_state_pool);
+	clv_pool_release(&b->output_state_pool);
+	clv_pool_release(&b->pending_state_pool);
 	free(b);
 
 	c->backend = NULL;
@@ -3075,6 +3606,13 @@ struct clv_backend *drm_backend_create(struct clv_compositor *c)
 
 	b->c = c;
 
+	clv_pool_init(&b->pending_state_pool,
+		      sizeof(struct drm_pending_state), 4);
+	clv_pool_init(&b->output_state_pool,
+		      sizeof(struct drm_output_state), 16);
+	clv_pool_init(&b->plane_state_pool,
+		      sizeof(struct drm_plane_state), 32);
+
 	clv_region_init(&b->canvas);
 
 	dev_node = getenv("CLOVER_DEV_NODE");
@@ -3160,6 +3698,9 @@ struct clv_backend *drm_backend_create(struct clv_compositor *c)
 	set_renderer_dbg(0);
 	assert(c->renderer);
 	gl_renderer = c->renderer;
+	b->use_dumb = !!c->renderer->output_set_buffer;
+	drm_info("renderer paints in %s", b->use_dumb ? "dumb buffers"
+						      : "a gbm surface");
 	drm_debug("DRM Backend created.");
 
 	drm_dbg = 0;
@@ -37,6 +37,7 @@
 #include <clover_shm.h>
 #include <clover_event.h>
 #include <clover_compositor.h>
+#include "clover_ipc_worker.h"
 
 s32 run_as_daemon = 0;
 char drm_node[] = "/dev/dri/card0";
@@ -51,6 +52,7 @@ enum timing_select_method timing_choose_mode;
 static void set_common_dbg(u32 flags)
 {
 	common_dbg = flags & 0x0F;
+	clv_ipc_worker_set_dbg(flags);
 }
 
 #define com_debug(fmt, ...) do { \
@@ -218,7 +220,28 @@ static void head_state_changed_cb(struct clv_listener *listener, void *data)
 	list_for_each_entry(agent, &server.client_agents, link) {
 		clv_dup_hpd_cmd(agent->hpd_tx_cmd, agent->hpd_tx_cmd_t,
 				agent->hpd_tx_len, hpd_info);
-		clv_send(agent->sock, agent->hpd_tx_cmd, agent->hpd_tx_len);
+		client_agent_send(agent, agent->hpd_tx_cmd, agent->hpd_tx_len);
+	}
+}
+
+static void dump_repaint_timeline(void)
+{
+	char path[64];
+	FILE *fp;
+	s32 i;
+
+	for (i = 0; i < server.count_outputs; i++) {
+		if (!server.outputs[i])
+			continue;
+		sprintf(path, "/tmp/repaint-timeline-%u",
+			server.outputs[i]->index);
+		fp = fopen(path, "w");
+		if (!fp) {
+			com_err("failed to open %s", path);
+			continue;
+		}
+		clv_output_dump_repaint_timeline(server.outputs[i], fp);
+		fclose(fp);
 	}
 }
 
@@ -328,59 +351,30 @@ static void update_layout(struct clv_compositor *c, struct clv_shell_info *si)
 	}
 }
 
-static s32 client_sock_cb(s32 fd, u32 mask, void *data)
+/* Runs on the compositor thread, msg was decoded by the IPC worker */
+static s32 client_cmd_proc(struct clv_client_agent *agent,
+			   struct clv_ipc_msg *msg)
 {
-	struct clv_client_agent *agent = data;
-	struct clv_tlv *tlv;
-	u8 *rx_p, *shell_tx_buf;
-	u32 flag, length, f, f1, n;
+	u8 shell_tx_buf[CLV_CMD_SIZE(sizeof(struct clv_shell_info))];
+	u32 flag = msg->flag, f, f1, n;
 	u64 id;
 	s32 ret, dmabuf_fd;
 	struct clv_surface_info si;
 	struct clv_view_info vi;
 	struct clv_bo_info bi;
 	struct clv_commit_info ci;
+	struct clv_transaction_info ti;
 	struct clv_shell_info shell;
 	struct clv_buffer *buf;
-	struct timespec t1, t2;
+	struct clv_surface *surface;
+	struct clv_view *view;
 	//struct timespec ts1;
 	struct clv_config *config;
 	s32 i;
 
-	ret = clv_recv(fd, agent->ipc_rx_buf, sizeof(*tlv) + sizeof(u32));
-	if (ret == -1) {
-		com_err("client exit.");
-		client_agent_destroy(agent);
-		return -1;
-	} else if (ret < 0) {
-		com_err("failed to receive client cmd");
-		client_agent_destroy(agent);
-		return -1;
-	}
-
-	tlv = (struct clv_tlv *)(agent->ipc_rx_buf + sizeof(u32));
-	length = tlv->length;
-	rx_p = agent->ipc_rx_buf + sizeof(u32) + sizeof(*tlv);
-	flag = *((u32 *)(agent->ipc_rx_buf));
-	ret = clv_recv(fd, rx_p, length);
-	if (ret == -1) {
-		com_err("client exit.");
-		client_agent_destroy(agent);
-		return -1;
-	} else if (ret < 0) {
-		com_err("failed to receive client cmd");
-		client_agent_destroy(agent);
-		return -1;
-	}
-
-	if (tlv->tag != CLV_TAG_WIN) {
-		com_err("invalid TAG, not a win. 0x%08X", tlv->tag);
-		return -1;
-	}
-
 	if (flag & (1 << CLV_CMD_CREATE_SURFACE_SHIFT)) {
-		ret = clv_server_parse_create_surface_cmd(agent->ipc_rx_buf,
-							  &si);
+		ret = msg->ret;
+		si = msg->u.si;
 		if (ret < 0) {
 			com_err("failed to parse surface create command from "
 				"agent 0x%08lX", (u64)agent);
@@ -394,17 +388,20 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 				  si.width, si.height,
 				  si.opaque.pos.x, si.opaque.pos.y,
 				  si.opaque.w, si.opaque.h);
-			agent->surface = clv_surface_create(agent->c, &si,
-							    agent);
-			assert(agent->surface);
-			id = (u64)(agent->surface);
-			com_debug("Surf created 0x%08lX", id);
+			surface = clv_surface_create(agent->c, &si, agent);
+			if (!surface) {
+				com_err("failed to create surface");
+				id = 0;
+			} else {
+				id = surface->id;
+				com_debug("Surf created %lu", id);
+			}
 		}
 		clv_dup_surface_id_cmd(agent->surface_id_created_tx_cmd,
 				       agent->surface_id_created_tx_cmd_t,
 				       agent->surface_id_created_tx_len, id);
-		ret = clv_send(fd, agent->surface_id_created_tx_cmd,
-			       agent->surface_id_created_tx_len);
+		ret = client_agent_send(agent, agent->surface_id_created_tx_cmd,
+					agent->surface_id_created_tx_len);
 		if (ret == -1) {
 			com_err("client exit.");
 			client_agent_destroy(agent);
@@ -415,8 +412,8 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 			return -1;
 		}
 	} else if (flag & (1 << CLV_CMD_CREATE_VIEW_SHIFT)) {
-		ret = clv_server_parse_create_view_cmd(agent->ipc_rx_buf,
-						       &vi);
+		ret = msg->ret;
+		vi = msg->u.vi;
 		if (ret < 0) {
 			com_err("failed to parse view create command from "
 				"agent 0x%08lX", (u64)agent);
@@ -428,16 +425,24 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 				  vi.area.w, vi.area.h,
 				  vi.alpha, vi.output_mask,
 				  vi.primary_output);
-			agent->view = clv_view_create(agent->surface, &vi);
-			assert(agent->view);
-			id = (u64)(agent->view);
-			com_debug("View created 0x%08lX", id);
+			surface = client_agent_find_surface(agent,
+							   vi.surface_id);
+			if (!surface || surface->view) {
+				com_err("illegal surface id %lu", vi.surface_id);
+				id = 0;
+			} else {
+				view = clv_view_create(surface, &vi);
+				assert(view);
+				/* a view is bound to its surface */
+				id = surface->id;
+				com_debug("View created %lu", id);
+			}
 		}
 		clv_dup_view_id_cmd(agent->view_id_created_tx_cmd,
 				    agent->view_id_created_tx_cmd_t,
 				    agent->view_id_created_tx_len, id);
-		ret = clv_send(fd, agent->view_id_created_tx_cmd,
-			       agent->view_id_created_tx_len);
+		ret = client_agent_send(agent, agent->view_id_created_tx_cmd,
+					agent->view_id_created_tx_len);
 		if (ret == -1) {
 			com_err("client exit.");
 			client_agent_destroy(agent);
@@ -448,7 +453,8 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 			return -1;
 		}
 	} else if (flag & (1 << CLV_CMD_CREATE_BO_SHIFT)) {
-		ret = clv_server_parse_create_bo_cmd(agent->ipc_rx_buf, &bi);
+		ret = msg->ret;
+		bi = msg->u.bi;
 		if (ret < 0) {
 			com_err("failed to parse bo create command from "
 				"agent 0x%08lX", (u64)agent);
@@ -459,24 +465,33 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 				com_debug("SHM BO create req: %u, %s, %u:%ux%u "
 					  "%lu", bi.fmt, bi.name, bi.width,
 					  bi.stride, bi.height, bi.surface_id);
-				buf = shm_buffer_create(&bi);
+				/* mapped by the IPC worker */
+				buf = msg->shm_buf;
+				msg->shm_buf = NULL;
 				assert(buf);
-				list_add_tail(&buf->link, &agent->buffers);
-				id = (u64)buf;
+				buf->surface = client_agent_find_surface(agent,
+								bi.surface_id);
+				id = client_agent_add_buffer(agent, buf);
+				assert(id);
 				com_debug("SHM-BUF BO created 0x%08lX", id);
 			} else if (bi.type == CLV_BUF_TYPE_DMA) {
 				com_debug("DMA-BUF BO create req: %u, %u, "
 					  "%u:%ux%u %lu", bi.fmt,
 					  bi.internal_fmt, bi.width, bi.stride,
 					  bi.height, bi.surface_id);
-				dmabuf_fd = clv_recv_fd(fd);
-				com_debug("receive dma buf fd %d", dmabuf_fd);
-				if (dmabuf_fd < 0) {
-					com_err("dmabuf illegal %d", dmabuf_fd);
-					client_agent_destroy(agent);
-					return -1;
+				/* received by the IPC worker */
+				dmabuf_fd = msg->dmabuf_fd;
+				msg->dmabuf_fd = -1;
+				surface = client_agent_find_surface(agent,
+								bi.surface_id);
+				if (!surface || !surface->view) {
+					com_err("illegal surface id %lu",
+						bi.surface_id);
+					close(dmabuf_fd);
+					id = 0;
+					goto ack_bo;
 				}
-				if (agent->view->type == CLV_VIEW_TYPE_OVERLAY){
+				if (surface->view->type == CLV_VIEW_TYPE_OVERLAY){
 					buf = calloc(1, sizeof(*buf));
 					buf->type = CLV_BUF_TYPE_DMA;
 					buf->w = bi.width;
@@ -509,16 +524,18 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 						bi.internal_fmt);
 				}
 				assert(buf);
-				list_add_tail(&buf->link, &agent->buffers);
-				id = (u64)buf;
+				buf->surface = surface;
+				id = client_agent_add_buffer(agent, buf);
+				assert(id);
 				com_debug("DMA-BUF BO created 0x%08lX", id);
 			}
 		}
+ack_bo:
 		clv_dup_bo_id_cmd(agent->bo_id_created_tx_cmd,
 				  agent->bo_id_created_tx_cmd_t,
 				  agent->bo_id_created_tx_len, id);
-		ret = clv_send(fd, agent->bo_id_created_tx_cmd,
-			       agent->bo_id_created_tx_len);
+		ret = client_agent_send(agent, agent->bo_id_created_tx_cmd,
+					agent->bo_id_created_tx_len);
 		if (ret == -1) {
 			com_err("client exit.");
 			client_agent_destroy(agent);
@@ -529,124 +546,62 @@ static s32 client_sock_cb(s32 fd, u32 mask, void *data)
 			return -1;
 		}
 	} else if (flag & (1 << CLV_CMD_DESTROY_BO_SHIFT)) {
-		id = clv_server_parse_destroy_bo_cmd(agent->ipc_rx_buf);
+		id = msg->u.id;
 		if (!id) {
 			com_err("failed to parse destroy bo command from "
 				"agent 0x%08lX", (u64)agent);
 		} else {
-			buf = (struct clv_buffer *)id;
 			com_debug("parse destroy bo command ok. bo_id = %lu",
 				  id);
 //			clv_debug("parse destroy bo command ok. bo_id = %lu",
 //				  id);
-			client_destroy_buf(agent, buf);
+			buf = client_agent_find_buffer(agent, id);
+			if (!buf) {
+				com_err("illegal bo id 0x%016lX", id);
+			} else {
+				client_destroy_buf(agent, buf);
+			}
+		}
+	} else if (flag & (1 << CLV_CMD_FRAME_SHIFT)) {
+		id = msg->u.id;
+		surface = client_agent_find_surface(agent, id);
+		if (!surface) {
+			com_err("illegal surface id 0x%016lX", id);
+		} else {
+			com_debug("surface %lu requests frame", id);
+			clv_surface_request_frame(surface);
 		}
 	} else if (flag & (1 << CLV_CMD_COMMIT_SHIFT)) {
 		//clock_gettime(CLOCK_MONOTONIC, &ts1);
 		//clv_debug("r: %3d.%06d", ts1.tv_sec, ts1.tv_nsec/1000000l);
-		ret = clv_server_parse_commit_req_cmd(agent->ipc_rx_buf, &ci);
+		ret = msg->ret;
+		ci = msg->u.ci;
 		if (ret < 0) {
 			com_err("failed to parse commit command from "
 				"agent 0x%08lX", (u64)agent);
 			id = 0;
 		} else {
-			buf = (struct clv_buffer *)(ci.bo_id);
 			com_debug("parse commit command ok. bo_id = %lu",
 				  ci.bo_id);
-			if (!ci.bo_id) {
-				com_err("commit bo_id == 0!!!");
+			buf = client_agent_find_buffer(agent, ci.bo_id);
+			if (!buf) {
+				com_err("illegal commit bo_id 0x%016lX",
+					ci.bo_id);
+				id = 0;
 				goto ack_commit;
 			}
-			agent->view->area.pos.x = ci.view_x;
-			agent->view->area.pos.y = ci.view_y;
-			com_debug("set view %p pos: %d, %d", agent->view,
-				  agent->view->area.pos.x,
-				  agent->view->area.pos.y);
-			agent->view->hot_x = ci.view_hot_x;
-			agent->view->hot_y = ci.view_hot_y;
-			if (buf->type == CLV_BUF_TYPE_SHM) {
-				com_debug("Commit info: 0x%08lX, %d, %d,"
-					  "%d:%ux%u %d damage:%d,%d %ux%u",
-					  ci.bo_id, ci.shown,
-					  ci.view_x, ci.view_y,
-					  ci.view_width, ci.view_height,
-					  ci.delta_z,
-					  ci.bo_damage.pos.x,ci.bo_damage.pos.y,
-					  ci.bo_damage.w, ci.bo_damage.h);
-				if (agent->view->type == CLV_VIEW_TYPE_CURSOR) {
-					com_debug("receive cursor bo %lu's cmt",
-						  ci.bo_id);
-					if (agent->view->cursor_buf != buf) {
-						clv_debug("cursor bo changed.");
-					}
-					agent->view->cursor_buf = buf;
-				}
-				clv_region_fini(&agent->surface->damage);
-				if (ci.bo_damage.w && ci.bo_damage.h)
-					clv_region_init_rect(
-						&agent->surface->damage,
-						ci.bo_damage.pos.x,
-						ci.bo_damage.pos.y,
-						ci.bo_damage.w,
-						ci.bo_damage.h);
-				else
-					clv_region_init(
-						&agent->surface->damage);
-				if (agent->view->type == CLV_VIEW_TYPE_PRIMARY){
-					agent->c->renderer->attach_buffer(
-						agent->surface, buf);
-					if (ci.bo_damage.w && ci.bo_damage.h) {
-						clock_gettime(
-							agent->c->clk_id, &t1);
-						agent->c->renderer-> \
-						    flush_damage(
-							agent->surface);
-						clock_gettime(agent->c->clk_id,
-								&t2);
-						com_debug("[TIMER] flush spent "
-							"%ld ms",
-							timespec_sub_to_msec(
-								&t2, &t1));
-					}
-				}
-				clv_region_fini(&agent->surface->damage);
-			} else if (buf->type == CLV_BUF_TYPE_DMA) {
-				com_debug("Commit info: 0x%08lX, %d, %d,"
-					  "%d:%ux%u %d",
-					  ci.bo_id, ci.shown,
-					  ci.view_x, ci.view_y,
-					  ci.view_width, ci.view_height,
-					  ci.delta_z);
-
-				if (agent->view->type == CLV_VIEW_TYPE_PRIMARY){
-					agent->c->renderer->attach_buffer(
-						agent->surface, buf);
-				} else {
-					com_debug("attach dma buf %p", buf);
-					agent->view->last_dmafb = 
-						agent->view->curr_dmafb;
-					//clock_gettime(CLOCK_MONOTONIC, &ts1);
-					//clv_debug("rr: %3d.%06d", ts1.tv_sec, ts1.tv_nsec/1000000l);
-					agent->view->curr_dmafb = 
-					    agent->c->backend->import_dmabuf(
-					        agent->c, buf);
-					com_debug("view %p's curr_dmafb = %p",
-					    agent->view,
-					    agent->view->curr_dmafb);
-				}
+			surface = client_agent_find_surface(agent,
+							   ci.surface_id);
+			if (!surface) {
+				com_err("illegal surface id %lu", ci.surface_id);
+				id = 0;
+				goto ack_commit;
 			}
-
-			agent->view->plane = &agent->c->primary_plane;
-			clv_view_schedule_repaint(agent->view);
-			if (agent->view->type != CLV_VIEW_TYPE_CURSOR) {
-				com_debug("************ add flip listener");
-				clv_surface_add_flip_listener(agent->surface);
-			} else {
-				if (ci.bo_damage.w && ci.bo_damage.h) {
-					com_debug("****** add flip listener");
-					clv_surface_add_flip_listener(
-						agent->surface);
-				}
+			if (clv_surface_commit(surface, buf, &ci) < 0) {
+				com_err("failed to commit surface %lu",
+					surface->id);
+				id = 0;
+				goto ack_commit;
 			}
 			id = 1;
 		}
@@ -654,8 +609,8 @@ ack_commit:
 		clv_dup_commit_ack_cmd(agent->commit_ack_tx_cmd,
 				    agent->commit_ack_tx_cmd_t,
 				    agent->commit_ack_tx_len, id);
-		ret = clv_send(fd, agent->commit_ack_tx_cmd,
-			       agent->commit_ack_tx_len);
+		ret = client_agent_send(agent, agent->commit_ack_tx_cmd,
+					agent->commit_ack_tx_len);
 		if (ret == -1) {
 			com_err("client exit.");
 			client_agent_destroy(agent);
@@ -665,8 +620,39 @@ ack_commit:
 			client_agent_destroy(agent);
 			return -1;
 		}
+	} else if (flag & (1 << CLV_CMD_TRANSACTION_SHIFT)) {
+		ret = msg->ret;
+		ti = msg->u.ti;
+		if (ret < 0) {
+			com_err("failed to parse transaction command from "
+				"agent 0x%08lX", (u64)agent);
+			id = 0;
+		} else if (clv_compositor_queue_transaction(agent, &ti) < 0) {
+			com_err("failed to queue transaction of %u commits",
+				ti.count_entries);
+			id = 0;
+		} else {
+			com_debug("transaction of %u commits queued",
+				  ti.count_entries);
+			id = ti.count_entries;
+		}
+		clv_dup_commit_ack_cmd(agent->commit_ack_tx_cmd,
+				    agent->commit_ack_tx_cmd_t,
+				    agent->commit_ack_tx_len, id);
+		ret = client_agent_send(agent, agent->commit_ack_tx_cmd,
+					agent->commit_ack_tx_len);
+		if (ret == -1) {
+			com_err("client exit.");
+			client_agent_destroy(agent);
+			return -1;
+		} else if (ret < 0) {
+			com_err("failed to send transaction ack");
+			client_agent_destroy(agent);
+			return -1;
+		}
 	} else if (flag & (1 << CLV_CMD_SHELL_SHIFT)) {
-		ret = clv_parse_shell_cmd(agent->ipc_rx_buf, &shell);
+		ret = msg->ret;
+		shell = msg->u.shell;
 		if (ret < 0) {
 			com_err("failed to parse shell command from "
 				"agent 0x%08lX", (u64)agent);
@@ -716,6 +702,9 @@ ack_commit:
 				f |= (shell.value.dbg_flags.egl_flag << 4);
 				f &= 0x0FF;
 				set_renderer_dbg(f);
+			} else if (shell.cmd ==
+					CLV_SHELL_REPAINT_TIMELINE_DUMP) {
+				dump_repaint_timeline();
 			} else if (shell.cmd == CLV_SHELL_CANVAS_LAYOUT_QUERY) {
 				com_debug("request canvas layout.");
 				config = server.config;
@@ -736,27 +725,26 @@ ack_commit:
 					    config->heads[i].encoder \
 					        .output.render_area.h;
 				}
-				shell_tx_buf = clv_create_shell_cmd(&shell, &n);
-				if (shell_tx_buf)
-					clv_send(fd, shell_tx_buf, n);
+				n = clv_cmd_encode(shell_tx_buf,
+						   sizeof(shell_tx_buf),
+						   CLV_CMD_SHELL_SHIFT, &shell);
+				client_agent_send(agent, shell_tx_buf, n);
 			} else if (shell.cmd==CLV_SHELL_CANVAS_LAYOUT_SETTING) {
 				struct clv_client_agent *agt;
 				com_debug("receive layout setting command.");
 				update_layout(agent->c, &shell);
 
-				shell_tx_buf = clv_create_shell_cmd(&shell, &n);
+				n = clv_cmd_encode(shell_tx_buf,
+						   sizeof(shell_tx_buf),
+						   CLV_CMD_SHELL_SHIFT, &shell);
 				/*
 				 * send layout change event to each agent.
 				 * if (shell_tx_buf)
 				 * 	clv_send(fd, shell_tx_buf, n);
 				 */
 				list_for_each_entry(agt, &server.client_agents,
-							link) {
-					if (shell_tx_buf) {
-						clv_send(agt->sock,
-							shell_tx_buf, n);
-					}
-				}
+							link)
+					client_agent_send(agt, shell_tx_buf, n);
 			}
 		}
 	} else {
@@ -767,14 +755,14 @@ ack_commit:
 	return 0;
 }
 
-static s32 server_sock_cb(s32 fd, u32 mask, void *data)
+static void client_linkup(struct clv_server *s, struct clv_ipc_link *link)
 {
-	struct clv_server *s = data;
-	s32 sock = clv_socket_accept(fd);
+	s32 sock = link->sock;
 	struct clv_client_agent *agent;
 
-	agent = client_agent_create(s, sock, client_sock_cb);
+	agent = client_agent_create(s, sock, NULL);
 	assert(agent);
+	clv_ipc_link_set_agent(link, agent);
 
 	//clv_socket_nonblock(sock);
 	clv_dup_linkup_cmd(s->linkid_created_ack_tx_cmd,
@@ -782,11 +770,21 @@ static s32 server_sock_cb(s32 fd, u32 mask, void *data)
 			   s->linkid_created_ack_tx_len,
 			   (u64)agent);
 	com_info("Send link id 0x%08lX", (u64)agent);
-	assert(clv_send(sock, s->linkid_created_ack_tx_cmd,
-			s->linkid_created_ack_tx_len) == 0);
+	assert(client_agent_send(agent, s->linkid_created_ack_tx_cmd,
+				 s->linkid_created_ack_tx_len) == 0);
 	com_info("a new client connected. sock = %d", sock);
-	
-	return 0;
+}
+
+static void ipc_msg_cb(struct clv_ipc_msg *msg, void *data)
+{
+	struct clv_server *s = data;
+
+	if (msg->type == CLV_IPC_MSG_LINKUP)
+		client_linkup(s, msg->link);
+	else if (msg->type == CLV_IPC_MSG_CMD)
+		client_cmd_proc(msg->link->agent, msg);
+
+	clv_ipc_msg_free(msg);
 }
 
 s32 main(s32 argc, char **argv)
@@ -856,13 +854,6 @@ s32 main(s32 argc, char **argv)
 	unlink("/tmp/CLV_SERVER");
 	assert(clv_socket_bind_listen(server.server_sock,
 				      "/tmp/CLV_SERVER") == 0);
-	server.server_source = clv_event_loop_add_fd(server.loop,
-						     server.server_sock,
-						     CLV_EVT_READABLE,
-						     server_sock_cb,
-						     &server);
-	assert(server.server_source);
-
 	server.sig_int_source = clv_event_loop_add_signal(server.loop, SIGINT,
 							  signal_event_proc,
 							  server.display);
@@ -874,6 +865,11 @@ s32 main(s32 argc, char **argv)
 	clv_compositor_add_heads_changed_listener(server.c,
 						  &server.hpd_listener);
 	clv_compositor_schedule_heads_changed(server.c);
+	/* client links are accepted and read by the IPC worker thread */
+	server.ipc_worker = clv_ipc_worker_create(server.loop,
+						  server.server_sock,
+						  ipc_msg_cb, &server);
+	assert(server.ipc_worker);
 	clv_display_run(server.display);
 
 	clv_compositor_destroy(server.c);
@@ -885,8 +881,8 @@ s32 main(s32 argc, char **argv)
 		client_agent_destroy(agent);
 	}
 
-	if (server.server_source)
-		clv_event_source_remove(server.server_source);
+	if (server.ipc_worker)
+		clv_ipc_worker_destroy(server.ipc_worker);
 
 	if (server.server_sock > 0)
 		close(server.server_sock);
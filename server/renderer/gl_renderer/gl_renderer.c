@@ -5,6 +5,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
@@ -12,9 +14,11 @@
 #include <clover_utils.h>
 #include <clover_log.h>
 #include <clover_array.h>
+#include <clover_arena.h>
 #include <clover_region.h>
 #include <clover_shm.h>
 #include <clover_signal.h>
+#include <clover_queue.h>
 #include <clover_compositor.h>
 
 static u8 gles_dbg = 0;
@@ -181,10 +185,6 @@ static const EGLint gl_opaque_attribs[] = {
 	EGL_NONE,
 };
 
-struct gl_output_state {
-	EGLSurface egl_surface;
-};
-
 struct gl_shader {
 	GLuint program;
 	GLuint vertex_shader, fragment_shader;
@@ -195,21 +195,92 @@ struct gl_shader {
 	const char *vertex_source, *fragment_source;
 };
 
+enum gl_shader_type {
+	GL_SHADER_NONE = 0,
+	GL_SHADER_RGBA,
+	GL_SHADER_EGL_EXTERNAL,
+	GL_SHADER_RGBX,
+	GL_SHADER_Y_U_V,
+	GL_SHADER_COUNT,
+};
+
+/*
+ * GL state private to one EGL context. Programs carry their uniform values,
+ * so a context rendering on its own thread needs its own copy of them.
+ */
+struct gl_context {
+	EGLContext egl_context;
+	struct gl_shader shaders[GL_SHADER_COUNT];
+	struct gl_shader *current_shader;
+
+	struct clv_array vertices;
+	struct clv_array vtxcnt;
+
+	/* data of the frame being painted: region boxes, compressed bands */
+	struct clv_arena frame;
+};
+
+enum gl_render_cmd_type {
+	GL_RENDER_CMD_REPAINT = 0,
+	GL_RENDER_CMD_QUIT,
+};
+
+struct gl_render_cmd {
+	enum gl_render_cmd_type type;
+	/* views drawn on the primary plane, bottom first */
+	struct clv_array views;
+	/* signaled once the uploads of the main context are done */
+	EGLSyncKHR upload_sync;
+};
+
+/*
+ * Each output may be painted by its own thread, with its own EGL context
+ * sharing textures with the main one. The main thread snapshots the draw
+ * list, pushes a command and carries on with the other outputs, then
+ * waits for done_sem before it locks the front buffer. The scene is not
+ * modified between the two points.
+ */
+struct gl_render_thread {
+	pthread_t tid;
+	struct clv_output *output;
+	struct gl_context ctx;
+
+	struct clv_spsc_queue queue;
+	sem_t cmd_sem;
+	sem_t done_sem;
+	s32 busy;
+
+	struct gl_render_cmd quit_cmd;
+};
+
+struct gl_output_state {
+	EGLSurface egl_surface;
+	struct gl_render_cmd cmd;
+	struct gl_render_thread *thread;
+	/* written by the thread painting the output only */
+	s32 swap_errored;
+};
+
 struct gl_display {
 	struct clv_renderer base;
 	EGLDisplay egl_display;
-	EGLContext egl_context;
 	EGLConfig egl_config;
+	EGLint context_attribs[16];
 	EGLSurface dummy_surface;
 	u32 gl_version;
 
-	struct clv_array vertices;
-	struct clv_array vtxcnt;
+	/* context of the main thread, used for uploads */
+	struct gl_context ctx;
+	s32 use_render_thread;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
 	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
 	PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC create_platform_window;
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+	PFNEGLWAITSYNCKHRPROC wait_sync;
 
 	s32 support_unpack_subimage;
 	s32 support_context_priority;
@@ -219,18 +290,12 @@ struct gl_display {
 
 	struct list_head dmabuf_images;
 
-	struct gl_shader texture_shader_rgba;
-	struct gl_shader texture_shader_egl_external;
-	struct gl_shader texture_shader_rgbx;
-	struct gl_shader texture_shader_y_u_v;
-	struct gl_shader *current_shader;
-
 	struct clv_signal destroy_signal;
 };
 
 struct gl_surface_state {
 	GLfloat color[4];
-	struct gl_shader *shader;
+	enum gl_shader_type shader;
 
 	GLuint textures[3];
 	s32 count_textures;
@@ -456,6 +521,22 @@ static s32 set_egl_extensions(struct gl_display *disp)
 	if (check_egl_extension(extensions, "EGL_EXT_image_dma_buf_import"))
 		disp->support_dmabuf_import = 1;
 
+	if (check_egl_extension(extensions, "EGL_KHR_fence_sync")) {
+		disp->create_sync = (void *)eglGetProcAddress(
+						"eglCreateSyncKHR");
+		disp->destroy_sync = (void *)eglGetProcAddress(
+						"eglDestroySyncKHR");
+		disp->client_wait_sync = (void *)eglGetProcAddress(
+						"eglClientWaitSyncKHR");
+		if (!disp->create_sync || !disp->destroy_sync
+		    || !disp->client_wait_sync)
+			disp->create_sync = NULL;
+	}
+
+	/* the render threads wait on the GPU rather than on the CPU */
+	if (check_egl_extension(extensions, "EGL_KHR_wait_sync"))
+		disp->wait_sync = (void *)eglGetProcAddress("eglWaitSyncKHR");
+
 	set_egl_client_extensions(disp);
 	egl_info("EGL_IMG_context_priority: %s",
 		 disp->support_context_priority ? "Y" : "N");
@@ -463,6 +544,8 @@ static s32 set_egl_extensions(struct gl_display *disp)
 		 disp->support_surfaceless_context ? "Y" : "N");
 	egl_info("EGL_EXT_image_dma_buf_import: %s",
 		 disp->support_dmabuf_import ? "Y" : "N");
+	egl_info("EGL_KHR_fence_sync: %s", disp->create_sync ? "Y" : "N");
+	egl_info("EGL_KHR_wait_sync: %s", disp->wait_sync ? "Y" : "N");
 	return 0;
 }
 
@@ -559,23 +642,51 @@ static u32 get_gl_version(void)
 	return GEN_GL_VERSION_INVALID;
 }
 
-static void set_shaders(struct clv_compositor *c)
+static void gl_context_init(struct gl_context *ctx, EGLContext egl_context)
 {
-	struct gl_display *disp = get_display(c);
+	struct gl_shader *shaders = ctx->shaders;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->egl_context = egl_context;
 
-	disp->texture_shader_rgba.vertex_source = vertex_shader;
-	disp->texture_shader_rgba.fragment_source =texture_fragment_shader_rgba;
+	shaders[GL_SHADER_RGBA].vertex_source = vertex_shader;
+	shaders[GL_SHADER_RGBA].fragment_source = texture_fragment_shader_rgba;
 
-	disp->texture_shader_egl_external.vertex_source = vertex_shader;
-	disp->texture_shader_egl_external.fragment_source =
+	shaders[GL_SHADER_EGL_EXTERNAL].vertex_source = vertex_shader;
+	shaders[GL_SHADER_EGL_EXTERNAL].fragment_source =
 		texture_fragment_shader_egl_external;
 
-	disp->texture_shader_rgbx.vertex_source = vertex_shader;
-	disp->texture_shader_rgbx.fragment_source =texture_fragment_shader_rgbx;
+	shaders[GL_SHADER_RGBX].vertex_source = vertex_shader;
+	shaders[GL_SHADER_RGBX].fragment_source = texture_fragment_shader_rgbx;
 
-	disp->texture_shader_y_u_v.vertex_source = vertex_shader;
-	disp->texture_shader_y_u_v.fragment_source =
+	shaders[GL_SHADER_Y_U_V].vertex_source = vertex_shader;
+	shaders[GL_SHADER_Y_U_V].fragment_source =
 						texture_fragment_shader_y_u_v;
+
+	clv_array_init(&ctx->vertices);
+	clv_array_init(&ctx->vtxcnt);
+	clv_arena_init(&ctx->frame, 16384);
+}
+
+/* must be called with ctx current */
+static void gl_context_release(struct gl_context *ctx)
+{
+	struct gl_shader *shader;
+	s32 i;
+
+	for (i = 0; i < GL_SHADER_COUNT; i++) {
+		shader = &ctx->shaders[i];
+		if (!shader->program)
+			continue;
+		glDeleteProgram(shader->program);
+		glDeleteShader(shader->vertex_shader);
+		glDeleteShader(shader->fragment_shader);
+		shader->program = 0;
+	}
+	ctx->current_shader = NULL;
+	clv_array_release(&ctx->vertices);
+	clv_array_release(&ctx->vtxcnt);
+	clv_arena_release(&ctx->frame);
 }
 
 static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
@@ -583,6 +694,7 @@ static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
 	struct gl_display *disp = get_display(c);
 	const char *extensions;
 	EGLConfig context_config;
+	EGLContext egl_context;
 	EGLBoolean ret;
 	EGLint context_attribs[16] = {
 		EGL_CONTEXT_CLIENT_VERSION, 0,
@@ -607,15 +719,15 @@ static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
 	context_config = disp->egl_config;
 
 	context_attribs[1] = 3;
-	disp->egl_context = eglCreateContext(disp->egl_display, context_config,
-					     EGL_NO_CONTEXT, context_attribs);
-	if (disp->egl_context == NULL) {
+	egl_context = eglCreateContext(disp->egl_display, context_config,
+				       EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == NULL) {
 		context_attribs[1] = 2;
-		disp->egl_context = eglCreateContext(disp->egl_display,
-						     context_config,
-						     EGL_NO_CONTEXT,
-						     context_attribs);
-		if (disp->egl_context == EGL_NO_CONTEXT) {
+		egl_context = eglCreateContext(disp->egl_display,
+					       context_config,
+					       EGL_NO_CONTEXT,
+					       context_attribs);
+		if (egl_context == EGL_NO_CONTEXT) {
 			egl_err("failed to create context");
 			egl_error_state();
 			return -1;
@@ -624,9 +736,13 @@ static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
 	} else {
 		egl_info("Create OpenGLES3 context");
 	}
+	/* render threads create their contexts with the same attributes */
+	memcpy(disp->context_attribs, context_attribs,
+	       sizeof(disp->context_attribs));
+	gl_context_init(&disp->ctx, egl_context);
 
 	if (disp->support_context_priority) {
-		eglQueryContext(disp->egl_display, disp->egl_context,
+		eglQueryContext(disp->egl_display, egl_context,
 				EGL_CONTEXT_PRIORITY_LEVEL_IMG, &value);
 
 		if (value != EGL_CONTEXT_PRIORITY_HIGH_IMG) {
@@ -635,7 +751,7 @@ static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
 	}
 
 	ret = eglMakeCurrent(disp->egl_display, egl_surface,
-			     egl_surface, disp->egl_context);
+			     egl_surface, egl_context);
 	if (ret == EGL_FALSE) {
 		egl_err("Failed to make EGL context current.");
 		egl_error_state();
@@ -673,8 +789,6 @@ static s32 gl_setup(struct clv_compositor *c, EGLSurface egl_surface)
 
 	glActiveTexture(GL_TEXTURE0);
 
-	set_shaders(c);
-
 	gles_info("GL_EXT_texture_rg: %s",
 		  disp->support_texture_rg ? "Y" : "N");
 	gles_info("GL_EXT_unpack_subimage: %s",
@@ -801,18 +915,18 @@ static void gl_attach_dma_buffer(struct clv_surface *surface,
 	if (buffer->pixel_fmt == CLV_PIXEL_FMT_XRGB8888) {
 		gs->target = GL_TEXTURE_2D;
 		surface->is_opaque = 1;
-		gs->shader = &disp->texture_shader_rgba;
+		gs->shader = GL_SHADER_RGBA;
 		gs->pitch = buffer->stride / 4;
 	} else if (buffer->pixel_fmt == CLV_PIXEL_FMT_ARGB8888) {
 		gs->target = GL_TEXTURE_2D;
 		surface->is_opaque = 0;
-		gs->shader = &disp->texture_shader_rgba;
+		gs->shader = GL_SHADER_RGBA;
 		gs->pitch = buffer->stride / 4;
 	} else if (buffer->pixel_fmt == CLV_PIXEL_FMT_NV12
 	        || buffer->pixel_fmt == CLV_PIXEL_FMT_NV16) {
 		gs->target = GL_TEXTURE_EXTERNAL_OES;
 		surface->is_opaque = 1;
-		gs->shader = &disp->texture_shader_egl_external;
+		gs->shader = GL_SHADER_EGL_EXTERNAL;
 		gs->pitch = buffer->w;
 	} else {
 		clv_err("illegal pixel fmt %u", buffer->pixel_fmt);
@@ -850,21 +964,21 @@ static void gl_attach_shm_buffer(struct clv_surface *surface,
 	clock_gettime(c->clk_id, &t1);
 	switch (buffer->pixel_fmt) {
 	case CLV_PIXEL_FMT_XRGB8888:
-		gs->shader = &disp->texture_shader_rgbx;
+		gs->shader = GL_SHADER_RGBX;
 		pitch = buffer->stride / 4;
 		gl_format[0] = GL_BGRA_EXT;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		surface->is_opaque = 1;
 		break;
 	case CLV_PIXEL_FMT_ARGB8888:
-		gs->shader = &disp->texture_shader_rgba;
+		gs->shader = GL_SHADER_RGBA;
 		pitch = buffer->stride / 4;
 		gl_format[0] = GL_BGRA_EXT;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		surface->is_opaque = 0;
 		break;
 	case CLV_PIXEL_FMT_YUV420P:
-		gs->shader = &disp->texture_shader_y_u_v;
+		gs->shader = GL_SHADER_Y_U_V;
 		pitch = buffer->stride;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		count_planes = 3;
@@ -888,7 +1002,7 @@ static void gl_attach_shm_buffer(struct clv_surface *surface,
 		surface->is_opaque = 1;
 		break;
 	case CLV_PIXEL_FMT_YUV444P:
-		gs->shader = &disp->texture_shader_y_u_v;
+		gs->shader = GL_SHADER_Y_U_V;
 		pitch = buffer->stride;
 		gl_pixel_type = GL_UNSIGNED_BYTE;
 		count_planes = 3;
@@ -976,7 +1090,7 @@ static s32 gl_switch_output(struct clv_output *output)
 	static s32 errored = 0;
 
 	if (eglMakeCurrent(disp->egl_display, go->egl_surface, go->egl_surface,
-			   disp->egl_context) == EGL_FALSE) {
+			   disp->ctx.egl_context) == EGL_FALSE) {
 		if (errored) {
 			egl_err("eglMakeCurrent failed.");
 			return -1;
@@ -1009,7 +1123,7 @@ static s32 compile_shader(GLenum type, s32 count, const char **sources)
 	return s;
 }
 
-static s32 load_shader(struct gl_shader *shader, struct gl_display *disp,
+static s32 load_shader(struct gl_shader *shader,
 		       const char *vertex_source, const char *fragment_source)
 {
 	char msg[512];
@@ -1049,23 +1163,26 @@ static s32 load_shader(struct gl_shader *shader, struct gl_display *disp,
 	return 0;
 }
 
-static void use_shader(struct gl_display *disp, struct gl_shader *shader)
+static struct gl_shader *use_shader(struct gl_context *ctx,
+				    enum gl_shader_type type)
 {
+	struct gl_shader *shader = &ctx->shaders[type];
 	s32 ret;
 
 	if (!shader->program) {
-		ret = load_shader(shader, disp,
+		ret = load_shader(shader,
 				  shader->vertex_source,
 				  shader->fragment_source);
 		if (ret < 0)
 			gles_err("failed to compile shader");
 	}
 
-	if (disp->current_shader == shader)
-		return;
+	if (ctx->current_shader == shader)
+		return shader;
 
 	glUseProgram(shader->program);
-	disp->current_shader = shader;
+	ctx->current_shader = shader;
+	return shader;
 }
 
 static void shader_uniforms(struct gl_shader *shader, struct clv_view *v,
@@ -1088,8 +1205,8 @@ static void shader_uniforms(struct gl_shader *shader, struct clv_view *v,
 		 0.0f,  0.0f, 1.0f, 0.0f,
 		-1.0f,  1.0f, 0.0f, 1.0f
 	};
-	static GLfloat projmat_yinvert[16];
-	static GLfloat projmat_normal[16];
+	GLfloat projmat_yinvert[16];
+	GLfloat projmat_normal[16];
 
 	memcpy(projmat_yinvert, projmat_yinvert_temp,
 	       sizeof(projmat_yinvert));
@@ -1129,8 +1246,9 @@ static s32 merge_down(struct clv_box *a, struct clv_box *b,
 	return 0;
 }
 
-static s32 compress_bands(struct clv_box *inboxes, s32 count_in,
-			  struct clv_box **outboxes)
+/* the boxes out come from the frame arena */
+static s32 compress_bands(struct clv_arena *arena, struct clv_box *inboxes,
+			  s32 count_in, struct clv_box **outboxes)
 {
 	s32 merged = 0;
 	struct clv_box *out, merge_rect;
@@ -1141,7 +1259,11 @@ static s32 compress_bands(struct clv_box *inboxes, s32 count_in,
 		return 0;
 	}
 
-	out = calloc(count_in, sizeof(struct clv_box));
+	out = clv_arena_alloc(arena, count_in * sizeof(struct clv_box));
+	if (!out) {
+		*outboxes = NULL;
+		return 0;
+	}
 	out[0] = inboxes[0];
 	count_out = 1;
 	for (i = 1; i < count_in; i++) {
@@ -1228,15 +1350,13 @@ static s32 calculate_edges(struct clv_view *v, struct clv_box *box,
 	return clip_simple(&ctx, &surf, ex, ey);
 }
 
-static s32 texture_region(struct clv_view *view, struct clv_region *region,
+static s32 texture_region(struct gl_context *ctx, struct clv_view *view,
+			  struct clv_region *region,
 			  struct clv_region *surf_region,
 			  struct clv_pos *output_base)
 {
 	struct gl_surface_state *gs = get_surface_state(view->surface);
-	struct clv_compositor *c = view->surface->c;
-	struct gl_display *disp = get_display(c);
-	s32 count_boxes, count_surf_boxes, count_raw_boxes, i, j, k;
-	s32 use_band_compression, n;
+	s32 count_boxes, count_surf_boxes, count_raw_boxes, i, j, k, n;
 	struct clv_box *raw_boxes, *boxes, *surf_boxes, *box, *surf_box;
 	u32 count_vtx = 0, *vtxcnt;
 	GLfloat *v, inv_w, inv_h;
@@ -1246,18 +1366,18 @@ static s32 texture_region(struct clv_view *view, struct clv_region *region,
 	raw_boxes = clv_region_boxes(region, &count_raw_boxes);
 	surf_boxes = clv_region_boxes(surf_region, &count_surf_boxes);
 
-	if (count_raw_boxes < 4) {
-		use_band_compression = 0;
+	boxes = NULL;
+	if (count_raw_boxes >= 4)
+		count_boxes = compress_bands(&ctx->frame, raw_boxes,
+					     count_raw_boxes, &boxes);
+	if (!boxes) {
 		count_boxes = count_raw_boxes;
 		boxes = raw_boxes;
-	} else {
-		use_band_compression = 1;
-		count_boxes = compress_bands(raw_boxes, count_raw_boxes,&boxes);
 	}
 
-	v = clv_array_add(&disp->vertices,
+	v = clv_array_add(&ctx->vertices,
 			  count_boxes * count_surf_boxes * 8 * 4 * sizeof(*v));
-	vtxcnt = clv_array_add(&disp->vtxcnt,
+	vtxcnt = clv_array_add(&ctx->vtxcnt,
 			       count_boxes * count_surf_boxes *sizeof(*vtxcnt));
 	inv_w = 1.0f / gs->pitch;
 	inv_h = 1.0f / gs->h;
@@ -1295,9 +1415,6 @@ static s32 texture_region(struct clv_view *view, struct clv_region *region,
 		}
 	}
 
-	if (use_band_compression)
-		free(boxes);
-
 	return count_vtx;
 }
 
@@ -1313,20 +1430,19 @@ static GLenum gl_format_from_internal(GLenum internal_format)
 	}
 }
 
-static void repaint_region(struct clv_view *view, struct clv_region *region,
+static void repaint_region(struct gl_context *ctx, struct clv_view *view,
+			   struct clv_region *region,
 			   struct clv_region *surf_region,
 			   struct clv_pos *pos)
 {
-	struct clv_compositor *c = view->surface->c;
-	struct gl_display *disp = get_display(c);
 	GLfloat *v;
 	u32 *vtxcnt;
 	s32 i, first, nfans;
 
-	nfans = texture_region(view, region, surf_region, pos);
+	nfans = texture_region(ctx, view, region, surf_region, pos);
 
-	v = disp->vertices.data;
-	vtxcnt = disp->vtxcnt.data;
+	v = ctx->vertices.data;
+	vtxcnt = ctx->vtxcnt.data;
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(*v), &v[0]);
 	glEnableVertexAttribArray(0);
@@ -1344,16 +1460,15 @@ static void repaint_region(struct clv_view *view, struct clv_region *region,
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
-	disp->vertices.size = 0;
-	disp->vtxcnt.size = 0;
+	ctx->vertices.size = 0;
+	ctx->vtxcnt.size = 0;
 }
 
-static void draw_view(struct clv_view *v, struct clv_output *output,
-		      struct clv_region *damage)
+static void draw_view(struct gl_context *ctx, struct clv_view *v,
+		      struct clv_output *output, struct clv_region *damage)
 {
-	struct clv_compositor *c = v->surface->c;
-	struct gl_display *disp = get_display(c);
-	struct gl_surface_state *gs = get_surface_state(v->surface);
+	struct gl_surface_state *gs = v->surface->renderer_state;
+	struct gl_shader *shader;
 	struct clv_region surface_opaque, surface_blend;
 	struct clv_region view_area, output_area;
 	struct clv_box *boxes;
@@ -1374,10 +1489,12 @@ static void draw_view(struct clv_view *v, struct clv_output *output,
 			     v->area.w, v->area.h);
 	clv_region_init_rect(&view_area, v->area.pos.x, v->area.pos.y,
 			     v->area.w, v->area.h);
+	clv_region_set_arena(&view_area, &ctx->frame);
 	clv_region_init_rect(&output_area, output->render_area.pos.x,
 			     output->render_area.pos.y,
 			     output->render_area.w,
 			     output->render_area.h);
+	clv_region_set_arena(&output_area, &ctx->frame);
 	gles_debug("output area: %d,%d %ux%u",
 		   output->render_area.pos.x,
 		   output->render_area.pos.y,
@@ -1408,8 +1525,8 @@ static void draw_view(struct clv_view *v, struct clv_output *output,
 
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 
-	use_shader(disp, gs->shader);
-	shader_uniforms(gs->shader, v, output);
+	shader = use_shader(ctx, gs->shader);
+	shader_uniforms(shader, v, output);
 
 	filter = GL_LINEAR; /* GL_NEAREST */
 	for (i = 0; i < gs->count_textures; i++) {
@@ -1420,28 +1537,30 @@ static void draw_view(struct clv_view *v, struct clv_output *output,
 	}
 
 	clv_region_init_rect(&surface_blend, 0, 0, v->surface->w,v->surface->h);
+	clv_region_set_arena(&surface_blend, &ctx->frame);
 	clv_region_subtract(&surface_blend, &surface_blend,&v->surface->opaque);
 
 	clv_region_init(&surface_opaque);
+	clv_region_set_arena(&surface_opaque, &ctx->frame);
 	clv_region_copy(&surface_opaque, &v->surface->opaque);
 
 	if (clv_region_is_not_empty(&surface_opaque)) {
-		if (gs->shader == &disp->texture_shader_rgba) {
-			use_shader(disp, &disp->texture_shader_rgbx);
-			shader_uniforms(&disp->texture_shader_rgbx, v, output);
+		if (gs->shader == GL_SHADER_RGBA) {
+			shader = use_shader(ctx, GL_SHADER_RGBX);
+			shader_uniforms(shader, v, output);
 		}
 		if (v->alpha < 1.0f)
 			glEnable(GL_BLEND);
 		else
 			glDisable(GL_BLEND);
-		repaint_region(v, &view_area, &surface_opaque,
+		repaint_region(ctx, v, &view_area, &surface_opaque,
 			       &output->render_area.pos);
 	}
 
 	if (clv_region_is_not_empty(&surface_blend)) {
-		use_shader(disp, gs->shader);
+		use_shader(ctx, gs->shader);
 		glEnable(GL_BLEND);
-		repaint_region(v, &view_area, &surface_blend,
+		repaint_region(ctx, v, &view_area, &surface_blend,
 			       &output->render_area.pos);
 	}
 
@@ -1451,39 +1570,57 @@ static void draw_view(struct clv_view *v, struct clv_output *output,
 out:
 	clv_region_fini(&view_area);
 	clv_region_fini(&output_area);
-	v->painted = 1;
 }
 
-static void repaint_views(struct clv_output *output, struct clv_region *damage)
+/*
+ * Snapshot the views to draw on the output, bottom first. This runs on the
+ * main thread, the view and surface states are only read while painting.
+ */
+static void collect_views(struct clv_output *output, struct clv_array *views)
 {
 	struct clv_compositor *c = output->c;
-	struct clv_view *view;
-	//struct timespec t1, t2;
+	struct gl_surface_state *gs;
+	struct clv_view *view, **p;
 
-	//clock_gettime(c->clk_id, &t1);
+	views->size = 0;
 	list_for_each_entry_reverse(view, &c->views, link) {
 		gles_debug("view plane %p, primary_plane %p",
 			   view->plane, &output->c->primary_plane);
 		//if (view->type == CLV_VIEW_TYPE_PRIMARY) {
 		if (view->plane == &output->c->primary_plane
 		    && view->output_mask & (1 << output->index)) {
-			draw_view(view, output, damage);
+			gs = get_surface_state(view->surface);
+			if (gs->shader)
+				view->painted = 1;
 			view->need_to_draw = 0;
+			p = clv_array_add(views, sizeof(*p));
+			assert(p);
+			*p = view;
 		}
 	}
+}
+
+static void repaint_views(struct gl_context *ctx, struct clv_output *output,
+			  struct clv_array *views, struct clv_region *damage)
+{
+	struct clv_view **view;
+	//struct timespec t1, t2;
+
+	//clock_gettime(c->clk_id, &t1);
+	clv_array_for_each_entry(view, views)
+		draw_view(ctx, *view, output, damage);
 	//clock_gettime(c->clk_id, &t2);
 	//printf("repaint views spent %lu\n", timespec_sub_to_msec(&t2, &t1));
 }
 
-static void gl_repaint_output(struct clv_output *output)
+static void gl_paint_output(struct gl_context *ctx, struct clv_output *output,
+			    struct clv_array *views)
 {
 	struct gl_output_state *go = output->renderer_state;
-	struct clv_compositor *c = output->c;
-	struct gl_display *disp = get_display(c);
+	struct gl_display *disp = get_display(output->c);
 	struct clv_rect *area = &output->render_area;
 	struct clv_region total_damage;
 	EGLBoolean ret;
-	static s32 errored = 0;
 	s32 left, top, calc;
 	u32 width, height;
 	//struct timespec t1, t2;
@@ -1504,9 +1641,6 @@ static void gl_repaint_output(struct clv_output *output)
 		height = output->current_mode->h;
 	}
 
-	if (gl_switch_output(output) < 0)
-		return;
-
 	//glViewport(0, 0, area->w, area->h);
 	//gles_debug("%d,%d %ux%u", 0, 0, area->w, area->h);
 	if (output->changed) {
@@ -1529,21 +1663,212 @@ static void gl_repaint_output(struct clv_output *output)
 		 output->current_mode->w, output->current_mode->h);
 
 	clv_region_init_rect(&total_damage, 0, 0, area->w, area->h);
-	repaint_views(output, &total_damage);
+	clv_region_set_arena(&total_damage, &ctx->frame);
+	repaint_views(ctx, output, views, &total_damage);
 	clv_region_fini(&total_damage);
+	clv_arena_reset(&ctx->frame);
 	/* TODO send frame signal */
 	egl_debug("EGL Swap buffer.");
 	//clock_gettime(c->clk_id, &t1);
 	ret = eglSwapBuffers(disp->egl_display, go->egl_surface);
 	//clock_gettime(c->clk_id, &t2);
 	//printf("Swap spent %ld ms\n", timespec_sub_to_msec(&t2, &t1));
-	if (ret == EGL_FALSE && !errored) {
-		errored = 1;
+	if (ret == EGL_FALSE && !go->swap_errored) {
+		go->swap_errored = 1;
 		egl_err("Failed to call eglSwapBuffers.");
 		egl_error_state();
 	}
 }
 
+/*
+ * glFlush does not make the uploads of one context visible to another.
+ * A fence is put behind them, the render thread waits for it before it
+ * samples the textures. Without fence sync, wait for the uploads here.
+ */
+static EGLSyncKHR gl_upload_fence(struct gl_display *disp)
+{
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+
+	if (disp->create_sync)
+		sync = disp->create_sync(disp->egl_display, EGL_SYNC_FENCE_KHR,
+					 NULL);
+	if (sync == EGL_NO_SYNC_KHR) {
+		glFinish();
+		return EGL_NO_SYNC_KHR;
+	}
+
+	/* the fence has to be flushed before another context waits on it */
+	glFlush();
+	return sync;
+}
+
+static void gl_upload_wait(struct gl_display *disp, EGLSyncKHR sync)
+{
+	if (sync == EGL_NO_SYNC_KHR)
+		return;
+
+	if (disp->wait_sync) {
+		if (disp->wait_sync(disp->egl_display, sync, 0) == EGL_FALSE)
+			egl_err("failed to wait for the uploads.");
+	} else {
+		disp->client_wait_sync(disp->egl_display, sync, 0,
+				       EGL_FOREVER_KHR);
+	}
+	disp->destroy_sync(disp->egl_display, sync);
+}
+
+static void *gl_render_thread_proc(void *data)
+{
+	struct gl_render_thread *thread = data;
+	struct clv_output *output = thread->output;
+	struct gl_output_state *go = output->renderer_state;
+	struct gl_display *disp = get_display(output->c);
+	struct gl_render_cmd *cmd;
+
+	/* the output surface stays current on this thread until it exits */
+	if (eglMakeCurrent(disp->egl_display, go->egl_surface, go->egl_surface,
+			   thread->ctx.egl_context) == EGL_FALSE) {
+		egl_err("render thread %u failed to make context current.",
+			output->index);
+		egl_error_state();
+	}
+
+	for (;;) {
+		while (sem_wait(&thread->cmd_sem) < 0 && errno == EINTR)
+			;
+		cmd = clv_spsc_queue_pop(&thread->queue);
+		if (!cmd)
+			continue;
+		if (cmd->type == GL_RENDER_CMD_QUIT)
+			break;
+		gl_upload_wait(disp, cmd->upload_sync);
+		cmd->upload_sync = EGL_NO_SYNC_KHR;
+		gl_paint_output(&thread->ctx, output, &cmd->views);
+		sem_post(&thread->done_sem);
+	}
+
+	gl_context_release(&thread->ctx);
+	eglMakeCurrent(disp->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+		       EGL_NO_CONTEXT);
+	eglReleaseThread();
+	return NULL;
+}
+
+static s32 gl_render_thread_post(struct gl_render_thread *thread,
+				 struct gl_render_cmd *cmd)
+{
+	if (clv_spsc_queue_push(&thread->queue, cmd) < 0) {
+		gles_err("render thread %u queue full.", thread->output->index);
+		return -1;
+	}
+	sem_post(&thread->cmd_sem);
+	return 0;
+}
+
+static struct gl_render_thread *gl_render_thread_create(
+					struct clv_output *output)
+{
+	struct gl_display *disp = get_display(output->c);
+	struct gl_render_thread *thread;
+	EGLContext egl_context;
+
+	thread = calloc(1, sizeof(*thread));
+	if (!thread)
+		return NULL;
+
+	egl_context = eglCreateContext(disp->egl_display, disp->egl_config,
+				       disp->ctx.egl_context,
+				       disp->context_attribs);
+	if (egl_context == EGL_NO_CONTEXT) {
+		egl_err("failed to create shared context for output %u",
+			output->index);
+		egl_error_state();
+		goto err_ctx;
+	}
+	gl_context_init(&thread->ctx, egl_context);
+
+	if (clv_spsc_queue_init(&thread->queue, 4) < 0)
+		goto err_queue;
+
+	sem_init(&thread->cmd_sem, 0, 0);
+	sem_init(&thread->done_sem, 0, 0);
+	thread->quit_cmd.type = GL_RENDER_CMD_QUIT;
+	thread->output = output;
+
+	if (pthread_create(&thread->tid, NULL, gl_render_thread_proc,
+			   thread)) {
+		gles_err("failed to create render thread for output %u",
+			 output->index);
+		goto err_thread;
+	}
+
+	return thread;
+
+err_thread:
+	sem_destroy(&thread->done_sem);
+	sem_destroy(&thread->cmd_sem);
+	clv_spsc_queue_release(&thread->queue);
+err_queue:
+	clv_array_release(&thread->ctx.vertices);
+	clv_array_release(&thread->ctx.vtxcnt);
+	eglDestroyContext(disp->egl_display, egl_context);
+err_ctx:
+	free(thread);
+	return NULL;
+}
+
+static void gl_render_thread_destroy(struct gl_render_thread *thread)
+{
+	struct gl_display *disp = get_display(thread->output->c);
+
+	gl_render_thread_post(thread, &thread->quit_cmd);
+	pthread_join(thread->tid, NULL);
+
+	eglDestroyContext(disp->egl_display, thread->ctx.egl_context);
+	sem_destroy(&thread->done_sem);
+	sem_destroy(&thread->cmd_sem);
+	clv_spsc_queue_release(&thread->queue);
+	free(thread);
+}
+
+static void gl_repaint_output(struct clv_output *output)
+{
+	struct gl_output_state *go = output->renderer_state;
+	struct gl_display *disp = get_display(output->c);
+
+	if (go->thread) {
+		assert(!go->thread->busy);
+		collect_views(output, &go->cmd.views);
+		go->cmd.upload_sync = gl_upload_fence(disp);
+		if (gl_render_thread_post(go->thread, &go->cmd) == 0) {
+			go->thread->busy = 1;
+		} else if (go->cmd.upload_sync != EGL_NO_SYNC_KHR) {
+			disp->destroy_sync(disp->egl_display,
+					   go->cmd.upload_sync);
+			go->cmd.upload_sync = EGL_NO_SYNC_KHR;
+		}
+		return;
+	}
+
+	if (gl_switch_output(output) < 0)
+		return;
+
+	collect_views(output, &go->cmd.views);
+	gl_paint_output(&disp->ctx, output, &go->cmd.views);
+}
+
+static void gl_repaint_output_wait(struct clv_output *output)
+{
+	struct gl_output_state *go = output->renderer_state;
+
+	if (!go->thread || !go->thread->busy)
+		return;
+
+	while (sem_wait(&go->thread->done_sem) < 0 && errno == EINTR)
+		;
+	go->thread->busy = 0;
+}
+
 static void gl_flush_damage(struct clv_surface *surface)
 {
 	struct gl_display *disp = get_display(surface->c);
@@ -1679,16 +2004,18 @@ static void gl_display_destroy(struct clv_compositor *c)
 	struct gl_display *disp = get_display(c);
 	struct dma_buffer *buffer, *t;
 
+	eglMakeCurrent(disp->egl_display, disp->dummy_surface,
+		       disp->dummy_surface, disp->ctx.egl_context);
+	gl_context_release(&disp->ctx);
 	eglMakeCurrent(disp->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
 		       EGL_NO_CONTEXT);
+	eglDestroyContext(disp->egl_display, disp->ctx.egl_context);
 	list_for_each_entry_safe(buffer, t, &disp->dmabuf_images, link)
 		dmabuf_destroy(buffer);
 	if (disp->dummy_surface != EGL_NO_SURFACE)
 		eglDestroySurface(disp->egl_display, disp->dummy_surface);
 	eglTerminate(disp->egl_display);
 	eglReleaseThread();
-	clv_array_release(&disp->vertices);
-	clv_array_release(&disp->vtxcnt);
 	free(disp);
 }
 
@@ -1702,6 +2029,8 @@ static s32 gl_output_state_create(struct clv_output *output,
 		return -ENOMEM;
 
 	go->egl_surface = surface;
+	clv_array_init(&go->cmd.views);
+	go->cmd.type = GL_RENDER_CMD_REPAINT;
 	output->renderer_state = go;
 	return 0;
 }
@@ -1757,6 +2086,7 @@ static s32 gl_output_create(struct clv_output *output,
 {
 	struct clv_compositor *c = output->c;
 	struct gl_display *disp = get_display(c);
+	struct gl_output_state *go;
 	EGLSurface egl_surface;
 	s32 ret;
 
@@ -1769,10 +2099,20 @@ static s32 gl_output_create(struct clv_output *output,
 	}
 
 	ret = gl_output_state_create(output, egl_surface);
-	if (ret < 0)
+	if (ret < 0) {
 		eglDestroySurface(disp->egl_display, egl_surface);
+		return ret;
+	}
+
+	if (disp->use_render_thread) {
+		go = output->renderer_state;
+		go->thread = gl_render_thread_create(output);
+		if (!go->thread)
+			gles_warn("output %u falls back to main thread render",
+				  output->index);
+	}
 
-	return ret;
+	return 0;
 }
 
 static void gl_output_destroy(struct clv_output *output)
@@ -1780,9 +2120,14 @@ static void gl_output_destroy(struct clv_output *output)
 	struct gl_display *disp = get_display(output->c);
 	struct gl_output_state *go = output->renderer_state;
 
-	eglMakeCurrent(disp->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
-		       EGL_NO_CONTEXT);
+	if (go->thread) {
+		gl_render_thread_destroy(go->thread);
+	} else {
+		eglMakeCurrent(disp->egl_display, EGL_NO_SURFACE,
+			       EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	}
 	eglDestroySurface(disp->egl_display, go->egl_surface);
+	clv_array_release(&go->cmd.views);
 	free(go);
 }
 
@@ -1960,6 +2305,7 @@ s32 gl_renderer_create(struct clv_compositor *c, s32 *formats, s32 count_fmts,
 {
 	struct gl_display *disp;
 	EGLint major, minor;
+	char *env;
 
 	gles_dbg = 15;
 	egl_dbg = 15;
@@ -2019,14 +2365,22 @@ s32 gl_renderer_create(struct clv_compositor *c, s32 *formats, s32 count_fmts,
 	if (gl_setup(c, disp->dummy_surface) < 0)
 		goto err3;
 
-	clv_array_init(&disp->vertices);
-	clv_array_init(&disp->vtxcnt);
+	/*
+	 * CLOVER_RENDER_THREAD=1 paints every output on its own thread. The
+	 * main context then stays current on the dummy surface, the output
+	 * surfaces belong to their render threads.
+	 */
+	env = getenv("CLOVER_RENDER_THREAD");
+	if (env && atoi(env))
+		disp->use_render_thread = 1;
+	gles_info("render thread: %s", disp->use_render_thread ? "Y" : "N");
 
 	clv_signal_init(&disp->destroy_signal);
 
 	INIT_LIST_HEAD(&disp->dmabuf_images);
 
 	disp->base.repaint_output = gl_repaint_output;
+	disp->base.repaint_output_wait = gl_repaint_output_wait;
 	disp->base.flush_damage = gl_flush_damage;
 	disp->base.attach_buffer = gl_attach_buffer;
 	disp->base.output_create = gl_output_create;
@@ -1,9 +1,35 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dlfcn.h>
 #include <clover_utils.h>
 #include <clover_compositor.h>
 
-#define LIB_NAME "libclover_gl_renderer.so"
+/*
+ * CLOVER_RENDERER=gl|sw picks the renderer, GL by default. The software
+ * one composes on the CPU, for boards without a usable GPU driver.
+ */
+struct renderer_lib {
+	const char *name;
+	const char *lib_name;
+	const char *create_sym;
+	const char *set_dbg_sym;
+};
+
+static const struct renderer_lib renderer_libs[] = {
+	{
+		.name = "gl",
+		.lib_name = "libclover_gl_renderer.so",
+		.create_sym = "gl_renderer_create",
+		.set_dbg_sym = "gl_set_renderer_dbg",
+	},
+	{
+		.name = "sw",
+		.lib_name = "libclover_sw_renderer.so",
+		.create_sym = "sw_renderer_create",
+		.set_dbg_sym = "sw_set_renderer_dbg",
+	},
+};
 
 static void *lib_handle = NULL;
 
@@ -11,27 +37,46 @@ static s32 (*create)(struct clv_compositor *c, s32 *formats, s32 count_fmts,
 		     s32 no_winsys, void *native_window, s32 *vid) = NULL;
 static void (*set_dbg)(u32 flag) = NULL;
 
+static const struct renderer_lib *choose_lib(void)
+{
+	char *env = getenv("CLOVER_RENDERER");
+	s32 i;
+
+	if (!env)
+		return &renderer_libs[0];
+
+	for (i = 0; i < ARRAY_SIZE(renderer_libs); i++)
+		if (!strcmp(env, renderer_libs[i].name))
+			return &renderer_libs[i];
+
+	fprintf(stderr, "unknown renderer %s, use %s\n", env,
+		renderer_libs[0].name);
+	return &renderer_libs[0];
+}
+
 static void load_lib(void)
 {
+	const struct renderer_lib *lib;
 	char *error;
 
 	if (create && set_dbg) {
 		return;
 	} else {
-		lib_handle = dlopen(LIB_NAME, RTLD_NOW);
+		lib = choose_lib();
+		lib_handle = dlopen(lib->lib_name, RTLD_NOW);
 		if (!lib_handle) {
-			fprintf(stderr, "cannot load %s (%s)\n", LIB_NAME,
+			fprintf(stderr, "cannot load %s (%s)\n", lib->lib_name,
 				dlerror());
 			exit(EXIT_FAILURE);
 		}
 		dlerror();
-		create = dlsym(lib_handle, "gl_renderer_create");
+		create = dlsym(lib_handle, lib->create_sym);
 		error = dlerror();
 		if (error)
 			exit(EXIT_FAILURE);
 
 		dlerror();
-		set_dbg = dlsym(lib_handle, "gl_set_renderer_dbg");
+		set_dbg = dlsym(lib_handle, lib->set_dbg_sym);
 		error = dlerror();
 		if (error)
 			exit(EXIT_FAILURE);
@@ -52,4 +97,3 @@ void set_renderer_dbg(u32 flag)
 		load_lib();
 	set_dbg(flag);
 }
-
@@ -0,0 +1,1193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_array.h>
+#include <clover_region.h>
+#include <clover_shm.h>
+#include <clover_signal.h>
+#include <clover_pixel.h>
+#include <clover_thread_pool.h>
+#include <clover_compositor.h>
+
+/*
+ * CPU renderer.
+ *
+ * Every surface keeps a premultiplied ARGB8888 copy of its content, made
+ * when the buffer is attached or damaged, the way the GL renderer keeps a
+ * texture. An output is painted into the XRGB8888 buffer the backend hands
+ * over with output_set_buffer. Only the damage of the frame, plus what was
+ * painted in the other buffers since this one was last used, is repainted.
+ *
+ * The regions to upload, compose or scale are cut in tiles of a grid small
+ * enough for the pixels of a tile to stay in the cache, which are handed to
+ * a work-stealing thread pool.
+ *
+ * If the render area and the part of the mode showing it differ in size, the
+ * views are composed in a render area sized canvas first, which is then
+ * scaled to the mode with a bilinear filter.
+ */
+
+static u8 sw_dbg = 0;
+
+#define sw_debug(fmt, ...) do { \
+	if (sw_dbg >= 3) { \
+		clv_debug("[SWR ] " fmt, ##__VA_ARGS__); \
+	} \
+} while (0);
+
+#define sw_info(fmt, ...) do { \
+	if (sw_dbg >= 2) { \
+		clv_info("[SWR ] " fmt, ##__VA_ARGS__); \
+	} \
+} while (0);
+
+#define sw_notice(fmt, ...) do { \
+	if (sw_dbg >= 1) { \
+		clv_notice("[SWR ] " fmt, ##__VA_ARGS__); \
+	} \
+} while (0);
+
+#define sw_warn(fmt, ...) do { \
+	clv_warn("[SWR ] " fmt, ##__VA_ARGS__); \
+} while (0);
+
+#define sw_err(fmt, ...) do { \
+	clv_err("[SWR ] " fmt, ##__VA_ARGS__); \
+} while (0);
+
+/* outputs whose damage is tracked, the others are repainted every frame */
+#define SW_MAX_OUTPUTS 8
+/* buffers an output is painted in, in turn */
+#define SW_MAX_TARGETS 4
+/* 32KB of ARGB pixels, the size of a typical L1 data cache */
+#define SW_TILE_W 128
+#define SW_TILE_H 64
+
+#define SW_BLACK 0xFF000000
+
+/* linux/dma-buf.h, missing from older kernel headers */
+struct sw_dma_buf_sync {
+	u64 flags;
+};
+#define SW_DMA_BUF_SYNC_READ (1 << 0)
+#define SW_DMA_BUF_SYNC_START (0 << 2)
+#define SW_DMA_BUF_SYNC_END (1 << 2)
+#define SW_DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct sw_dma_buf_sync)
+
+struct sw_dma_buffer {
+	struct clv_buffer base;
+	u8 *map;
+	u32 map_sz;
+	u32 pitch; /* bytes per row of the first plane */
+	u32 vpitch; /* rows of the first plane */
+	struct list_head link;
+};
+
+struct sw_renderer {
+	struct clv_renderer base;
+	struct clv_thread_pool *pool;
+	/* tiles of the upload running, main thread only */
+	struct clv_array upload_tiles;
+	struct list_head dmabufs;
+	struct clv_signal destroy_signal;
+};
+
+struct sw_surface_state {
+	struct clv_surface *surface;
+	struct clv_buffer *buffer;
+	enum clv_pixel_fmt pixel_fmt;
+
+	/* premultiplied ARGB8888 copy of the content */
+	u32 *pixels;
+	u32 w, h, stride;
+	s32 has_content;
+	s32 opaque;
+
+	s32 needs_full_upload;
+	struct clv_region upload_damage;
+	/* copied in and not painted yet, per output index */
+	struct clv_region damage[SW_MAX_OUTPUTS];
+
+	struct clv_listener renderer_destroy_listener;
+	struct clv_listener surface_destroy_listener;
+};
+
+/* what a view looked like on an output when it was last painted */
+struct sw_view_record {
+	struct clv_view *view;
+	struct sw_surface_state *ss;
+	struct clv_rect area;
+	float alpha;
+	s32 has_content;
+};
+
+/* a view as painted in this frame, output local coordinates */
+struct sw_layer {
+	struct sw_surface_state *ss;
+	s32 x, y;
+	u32 w, h;
+	u8 alpha;
+	struct clv_region clip;
+};
+
+struct sw_target {
+	void *pixels;
+	s32 full;
+	/* painted in the other targets since this one was used */
+	struct clv_region damage;
+};
+
+struct sw_output_state {
+	struct sw_target targets[SW_MAX_TARGETS];
+	struct sw_target *target;
+	u32 stride;
+	u32 next_target;
+
+	/* geometry of the last frame */
+	struct clv_rect area;
+	u32 mode_w, mode_h;
+	/* rect of the mode the render area is shown in */
+	s32 left, top;
+	u32 width, height;
+
+	struct clv_array records;
+	struct clv_array next_records;
+	struct clv_array layers;
+	struct clv_region repaint;
+	/* not covered by an opaque layer, cleared to black */
+	struct clv_region bg;
+	/* rect of the mode to scale, relative to left, top */
+	struct clv_region scale_damage;
+
+	/* render area sized, only if it is scaled */
+	u32 *canvas;
+	u32 canvas_w, canvas_h;
+
+	struct clv_array tiles;
+
+	/* where the layers are composed */
+	u8 *dst;
+	u32 dst_stride;
+	u8 *scale_dst;
+};
+
+static inline struct sw_renderer *get_renderer(struct clv_compositor *c)
+{
+	return container_of(c->renderer, struct sw_renderer, base);
+}
+
+/*
+ * Cut the boxes of a region along a grid of tiles. The tiles do not overlap,
+ * so that they may be painted concurrently.
+ */
+static void sw_tile_region(struct clv_array *tiles, struct clv_region *region)
+{
+	struct clv_box *boxes, *tile;
+	s32 i, count_boxes, x, y, x2, y2;
+
+	tiles->size = 0;
+	boxes = clv_region_boxes(region, &count_boxes);
+	for (i = 0; i < count_boxes; i++) {
+		for (y = boxes[i].p1.y; y < boxes[i].p2.y; y = y2) {
+			y2 = MIN((y / SW_TILE_H + 1) * SW_TILE_H,
+				 boxes[i].p2.y);
+			for (x = boxes[i].p1.x; x < boxes[i].p2.x; x = x2) {
+				x2 = MIN((x / SW_TILE_W + 1) * SW_TILE_W,
+					 boxes[i].p2.x);
+				tile = clv_array_add(tiles, sizeof(*tile));
+				if (!tile)
+					return;
+				tile->p1.x = x;
+				tile->p1.y = y;
+				tile->p2.x = x2;
+				tile->p2.y = y2;
+			}
+		}
+	}
+}
+
+static inline s32 clip_box(struct clv_box *out, struct clv_box *a,
+			   struct clv_box *b)
+{
+	out->p1.x = MAX(a->p1.x, b->p1.x);
+	out->p1.y = MAX(a->p1.y, b->p1.y);
+	out->p2.x = MIN(a->p2.x, b->p2.x);
+	out->p2.y = MIN(a->p2.y, b->p2.y);
+
+	return out->p1.x < out->p2.x && out->p1.y < out->p2.y;
+}
+
+static inline u32 clamp8(s32 v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* same BT.709 constants as the YUV shader of the GL renderer, Q10 */
+static inline u32 yuv_pixel(s32 y, s32 u, s32 v)
+{
+	s32 r, g, b;
+
+	y = (y - 16) * 1192;
+	u -= 128;
+	v -= 128;
+	r = (y + 1835 * v + 512) >> 10;
+	g = (y - 218 * u - 547 * v + 512) >> 10;
+	b = (y + 2165 * u + 512) >> 10;
+
+	return SW_BLACK | (clamp8(r) << 16) | (clamp8(g) << 8) | clamp8(b);
+}
+
+struct sw_yuv_layout {
+	const u8 *y, *u, *v;
+	u32 y_stride, uv_stride;
+	u32 hsub, vsub;
+	u32 uv_step; /* 2 for interleaved chroma */
+};
+
+static void sw_convert_yuv(struct sw_surface_state *ss,
+			   struct sw_yuv_layout *l, struct clv_box *box)
+{
+	const u8 *yrow, *urow, *vrow;
+	u32 *dst;
+	s32 x, y, c;
+
+	for (y = box->p1.y; y < box->p2.y; y++) {
+		yrow = l->y + y * l->y_stride;
+		urow = l->u + (y / l->vsub) * l->uv_stride;
+		vrow = l->v + (y / l->vsub) * l->uv_stride;
+		dst = ss->pixels + y * ss->w;
+		for (x = box->p1.x; x < box->p2.x; x++) {
+			c = (x / l->hsub) * l->uv_step;
+			dst[x] = yuv_pixel(yrow[x], urow[c], vrow[c]);
+		}
+	}
+}
+
+/*
+ * Copy a box of the buffer content to the surface's copy. pitch is the row
+ * pitch of the first plane in bytes, vpitch its count of rows, the other
+ * planes follow it.
+ */
+static void sw_upload_box(struct sw_surface_state *ss, const u8 *data,
+			  u32 pitch, u32 vpitch, struct clv_box *box)
+{
+	struct sw_yuv_layout l;
+	const u8 *src;
+	u32 *dst;
+	u32 w = box->p2.x - box->p1.x, h = box->p2.y - box->p1.y;
+
+	src = data + box->p1.y * pitch + box->p1.x * 4;
+	dst = ss->pixels + box->p1.y * ss->w + box->p1.x;
+
+	l.y = data;
+	l.y_stride = pitch;
+	switch (ss->pixel_fmt) {
+	case CLV_PIXEL_FMT_XRGB8888:
+		clv_pixel_xrgb_to_argb(dst, ss->stride, src, pitch, w, h);
+		return;
+	case CLV_PIXEL_FMT_ARGB8888:
+		/* clients hand premultiplied alpha, as for GL */
+		clv_pixel_copy_rect(dst, ss->stride, src, pitch, w * 4, h);
+		return;
+	case CLV_PIXEL_FMT_YUV420P:
+		l.u = data + pitch * vpitch;
+		l.uv_stride = pitch / 2;
+		l.v = l.u + l.uv_stride * (vpitch / 2);
+		l.hsub = l.vsub = 2;
+		l.uv_step = 1;
+		break;
+	case CLV_PIXEL_FMT_YUV444P:
+		l.u = data + pitch * vpitch;
+		l.uv_stride = pitch;
+		l.v = l.u + pitch * vpitch;
+		l.hsub = l.vsub = 1;
+		l.uv_step = 1;
+		break;
+	case CLV_PIXEL_FMT_NV12:
+	case CLV_PIXEL_FMT_NV16:
+		l.u = data + pitch * vpitch;
+		l.v = l.u + 1;
+		l.uv_stride = pitch;
+		l.hsub = 2;
+		l.vsub = ss->pixel_fmt == CLV_PIXEL_FMT_NV12 ? 2 : 1;
+		l.uv_step = 2;
+		break;
+	default:
+		return;
+	}
+	sw_convert_yuv(ss, &l, box);
+}
+
+struct sw_upload_job {
+	struct sw_surface_state *ss;
+	const u8 *data;
+	u32 pitch, vpitch;
+	struct clv_box *tiles;
+};
+
+static void sw_upload_tile(void *data, u32 index)
+{
+	struct sw_upload_job *job = data;
+
+	sw_upload_box(job->ss, job->data, job->pitch, job->vpitch,
+		      &job->tiles[index]);
+}
+
+static void sw_upload_region(struct sw_renderer *r,
+			     struct sw_surface_state *ss, const u8 *data,
+			     u32 pitch, u32 vpitch, struct clv_region *region)
+{
+	struct sw_upload_job job;
+
+	sw_tile_region(&r->upload_tiles, region);
+	job.ss = ss;
+	job.data = data;
+	job.pitch = pitch;
+	job.vpitch = vpitch;
+	job.tiles = r->upload_tiles.data;
+	clv_thread_pool_run(r->pool, sw_upload_tile, &job,
+			    r->upload_tiles.size / sizeof(struct clv_box));
+}
+
+static void sw_surface_add_damage(struct sw_surface_state *ss,
+				  struct clv_region *damage)
+{
+	s32 i;
+
+	for (i = 0; i < SW_MAX_OUTPUTS; i++)
+		clv_region_union(&ss->damage[i], &ss->damage[i], damage);
+}
+
+static void sw_surface_damage_all(struct sw_surface_state *ss)
+{
+	s32 i;
+
+	for (i = 0; i < SW_MAX_OUTPUTS; i++)
+		clv_region_union_rect(&ss->damage[i], &ss->damage[i],
+				      0, 0, ss->w, ss->h);
+}
+
+static void sw_surface_state_destroy(struct sw_surface_state *ss)
+{
+	s32 i;
+
+	if (!ss)
+		return;
+
+	if (ss->surface)
+		ss->surface->renderer_state = NULL;
+	free(ss->pixels);
+	clv_region_fini(&ss->upload_damage);
+	for (i = 0; i < SW_MAX_OUTPUTS; i++)
+		clv_region_fini(&ss->damage[i]);
+	list_del(&ss->renderer_destroy_listener.link);
+	list_del(&ss->surface_destroy_listener.link);
+	free(ss);
+}
+
+static void surface_state_handle_surface_destroy(struct clv_listener *listener,
+						 void *data)
+{
+	struct sw_surface_state *ss = container_of(listener,
+						   struct sw_surface_state,
+						   surface_destroy_listener);
+	sw_surface_state_destroy(ss);
+}
+
+static void surface_state_handle_renderer_destroy(
+					struct clv_listener *listener,
+					void *data)
+{
+	struct sw_surface_state *ss = container_of(listener,
+						   struct sw_surface_state,
+						   renderer_destroy_listener);
+	sw_surface_state_destroy(ss);
+}
+
+static struct sw_surface_state *get_surface_state(struct clv_surface *surface)
+{
+	struct sw_renderer *r = get_renderer(surface->c);
+	struct sw_surface_state *ss = surface->renderer_state;
+	s32 i;
+
+	if (ss)
+		return ss;
+
+	ss = calloc(1, sizeof(*ss));
+	if (!ss)
+		return NULL;
+
+	ss->surface = surface;
+	clv_region_init(&ss->upload_damage);
+	for (i = 0; i < SW_MAX_OUTPUTS; i++)
+		clv_region_init(&ss->damage[i]);
+
+	ss->surface_destroy_listener.notify =
+		surface_state_handle_surface_destroy;
+	clv_signal_add(&surface->destroy_signal, &ss->surface_destroy_listener);
+	ss->renderer_destroy_listener.notify =
+		surface_state_handle_renderer_destroy;
+	clv_signal_add(&r->destroy_signal, &ss->renderer_destroy_listener);
+
+	surface->renderer_state = ss;
+	return ss;
+}
+
+static s32 sw_surface_alloc(struct sw_surface_state *ss, u32 w, u32 h)
+{
+	if (ss->pixels && ss->w == w && ss->h == h)
+		return 0;
+
+	free(ss->pixels);
+	ss->pixels = malloc((size_t)w * h * 4);
+	if (!ss->pixels) {
+		sw_err("not enough memory for a %ux%u surface", w, h);
+		ss->w = ss->h = ss->stride = 0;
+		return -1;
+	}
+	ss->w = w;
+	ss->h = h;
+	ss->stride = w * 4;
+	ss->needs_full_upload = 1;
+
+	return 0;
+}
+
+static void sw_dma_sync(struct sw_dma_buffer *dmabuf, u64 flags)
+{
+	struct sw_dma_buf_sync sync = {
+		.flags = flags | SW_DMA_BUF_SYNC_READ,
+	};
+
+	/* older kernels have no cache maintenance to do, or the ioctl */
+	if (ioctl(dmabuf->base.fd, SW_DMA_BUF_IOCTL_SYNC, &sync) < 0
+	    && errno != ENOTTY)
+		sw_debug("failed to sync dmabuf %d. %m", dmabuf->base.fd);
+}
+
+static void sw_attach_buffer(struct clv_surface *surface,
+			     struct clv_buffer *buffer)
+{
+	struct sw_renderer *r = get_renderer(surface->c);
+	struct sw_surface_state *ss = get_surface_state(surface);
+	struct sw_dma_buffer *dmabuf;
+	struct clv_region all;
+
+	if (!ss)
+		return;
+
+	if (!buffer) {
+		ss->buffer = NULL;
+		ss->has_content = 0;
+		surface->is_opaque = 0;
+		sw_surface_damage_all(ss);
+		return;
+	}
+
+	switch (buffer->pixel_fmt) {
+	case CLV_PIXEL_FMT_ARGB8888:
+		surface->is_opaque = 0;
+		break;
+	case CLV_PIXEL_FMT_XRGB8888:
+	case CLV_PIXEL_FMT_YUV420P:
+	case CLV_PIXEL_FMT_YUV444P:
+	case CLV_PIXEL_FMT_NV12:
+	case CLV_PIXEL_FMT_NV16:
+		surface->is_opaque = 1;
+		break;
+	default:
+		sw_err("unknown pixel format %u", buffer->pixel_fmt);
+		return;
+	}
+
+	if (buffer->type != CLV_BUF_TYPE_SHM
+	    && buffer->type != CLV_BUF_TYPE_DMA) {
+		sw_err("unknown buffer type %p %u", buffer, buffer->type);
+		ss->buffer = NULL;
+		ss->has_content = 0;
+		surface->is_opaque = 0;
+		return;
+	}
+
+	if (buffer->pixel_fmt != ss->pixel_fmt)
+		ss->needs_full_upload = 1;
+	ss->pixel_fmt = buffer->pixel_fmt;
+	ss->opaque = surface->is_opaque;
+	ss->buffer = buffer;
+	ss->has_content = 0;
+	if (sw_surface_alloc(ss, buffer->w, buffer->h) < 0)
+		return;
+	ss->has_content = 1;
+
+	if (buffer->type == CLV_BUF_TYPE_SHM)
+		return;
+
+	/* nothing says which part of a dmabuf changed, copy it all */
+	dmabuf = container_of(buffer, struct sw_dma_buffer, base);
+	clv_region_init_rect(&all, 0, 0, buffer->w, buffer->h);
+	sw_dma_sync(dmabuf, SW_DMA_BUF_SYNC_START);
+	sw_upload_region(r, ss, dmabuf->map, dmabuf->pitch, dmabuf->vpitch,
+			 &all);
+	sw_dma_sync(dmabuf, SW_DMA_BUF_SYNC_END);
+	clv_region_fini(&all);
+	ss->needs_full_upload = 0;
+	sw_surface_damage_all(ss);
+}
+
+static void sw_flush_damage(struct clv_surface *surface)
+{
+	struct sw_renderer *r = get_renderer(surface->c);
+	struct sw_surface_state *ss = get_surface_state(surface);
+	struct clv_buffer *buffer;
+	u8 *data;
+
+	if (!ss)
+		return;
+
+	buffer = ss->buffer;
+	clv_region_union(&ss->upload_damage, &ss->upload_damage,
+			 &surface->damage);
+
+	if (!buffer || !ss->has_content || buffer->type != CLV_BUF_TYPE_SHM)
+		return;
+
+	if (ss->needs_full_upload) {
+		clv_region_fini(&ss->upload_damage);
+		clv_region_init_rect(&ss->upload_damage, 0, 0, ss->w, ss->h);
+	} else {
+		clv_region_intersect_rect(&ss->upload_damage,
+					  &ss->upload_damage,
+					  0, 0, ss->w, ss->h);
+	}
+
+	data = container_of(buffer, struct shm_buffer, base)->shm.map;
+	assert(data);
+
+	sw_upload_region(r, ss, data, buffer->stride, buffer->h,
+			 &ss->upload_damage);
+	sw_surface_add_damage(ss, &ss->upload_damage);
+
+	clv_region_fini(&ss->upload_damage);
+	clv_region_init(&ss->upload_damage);
+	ss->needs_full_upload = 0;
+}
+
+static void sw_output_targets_full(struct sw_output_state *so)
+{
+	s32 i;
+
+	for (i = 0; i < SW_MAX_TARGETS; i++) {
+		so->targets[i].full = 1;
+		clv_region_clear(&so->targets[i].damage);
+	}
+}
+
+static void sw_output_set_buffer(struct clv_output *output, void *pixels,
+				 u32 stride)
+{
+	struct sw_output_state *so = output->renderer_state;
+	struct sw_target *t;
+	s32 i;
+
+	if (stride != so->stride) {
+		so->stride = stride;
+		for (i = 0; i < SW_MAX_TARGETS; i++)
+			so->targets[i].pixels = NULL;
+	}
+
+	for (i = 0; i < SW_MAX_TARGETS; i++) {
+		if (so->targets[i].pixels == pixels) {
+			so->target = &so->targets[i];
+			return;
+		}
+	}
+
+	/* a buffer we did not paint yet, nothing in it can be kept */
+	t = &so->targets[so->next_target];
+	so->next_target = (so->next_target + 1) % SW_MAX_TARGETS;
+	t->pixels = pixels;
+	t->full = 1;
+	clv_region_clear(&t->damage);
+	so->target = t;
+}
+
+/* place the render area in the mode, keeping its aspect ratio like GL does */
+static s32 sw_output_update_geometry(struct sw_output_state *so,
+				     struct clv_output *output)
+{
+	struct clv_rect *area = &output->render_area;
+	u32 mode_w = output->current_mode->w, mode_h = output->current_mode->h;
+	s32 calc;
+
+	if (!memcmp(area, &so->area, sizeof(*area))
+	    && mode_w == so->mode_w && mode_h == so->mode_h)
+		return 0;
+
+	so->area = *area;
+	so->mode_w = mode_w;
+	so->mode_h = mode_h;
+
+	calc = mode_w * area->h / area->w;
+	if (calc <= mode_h) {
+		so->left = 0;
+		so->top = (mode_h - calc) / 2;
+		so->width = mode_w;
+		so->height = calc;
+	} else {
+		calc = area->w * mode_h / area->h;
+		so->left = (mode_w - calc) / 2;
+		so->top = 0;
+		so->width = calc;
+		so->height = mode_h;
+	}
+
+	free(so->canvas);
+	so->canvas = NULL;
+	so->canvas_w = so->canvas_h = 0;
+	if (so->width != area->w || so->height != area->h) {
+		so->canvas = malloc((size_t)area->w * area->h * 4);
+		if (!so->canvas) {
+			sw_err("not enough memory for a %ux%u canvas",
+			       area->w, area->h);
+			return -1;
+		}
+		so->canvas_w = area->w;
+		so->canvas_h = area->h;
+	}
+	sw_info("output %u: render area %ux%u shown at %d,%d %ux%u",
+		output->index, area->w, area->h,
+		so->left, so->top, so->width, so->height);
+
+	return 1;
+}
+
+/*
+ * Walk the views of the output bottom up, record them and add to damage
+ * (output local) what changed since the last frame.
+ */
+static void sw_collect_views(struct sw_output_state *so,
+			     struct clv_output *output,
+			     struct clv_region *damage)
+{
+	struct clv_compositor *c = output->c;
+	struct sw_view_record *rec, *old;
+	struct clv_array tmp;
+	struct clv_view *view;
+	struct clv_region *sd;
+	u32 count_old, count_new, i;
+	s32 ox = output->render_area.pos.x, oy = output->render_area.pos.y;
+	s32 track = output->index < SW_MAX_OUTPUTS;
+
+	so->next_records.size = 0;
+	list_for_each_entry(view, &c->views, link) {
+		if (view->plane != &c->primary_plane
+		    || !(view->output_mask & (1 << output->index)))
+			continue;
+		rec = clv_array_add(&so->next_records, sizeof(*rec));
+		if (!rec)
+			break;
+		rec->view = view;
+		rec->ss = get_surface_state(view->surface);
+		rec->area = view->area;
+		rec->alpha = view->alpha;
+		rec->has_content = rec->ss && rec->ss->has_content;
+		if (rec->has_content)
+			view->painted = 1;
+		view->need_to_draw = 0;
+	}
+
+	count_old = so->records.size / sizeof(*rec);
+	count_new = so->next_records.size / sizeof(*rec);
+	old = so->records.data;
+	rec = so->next_records.data;
+	for (i = 0; i < MAX(count_old, count_new); i++) {
+		if (i < count_old && i < count_new
+		    && old[i].view == rec[i].view && old[i].ss == rec[i].ss
+		    && !memcmp(&old[i].area, &rec[i].area, sizeof(rec->area))
+		    && old[i].alpha == rec[i].alpha
+		    && old[i].has_content == rec[i].has_content) {
+			if (!rec[i].ss || !track)
+				continue;
+			sd = &rec[i].ss->damage[output->index];
+			clv_region_translate(sd, rec[i].area.pos.x - ox,
+					     rec[i].area.pos.y - oy);
+			clv_region_union(damage, damage, sd);
+			continue;
+		}
+		if (i < count_old)
+			clv_region_union_rect(damage, damage,
+					      old[i].area.pos.x - ox,
+					      old[i].area.pos.y - oy,
+					      old[i].area.w, old[i].area.h);
+		if (i < count_new)
+			clv_region_union_rect(damage, damage,
+					      rec[i].area.pos.x - ox,
+					      rec[i].area.pos.y - oy,
+					      rec[i].area.w, rec[i].area.h);
+	}
+
+	if (track) {
+		for (i = 0; i < count_new; i++) {
+			if (rec[i].ss)
+				clv_region_clear(
+					&rec[i].ss->damage[output->index]);
+		}
+	}
+
+	tmp = so->records;
+	so->records = so->next_records;
+	so->next_records = tmp;
+}
+
+/*
+ * Build the layers of the frame, each clipped to the part of the repaint
+ * region it shows in, minus what the opaque layers above it cover.
+ */
+static void sw_build_layers(struct sw_output_state *so,
+			    struct clv_output *output)
+{
+	struct sw_view_record *rec;
+	struct sw_layer *layer;
+	struct clv_region opaque;
+	s32 ox = output->render_area.pos.x, oy = output->render_area.pos.y;
+	s32 i, count;
+	float alpha;
+
+	clv_array_for_each_entry(layer, &so->layers)
+		clv_region_fini(&layer->clip);
+	so->layers.size = 0;
+
+	clv_array_for_each_entry(rec, &so->records) {
+		if (!rec->has_content)
+			continue;
+		alpha = rec->alpha < 0.0f ? 0.0f
+			: (rec->alpha > 1.0f ? 1.0f : rec->alpha);
+		if (alpha * 255.0f + 0.5f < 1.0f)
+			continue;
+		layer = clv_array_add(&so->layers, sizeof(*layer));
+		if (!layer)
+			break;
+		layer->ss = rec->ss;
+		layer->x = rec->area.pos.x - ox;
+		layer->y = rec->area.pos.y - oy;
+		/* content is not stretched to the view, as for GL */
+		layer->w = MIN(rec->area.w, rec->ss->w);
+		layer->h = MIN(rec->area.h, rec->ss->h);
+		layer->alpha = alpha * 255.0f + 0.5f;
+		clv_region_init(&layer->clip);
+	}
+
+	clv_region_copy(&so->bg, &so->repaint);
+	count = so->layers.size / sizeof(*layer);
+	layer = so->layers.data;
+	for (i = count - 1; i >= 0; i--) {
+		clv_region_intersect_rect(&layer[i].clip, &so->bg,
+					  layer[i].x, layer[i].y,
+					  layer[i].w, layer[i].h);
+		if (layer[i].alpha != 255)
+			continue;
+		if (layer[i].ss->opaque) {
+			clv_region_init_rect(&opaque, layer[i].x, layer[i].y,
+					     layer[i].w, layer[i].h);
+		} else {
+			clv_region_init(&opaque);
+			clv_region_intersect_rect(&opaque,
+					&layer[i].ss->surface->opaque,
+					0, 0, layer[i].w, layer[i].h);
+			clv_region_translate(&opaque, layer[i].x, layer[i].y);
+		}
+		clv_region_subtract(&so->bg, &so->bg, &opaque);
+		clv_region_fini(&opaque);
+	}
+}
+
+static void sw_compose_tile(void *data, u32 index)
+{
+	struct sw_output_state *so = data;
+	struct clv_box *tile = (struct clv_box *)so->tiles.data + index;
+	struct sw_layer *layer;
+	struct sw_surface_state *ss;
+	struct clv_box *boxes, b;
+	const u32 *src;
+	u8 *dst;
+	s32 i, count_boxes;
+
+	boxes = clv_region_boxes(&so->bg, &count_boxes);
+	for (i = 0; i < count_boxes; i++) {
+		if (!clip_box(&b, &boxes[i], tile))
+			continue;
+		clv_pixel_fill32(so->dst + b.p1.y * so->dst_stride
+				 + b.p1.x * 4, so->dst_stride,
+				 b.p2.x - b.p1.x, b.p2.y - b.p1.y, SW_BLACK);
+	}
+
+	clv_array_for_each_entry(layer, &so->layers) {
+		if (!clip_box(&b, clv_region_extents(&layer->clip), tile))
+			continue;
+		ss = layer->ss;
+		boxes = clv_region_boxes(&layer->clip, &count_boxes);
+		for (i = 0; i < count_boxes; i++) {
+			if (!clip_box(&b, &boxes[i], tile))
+				continue;
+			src = ss->pixels + (b.p1.y - layer->y) * ss->w
+				+ (b.p1.x - layer->x);
+			dst = so->dst + b.p1.y * so->dst_stride + b.p1.x * 4;
+			if (ss->opaque && layer->alpha == 255)
+				clv_pixel_copy_rect(dst, so->dst_stride,
+						    src, ss->stride,
+						    (b.p2.x - b.p1.x) * 4,
+						    b.p2.y - b.p1.y);
+			else
+				clv_pixel_over(dst, so->dst_stride,
+					       src, ss->stride,
+					       b.p2.x - b.p1.x,
+					       b.p2.y - b.p1.y,
+					       layer->alpha);
+		}
+	}
+}
+
+static void sw_scale_tile(void *data, u32 index)
+{
+	struct sw_output_state *so = data;
+
+	clv_pixel_scale_bilinear(so->scale_dst, so->stride,
+				 so->width, so->height,
+				 so->canvas, so->canvas_w * 4,
+				 so->canvas_w, so->canvas_h,
+				 (struct clv_box *)so->tiles.data + index);
+}
+
+/*
+ * The part of the mode rect a damaged canvas box shows in. A canvas pixel
+ * is sampled by the mode pixels up to one and a half of its own size
+ * away from it.
+ */
+static void sw_scale_damage(struct sw_output_state *so)
+{
+	struct clv_box *boxes;
+	s64 x1, y1, x2, y2, mx, my;
+	s32 i, count_boxes;
+
+	mx = so->width / (2 * so->canvas_w) + 2;
+	my = so->height / (2 * so->canvas_h) + 2;
+	clv_region_clear(&so->scale_damage);
+	boxes = clv_region_boxes(&so->repaint, &count_boxes);
+	for (i = 0; i < count_boxes; i++) {
+		x1 = (s64)boxes[i].p1.x * so->width / so->canvas_w - mx;
+		y1 = (s64)boxes[i].p1.y * so->height / so->canvas_h - my;
+		x2 = ((s64)boxes[i].p2.x * so->width + so->canvas_w - 1)
+			/ so->canvas_w + mx;
+		y2 = ((s64)boxes[i].p2.y * so->height + so->canvas_h - 1)
+			/ so->canvas_h + my;
+		x1 = MAX(x1, 0);
+		y1 = MAX(y1, 0);
+		x2 = MIN(x2, so->width);
+		y2 = MIN(y2, so->height);
+		clv_region_union_rect(&so->scale_damage, &so->scale_damage,
+				      x1, y1, x2 - x1, y2 - y1);
+	}
+}
+
+static void sw_fill_bars(struct sw_output_state *so)
+{
+	u8 *pixels = so->target->pixels;
+
+	if (so->top) {
+		clv_pixel_fill32(pixels, so->stride, so->mode_w, so->top,
+				 SW_BLACK);
+		clv_pixel_fill32(pixels + (so->top + so->height) * so->stride,
+				 so->stride, so->mode_w,
+				 so->mode_h - so->top - so->height, SW_BLACK);
+	}
+	if (so->left) {
+		clv_pixel_fill32(pixels, so->stride, so->left, so->mode_h,
+				 SW_BLACK);
+		clv_pixel_fill32(pixels + (so->left + so->width) * 4,
+				 so->stride, so->mode_w - so->left - so->width,
+				 so->mode_h, SW_BLACK);
+	}
+}
+
+static void sw_repaint_output(struct clv_output *output)
+{
+	struct sw_renderer *r = get_renderer(output->c);
+	struct sw_output_state *so = output->renderer_state;
+	struct clv_rect *area = &output->render_area;
+	struct sw_target *target = so->target;
+	struct clv_region damage;
+	s32 i, ret, full;
+
+	if (!target || !target->pixels) {
+		sw_err("output %u has no buffer to paint in", output->index);
+		return;
+	}
+
+	ret = sw_output_update_geometry(so, output);
+	if (ret < 0)
+		return;
+	if (ret > 0 || output->changed || output->index >= SW_MAX_OUTPUTS)
+		sw_output_targets_full(so);
+	if (output->changed)
+		output->changed--;
+
+	clv_region_init(&damage);
+	sw_collect_views(so, output, &damage);
+	clv_region_intersect_rect(&damage, &damage, 0, 0, area->w, area->h);
+
+	/* what was painted since in the other buffers is stale in this one */
+	for (i = 0; i < SW_MAX_TARGETS; i++) {
+		if (&so->targets[i] != target)
+			clv_region_union(&so->targets[i].damage,
+					 &so->targets[i].damage, &damage);
+	}
+	full = target->full;
+	if (full) {
+		clv_region_fini(&so->repaint);
+		clv_region_init_rect(&so->repaint, 0, 0, area->w, area->h);
+	} else {
+		clv_region_union(&so->repaint, &damage, &target->damage);
+	}
+	target->full = 0;
+	clv_region_clear(&target->damage);
+	clv_region_fini(&damage);
+
+	if (full)
+		sw_fill_bars(so);
+	if (!clv_region_is_not_empty(&so->repaint))
+		return;
+	sw_debug("output %u repaint %d boxes%s", output->index,
+		 clv_region_count_boxes(&so->repaint), full ? " (full)" : "");
+
+	sw_build_layers(so, output);
+	so->scale_dst = (u8 *)target->pixels + so->top * so->stride
+			+ so->left * 4;
+	if (so->canvas) {
+		so->dst = (u8 *)so->canvas;
+		so->dst_stride = so->canvas_w * 4;
+	} else {
+		so->dst = so->scale_dst;
+		so->dst_stride = so->stride;
+	}
+	sw_tile_region(&so->tiles, &so->repaint);
+	clv_thread_pool_run(r->pool, sw_compose_tile, so,
+			    so->tiles.size / sizeof(struct clv_box));
+
+	if (so->canvas) {
+		sw_scale_damage(so);
+		sw_tile_region(&so->tiles, &so->scale_damage);
+		clv_thread_pool_run(r->pool, sw_scale_tile, so,
+				    so->tiles.size / sizeof(struct clv_box));
+	}
+}
+
+static s32 sw_output_create(struct clv_output *output,
+			    void *window_for_legacy,
+			    void *window,
+			    s32 *formats,
+			    s32 count_fmts,
+			    s32 *vid)
+{
+	struct sw_output_state *so;
+	s32 i;
+
+	so = calloc(1, sizeof(*so));
+	if (!so)
+		return -ENOMEM;
+
+	for (i = 0; i < SW_MAX_TARGETS; i++)
+		clv_region_init(&so->targets[i].damage);
+	clv_array_init(&so->records);
+	clv_array_init(&so->next_records);
+	clv_array_init(&so->layers);
+	clv_array_init(&so->tiles);
+	clv_region_init(&so->repaint);
+	clv_region_init(&so->bg);
+	clv_region_init(&so->scale_damage);
+	output->renderer_state = so;
+
+	return 0;
+}
+
+static void sw_output_destroy(struct clv_output *output)
+{
+	struct sw_output_state *so = output->renderer_state;
+	struct sw_layer *layer;
+	s32 i;
+
+	if (!so)
+		return;
+
+	for (i = 0; i < SW_MAX_TARGETS; i++)
+		clv_region_fini(&so->targets[i].damage);
+	clv_array_for_each_entry(layer, &so->layers)
+		clv_region_fini(&layer->clip);
+	clv_array_release(&so->layers);
+	clv_array_release(&so->tiles);
+	clv_array_release(&so->records);
+	clv_array_release(&so->next_records);
+	clv_region_fini(&so->repaint);
+	clv_region_fini(&so->bg);
+	clv_region_fini(&so->scale_damage);
+	free(so->canvas);
+	free(so);
+	output->renderer_state = NULL;
+}
+
+static void sw_dmabuf_destroy(struct sw_dma_buffer *dmabuf)
+{
+	munmap(dmabuf->map, dmabuf->map_sz);
+	close(dmabuf->base.fd);
+	list_del(&dmabuf->link);
+	free(dmabuf);
+}
+
+static void sw_dmabuf_release(struct clv_compositor *c,
+			      struct clv_buffer *buffer)
+{
+	if (!buffer)
+		return;
+
+	sw_dmabuf_destroy(container_of(buffer, struct sw_dma_buffer, base));
+}
+
+static struct clv_buffer *sw_import_dmabuf(struct clv_compositor *c,
+					   s32 fd, u32 w, u32 h,
+					   u32 stride,
+					   u32 vstride,
+					   enum clv_pixel_fmt pixel_fmt,
+					   u32 internal_fmt)
+{
+	struct sw_renderer *r = get_renderer(c);
+	struct sw_dma_buffer *dmabuf;
+	u32 pitch, vpitch, map_sz;
+	off_t size;
+
+	switch (pixel_fmt) {
+	case CLV_PIXEL_FMT_ARGB8888:
+	case CLV_PIXEL_FMT_XRGB8888:
+		pitch = stride;
+		vpitch = h;
+		map_sz = pitch * vpitch;
+		break;
+	case CLV_PIXEL_FMT_NV12:
+	case CLV_PIXEL_FMT_NV16:
+		/* same layout as the GL renderer imports */
+		if (vstride) {
+			pitch = stride;
+			vpitch = vstride;
+		} else {
+			pitch = (w + 16 - 1) & ~(16 - 1);
+			vpitch = (h + 16 - 1) & ~(16 - 1);
+		}
+		map_sz = pitch * vpitch;
+		if (pixel_fmt == CLV_PIXEL_FMT_NV12)
+			map_sz += pitch * vpitch / 2;
+		else
+			map_sz += pitch * vpitch;
+		break;
+	default:
+		sw_err("cannot support pixel fmt %u", pixel_fmt);
+		return NULL;
+	}
+
+	size = lseek(fd, 0, SEEK_END);
+	if (size >= 0 && size < map_sz) {
+		sw_err("dmabuf %d too small, %ld < %u", fd, (long)size, map_sz);
+		return NULL;
+	}
+
+	dmabuf = calloc(1, sizeof(*dmabuf));
+	if (!dmabuf)
+		return NULL;
+
+	dmabuf->map = mmap(NULL, map_sz, PROT_READ, MAP_SHARED, fd, 0);
+	if (dmabuf->map == MAP_FAILED) {
+		sw_err("failed to map dmabuf %d. %m", fd);
+		free(dmabuf);
+		return NULL;
+	}
+
+	dmabuf->map_sz = map_sz;
+	dmabuf->pitch = pitch;
+	dmabuf->vpitch = vpitch;
+	dmabuf->base.type = CLV_BUF_TYPE_DMA;
+	dmabuf->base.w = w;
+	dmabuf->base.h = h;
+	dmabuf->base.stride = stride;
+	dmabuf->base.pixel_fmt = pixel_fmt;
+	dmabuf->base.count_planes = 1;
+	dmabuf->base.fd = fd;
+	list_add_tail(&dmabuf->link, &r->dmabufs);
+	sw_info("import dmabuf %d %ux%u fmt %u pitch %u", fd, w, h, pixel_fmt,
+		pitch);
+
+	return &dmabuf->base;
+}
+
+static void sw_renderer_destroy(struct clv_compositor *c)
+{
+	struct sw_renderer *r = get_renderer(c);
+	struct sw_dma_buffer *dmabuf, *t;
+
+	clv_signal_emit(&r->destroy_signal, c);
+	list_for_each_entry_safe(dmabuf, t, &r->dmabufs, link)
+		sw_dmabuf_destroy(dmabuf);
+	clv_thread_pool_destroy(r->pool);
+	clv_array_release(&r->upload_tiles);
+	free(r);
+}
+
+s32 sw_renderer_create(struct clv_compositor *c, s32 *formats, s32 count_fmts,
+		       s32 no_winsys, void *native_window, s32 *vid)
+{
+	struct sw_renderer *r;
+	char *env;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	/*
+	 * CLOVER_SW_THREADS=<n> sets the count of threads painting the
+	 * outputs, the default is one per CPU.
+	 */
+	env = getenv("CLOVER_SW_THREADS");
+	r->pool = clv_thread_pool_create(env ? atoi(env) : 0);
+	if (!r->pool) {
+		sw_err("failed to create thread pool");
+		free(r);
+		return -1;
+	}
+	sw_notice("%u paint threads, %s pixel kernels",
+		  clv_thread_pool_count_threads(r->pool), clv_pixel_impl());
+	clv_array_init(&r->upload_tiles);
+
+	clv_signal_init(&r->destroy_signal);
+	INIT_LIST_HEAD(&r->dmabufs);
+
+	r->base.repaint_output = sw_repaint_output;
+	r->base.flush_damage = sw_flush_damage;
+	r->base.attach_buffer = sw_attach_buffer;
+	r->base.output_create = sw_output_create;
+	r->base.output_destroy = sw_output_destroy;
+	r->base.output_set_buffer = sw_output_set_buffer;
+	r->base.destroy = sw_renderer_destroy;
+	r->base.import_dmabuf = sw_import_dmabuf;
+	r->base.release_dmabuf = sw_dmabuf_release;
+	c->renderer = &r->base;
+
+	return 0;
+}
+
+void sw_set_renderer_dbg(u32 flags)
+{
+	sw_dbg = flags & 0x0F;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_pixel.h>
+
+/*
+ * Micro benchmark of the pixel kernels.
+ *
+ * Every kernel runs on a W x H frame with every implementation the CPU has,
+ * the scalar one first. The output of the others is checked against it.
+ *
+ * usage: bench_pixel [loops]
+ */
+
+#define DEFAULT_LOOPS 100
+#define W 1920
+#define H 1080
+/* a row pitch wider than the rect, like a sub-rect of a larger buffer */
+#define STRIDE ((W + 64) * 4)
+#define FRAME_SZ (STRIDE * H)
+
+static const char *impl_names[] = { "scalar", "sse2", "avx2", "neon" };
+
+static u32 loops = DEFAULT_LOOPS;
+static u8 *src, *dst, *ref[16];
+
+static inline u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+typedef void (*bench_op_t)(void);
+
+static void op_fill(void)
+{
+	clv_pixel_fill32(dst, STRIDE, W, H, 0xFF404040);
+}
+
+static void op_fill_contig(void)
+{
+	clv_pixel_fill32(dst, W * 4, W, H, 0xFF404040);
+}
+
+static void op_copy(void)
+{
+	clv_pixel_copy_rect(dst, STRIDE, src, STRIDE, W * 4, H);
+}
+
+static void op_premultiply(void)
+{
+	clv_pixel_premultiply(dst, STRIDE, src, STRIDE, W, H);
+}
+
+static void op_xrgb_to_argb(void)
+{
+	clv_pixel_xrgb_to_argb(dst, STRIDE, src, STRIDE, W, H);
+}
+
+static void op_argb_to_xrgb(void)
+{
+	clv_pixel_argb_to_xrgb(dst, STRIDE, src, STRIDE, W, H);
+}
+
+static void op_over(void)
+{
+	clv_pixel_over(dst, STRIDE, src, STRIDE, W, H, 255);
+}
+
+static void op_over_alpha(void)
+{
+	clv_pixel_over(dst, STRIDE, src, STRIDE, W, H, 0x80);
+}
+
+/* a quarter size frame up to the full one, in two boxes */
+static void op_scale(void)
+{
+	struct clv_box top = { { 0, 0 }, { W, H / 3 } };
+	struct clv_box bottom = { { 0, H / 3 }, { W, H } };
+
+	clv_pixel_scale_bilinear(dst, STRIDE, W, H, src, STRIDE, W / 2, H / 2,
+				 &top);
+	clv_pixel_scale_bilinear(dst, STRIDE, W, H, src, STRIDE, W / 2, H / 2,
+				 &bottom);
+}
+
+static void op_i420(void)
+{
+	u8 *d[3] = { dst, dst + W * H, dst + W * H * 5 / 4 };
+	u8 *s[3] = { src, src + STRIDE * H / 2, src + STRIDE * H * 3 / 4 };
+	u32 ds[3] = { W, W / 2, W / 2 };
+	u32 ss[3] = { STRIDE / 4, STRIDE / 8, STRIDE / 8 };
+
+	clv_pixel_copy_i420(d, ds, s, ss, W, H);
+}
+
+static void op_nv12(void)
+{
+	u8 *d[2] = { dst, dst + W * H };
+	u8 *s[2] = { src, src + STRIDE * H / 2 };
+	u32 ds[2] = { W, W };
+	u32 ss[2] = { STRIDE / 4, STRIDE / 4 };
+
+	clv_pixel_copy_nv12(d, ds, s, ss, W, H);
+}
+
+struct bench_case {
+	const char *name;
+	bench_op_t op;
+	u32 bytes; /* bytes written per op */
+};
+
+static struct bench_case cases[] = {
+	{ "fill32 (strided)", op_fill, W * H * 4 },
+	{ "fill32 (contiguous)", op_fill_contig, W * H * 4 },
+	{ "copy_rect", op_copy, W * H * 4 },
+	{ "premultiply", op_premultiply, W * H * 4 },
+	{ "xrgb_to_argb", op_xrgb_to_argb, W * H * 4 },
+	{ "argb_to_xrgb", op_argb_to_xrgb, W * H * 4 },
+	{ "over", op_over, W * H * 4 },
+	{ "over (alpha 0x80)", op_over_alpha, W * H * 4 },
+	{ "scale_bilinear (2x)", op_scale, W * H * 4 },
+	{ "copy_i420", op_i420, W * H * 3 / 2 },
+	{ "copy_nv12", op_nv12, W * H * 3 / 2 },
+};
+
+static void bench(struct bench_case *bc, u32 idx, s32 is_ref)
+{
+	s32 mismatch = 0;
+	u64 t0, t1;
+	u32 i;
+
+	/* over blends into what is there, check a single op */
+	memset(dst, 0x40, FRAME_SZ);
+	bc->op();
+	if (is_ref)
+		memcpy(ref[idx], dst, FRAME_SZ);
+	else
+		mismatch = memcmp(ref[idx], dst, FRAME_SZ);
+
+	t0 = now_ns();
+	for (i = 0; i < loops; i++)
+		bc->op();
+	t1 = now_ns();
+
+	printf("%-24s %9.1f us/op %9.1f Mpix/s %8.2f GB/s%s\n",
+	       bc->name, (double)(t1 - t0) / loops / 1000.0,
+	       (double)W * H * loops * 1000.0 / (t1 - t0),
+	       (double)bc->bytes * loops / (t1 - t0),
+	       mismatch ? "  MISMATCH" : "");
+}
+
+s32 main(s32 argc, char **argv)
+{
+	u32 i, j;
+
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (!loops)
+		loops = DEFAULT_LOOPS;
+
+	src = malloc(FRAME_SZ);
+	dst = malloc(FRAME_SZ);
+	if (!src || !dst) {
+		fprintf(stderr, "not enough memory\n");
+		return 1;
+	}
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		ref[i] = malloc(FRAME_SZ);
+		if (!ref[i]) {
+			fprintf(stderr, "not enough memory\n");
+			return 1;
+		}
+	}
+
+	/* every alpha and channel value shows up */
+	srand(1);
+	for (i = 0; i < FRAME_SZ; i++)
+		src[i] = rand();
+
+	for (i = 0; i < ARRAY_SIZE(impl_names); i++) {
+		if (clv_pixel_select(impl_names[i]) < 0)
+			continue;
+		printf("== %s ==\n", impl_names[i]);
+		for (j = 0; j < ARRAY_SIZE(cases); j++)
+			bench(&cases[j], j, i == 0);
+	}
+
+	return 0;
+}
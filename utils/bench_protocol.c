@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_ipc.h>
+#include <clover_protocal.h>
+
+/*
+ * Micro benchmark of the wire format.
+ *
+ * For every command: encode / parse throughput (mean ns per op over a tight
+ * loop) and latency (p50 / p99 of single timed ops). Then a socketpair
+ * loopback of clv_send / clv_recv at several message sizes.
+ *
+ * usage: bench_protocol [loops]
+ */
+
+#define DEFAULT_LOOPS 1000000
+#define LAT_SAMPLES 10000
+
+static u32 loops = DEFAULT_LOOPS;
+static volatile u64 sink;
+static u64 lat[LAT_SAMPLES];
+
+static inline u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static s32 u64_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+typedef void (*bench_op_t)(void *ctx);
+
+static void bench(const char *name, bench_op_t op, void *ctx)
+{
+	u64 t0, t1;
+	u32 i;
+
+	for (i = 0; i < loops / 100; i++)
+		op(ctx);
+
+	t0 = now_ns();
+	for (i = 0; i < loops; i++)
+		op(ctx);
+	t1 = now_ns();
+
+	for (i = 0; i < LAT_SAMPLES; i++) {
+		u64 s = now_ns();
+		op(ctx);
+		lat[i] = now_ns() - s;
+	}
+	qsort(lat, LAT_SAMPLES, sizeof(lat[0]), u64_cmp);
+
+	printf("%-32s %9.1f ns/op %9.2f Mop/s  p50 %5llu ns  p99 %5llu ns\n",
+	       name, (double)(t1 - t0) / loops,
+	       loops * 1000.0 / (t1 - t0),
+	       (unsigned long long)lat[LAT_SAMPLES / 2],
+	       (unsigned long long)lat[LAT_SAMPLES * 99 / 100]);
+}
+
+/* large enough for any fixed layout payload */
+union cmd_payload {
+	struct clv_surface_info si;
+	struct clv_view_info vi;
+	struct clv_bo_info bi;
+	struct clv_commit_info ci;
+	struct clv_transaction_info ti;
+	struct clv_shell_info shell;
+	u64 id;
+};
+
+struct cmd_ctx {
+	enum clv_cmd_shift shift;
+	union cmd_payload payload;
+	union cmd_payload out;
+	u32 n;
+	u8 buf[CLV_CMD_SIZE(sizeof(union cmd_payload))];
+};
+
+static void op_encode(void *data)
+{
+	struct cmd_ctx *ctx = data;
+
+	sink += clv_cmd_encode(ctx->buf, sizeof(ctx->buf), ctx->shift,
+			       &ctx->payload);
+}
+
+static void op_decode(void *data)
+{
+	struct cmd_ctx *ctx = data;
+
+	sink += clv_cmd_decode(ctx->buf, ctx->n, ctx->shift, &ctx->out);
+}
+
+static void op_payload(void *data)
+{
+	struct cmd_ctx *ctx = data;
+
+	sink += (u64)clv_cmd_payload(ctx->buf, ctx->n, ctx->shift);
+}
+
+static void bench_fixed_cmds(void)
+{
+	struct cmd_ctx ctx;
+	char name[64];
+	const char *cmd;
+	u32 shift;
+
+	printf("== fixed layout commands ==\n");
+	for (shift = 0; shift < CLV_CMD_LAST_SHIFT; shift++) {
+		if (!clv_cmd_size(shift))
+			continue;
+
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.shift = shift;
+		if (shift == CLV_CMD_SHELL_SHIFT) {
+			ctx.payload.shell.cmd = CLV_SHELL_CANVAS_LAYOUT_SETTING;
+			ctx.payload.shell.value.layout.count_heads = 2;
+		} else if (shift == CLV_CMD_TRANSACTION_SHIFT) {
+			ctx.payload.ti.count_entries =
+				CLV_TRANSACTION_MAX_ENTRIES;
+		}
+		ctx.n = clv_cmd_encode(ctx.buf, sizeof(ctx.buf), shift,
+				       &ctx.payload);
+		cmd = clv_cmd_name(1 << shift);
+
+		snprintf(name, sizeof(name), "%s encode", cmd);
+		bench(name, op_encode, &ctx);
+		snprintf(name, sizeof(name), "%s decode", cmd);
+		bench(name, op_decode, &ctx);
+		snprintf(name, sizeof(name), "%s payload", cmd);
+		bench(name, op_payload, &ctx);
+	}
+}
+
+struct legacy_ctx {
+	struct clv_commit_info c;
+	struct clv_bo_info b;
+	u8 *commit_t, *bo_t;
+	u8 commit[CLV_CMD_SIZE(sizeof(struct clv_commit_info))];
+	u8 bo[CLV_CMD_SIZE(sizeof(struct clv_bo_info))];
+	u32 commit_n, bo_n;
+};
+
+static void op_dup_commit(void *data)
+{
+	struct legacy_ctx *ctx = data;
+
+	sink += (u64)clv_dup_commit_req_cmd(ctx->commit, ctx->commit_t,
+					    ctx->commit_n, &ctx->c);
+}
+
+static void op_parse_commit(void *data)
+{
+	struct legacy_ctx *ctx = data;
+
+	sink += clv_server_parse_commit_req_cmd(ctx->commit, &ctx->c);
+}
+
+static void op_dup_bo(void *data)
+{
+	struct legacy_ctx *ctx = data;
+
+	sink += (u64)clv_dup_create_bo_cmd(ctx->bo, ctx->bo_t, ctx->bo_n,
+					   &ctx->b);
+}
+
+static void op_parse_bo(void *data)
+{
+	struct legacy_ctx *ctx = data;
+
+	sink += clv_server_parse_create_bo_cmd(ctx->bo, &ctx->b);
+}
+
+/* the per-command helpers the clients and the server use */
+static void bench_legacy_api(void)
+{
+	struct legacy_ctx ctx;
+
+	printf("== per-command helpers ==\n");
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.commit_t = clv_client_create_commit_req_cmd(&ctx.c, &ctx.commit_n);
+	ctx.bo_t = clv_client_create_bo_cmd(&ctx.b, &ctx.bo_n);
+	if (!ctx.commit_t || !ctx.bo_t) {
+		fprintf(stderr, "failed to create templates\n");
+		exit(1);
+	}
+
+	bench("clv_dup_commit_req_cmd", op_dup_commit, &ctx);
+	bench("clv_server_parse_commit_req_cmd", op_parse_commit, &ctx);
+	bench("clv_dup_create_bo_cmd", op_dup_bo, &ctx);
+	bench("clv_server_parse_create_bo_cmd", op_parse_bo, &ctx);
+
+	free(ctx.commit_t);
+	free(ctx.bo_t);
+}
+
+#define MAX_INPUT_EVTS 64
+
+struct input_ctx {
+	struct clv_input_event evts[MAX_INPUT_EVTS];
+	u32 count;
+	u8 *buf;
+	u32 n;
+};
+
+static void op_fill_input(void *data)
+{
+	struct input_ctx *ctx = data;
+
+	sink += (u64)clv_server_fill_input_evt_cmd(ctx->buf, ctx->evts,
+						   ctx->count, &ctx->n,
+						   sizeof(ctx->evts));
+}
+
+static void op_parse_input(void *data)
+{
+	struct input_ctx *ctx = data;
+	u32 count;
+
+	sink += (u64)clv_client_parse_input_evt_cmd(ctx->buf, &count);
+	sink += count;
+}
+
+static void bench_input_evts(void)
+{
+	u32 counts[] = { 1, 8, MAX_INPUT_EVTS };
+	struct input_ctx ctx;
+	char name[64];
+	u32 i;
+
+	printf("== input events ==\n");
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.buf = clv_server_create_input_evt_cmd(NULL, MAX_INPUT_EVTS,
+						  &ctx.n);
+	if (!ctx.buf) {
+		fprintf(stderr, "failed to create input event command\n");
+		exit(1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(counts); i++) {
+		ctx.count = counts[i];
+		op_fill_input(&ctx);
+		snprintf(name, sizeof(name), "INPUT_EVT x%u fill", counts[i]);
+		bench(name, op_fill_input, &ctx);
+		snprintf(name, sizeof(name), "INPUT_EVT x%u parse", counts[i]);
+		bench(name, op_parse_input, &ctx);
+	}
+
+	free(ctx.buf);
+}
+
+struct loopback {
+	s32 sock[2];
+	u8 *buf;
+	u32 size;
+	u32 count;
+	s32 pingpong;
+};
+
+static void *loopback_peer(void *data)
+{
+	struct loopback *lb = data;
+	u8 ack = 0;
+	u32 i;
+
+	for (i = 0; i < lb->count; i++) {
+		if (clv_recv(lb->sock[1], lb->buf, lb->size) < 0)
+			return NULL;
+		if (lb->pingpong && clv_send(lb->sock[1], lb->buf, lb->size))
+			return NULL;
+	}
+
+	if (!lb->pingpong)
+		clv_send(lb->sock[1], &ack, sizeof(ack));
+
+	return NULL;
+}
+
+static void bench_loopback_one(u32 size)
+{
+	struct loopback lb;
+	pthread_t tid;
+	u8 *tx, ack;
+	u64 t0, t1;
+	u32 i, count;
+
+	/* keep the amount of data roughly constant */
+	count = (256u << 20) / size;
+	if (count > loops)
+		count = loops;
+	if (count < 100)
+		count = 100;
+
+	memset(&lb, 0, sizeof(lb));
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, lb.sock) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	lb.size = size;
+	lb.buf = malloc(size);
+	tx = calloc(1, size);
+	if (!lb.buf || !tx) {
+		fprintf(stderr, "not enough memory\n");
+		exit(1);
+	}
+
+	/* throughput: stream count messages, the peer acks once at the end */
+	lb.count = count;
+	pthread_create(&tid, NULL, loopback_peer, &lb);
+	t0 = now_ns();
+	for (i = 0; i < count; i++)
+		clv_send(lb.sock[0], tx, size);
+	clv_recv(lb.sock[0], &ack, sizeof(ack));
+	t1 = now_ns();
+	pthread_join(tid, NULL);
+	printf("send/recv %6u B  %9.1f ns/msg %9.1f MB/s", size,
+	       (double)(t1 - t0) / count,
+	       (double)size * count * 1000.0 / (t1 - t0));
+
+	/* latency: ping-pong, half of the round trip */
+	lb.count = count < 20000 ? count : 20000;
+	lb.pingpong = 1;
+	pthread_create(&tid, NULL, loopback_peer, &lb);
+	t0 = now_ns();
+	for (i = 0; i < lb.count; i++) {
+		clv_send(lb.sock[0], tx, size);
+		clv_recv(lb.sock[0], tx, size);
+	}
+	t1 = now_ns();
+	pthread_join(tid, NULL);
+	printf("  one way %8.1f ns\n", (double)(t1 - t0) / lb.count / 2);
+
+	close(lb.sock[0]);
+	close(lb.sock[1]);
+	free(lb.buf);
+	free(tx);
+}
+
+static void bench_loopback(void)
+{
+	u32 sizes[] = {
+		CLV_CMD_SIZE(sizeof(u64)),
+		CLV_CMD_SIZE(sizeof(struct clv_commit_info)),
+		1024, 4096, 16384, 65536,
+	};
+	u32 i;
+
+	printf("== socketpair loopback ==\n");
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		bench_loopback_one(sizes[i]);
+}
+
+s32 main(s32 argc, char **argv)
+{
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (!loops)
+		loops = DEFAULT_LOOPS;
+
+	bench_fixed_cmds();
+	bench_legacy_api();
+	bench_input_evts();
+	bench_loopback();
+
+	return 0;
+}
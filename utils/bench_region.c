@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_arena.h>
+#include <clover_region.h>
+
+/*
+ * Micro benchmark of the region operations.
+ *
+ * Every case runs over SETS pairs of regions shaped like those of a repaint:
+ * frame damage made of a few rects, view and output rects, opaque windows
+ * stacked over each other. The result of the first pass is rasterised and
+ * checked against the same operation done on bitmaps.
+ *
+ * usage: bench_region [loops]
+ */
+
+#define DEFAULT_LOOPS 2000
+#define W 1920
+#define H 1080
+#define SETS 64
+/* room for the translated regions around the screen */
+#define MARGIN 64
+#define BW (W + 2 * MARGIN)
+#define BH (H + 2 * MARGIN)
+
+static u32 loops = DEFAULT_LOOPS;
+
+/* a, b the operands, r the result of every set */
+static struct clv_region a[SETS], b[SETS], r[SETS];
+static struct clv_box unsorted[SETS][16];
+static u8 *bm_a, *bm_b, *bm_r;
+static struct clv_arena frame;
+
+static inline u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static s32 rnd(s32 min, s32 max)
+{
+	return min + rand() % (max - min + 1);
+}
+
+static void rnd_box(struct clv_box *box, s32 min_sz, s32 max_sz)
+{
+	s32 w = rnd(min_sz, max_sz), h = rnd(min_sz, max_sz);
+
+	box->p1.x = rnd(0, W - w);
+	box->p1.y = rnd(0, H - h);
+	box->p2.x = box->p1.x + w;
+	box->p2.y = box->p1.y + h;
+}
+
+/* union of n rects, like the damage of a frame */
+static void rnd_region(struct clv_region *region, s32 n, s32 min_sz,
+		       s32 max_sz)
+{
+	struct clv_box box;
+	s32 i;
+
+	clv_region_fini(region);
+	clv_region_init(region);
+	for (i = 0; i < n; i++) {
+		rnd_box(&box, min_sz, max_sz);
+		clv_region_union_rect(region, region, box.p1.x, box.p1.y,
+				      box.p2.x - box.p1.x,
+				      box.p2.y - box.p1.y);
+	}
+}
+
+static void rnd_rect_region(struct clv_region *region, s32 min_sz,
+			    s32 max_sz)
+{
+	struct clv_box box;
+
+	rnd_box(&box, min_sz, max_sz);
+	clv_region_fini(region);
+	clv_region_init_rect(region, box.p1.x, box.p1.y, box.p2.x - box.p1.x,
+			     box.p2.y - box.p1.y);
+}
+
+static void setup_damage(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		rnd_region(&a[i], rnd(2, 4), 16, 400);
+		rnd_region(&b[i], rnd(2, 4), 16, 400);
+	}
+}
+
+static void setup_complex(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		rnd_region(&a[i], 32, 16, 300);
+		rnd_region(&b[i], 32, 16, 300);
+	}
+}
+
+/* a view, b the damage of the frame */
+static void setup_view_damage(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		rnd_rect_region(&a[i], 200, 1000);
+		rnd_region(&b[i], rnd(1, 4), 16, 600);
+	}
+}
+
+/* a view, b the opaque windows above it */
+static void setup_view_opaque(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		rnd_rect_region(&a[i], 200, 1000);
+		rnd_region(&b[i], rnd(1, 3), 100, 800);
+	}
+}
+
+static void setup_unsorted(void)
+{
+	s32 i, j;
+
+	for (i = 0; i < SETS; i++)
+		for (j = 0; j < 16; j++)
+			rnd_box(&unsorted[i][j], 16, 300);
+}
+
+static void op_union(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++)
+		clv_region_union(&r[i], &a[i], &b[i]);
+}
+
+static void op_intersect(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++)
+		clv_region_intersect(&r[i], &a[i], &b[i]);
+}
+
+static void op_subtract(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++)
+		clv_region_subtract(&r[i], &a[i], &b[i]);
+}
+
+static void op_translate(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		clv_region_copy(&r[i], &a[i]);
+		clv_region_translate(&r[i], 37, -21);
+	}
+}
+
+static void op_init_boxes(void)
+{
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		clv_region_fini(&r[i]);
+		clv_region_init_boxes(&r[i], unsorted[i], 16);
+	}
+}
+
+/*
+ * the region work draw_view does for a view, b is the damage left, arena
+ * as the GL renderer's frame arena
+ */
+static void draw_view(struct clv_arena *arena)
+{
+	struct clv_region damage, view_area, output_area, blend, opaque;
+	struct clv_box *e;
+	s32 i;
+
+	for (i = 0; i < SETS; i++) {
+		clv_region_init(&damage);
+		clv_region_set_arena(&damage, arena);
+		clv_region_copy(&damage, &b[i]);
+		e = clv_region_extents(&a[i]);
+		clv_region_init_rect(&view_area, e->p1.x, e->p1.y,
+				     e->p2.x - e->p1.x, e->p2.y - e->p1.y);
+		clv_region_set_arena(&view_area, arena);
+		clv_region_init_rect(&output_area, 0, 0, W, H);
+		clv_region_set_arena(&output_area, arena);
+		clv_region_intersect(&view_area, &view_area, &output_area);
+		clv_region_translate(&view_area, 0, 0);
+		clv_region_intersect(&view_area, &view_area, &damage);
+		clv_region_subtract(&damage, &damage, &view_area);
+		clv_region_init_rect(&blend, 0, 0, e->p2.x - e->p1.x,
+				     e->p2.y - e->p1.y);
+		clv_region_set_arena(&blend, arena);
+		clv_region_subtract(&blend, &blend, &a[(i + 1) % SETS]);
+		clv_region_init(&opaque);
+		clv_region_set_arena(&opaque, arena);
+		clv_region_copy(&opaque, &a[(i + 1) % SETS]);
+		clv_region_copy(&r[i], &damage);
+		clv_region_fini(&opaque);
+		clv_region_fini(&blend);
+		clv_region_fini(&output_area);
+		clv_region_fini(&view_area);
+		clv_region_fini(&damage);
+	}
+	if (arena)
+		clv_arena_reset(arena);
+}
+
+static void op_draw_view(void)
+{
+	draw_view(NULL);
+}
+
+static void op_draw_view_arena(void)
+{
+	draw_view(&frame);
+}
+
+static void raster(u8 *bm, struct clv_region *region, s32 dx, s32 dy)
+{
+	struct clv_box *boxes;
+	s32 i, y, count_boxes;
+
+	memset(bm, 0, BW * BH);
+	boxes = clv_region_boxes(region, &count_boxes);
+	for (i = 0; i < count_boxes; i++)
+		for (y = boxes[i].p1.y; y < boxes[i].p2.y; y++)
+			memset(bm + (y + dy + MARGIN) * BW
+				  + boxes[i].p1.x + dx + MARGIN, 1,
+			       boxes[i].p2.x - boxes[i].p1.x);
+}
+
+/* y-x banded, no empty or touching boxes in a band, exact extents */
+static s32 check_bands(struct clv_region *region)
+{
+	struct clv_box *boxes, *e, bb;
+	s32 i, count_boxes;
+
+	boxes = clv_region_boxes(region, &count_boxes);
+	if (!clv_region_is_not_empty(region))
+		return 0;
+	bb = boxes[0];
+	for (i = 0; i < count_boxes; i++) {
+		if (boxes[i].p1.x >= boxes[i].p2.x
+		    || boxes[i].p1.y >= boxes[i].p2.y)
+			return -1;
+		if (i && boxes[i].p1.y == boxes[i - 1].p1.y) {
+			if (boxes[i].p2.y != boxes[i - 1].p2.y
+			    || boxes[i].p1.x <= boxes[i - 1].p2.x)
+				return -1;
+		} else if (i && boxes[i].p1.y < boxes[i - 1].p2.y) {
+			return -1;
+		}
+		bb.p1.x = MIN(bb.p1.x, boxes[i].p1.x);
+		bb.p2.x = MAX(bb.p2.x, boxes[i].p2.x);
+		bb.p2.y = MAX(bb.p2.y, boxes[i].p2.y);
+	}
+	e = clv_region_extents(region);
+	return memcmp(e, &bb, sizeof(bb)) ? -1 : 0;
+}
+
+enum bench_check {
+	CHECK_NONE = 0,
+	CHECK_UNION,
+	CHECK_INTERSECT,
+	CHECK_SUBTRACT,
+	CHECK_TRANSLATE,
+	CHECK_BOXES,
+};
+
+static s32 check(enum bench_check type, s32 i)
+{
+	struct clv_region boxes;
+	s32 j, ret;
+
+	if (check_bands(&r[i]) < 0)
+		return -1;
+
+	switch (type) {
+	case CHECK_TRANSLATE:
+		raster(bm_a, &a[i], 37, -21);
+		break;
+	case CHECK_BOXES:
+		clv_region_init(&boxes);
+		for (j = 0; j < 16; j++)
+			clv_region_union_rect(&boxes, &boxes,
+				unsorted[i][j].p1.x, unsorted[i][j].p1.y,
+				unsorted[i][j].p2.x - unsorted[i][j].p1.x,
+				unsorted[i][j].p2.y - unsorted[i][j].p1.y);
+		raster(bm_a, &boxes, 0, 0);
+		clv_region_fini(&boxes);
+		break;
+	default:
+		raster(bm_a, &a[i], 0, 0);
+		raster(bm_b, &b[i], 0, 0);
+		for (j = 0; j < BW * BH; j++) {
+			if (type == CHECK_UNION)
+				bm_a[j] |= bm_b[j];
+			else if (type == CHECK_INTERSECT)
+				bm_a[j] &= bm_b[j];
+			else
+				bm_a[j] &= !bm_b[j];
+		}
+		break;
+	}
+
+	raster(bm_r, &r[i], 0, 0);
+	ret = memcmp(bm_a, bm_r, BW * BH);
+
+	return ret ? -1 : 0;
+}
+
+struct bench_case {
+	const char *name;
+	void (*setup)(void);
+	void (*op)(void);
+	enum bench_check check;
+};
+
+static struct bench_case cases[] = {
+	{ "union (damage)", setup_damage, op_union, CHECK_UNION },
+	{ "union (32 rects)", setup_complex, op_union, CHECK_UNION },
+	{ "intersect (view, damage)", setup_view_damage, op_intersect,
+	  CHECK_INTERSECT },
+	{ "intersect (32 rects)", setup_complex, op_intersect,
+	  CHECK_INTERSECT },
+	{ "subtract (view, opaque)", setup_view_opaque, op_subtract,
+	  CHECK_SUBTRACT },
+	{ "subtract (32 rects)", setup_complex, op_subtract, CHECK_SUBTRACT },
+	{ "copy+translate (32 rects)", setup_complex, op_translate,
+	  CHECK_TRANSLATE },
+	{ "init_boxes (16 unsorted)", setup_unsorted, op_init_boxes,
+	  CHECK_BOXES },
+	{ "draw_view", setup_view_damage, op_draw_view, CHECK_NONE },
+	{ "draw_view (arena)", setup_view_damage, op_draw_view_arena,
+	  CHECK_NONE },
+};
+
+static void bench(struct bench_case *bc)
+{
+	s32 mismatch = 0, count_boxes = 0, i;
+	u64 t0, t1;
+
+	bc->setup();
+	bc->op();
+	for (i = 0; i < SETS; i++) {
+		count_boxes += clv_region_count_boxes(&r[i]);
+		if (bc->check && check(bc->check, i) < 0)
+			mismatch = 1;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < loops; i++)
+		bc->op();
+	t1 = now_ns();
+
+	printf("%-28s %9.1f ns/op %7.1f boxes out%s\n",
+	       bc->name, (double)(t1 - t0) / loops / SETS,
+	       (double)count_boxes / SETS, mismatch ? "  MISMATCH" : "");
+}
+
+s32 main(s32 argc, char **argv)
+{
+	u32 i;
+
+	if (argc > 1)
+		loops = atoi(argv[1]);
+	if (!loops)
+		loops = DEFAULT_LOOPS;
+
+	bm_a = malloc(BW * BH);
+	bm_b = malloc(BW * BH);
+	bm_r = malloc(BW * BH);
+	if (!bm_a || !bm_b || !bm_r) {
+		fprintf(stderr, "not enough memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < SETS; i++) {
+		clv_region_init(&a[i]);
+		clv_region_init(&b[i]);
+		clv_region_init(&r[i]);
+	}
+
+	clv_arena_init(&frame, 16384);
+
+	srand(1);
+	for (i = 0; i < ARRAY_SIZE(cases); i++)
+		bench(&cases[i]);
+
+	clv_arena_release(&frame);
+
+	for (i = 0; i < SETS; i++) {
+		clv_region_fini(&a[i]);
+		clv_region_fini(&b[i]);
+		clv_region_fini(&r[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_arena.h>
+
+#define ARENA_ALIGN (sizeof(void *) * 2)
+
+struct clv_arena_chunk {
+	struct clv_arena_chunk *next;
+	u32 size;
+	u32 used;
+	u8 data[0] __attribute__((aligned(sizeof(void *) * 2)));
+};
+
+void clv_arena_init(struct clv_arena *arena, u32 chunk_size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size ? chunk_size : 4096;
+}
+
+static void arena_free_chunks(struct clv_arena *arena)
+{
+	struct clv_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
+
+void clv_arena_release(struct clv_arena *arena)
+{
+	arena_free_chunks(arena);
+	arena->used = 0;
+}
+
+static struct clv_arena_chunk *arena_grow(struct clv_arena *arena, u32 size)
+{
+	struct clv_arena_chunk *chunk;
+
+	if (size < arena->chunk_size)
+		size = arena->chunk_size;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	return chunk;
+}
+
+void *clv_arena_alloc(struct clv_arena *arena, u32 size)
+{
+	struct clv_arena_chunk *chunk = arena->chunks;
+	void *p;
+
+	if (size > UINT32_MAX - ARENA_ALIGN)
+		return NULL;
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_grow(arena, size);
+		if (!chunk) {
+			clv_err("not enough memory to grow arena.");
+			return NULL;
+		}
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+
+	return p;
+}
+
+void clv_arena_reset(struct clv_arena *arena)
+{
+	u32 used = arena->used;
+
+	arena->used = 0;
+	if (!arena->chunks)
+		return;
+
+	if (!arena->chunks->next) {
+		arena->chunks->used = 0;
+		return;
+	}
+
+	/* one chunk for what the last frame took, the next one fits in it */
+	arena_free_chunks(arena);
+	if (used > arena->chunk_size)
+		arena->chunk_size = used;
+	arena_grow(arena, arena->chunk_size);
+}
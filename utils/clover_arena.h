@@ -0,0 +1,37 @@
+#ifndef CLOVER_ARENA_H
+#define CLOVER_ARENA_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump allocator for data that lives no longer than a frame.
+ *
+ * Allocations are carved from the current chunk one after the other and are
+ * never freed one by one, clv_arena_reset drops all of them at once. If the
+ * last frame took more than one chunk, reset swaps them for a single chunk
+ * that holds all of it, so a steady state frame never reaches malloc.
+ * An arena is used by one thread only.
+ */
+struct clv_arena_chunk;
+
+struct clv_arena {
+	struct clv_arena_chunk *chunks; /* allocations come from the first */
+	u32 chunk_size;
+	u32 used; /* bytes handed out since the last reset */
+};
+
+void clv_arena_init(struct clv_arena *arena, u32 chunk_size);
+void clv_arena_release(struct clv_arena *arena);
+/* not zeroed, aligned as malloc */
+void *clv_arena_alloc(struct clv_arena *arena, u32 size);
+void clv_arena_reset(struct clv_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_cursor_state.h>
+
+/* a writer preempted in the middle of an update must not stall a frame */
+#define CURSOR_STATE_READ_RETRIES 64
+
+void clv_cursor_state_write(struct clv_cursor_state *st, s32 x, s32 y,
+			    s32 hot_x, s32 hot_y)
+{
+	u32 seq = st->seq;
+
+	__atomic_store_n(&st->seq, seq + 1, __ATOMIC_RELAXED);
+	/* the odd seq is visible before any of the fields */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&st->x, x, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->y, y, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->hot_x, hot_x, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->hot_y, hot_y, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->serial, st->serial + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&st->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+s32 clv_cursor_state_read(struct clv_cursor_state *st,
+			  struct clv_cursor_state *snapshot)
+{
+	u32 seq, i;
+
+	for (i = 0; i < CURSOR_STATE_READ_RETRIES; i++) {
+		seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		snapshot->x = __atomic_load_n(&st->x, __ATOMIC_RELAXED);
+		snapshot->y = __atomic_load_n(&st->y, __ATOMIC_RELAXED);
+		snapshot->hot_x = __atomic_load_n(&st->hot_x,
+						  __ATOMIC_RELAXED);
+		snapshot->hot_y = __atomic_load_n(&st->hot_y,
+						  __ATOMIC_RELAXED);
+		snapshot->serial = __atomic_load_n(&st->serial,
+						   __ATOMIC_RELAXED);
+		/* the fields are read before seq is checked again */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&st->seq, __ATOMIC_RELAXED) == seq) {
+			snapshot->seq = seq;
+			return 0;
+		}
+	}
+
+	return -1;
+}
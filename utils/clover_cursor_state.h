@@ -0,0 +1,45 @@
+#ifndef CLOVER_CURSOR_STATE_H
+#define CLOVER_CURSOR_STATE_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Cursor state page shared by the input server and the compositor.
+ *
+ * The compositor creates the page, the input server writes the cursor
+ * position into it as soon as the pointer moves, and the compositor samples
+ * it right before it assigns the planes of a frame. The position no longer
+ * waits for the commit round trip of the cursor surface, commits are still
+ * needed for the cursor image and its hotspot. hot_x and hot_y follow the
+ * input server's current image, the compositor does not take them from the
+ * page as the image they belong to may not be committed yet.
+ *
+ * The page is protected by a seqlock: seq is odd while the single writer
+ * updates it, readers retry until they see the same even seq around their
+ * copy. serial is bumped by every update, 0 means never written.
+ */
+
+#define CLV_CURSOR_STATE_SHM "clover_cursor_state"
+
+struct clv_cursor_state {
+	u32 seq;
+	u32 serial;
+	s32 x, y; /* canvas coordinates */
+	s32 hot_x, hot_y;
+};
+
+void clv_cursor_state_write(struct clv_cursor_state *st, s32 x, s32 y,
+			    s32 hot_x, s32 hot_y);
+/* returns -1 if no consistent snapshot could be taken */
+s32 clv_cursor_state_read(struct clv_cursor_state *st,
+			  struct clv_cursor_state *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
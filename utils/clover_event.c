@@ -9,9 +9,11 @@
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <clover_utils.h>
 #include <clover_log.h>
 #include <clover_signal.h>
+#include <clover_queue.h>
 #include <clover_event.h>
 
 struct clv_event_source_idle {
@@ -25,9 +27,15 @@ struct clv_event_source_fd {
 	s32 fd;
 };
 
+/*
+ * Software timer. All the timers of a loop are kept in a min-heap ordered
+ * by deadline and share one timerfd, which is armed for the earliest one.
+ */
 struct clv_event_source_timer {
 	struct clv_event_source base;
 	clv_event_loop_timer_cb_t cb;
+	u64 deadline; /* CLOCK_MONOTONIC nsec */
+	s32 heap_index; /* -1 if not armed */
 };
 
 struct clv_event_source_signal {
@@ -36,10 +44,25 @@ struct clv_event_source_signal {
 	s32 signal_number;
 };
 
+/*
+ * Work queue. The works are linked into a MPSC queue, the eventfd only wakes
+ * the loop up. kicked is set while the eventfd is signaled, so a burst of
+ * works costs a single write.
+ */
+struct clv_event_source_queue {
+	struct clv_event_source base;
+	struct clv_mpsc_queue queue;
+	u32 kicked;
+};
+
 struct clv_event_source_interface idle_source_interface = {
 	NULL,
 };
 
+static struct clv_event_source_interface timer_source_interface;
+static void clv_timer_heap_remove(struct clv_event_loop *loop,
+				  struct clv_event_source_timer *timer);
+
 static s32 epoll_create_cloexec(void)
 {
 	s32 fd;
@@ -61,8 +84,12 @@ static void process_destroy_list(struct clv_event_loop *loop)
 {
 	struct clv_event_source *source, *next;
 
-	list_for_each_entry_safe(source, next, &loop->destroy_list, link)
-		free(source);
+	list_for_each_entry_safe(source, next, &loop->destroy_list, link) {
+		if (source->interface == &idle_source_interface)
+			clv_pool_free(&loop->idle_pool, source);
+		else
+			free(source);
+	}
 
 	INIT_LIST_HEAD(&loop->destroy_list);
 }
@@ -77,14 +104,26 @@ struct clv_event_loop * clv_event_loop_create(void)
 		return NULL;
 	}
 
+	loop->count_events = CLV_EVT_DEFAULT_BATCH;
+	loop->events = calloc(loop->count_events, sizeof(*loop->events));
+	if (!loop->events) {
+		clv_err("not enough memory to alloc epoll events.");
+		free(loop);
+		return NULL;
+	}
+
 	loop->epoll_fd = epoll_create_cloexec();
 	if (loop->epoll_fd < 0) {
+		free(loop->events);
 		free(loop);
 		return NULL;
 	}
 
 	INIT_LIST_HEAD(&loop->idle_list);
+	clv_pool_init(&loop->idle_pool, sizeof(struct clv_event_source_idle),
+		      16);
 	INIT_LIST_HEAD(&loop->destroy_list);
+	INIT_LIST_HEAD(&loop->pending_list);
 	clv_signal_init(&loop->destroy_signal);
 
 	return loop;
@@ -96,23 +135,57 @@ void clv_event_loop_destroy(struct clv_event_loop *loop)
 		return;
 
 	clv_signal_emit(&loop->destroy_signal, loop);
+	if (loop->timer_source)
+		clv_event_source_remove(loop->timer_source);
 	process_destroy_list(loop);
+	clv_pool_release(&loop->idle_pool);
 	close(loop->epoll_fd);
+	free(loop->timers);
+	free(loop->events);
 	free(loop);
 	loop = NULL;
 }
 
+/*
+ * Set the max number of events fetched by one epoll_wait.
+ * Must not be called from inside of a dispatch callback.
+ */
+s32 clv_event_loop_set_batch_size(struct clv_event_loop *loop, s32 count)
+{
+	struct epoll_event *events;
+
+	if (count <= 0)
+		return -1;
+
+	events = realloc(loop->events, count * sizeof(*events));
+	if (!events) {
+		clv_err("not enough memory to alloc epoll events.");
+		return -1;
+	}
+
+	loop->events = events;
+	loop->count_events = count;
+	return 0;
+}
+
 void clv_event_source_remove(struct clv_event_source *source)
 {
 	if (!source)
 		return;
 
+	if (source->interface == &timer_source_interface)
+		clv_timer_heap_remove(source->loop,
+				      container_of(source,
+						   struct clv_event_source_timer,
+						   base));
+
 	if (source->fd >= 0) {
 		epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_DEL, source->fd,
 			  NULL);
 		close(source->fd);
 		source->fd = -1;
 	}
+	list_del_init(&source->pending_link);
 	list_del(&source->link);
 	list_add_tail(&source->link, &source->loop->destroy_list);
 }
@@ -121,7 +194,7 @@ static void clv_event_idle_source_remove(struct clv_event_source *source)
 {
 	assert(source->fd < 0);
 	list_del(&source->link);
-	free(source);
+	clv_pool_free(&source->loop->idle_pool, source);
 }
 
 struct clv_event_source * clv_event_loop_add_idle(struct clv_event_loop *loop,
@@ -130,7 +203,7 @@ struct clv_event_source * clv_event_loop_add_idle(struct clv_event_loop *loop,
 {
 	struct clv_event_source_idle *source;
 
-	source = calloc(1, sizeof(*source));
+	source = clv_pool_alloc(&loop->idle_pool);
 	if (!source)
 		return NULL;
 
@@ -139,6 +212,7 @@ struct clv_event_source * clv_event_loop_add_idle(struct clv_event_loop *loop,
 	source->base.fd = -1;
 	source->cb = cb;
 	source->base.data = data;
+	INIT_LIST_HEAD(&source->base.pending_link);
 	list_add_tail(&source->base.link, &loop->idle_list);
 
 	return &source->base;
@@ -157,31 +231,123 @@ void clv_event_loop_dispatch_idle(struct clv_event_loop *loop)
 	}
 }
 
-s32 clv_event_loop_dispatch(struct clv_event_loop *loop, s32 timeout)
+static void clv_event_source_dispatch(struct clv_event_source *source,
+				      struct epoll_event *ep)
+{
+	s32 budget = CLV_EVT_DRAIN_BUDGET;
+	s32 ret;
+
+	if (!source->edge) {
+		source->interface->dispatch(source, ep);
+		return;
+	}
+
+	/* drain the edge triggered source, no more event until then. */
+	list_del_init(&source->pending_link);
+	do {
+		ret = source->interface->dispatch(source, ep);
+	} while (ret != CLV_EVT_DRAINED && source->fd >= 0 && --budget);
+
+	/* out of budget, continue at the next dispatch to be fair. */
+	if (ret != CLV_EVT_DRAINED && source->fd >= 0)
+		list_add_tail(&source->pending_link, &source->loop->pending_list);
+}
+
+static void clv_event_loop_dispatch_pending(struct clv_event_loop *loop)
+{
+	struct clv_event_source *source;
+	struct epoll_event ep;
+	s32 n = 0;
+
+	list_for_each_entry(source, &loop->pending_list, pending_link)
+		n++;
+
+	memset(&ep, 0, sizeof(ep));
+	ep.events = EPOLLIN;
+	/* sources queued again during this pass wait for the next one */
+	while (n-- && !list_empty(&loop->pending_list)) {
+		source = list_first_entry(&loop->pending_list,
+					  struct clv_event_source,
+					  pending_link);
+		ep.data.ptr = source;
+		clv_event_source_dispatch(source, &ep);
+	}
+}
+
+static s32 clv_event_loop_dispatch_once(struct clv_event_loop *loop,
+					s32 timeout)
 {
 	struct clv_event_source *source;
-	struct epoll_event ep[32];
 	s32 i, n;
-	
+
 	clv_event_loop_dispatch_idle(loop);
 
-	n = epoll_wait(loop->epoll_fd, ep, ARRAY_SIZE(ep), timeout);
+	/* do not sleep while some sources are not drained */
+	if (!list_empty(&loop->pending_list))
+		timeout = 0;
+
+	n = epoll_wait(loop->epoll_fd, loop->events, loop->count_events,
+		       timeout);
 	if (n < 0)
 		return -1;
 
 	for (i = 0; i < n; i++) {
-		source = ep[i].data.ptr;
+		source = loop->events[i].data.ptr;
 		if (source->fd > 0)
-			source->interface->dispatch(source, &ep[i]);
+			clv_event_source_dispatch(source, &loop->events[i]);
 	}
-	
+
+	clv_event_loop_dispatch_pending(loop);
+
 	process_destroy_list(loop);
 
 	clv_event_loop_dispatch_idle(loop);
 
+	return n;
+}
+
+s32 clv_event_loop_dispatch(struct clv_event_loop *loop, s32 timeout)
+{
+	if (clv_event_loop_dispatch_once(loop, timeout) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Like clv_event_loop_dispatch(), but go on without sleeping as long as
+ * there may be more work, i.e. the last batch was full or some edge
+ * triggered sources are not drained yet.
+ */
+s32 clv_event_loop_dispatch_all(struct clv_event_loop *loop, s32 timeout)
+{
+	s32 n;
+
+	n = clv_event_loop_dispatch_once(loop, timeout);
+	while (n == loop->count_events ||
+	       (n >= 0 && !list_empty(&loop->pending_list)))
+		n = clv_event_loop_dispatch_once(loop, 0);
+
+	if (n < 0)
+		return -1;
+
 	return 0;
 }
 
+static u32 clv_event_mask_to_epoll(u32 mask)
+{
+	u32 events = 0;
+
+	if (mask & CLV_EVT_READABLE)
+		events |= EPOLLIN;
+	if (mask & CLV_EVT_WRITABLE)
+		events |= EPOLLOUT;
+	if (mask & CLV_EVT_EDGE)
+		events |= EPOLLET;
+
+	return events;
+}
+
 static struct clv_event_source * clv_event_loop_add_source(
 						struct clv_event_loop *loop,
 						struct clv_event_source *source,
@@ -198,12 +364,11 @@ static struct clv_event_source * clv_event_loop_add_source(
 	source->loop = loop;
 	source->data = data;
 	INIT_LIST_HEAD(&source->link);
+	INIT_LIST_HEAD(&source->pending_link);
+	source->edge = !!(mask & CLV_EVT_EDGE);
 
 	memset(&ep, 0, sizeof(ep));
-	if (mask & CLV_EVT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & CLV_EVT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = clv_event_mask_to_epoll(mask);
 	ep.data.ptr = source;
 
 	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ep) < 0) {
@@ -304,70 +469,245 @@ s32 clv_event_source_fd_update_mask(struct clv_event_source *source, u32 mask)
 	struct epoll_event ep;
 
 	memset(&ep, 0, sizeof(ep));
-	if (mask & CLV_EVT_READABLE)
-		ep.events |= EPOLLIN;
-	if (mask & CLV_EVT_WRITABLE)
-		ep.events |= EPOLLOUT;
+	ep.events = clv_event_mask_to_epoll(mask);
 	ep.data.ptr = source;
+	source->edge = !!(mask & CLV_EVT_EDGE);
+	if (!source->edge)
+		list_del_init(&source->pending_link);
 
 	return epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_MOD, source->fd,&ep);
 }
 
-static s32 clv_event_source_timer_dispatch(struct clv_event_source *source,
+static u64 clv_timer_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static inline s32 clv_timer_before(struct clv_event_source_timer **heap,
+				   s32 a, s32 b)
+{
+	return heap[a]->deadline < heap[b]->deadline;
+}
+
+static inline void clv_timer_swap(struct clv_event_source_timer **heap,
+				  s32 a, s32 b)
+{
+	struct clv_event_source_timer *t = heap[a];
+
+	heap[a] = heap[b];
+	heap[b] = t;
+	heap[a]->heap_index = a;
+	heap[b]->heap_index = b;
+}
+
+static void clv_timer_sift_up(struct clv_event_source_timer **heap, s32 i)
+{
+	while (i > 0 && clv_timer_before(heap, i, (i - 1) / 2)) {
+		clv_timer_swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void clv_timer_sift_down(struct clv_event_source_timer **heap,
+				s32 count, s32 i)
+{
+	s32 min, l, r;
+
+	while (1) {
+		min = i;
+		l = 2 * i + 1;
+		r = l + 1;
+		if (l < count && clv_timer_before(heap, l, min))
+			min = l;
+		if (r < count && clv_timer_before(heap, r, min))
+			min = r;
+		if (min == i)
+			break;
+		clv_timer_swap(heap, i, min);
+		i = min;
+	}
+}
+
+/*
+ * Arm the shared timerfd for the earliest deadline. It is only touched
+ * when the earliest deadline moves ahead. If it moves later, the timerfd
+ * fires early and is re-armed from the dispatcher.
+ */
+static void clv_timer_heap_arm(struct clv_event_loop *loop)
+{
+	struct itimerspec its;
+	u64 deadline;
+
+	if (!loop->count_timers)
+		return;
+
+	deadline = loop->timers[0]->deadline;
+	if (loop->timer_armed && loop->timer_armed <= deadline)
+		return;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000000ull;
+	its.it_value.tv_nsec = deadline % 1000000000ull;
+	if (timerfd_settime(loop->timer_source->fd, TFD_TIMER_ABSTIME,
+			    &its, NULL) < 0) {
+		clv_err("failed to timerfd_settime: %s fd = %d %ld %ld",
+			strerror(errno), loop->timer_source->fd,
+			its.it_value.tv_sec, its.it_value.tv_nsec);
+		return;
+	}
+	loop->timer_armed = deadline;
+}
+
+static void clv_timer_heap_remove(struct clv_event_loop *loop,
+				  struct clv_event_source_timer *timer)
+{
+	struct clv_event_source_timer *last;
+	s32 i = timer->heap_index;
+
+	if (i < 0)
+		return;
+
+	timer->heap_index = -1;
+	loop->count_timers--;
+	if (i == loop->count_timers)
+		return;
+
+	last = loop->timers[loop->count_timers];
+	loop->timers[i] = last;
+	last->heap_index = i;
+	clv_timer_sift_up(loop->timers, i);
+	clv_timer_sift_down(loop->timers, loop->count_timers, last->heap_index);
+}
+
+static s32 clv_timer_heap_insert(struct clv_event_loop *loop,
+				 struct clv_event_source_timer *timer)
+{
+	struct clv_event_source_timer **timers;
+	s32 size;
+
+	if (loop->count_timers == loop->size_timers) {
+		size = loop->size_timers ? loop->size_timers * 2 : 16;
+		timers = realloc(loop->timers, size * sizeof(*timers));
+		if (!timers) {
+			clv_err("not enough memory to alloc timer heap.");
+			return -1;
+		}
+		loop->timers = timers;
+		loop->size_timers = size;
+	}
+
+	timer->heap_index = loop->count_timers++;
+	loop->timers[timer->heap_index] = timer;
+	clv_timer_sift_up(loop->timers, timer->heap_index);
+
+	return 0;
+}
+
+static s32 clv_event_loop_timerfd_dispatch(struct clv_event_source *source,
 					   struct epoll_event *ep)
 {
-	struct clv_event_source_timer *timer_source;
-	u64 expires;
+	struct clv_event_loop *loop = source->data;
+	struct clv_event_source_timer *timer;
+	u64 expires, now;
 	u32 len;
 
-	timer_source = container_of(source,
-				    struct clv_event_source_timer,
-				    base);
 	len = read(source->fd, &expires, sizeof(expires));
 	if (!(len == -1 && errno == EAGAIN) && len != sizeof(expires))
 		clv_err("failed to read timerfd: %m");
 
-	return timer_source->cb(source->data);
+	loop->timer_armed = 0;
+	now = clv_timer_now();
+	/* timers re-armed by the callbacks expire in the future */
+	while (loop->count_timers && loop->timers[0]->deadline <= now) {
+		timer = loop->timers[0];
+		clv_timer_heap_remove(loop, timer);
+		timer->cb(timer->base.data);
+	}
+
+	clv_timer_heap_arm(loop);
+
+	return 0;
+}
+
+static struct clv_event_source_interface timerfd_source_interface = {
+	clv_event_loop_timerfd_dispatch,
+};
+
+static s32 clv_event_source_timer_dispatch(struct clv_event_source *source,
+					   struct epoll_event *ep)
+{
+	/* software timers are dispatched from the shared timerfd */
+	return 0;
 }
 
 static struct clv_event_source_interface timer_source_interface = {
 	clv_event_source_timer_dispatch,
 };
 
+static struct clv_event_source * clv_event_loop_add_timerfd(
+						struct clv_event_loop *loop)
+{
+	struct clv_event_source *source;
+
+	source = calloc(1, sizeof(*source));
+	if (!source)
+		return NULL;
+
+	source->fd = timerfd_create(CLOCK_MONOTONIC,
+				    TFD_CLOEXEC | TFD_NONBLOCK);
+	source->interface = &timerfd_source_interface;
+	return clv_event_loop_add_source(loop, source, CLV_EVT_READABLE, loop);
+}
+
 struct clv_event_source * clv_event_loop_add_timer(struct clv_event_loop *loop,
 						   clv_event_loop_timer_cb_t cb,
 						   void *data)
 {
 	struct clv_event_source_timer *source;
 
+	if (!loop->timer_source) {
+		loop->timer_source = clv_event_loop_add_timerfd(loop);
+		if (!loop->timer_source)
+			return NULL;
+	}
+
 	source = calloc(1, sizeof(*source));
 	if (!source)
 		return NULL;
 
-	source->base.fd = timerfd_create(CLOCK_MONOTONIC,
-					TFD_CLOEXEC | TFD_NONBLOCK);
-	source->cb = cb;
 	source->base.interface = &timer_source_interface;
-	return clv_event_loop_add_source(loop, &source->base,
-					 CLV_EVT_READABLE, data);
+	source->base.loop = loop;
+	source->base.data = data;
+	source->base.fd = -1;
+	INIT_LIST_HEAD(&source->base.link);
+	INIT_LIST_HEAD(&source->base.pending_link);
+	source->cb = cb;
+	source->heap_index = -1;
+
+	return &source->base;
 }
 
+/* Arm the timer to expire after ms + us, 0 disarms it. */
 s32 clv_event_source_timer_update(struct clv_event_source *source,
 				  s32 ms, s32 us)
 {
-	struct itimerspec its;
+	struct clv_event_loop *loop = source->loop;
+	struct clv_event_source_timer *timer;
 
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-	its.it_value.tv_sec = ms / 1000;
-	its.it_value.tv_nsec = (ms % 1000) * 1000 * 1000 + us * 1000;
+	timer = container_of(source, struct clv_event_source_timer, base);
+	clv_timer_heap_remove(loop, timer);
+	if (!ms && !us)
+		return 0;
 
-	if (timerfd_settime(source->fd, 0, &its, NULL) < 0) {
-		clv_err("failed to timerfd_settime: %s fd = %d %ld %ld",
-			strerror(errno), source->fd, its.it_value.tv_sec,
-			its.it_value.tv_nsec);
+	timer->deadline = clv_timer_now() + (u64)ms * 1000000ull
+				+ (u64)us * 1000ull;
+	if (clv_timer_heap_insert(loop, timer) < 0)
 		return -1;
-	}
+
+	clv_timer_heap_arm(loop);
 
 	return 0;
 }
@@ -418,6 +758,97 @@ struct clv_event_source * clv_event_loop_add_signal(
 					 CLV_EVT_READABLE, data);
 }
 
+static s32 clv_event_source_queue_dispatch(struct clv_event_source *source,
+					   struct epoll_event *ep)
+{
+	struct clv_event_source_queue *queue_source;
+	struct clv_event_work *work;
+	struct clv_mpsc_node *node;
+	s32 batch = CLV_EVT_QUEUE_BATCH;
+	u64 v;
+
+	queue_source = container_of(source, struct clv_event_source_queue,
+				    base);
+	/* the works posted from now on kick the eventfd again */
+	if (__atomic_exchange_n(&queue_source->kicked, 0, __ATOMIC_SEQ_CST)) {
+		if (read(source->fd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+			clv_err("failed to read eventfd: %m");
+	}
+
+	while (batch--) {
+		/*
+		 * NULL may also mean a producer is half way through a push,
+		 * it kicks the eventfd again once the push is done.
+		 */
+		node = clv_mpsc_queue_pop(&queue_source->queue);
+		if (!node)
+			return CLV_EVT_DRAINED;
+		work = container_of(node, struct clv_event_work, node);
+		work->cb(work, source->data);
+		/* removed by the work */
+		if (source->fd < 0)
+			return CLV_EVT_DRAINED;
+	}
+
+	return CLV_EVT_AGAIN;
+}
+
+static struct clv_event_source_interface queue_source_interface = {
+	clv_event_source_queue_dispatch,
+};
+
+struct clv_event_source * clv_event_loop_add_queue(
+				struct clv_event_loop *loop,
+				void *data)
+{
+	struct clv_event_source_queue *source;
+
+	/* the queue's head and tail sit in their own cache lines */
+	if (posix_memalign((void **)&source, CLV_CACHELINE_SIZE,
+			   sizeof(*source)))
+		return NULL;
+
+	memset(source, 0, sizeof(*source));
+	clv_mpsc_queue_init(&source->queue);
+	source->base.interface = &queue_source_interface;
+	source->base.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	return clv_event_loop_add_source(loop, &source->base,
+					 CLV_EVT_READABLE | CLV_EVT_EDGE, data);
+}
+
+/* May be called from any thread. */
+void clv_event_source_queue_post(struct clv_event_source *source,
+				 struct clv_event_work *work)
+{
+	struct clv_event_source_queue *queue_source;
+	u64 v = 1;
+
+	queue_source = container_of(source, struct clv_event_source_queue,
+				    base);
+	clv_mpsc_queue_push(&queue_source->queue, &work->node);
+	if (__atomic_exchange_n(&queue_source->kicked, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	if (write(source->fd, &v, sizeof(v)) < 0)
+		clv_err("failed to write eventfd: %m");
+}
+
+struct clv_event_work * clv_event_source_queue_take(
+				struct clv_event_source *source)
+{
+	struct clv_event_source_queue *queue_source;
+	struct clv_mpsc_node *node;
+
+	queue_source = container_of(source, struct clv_event_source_queue,
+				    base);
+	node = clv_mpsc_queue_pop(&queue_source->queue);
+	if (!node)
+		return NULL;
+
+	return container_of(node, struct clv_event_work, node);
+}
+
 void clv_event_loop_add_destroy_listener(struct clv_event_loop *loop,
 					    struct clv_listener *listener)
 {
@@ -4,6 +4,8 @@
 #include <sys/epoll.h>
 #include <clover_utils.h>
 #include <clover_signal.h>
+#include <clover_pool.h>
+#include <clover_queue.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,13 +16,42 @@ enum {
 	CLV_EVT_WRITABLE = 0x02,
 	CLV_EVT_HANGUP   = 0x04,
 	CLV_EVT_ERROR    = 0x08,
+	/*
+	 * Edge triggered fd source. The callback is invoked again and again
+	 * until it returns CLV_EVT_DRAINED (e.g. once read() reports EAGAIN)
+	 * or the source is removed.
+	 */
+	CLV_EVT_EDGE     = 0x10,
 };
 
+/* return value of an edge triggered source's callback */
+#define CLV_EVT_DRAINED 0
+#define CLV_EVT_AGAIN   1
+
+#define CLV_EVT_DEFAULT_BATCH 32
+/* callbacks of one edge triggered source per dispatch, before yielding */
+#define CLV_EVT_DRAIN_BUDGET 16
+/* works run by one callback of a queue source */
+#define CLV_EVT_QUEUE_BATCH 32
+
+struct clv_event_source_timer;
+
 struct clv_event_loop {
 	s32 epoll_fd;
+	struct epoll_event *events;
+	s32 count_events; /* batch size of epoll_wait */
 	struct list_head idle_list;
+	struct clv_pool idle_pool; /* idle sources come and go every frame */
 	struct list_head destroy_list;
+	/* edge triggered sources which are not drained yet */
+	struct list_head pending_list;
 	struct clv_signal destroy_signal;
+
+	/* software timers, min-heap on the deadline */
+	struct clv_event_source *timer_source; /* shared timerfd */
+	struct clv_event_source_timer **timers;
+	s32 count_timers, size_timers;
+	u64 timer_armed; /* deadline the timerfd is armed for, 0 if none */
 };
 
 struct clv_event_source;
@@ -35,12 +66,27 @@ typedef s32 (*clv_event_loop_fd_cb_t)(s32 fd, u32 mask, void *data);
 typedef s32 (*clv_event_loop_timer_cb_t)(void *data);
 typedef s32 (*clv_event_loop_signal_cb_t)(s32 signal_number, void *data);
 
+struct clv_event_work;
+typedef void (*clv_event_loop_work_cb_t)(struct clv_event_work *work,
+					 void *data);
+
+/*
+ * A closure posted to a queue source. It is embedded into the caller's
+ * own structure and is owned by the caller again once cb is invoked.
+ */
+struct clv_event_work {
+	struct clv_mpsc_node node;
+	clv_event_loop_work_cb_t cb;
+};
+
 struct clv_event_source {
 	struct clv_event_source_interface *interface;
 	struct clv_event_loop *loop;
 	struct list_head link;
 	void *data;
 	s32 fd;
+	s32 edge;
+	struct list_head pending_link;
 };
 
 s32 clv_set_cloexec_or_close(s32 fd);
@@ -62,6 +108,24 @@ struct clv_event_source * clv_event_loop_add_signal(
 				clv_event_loop_signal_cb_t cb,
 				void *data);
 
+/*
+ * Work queue source. Any thread may post works to it, the works are run
+ * in the loop's thread, in posting order per producer, with the source's
+ * data as the second argument of their callbacks.
+ */
+struct clv_event_source * clv_event_loop_add_queue(
+				struct clv_event_loop *loop,
+				void *data);
+void clv_event_source_queue_post(struct clv_event_source *source,
+				 struct clv_event_work *work);
+/*
+ * Take a queued work back without running it, NULL if there is none.
+ * Only valid in the loop's thread, or once all the producers are gone.
+ * The works left in a queue source are not run when it is removed.
+ */
+struct clv_event_work * clv_event_source_queue_take(
+				struct clv_event_source *source);
+
 struct clv_event_loop * clv_event_loop_create(void);
 void clv_event_loop_destroy(struct clv_event_loop *loop);
 void clv_event_source_remove(struct clv_event_source *source);
@@ -70,7 +134,9 @@ struct clv_event_source * clv_event_loop_add_idle(struct clv_event_loop *loop,
 						  clv_event_loop_idle_cb_t cb,
 						  void *data);
 
+s32 clv_event_loop_set_batch_size(struct clv_event_loop *loop, s32 count);
 s32 clv_event_loop_dispatch(struct clv_event_loop *loop, s32 timeout);
+s32 clv_event_loop_dispatch_all(struct clv_event_loop *loop, s32 timeout);
 
 void clv_event_loop_add_destroy_listener(struct clv_event_loop *loop,
 					 struct clv_listener *listener);
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_handle.h>
+
+void clv_handle_table_init(struct clv_handle_table *table)
+{
+	memset(table, 0, sizeof(*table));
+	table->free_head = -1;
+}
+
+void clv_handle_table_release(struct clv_handle_table *table)
+{
+	if (table->slots)
+		free(table->slots);
+	clv_handle_table_init(table);
+}
+
+u64 clv_handle_alloc(struct clv_handle_table *table, void *obj, u32 type)
+{
+	struct clv_handle_slot *slot, *slots;
+	u32 index, alloc;
+
+	if (!table || !obj)
+		return 0;
+
+	if (table->free_head >= 0) {
+		index = (u32)table->free_head;
+		slot = &table->slots[index];
+		table->free_head = slot->next_free;
+	} else {
+		if (table->count_slots == table->alloc) {
+			if (table->alloc > 0)
+				alloc = table->alloc * 2;
+			else
+				alloc = 16;
+			slots = realloc(table->slots, alloc * sizeof(*slots));
+			if (!slots)
+				return 0;
+			table->slots = slots;
+			table->alloc = alloc;
+		}
+		index = table->count_slots++;
+		slot = &table->slots[index];
+		slot->gen = 1;
+	}
+
+	slot->obj = obj;
+	slot->type = type;
+	slot->next_free = -1;
+	table->count_objs++;
+
+	return clv_handle_of_slot(table, index);
+}
+
+void *clv_handle_free(struct clv_handle_table *table, u64 handle)
+{
+	struct clv_handle_slot *slot;
+	u32 index = (u32)(handle & 0xFFFFFFFF);
+	void *obj;
+
+	if (!index || index > table->count_slots)
+		return NULL;
+
+	slot = &table->slots[index - 1];
+	if (!slot->obj || slot->gen != (u32)(handle >> 32))
+		return NULL;
+
+	obj = slot->obj;
+	slot->obj = NULL;
+	slot->type = 0;
+	/* generation 0 is never used, handle 0 is illegal. */
+	if (!(++slot->gen))
+		slot->gen = 1;
+	slot->next_free = table->free_head;
+	table->free_head = (s32)(index - 1);
+	table->count_objs--;
+
+	return obj;
+}
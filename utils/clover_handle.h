@@ -0,0 +1,74 @@
+#ifndef CLOVER_HANDLE_H
+#define CLOVER_HANDLE_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Generation tagged handle table.
+ *
+ * Objects are kept in a dense array of slots, free slots are chained into a
+ * free list, so both allocation and lookup are O(1).
+ *
+ * A handle is never 0:
+ *     bit  0 ~ 31: slot index + 1
+ *     bit 32 ~ 63: generation of the slot
+ * The generation of a slot is increased each time the slot is released, a
+ * stale handle is rejected by lookup instead of touching a freed object.
+ */
+struct clv_handle_slot {
+	void *obj;
+	u32 gen;
+	u32 type;
+	s32 next_free;
+};
+
+struct clv_handle_table {
+	struct clv_handle_slot *slots;
+	u32 count_slots;
+	u32 alloc;
+	u32 count_objs;
+	s32 free_head;
+};
+
+void clv_handle_table_init(struct clv_handle_table *table);
+void clv_handle_table_release(struct clv_handle_table *table);
+u64 clv_handle_alloc(struct clv_handle_table *table, void *obj, u32 type);
+void *clv_handle_free(struct clv_handle_table *table, u64 handle);
+
+static inline void *clv_handle_lookup(struct clv_handle_table *table,
+				      u64 handle, u32 type)
+{
+	u32 index = (u32)(handle & 0xFFFFFFFF);
+	struct clv_handle_slot *slot;
+
+	if (!index || index > table->count_slots)
+		return NULL;
+
+	slot = &table->slots[index - 1];
+	if (!slot->obj || slot->gen != (u32)(handle >> 32)
+	    || slot->type != type)
+		return NULL;
+
+	return slot->obj;
+}
+
+static inline u64 clv_handle_of_slot(struct clv_handle_table *table, u32 i)
+{
+	return ((u64)(table->slots[i].gen) << 32) | (i + 1);
+}
+
+/* iterate all live objects of the given type */
+#define clv_handle_table_for_each(p, i, table, t) \
+	for (i = 0; i < (table)->count_slots; i++) \
+		if (((p) = (table)->slots[i].obj) \
+		    && (table)->slots[i].type == (t))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/input.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_input_ring.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+/* older C libraries do not wrap memfd_create */
+static s32 memfd_create_cloexec(const char *name, u32 flags)
+{
+	return syscall(SYS_memfd_create, name, flags | MFD_CLOEXEC);
+}
+
+static u32 ring_map_size(u32 size)
+{
+	u32 sz = sizeof(struct clv_input_ring_shared)
+			+ size * sizeof(struct clv_input_event_ts);
+	u32 page = getpagesize();
+
+	return (sz + page - 1) & ~(page - 1);
+}
+
+s32 clv_input_ring_create(struct clv_input_ring *ring, u32 size)
+{
+	u32 n = 1;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = ring->efd = -1;
+
+	if (!size)
+		size = CLV_INPUT_RING_DEFAULT_SIZE;
+	if (size > CLV_INPUT_RING_MAX_SIZE)
+		size = CLV_INPUT_RING_MAX_SIZE;
+	while (n < size)
+		n <<= 1;
+
+	ring->map_sz = ring_map_size(n);
+	ring->fd = memfd_create_cloexec("clv_input_ring", MFD_ALLOW_SEALING);
+	if (ring->fd < 0) {
+		clv_err("failed to create memfd. %m");
+		goto err;
+	}
+
+	if (ftruncate(ring->fd, ring->map_sz) < 0) {
+		clv_err("failed to truncate memfd. %m");
+		goto err;
+	}
+
+#ifdef F_ADD_SEALS
+	/* the peer must not be able to make our mapping fault */
+	if (fcntl(ring->fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+		clv_warn("failed to seal memfd. %m");
+#endif
+
+	ring->shared = mmap(NULL, ring->map_sz, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, ring->fd, 0);
+	if (ring->shared == MAP_FAILED) {
+		clv_err("failed to map input ring. %m");
+		ring->shared = NULL;
+		goto err;
+	}
+
+	ring->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (ring->efd < 0) {
+		clv_err("failed to create eventfd. %m");
+		goto err;
+	}
+
+	ring->mask = n - 1;
+	ring->shared->size = n;
+	ring->shared->rec_size = sizeof(struct clv_input_event_ts);
+	__atomic_store_n(&ring->shared->magic, CLV_INPUT_RING_MAGIC,
+			 __ATOMIC_RELEASE);
+
+	return 0;
+
+err:
+	clv_input_ring_release(ring);
+	return -1;
+}
+
+static inline void ring_write(struct clv_input_ring *ring,
+			      struct clv_input_event_ts *evt)
+{
+	ring->shared->recs[ring->tail & ring->mask] = *evt;
+	ring->tail++;
+}
+
+s32 clv_input_is_motion_batch(struct clv_input_event_ts *evts, u32 count)
+{
+	s32 motion = 0;
+	u32 i;
+
+	for (i = 0; i < count; i++) {
+		if (clv_input_is_motion(&evts[i]))
+			motion = 1;
+		else if (evts[i].evt.type != EV_SYN)
+			return 0;
+	}
+
+	return motion;
+}
+
+s32 clv_input_fold_motion(struct clv_input_event_ts *p,
+			  struct clv_input_event_ts *evt)
+{
+	s32 dx = p->evt.v.pos.dx + evt->evt.v.pos.dx;
+	s32 dy = p->evt.v.pos.dy + evt->evt.v.pos.dy;
+
+	if (dx > INT16_MAX || dx < INT16_MIN || dy > INT16_MAX
+	    || dy < INT16_MIN)
+		return -1;
+
+	p->evt.v.pos.x = evt->evt.v.pos.x;
+	p->evt.v.pos.y = evt->evt.v.pos.y;
+	p->evt.v.pos.dx = (s16)dx;
+	p->evt.v.pos.dy = (s16)dy;
+	p->time = evt->time;
+
+	return 0;
+}
+
+void clv_input_make_syn(struct clv_input_event_ts *syn,
+			struct clv_input_event_ts *evt)
+{
+	memset(syn, 0, sizeof(*syn));
+	syn->evt.type = EV_SYN;
+	syn->evt.code = SYN_REPORT;
+	syn->time = evt->time;
+}
+
+static s32 backlog_append(struct clv_input_ring *ring,
+			  struct clv_input_event_ts *evts, u32 count)
+{
+	struct clv_input_event_ts *p;
+	u32 cap = ring->backlog_cap;
+
+	if (ring->backlog_len + count > CLV_INPUT_RING_BACKLOG_MAX)
+		return -1;
+
+	if (ring->backlog_len + count > cap) {
+		if (!cap)
+			cap = 64;
+		while (cap < ring->backlog_len + count)
+			cap <<= 1;
+		p = realloc(ring->backlog, cap * sizeof(*p));
+		if (!p)
+			return -1;
+		ring->backlog = p;
+		ring->backlog_cap = cap;
+	}
+
+	memcpy(ring->backlog + ring->backlog_len, evts, count * sizeof(*evts));
+	ring->backlog_len += count;
+
+	return 0;
+}
+
+static u32 ring_room(struct clv_input_ring *ring)
+{
+	u32 head, used;
+
+	head = __atomic_load_n(&ring->shared->head, __ATOMIC_ACQUIRE);
+	used = ring->tail - head;
+	/* a head the peer made up, treat the ring as full */
+	if (used > ring->mask + 1)
+		used = ring->mask + 1;
+
+	return ring->mask + 1 - used;
+}
+
+/* move what was held back into the ring, whole batches only */
+static void ring_write_held(struct clv_input_ring *ring, u32 *room)
+{
+	struct clv_input_event_ts syn;
+	u32 n, i;
+
+	if (ring->backlog_len) {
+		n = MIN(*room, ring->backlog_len);
+		while (n && ring->backlog[n - 1].evt.type != EV_SYN)
+			n--;
+		/* a batch without SYN_REPORT must not stall the backlog */
+		if (!n && *room == ring->mask + 1)
+			n = MIN(*room, ring->backlog_len);
+		for (i = 0; i < n; i++)
+			ring_write(ring, &ring->backlog[i]);
+		ring->backlog_len -= n;
+		memmove(ring->backlog, ring->backlog + n,
+			ring->backlog_len * sizeof(*ring->backlog));
+		*room -= n;
+		if (ring->backlog_len)
+			return;
+	}
+
+	if (ring->has_pending && *room >= 2) {
+		clv_input_make_syn(&syn, &ring->pending);
+		ring_write(ring, &ring->pending);
+		ring_write(ring, &syn);
+		ring->has_pending = 0;
+		*room -= 2;
+	}
+}
+
+/* make the records written since start visible, ring the doorbell */
+static void ring_publish(struct clv_input_ring *ring, u32 start)
+{
+	struct clv_input_ring_shared *shared = ring->shared;
+	u32 head;
+	u64 v = 1;
+
+	if (ring->tail == start)
+		return;
+
+	__atomic_store_n(&shared->tail, ring->tail, __ATOMIC_RELEASE);
+	/*
+	 * Pairs with the fence in clv_input_ring_pop. Either the consumer
+	 * sees the new tail, or we see that it had drained everything before
+	 * this batch and may be going to sleep.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	head = __atomic_load_n(&shared->head, __ATOMIC_RELAXED);
+	if (head == start) {
+		if (write(ring->efd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+			clv_err("failed to write doorbell. %m");
+	}
+}
+
+/* queue the pending motion and its SYN_REPORT behind the backlog */
+static s32 ring_hold_pending(struct clv_input_ring *ring)
+{
+	struct clv_input_event_ts motion[2];
+
+	motion[0] = ring->pending;
+	clv_input_make_syn(&motion[1], &ring->pending);
+	if (backlog_append(ring, motion, 2) < 0)
+		return -1;
+
+	ring->has_pending = 0;
+
+	return 0;
+}
+
+/* returns the count of records dropped to start over from evt */
+static u32 ring_fold_motion(struct clv_input_ring *ring,
+			    struct clv_input_event_ts *evt)
+{
+	u32 dropped = 0;
+
+	if (ring->has_pending) {
+		if (!clv_input_fold_motion(&ring->pending, evt))
+			return 0;
+		/* the deltas would overflow, hold the pending motion as is */
+		if (ring_hold_pending(ring) < 0) {
+			clv_err("input ring backlog full, drop a motion");
+			dropped = 2;
+		}
+	}
+
+	ring->pending = *evt;
+	ring->has_pending = 1;
+
+	return dropped;
+}
+
+u32 clv_input_ring_push(struct clv_input_ring *ring,
+			struct clv_input_event_ts *evts, u32 count)
+{
+	struct clv_input_ring_shared *shared = ring->shared;
+	u32 room, start = ring->tail;
+	u32 overflow = 0, coalesced = 0, dropped = 0, i;
+
+	room = ring_room(ring);
+	ring_write_held(ring, &room);
+
+	if (!ring->backlog_len && !ring->has_pending && count <= room) {
+		for (i = 0; i < count; i++)
+			ring_write(ring, &evts[i]);
+	} else if (clv_input_is_motion_batch(evts, count)) {
+		/* the pending motion carries its own SYN_REPORT */
+		for (i = 0; i < count; i++) {
+			if (clv_input_is_motion(&evts[i]))
+				dropped += ring_fold_motion(ring, &evts[i]);
+			coalesced++;
+		}
+	} else {
+		/* keys and buttons are held back in order, never dropped */
+		if (ring->has_pending)
+			ring_hold_pending(ring);
+		if (ring->has_pending
+		    || backlog_append(ring, evts, count) < 0) {
+			clv_err("input ring backlog full, drop %u records",
+				count);
+			overflow += count;
+		}
+	}
+
+	if (overflow + dropped)
+		__atomic_fetch_add(&shared->overflow, overflow + dropped,
+				   __ATOMIC_RELAXED);
+	if (coalesced)
+		__atomic_fetch_add(&shared->coalesced, coalesced,
+				   __ATOMIC_RELAXED);
+
+	ring_publish(ring, start);
+
+	return count - overflow - coalesced;
+}
+
+s32 clv_input_ring_flush(struct clv_input_ring *ring)
+{
+	u32 room, start = ring->tail;
+
+	if (!ring->backlog_len && !ring->has_pending)
+		return 0;
+
+	room = ring_room(ring);
+	ring_write_held(ring, &room);
+	ring_publish(ring, start);
+
+	return ring->backlog_len || ring->has_pending;
+}
+
+s32 clv_input_ring_map(struct clv_input_ring *ring, s32 fd, s32 efd)
+{
+	struct stat st;
+	u32 size;
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = fd;
+	ring->efd = efd;
+
+	if (fstat(fd, &st) < 0) {
+		clv_err("failed to stat input ring. %m");
+		goto err;
+	}
+
+	if (st.st_size < sizeof(struct clv_input_ring_shared)) {
+		clv_err("input ring too small %ld", (long)st.st_size);
+		goto err;
+	}
+
+	ring->map_sz = st.st_size;
+	ring->shared = mmap(NULL, ring->map_sz, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	if (ring->shared == MAP_FAILED) {
+		clv_err("failed to map input ring. %m");
+		ring->shared = NULL;
+		goto err;
+	}
+
+	size = ring->shared->size;
+	if (__atomic_load_n(&ring->shared->magic, __ATOMIC_ACQUIRE)
+			!= CLV_INPUT_RING_MAGIC
+	    || ring->shared->rec_size != sizeof(struct clv_input_event_ts)
+	    || !size || (size & (size - 1))
+	    || ring_map_size(size) > ring->map_sz) {
+		clv_err("invalid input ring, size %u record size %u", size,
+			ring->shared->rec_size);
+		goto err;
+	}
+
+	ring->mask = size - 1;
+
+	return 0;
+
+err:
+	clv_input_ring_release(ring);
+	return -1;
+}
+
+u32 clv_input_ring_queued(struct clv_input_ring *ring)
+{
+	u32 used;
+
+	used = ring->tail - __atomic_load_n(&ring->shared->head,
+					    __ATOMIC_ACQUIRE);
+	if (used > ring->mask + 1)
+		used = ring->mask + 1;
+
+	return used;
+}
+
+void clv_input_ring_clear_doorbell(struct clv_input_ring *ring)
+{
+	u64 v;
+
+	if (read(ring->efd, &v, sizeof(v)) < 0 && errno != EAGAIN)
+		clv_err("failed to read doorbell. %m");
+}
+
+u32 clv_input_ring_pop(struct clv_input_ring *ring,
+		       struct clv_input_event_ts *evts, u32 max)
+{
+	struct clv_input_ring_shared *shared = ring->shared;
+	u32 head, tail, n, i;
+
+	head = shared->head;
+	tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+	n = tail - head;
+	if (n > max)
+		n = max;
+	if (!n)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		evts[i] = shared->recs[(head + i) & ring->mask];
+
+	/* the records may be reused by the producer once head moves */
+	__atomic_store_n(&shared->head, head + n, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	return n;
+}
+
+void clv_input_ring_release(struct clv_input_ring *ring)
+{
+	free(ring->backlog);
+	ring->backlog = NULL;
+	ring->backlog_len = ring->backlog_cap = 0;
+	ring->has_pending = 0;
+
+	if (ring->shared)
+		munmap(ring->shared, ring->map_sz);
+	ring->shared = NULL;
+
+	if (ring->efd >= 0)
+		close(ring->efd);
+	ring->efd = -1;
+
+	if (ring->fd >= 0)
+		close(ring->fd);
+	ring->fd = -1;
+}
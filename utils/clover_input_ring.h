@@ -0,0 +1,127 @@
+#ifndef CLOVER_INPUT_RING_H
+#define CLOVER_INPUT_RING_H
+
+#include <linux/input.h>
+#include <clover_utils.h>
+#include <clover_queue.h>
+#include <clover_protocal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared memory transport of input events.
+ *
+ * The input server creates one ring per subscriber: a sealed memfd holding a
+ * single producer / single consumer ring of clv_input_event_ts records, and
+ * an eventfd doorbell. The doorbell is only written when the ring goes from
+ * empty to non-empty, a subscriber which keeps up with the events costs the
+ * server no syscall at all.
+ *
+ * A subscriber asks for the ring with INPUT_CMD_TYPE_SUBSCRIBE_RING. The
+ * server answers on the socket with the length CLV_INPUT_RING_HANDOVER in
+ * place of an event batch, followed by the memfd and then the eventfd, each
+ * passed with clv_send_fd. No event is sent on the socket after that. The
+ * consumer refuses a ring whose record size is not its own.
+ *
+ * The producer never blocks. If the ring is full a batch of motion only is
+ * folded into one pending motion (latest position, summed deltas) and
+ * counted in coalesced. A pending motion whose deltas would overflow is
+ * held back as is, and folding starts over. Any other batch is held back in
+ * a private backlog, after the pending motion, so keys and buttons are
+ * neither lost nor reordered. Only a backlog grown to
+ * CLV_INPUT_RING_BACKLOG_MAX records drops batches, counted in overflow.
+ * What was held back is queued, in order and in whole batches, by the next
+ * push or by clv_input_ring_flush, which the producer calls until nothing
+ * is held.
+ */
+
+#define CLV_INPUT_RING_MAGIC 0x474e5249 /* "IRNG" */
+#define CLV_INPUT_RING_DEFAULT_SIZE 1024
+#define CLV_INPUT_RING_MAX_SIZE 65536
+#define CLV_INPUT_RING_HANDOVER 0xFFFFFFFF
+#define CLV_INPUT_RING_BACKLOG_MAX 4096
+
+struct clv_input_ring_shared {
+	u32 magic;
+	u32 size; /* count of records, power of two */
+	u32 rec_size; /* sizeof(struct clv_input_event_ts) */
+	u32 reserved;
+	u64 overflow; /* records dropped because the backlog was full */
+	u64 coalesced; /* motion batch records folded while the ring was full */
+
+	/* written by the consumer only */
+	u32 head __attribute__((aligned(CLV_CACHELINE_SIZE)));
+	/* written by the producer only */
+	u32 tail __attribute__((aligned(CLV_CACHELINE_SIZE)));
+
+	struct clv_input_event_ts recs[]
+		__attribute__((aligned(CLV_CACHELINE_SIZE)));
+};
+
+struct clv_input_ring {
+	struct clv_input_ring_shared *shared;
+	u32 map_sz;
+	u32 mask;
+	s32 fd; /* memfd */
+	s32 efd; /* doorbell */
+
+	/* producer private, the shared tail may be scribbled by the peer */
+	u32 tail;
+	s32 has_pending;
+	struct clv_input_event_ts pending;
+	struct clv_input_event_ts *backlog;
+	u32 backlog_len, backlog_cap;
+};
+
+/* motion is sent as one event, latest absolute position and deltas */
+static inline s32 clv_input_is_motion(struct clv_input_event_ts *evt)
+{
+	return evt->evt.type == EV_ABS && evt->evt.code == (ABS_X | ABS_Y);
+}
+
+/* a batch made of motion and SYN_REPORT only, nothing which must not be lost */
+s32 clv_input_is_motion_batch(struct clv_input_event_ts *evts, u32 count);
+/*
+ * Fold the motion evt into the motion p. Returns -1 and leaves p alone if a
+ * summed delta would not fit, p has to be sent before starting over from evt.
+ */
+s32 clv_input_fold_motion(struct clv_input_event_ts *p,
+			  struct clv_input_event_ts *evt);
+/* the SYN_REPORT closing the batch of evt */
+void clv_input_make_syn(struct clv_input_event_ts *syn,
+			struct clv_input_event_ts *evt);
+
+/* producer side */
+s32 clv_input_ring_create(struct clv_input_ring *ring, u32 size);
+/*
+ * Queue a batch of events. Returns the count of records queued or held
+ * back, which is smaller than count if motion was folded or the batch
+ * dropped.
+ */
+u32 clv_input_ring_push(struct clv_input_ring *ring,
+			struct clv_input_event_ts *evts, u32 count);
+/* queue what was held back, returns 1 if some of it still is */
+s32 clv_input_ring_flush(struct clv_input_ring *ring);
+/* count of records the consumer has not popped yet */
+u32 clv_input_ring_queued(struct clv_input_ring *ring);
+
+/* consumer side, takes the ownership of both fds */
+s32 clv_input_ring_map(struct clv_input_ring *ring, s32 fd, s32 efd);
+/*
+ * Call once the doorbell is readable, then pop until the ring is empty.
+ * The doorbell is not written again before the ring has been seen empty.
+ */
+void clv_input_ring_clear_doorbell(struct clv_input_ring *ring);
+/* returns the count of events copied to evts, 0 if the ring is empty */
+u32 clv_input_ring_pop(struct clv_input_ring *ring,
+		       struct clv_input_event_ts *evts, u32 max);
+
+void clv_input_ring_release(struct clv_input_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_pixel.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define PIXEL_NEON
+#include <arm_neon.h>
+#endif
+
+#define ALPHA_MASK 0xFF000000
+
+/* row kernels, n is a count of pixels */
+struct pixel_impl {
+	const char *name;
+	s32 (*supported)(void);
+	void (*fill)(u32 *dst, u32 n, u32 value);
+	void (*set_alpha)(u32 *dst, const u32 *src, u32 n);
+	/* or_alpha is ALPHA_MASK to flatten, 0 to keep the alpha */
+	void (*premultiply)(u32 *dst, const u32 *src, u32 n, u32 or_alpha);
+	void (*over)(u32 *dst, const u32 *src, u32 n, u32 alpha);
+	/*
+	 * One bilinear row from the src rows r0 / r1, fy weights r1. The
+	 * first dst pixel samples the 16.16 src column fx, then every
+	 * pixel moves by step.
+	 */
+	void (*lerp)(u32 *dst, const u32 *r0, const u32 *r1, u32 n,
+		     s64 fx, s32 step, u32 sw, u32 fy);
+};
+
+/*
+ * c * a / 255 rounded, the same integer steps in every implementation so
+ * that they agree to the bit. t + (t >> 8) never exceeds 16 bits.
+ */
+static inline u32 mul_div255(u32 c, u32 a)
+{
+	u32 t = c * a + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+/* a * (256 - w) + b * w never exceeds 16 bits either */
+static inline u32 lerp8(u32 a, u32 b, u32 w)
+{
+	return (a * (256 - w) + b * w + 128) >> 8;
+}
+
+static inline u32 lerp_pixel(u32 a, u32 b, u32 w)
+{
+	return (lerp8(a >> 24, b >> 24, w) << 24)
+		| (lerp8((a >> 16) & 0xFF, (b >> 16) & 0xFF, w) << 16)
+		| (lerp8((a >> 8) & 0xFF, (b >> 8) & 0xFF, w) << 8)
+		| lerp8(a & 0xFF, b & 0xFF, w);
+}
+
+/* src column at 16.16 position f, its right neighbour and 8 bit weight */
+static inline u32 lerp_col(s64 f, u32 size, u32 *next, u32 *w)
+{
+	u32 x;
+
+	if (f < 0)
+		f = 0;
+	x = f >> 16;
+	if (x >= size - 1) {
+		*next = size - 1;
+		*w = 0;
+		return size - 1;
+	}
+	*next = x + 1;
+	*w = (f >> 8) & 0xFF;
+
+	return x;
+}
+
+static s32 scalar_supported(void)
+{
+	return 1;
+}
+
+static void scalar_fill(u32 *dst, u32 n, u32 value)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = value;
+}
+
+static void scalar_set_alpha(u32 *dst, const u32 *src, u32 n)
+{
+	u32 i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[i] | ALPHA_MASK;
+}
+
+static void scalar_premultiply(u32 *dst, const u32 *src, u32 n,
+			       u32 or_alpha)
+{
+	u32 i, p, a;
+
+	for (i = 0; i < n; i++) {
+		p = src[i];
+		a = p >> 24;
+		dst[i] = (p & ALPHA_MASK) | or_alpha
+			| (mul_div255((p >> 16) & 0xFF, a) << 16)
+			| (mul_div255((p >> 8) & 0xFF, a) << 8)
+			| mul_div255(p & 0xFF, a);
+	}
+}
+
+static void scalar_over(u32 *dst, const u32 *src, u32 n, u32 alpha)
+{
+	u32 i, j, s, d, ia, c;
+
+	for (i = 0; i < n; i++) {
+		s = src[i];
+		if (alpha != 255) {
+			s = (mul_div255(s >> 24, alpha) << 24)
+				| (mul_div255((s >> 16) & 0xFF, alpha) << 16)
+				| (mul_div255((s >> 8) & 0xFF, alpha) << 8)
+				| mul_div255(s & 0xFF, alpha);
+		}
+		ia = 255 - (s >> 24);
+		d = 0;
+		for (j = 0; j < 32; j += 8) {
+			c = ((s >> j) & 0xFF)
+				+ mul_div255((dst[i] >> j) & 0xFF, ia);
+			d |= MIN(c, 255) << j;
+		}
+		dst[i] = d;
+	}
+}
+
+static void scalar_lerp(u32 *dst, const u32 *r0, const u32 *r1, u32 n,
+			s64 fx, s32 step, u32 sw, u32 fy)
+{
+	u32 i, x, x1, wx;
+
+	for (i = 0; i < n; i++, fx += step) {
+		x = lerp_col(fx, sw, &x1, &wx);
+		dst[i] = lerp_pixel(lerp_pixel(r0[x], r0[x1], wx),
+				    lerp_pixel(r1[x], r1[x1], wx), fy);
+	}
+}
+
+static const struct pixel_impl scalar_impl = {
+	.name = "scalar",
+	.supported = scalar_supported,
+	.fill = scalar_fill,
+	.set_alpha = scalar_set_alpha,
+	.premultiply = scalar_premultiply,
+	.over = scalar_over,
+	.lerp = scalar_lerp,
+};
+
+#ifdef PIXEL_X86
+static s32 sse2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void sse2_fill(u32 *dst, u32 n, u32 value)
+{
+	__m128i v = _mm_set1_epi32(value);
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	scalar_fill(dst + i, n - i, value);
+}
+
+__attribute__((target("sse2")))
+static void sse2_set_alpha(u32 *dst, const u32 *src, u32 n)
+{
+	__m128i m = _mm_set1_epi32(ALPHA_MASK);
+	__m128i p;
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		p = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(p, m));
+	}
+	scalar_set_alpha(dst + i, src + i, n - i);
+}
+
+/* mul_div255 of 16 bit lanes */
+__attribute__((target("sse2")))
+static inline __m128i sse2_mul_div255(__m128i c, __m128i a)
+{
+	__m128i t;
+
+	t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+/* the alpha lane of each of two 16 bit lane pixels, in all its lanes */
+__attribute__((target("sse2")))
+static inline __m128i sse2_alpha16(__m128i p)
+{
+	p = _mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm_shufflehi_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+/* two pixels widened to 16 bit lanes: b g r a b g r a */
+__attribute__((target("sse2")))
+static inline __m128i sse2_premul_half(__m128i p)
+{
+	return sse2_mul_div255(p, sse2_alpha16(p));
+}
+
+__attribute__((target("sse2")))
+static void sse2_premultiply(u32 *dst, const u32 *src, u32 n,
+			     u32 or_alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i am = _mm_set1_epi32(ALPHA_MASK);
+	__m128i om = _mm_set1_epi32(or_alpha);
+	__m128i p, lo, hi, c;
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		p = _mm_loadu_si128((const __m128i *)(src + i));
+		lo = sse2_premul_half(_mm_unpacklo_epi8(p, zero));
+		hi = sse2_premul_half(_mm_unpackhi_epi8(p, zero));
+		c = _mm_andnot_si128(am, _mm_packus_epi16(lo, hi));
+		c = _mm_or_si128(c, _mm_and_si128(p, am));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(c, om));
+	}
+	scalar_premultiply(dst + i, src + i, n - i, or_alpha);
+}
+
+__attribute__((target("sse2")))
+static void sse2_over(u32 *dst, const u32 *src, u32 n, u32 alpha)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi32(-1);
+	__m128i ga = _mm_set1_epi16(alpha);
+	__m128i s, d, lo, hi, ia;
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = _mm_loadu_si128((const __m128i *)(src + i));
+		d = _mm_loadu_si128((const __m128i *)(dst + i));
+		if (alpha != 255) {
+			lo = sse2_mul_div255(_mm_unpacklo_epi8(s, zero), ga);
+			hi = sse2_mul_div255(_mm_unpackhi_epi8(s, zero), ga);
+			s = _mm_packus_epi16(lo, hi);
+		}
+		/* 255 - every byte, the alpha one is the dst weight */
+		ia = _mm_xor_si128(s, ones);
+		lo = sse2_mul_div255(_mm_unpacklo_epi8(d, zero),
+			sse2_alpha16(_mm_unpacklo_epi8(ia, zero)));
+		hi = sse2_mul_div255(_mm_unpackhi_epi8(d, zero),
+			sse2_alpha16(_mm_unpackhi_epi8(ia, zero)));
+		d = _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+	scalar_over(dst + i, src + i, n - i, alpha);
+}
+
+/* the lanes of two 16 bit lane pixels a, b weighted by w, a in the low half */
+__attribute__((target("sse2")))
+static inline __m128i sse2_lerp2(__m128i ab, __m128i w)
+{
+	__m128i m = _mm_mullo_epi16(ab, w);
+
+	m = _mm_add_epi16(m, _mm_srli_si128(m, 8));
+	return _mm_srli_epi16(_mm_add_epi16(m, _mm_set1_epi16(128)), 8);
+}
+
+__attribute__((target("sse2")))
+static void sse2_lerp(u32 *dst, const u32 *r0, const u32 *r1, u32 n,
+		      s64 fx, s32 step, u32 sw, u32 fy)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i wy = _mm_set_epi16(fy, fy, fy, fy,
+				   256 - fy, 256 - fy, 256 - fy, 256 - fy);
+	__m128i wx, t, b;
+	u32 i, x, x1, w;
+
+	for (i = 0; i < n; i++, fx += step) {
+		x = lerp_col(fx, sw, &x1, &w);
+		wx = _mm_set_epi16(w, w, w, w, 256 - w, 256 - w, 256 - w,
+				   256 - w);
+		t = _mm_unpacklo_epi32(_mm_cvtsi32_si128(r0[x]),
+				       _mm_cvtsi32_si128(r0[x1]));
+		b = _mm_unpacklo_epi32(_mm_cvtsi32_si128(r1[x]),
+				       _mm_cvtsi32_si128(r1[x1]));
+		t = sse2_lerp2(_mm_unpacklo_epi8(t, zero), wx);
+		b = sse2_lerp2(_mm_unpacklo_epi8(b, zero), wx);
+		t = sse2_lerp2(_mm_unpacklo_epi64(t, b), wy);
+		dst[i] = _mm_cvtsi128_si32(_mm_packus_epi16(t, t));
+	}
+}
+
+static const struct pixel_impl sse2_impl = {
+	.name = "sse2",
+	.supported = sse2_supported,
+	.fill = sse2_fill,
+	.set_alpha = sse2_set_alpha,
+	.premultiply = sse2_premultiply,
+	.over = sse2_over,
+	.lerp = sse2_lerp,
+};
+
+static s32 avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void avx2_fill(u32 *dst, u32 n, u32 value)
+{
+	__m256i v = _mm256_set1_epi32(value);
+	u32 i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	scalar_fill(dst + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+static void avx2_set_alpha(u32 *dst, const u32 *src, u32 n)
+{
+	__m256i m = _mm256_set1_epi32(ALPHA_MASK);
+	__m256i p;
+	u32 i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		p = _mm256_loadu_si256((const __m256i *)(src + i));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_or_si256(p, m));
+	}
+	scalar_set_alpha(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_mul_div255(__m256i c, __m256i a)
+{
+	__m256i t;
+
+	t = _mm256_add_epi16(_mm256_mullo_epi16(c, a),
+			     _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)),
+				 8);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_alpha16(__m256i p)
+{
+	p = _mm256_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+	return _mm256_shufflehi_epi16(p, _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_premul_half(__m256i p)
+{
+	return avx2_mul_div255(p, avx2_alpha16(p));
+}
+
+/* unpack and pack both work within 128 bit lanes, the order is kept */
+__attribute__((target("avx2")))
+static void avx2_premultiply(u32 *dst, const u32 *src, u32 n,
+			     u32 or_alpha)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i am = _mm256_set1_epi32(ALPHA_MASK);
+	__m256i om = _mm256_set1_epi32(or_alpha);
+	__m256i p, lo, hi, c;
+	u32 i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		p = _mm256_loadu_si256((const __m256i *)(src + i));
+		lo = avx2_premul_half(_mm256_unpacklo_epi8(p, zero));
+		hi = avx2_premul_half(_mm256_unpackhi_epi8(p, zero));
+		c = _mm256_andnot_si256(am, _mm256_packus_epi16(lo, hi));
+		c = _mm256_or_si256(c, _mm256_and_si256(p, am));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_or_si256(c, om));
+	}
+	scalar_premultiply(dst + i, src + i, n - i, or_alpha);
+}
+
+__attribute__((target("avx2")))
+static void avx2_over(u32 *dst, const u32 *src, u32 n, u32 alpha)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i ones = _mm256_set1_epi32(-1);
+	__m256i ga = _mm256_set1_epi16(alpha);
+	__m256i s, d, lo, hi, ia;
+	u32 i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(src + i));
+		d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		if (alpha != 255) {
+			lo = avx2_mul_div255(_mm256_unpacklo_epi8(s, zero),
+					     ga);
+			hi = avx2_mul_div255(_mm256_unpackhi_epi8(s, zero),
+					     ga);
+			s = _mm256_packus_epi16(lo, hi);
+		}
+		ia = _mm256_xor_si256(s, ones);
+		lo = avx2_mul_div255(_mm256_unpacklo_epi8(d, zero),
+			avx2_alpha16(_mm256_unpacklo_epi8(ia, zero)));
+		hi = avx2_mul_div255(_mm256_unpackhi_epi8(d, zero),
+			avx2_alpha16(_mm256_unpackhi_epi8(ia, zero)));
+		d = _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+	sse2_over(dst + i, src + i, n - i, alpha);
+}
+
+/* the gathers of a bilinear row do not get wider, the SSE2 one is used */
+static const struct pixel_impl avx2_impl = {
+	.name = "avx2",
+	.supported = avx2_supported,
+	.fill = avx2_fill,
+	.set_alpha = avx2_set_alpha,
+	.premultiply = avx2_premultiply,
+	.over = avx2_over,
+	.lerp = sse2_lerp,
+};
+#endif
+
+#ifdef PIXEL_NEON
+/* only built when NEON is part of the target, AArch64 always has it */
+static s32 neon_supported(void)
+{
+	return 1;
+}
+
+static void neon_fill(u32 *dst, u32 n, u32 value)
+{
+	uint32x4_t v = vdupq_n_u32(value);
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, v);
+	scalar_fill(dst + i, n - i, value);
+}
+
+static void neon_set_alpha(u32 *dst, const u32 *src, u32 n)
+{
+	uint32x4_t m = vdupq_n_u32(ALPHA_MASK);
+	u32 i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_u32(dst + i, vorrq_u32(vld1q_u32(src + i), m));
+	scalar_set_alpha(dst + i, src + i, n - i);
+}
+
+/* vraddhn(t, vrshr(t, 8)) is (t + 128 + ((t + 128) >> 8)) >> 8 */
+static inline uint8x8_t neon_mul_div255(uint8x8_t c, uint8x8_t a)
+{
+	uint16x8_t t = vmull_u8(c, a);
+
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void neon_premultiply(u32 *dst, const u32 *src, u32 n,
+			     u32 or_alpha)
+{
+	uint8x8_t oa = vdup_n_u8(or_alpha >> 24);
+	uint8x8x4_t p;
+	u32 i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		/* b, g, r, a planes of 8 pixels */
+		p = vld4_u8((const u8 *)(src + i));
+		p.val[0] = neon_mul_div255(p.val[0], p.val[3]);
+		p.val[1] = neon_mul_div255(p.val[1], p.val[3]);
+		p.val[2] = neon_mul_div255(p.val[2], p.val[3]);
+		p.val[3] = vorr_u8(p.val[3], oa);
+		vst4_u8((u8 *)(dst + i), p);
+	}
+	scalar_premultiply(dst + i, src + i, n - i, or_alpha);
+}
+
+static void neon_over(u32 *dst, const u32 *src, u32 n, u32 alpha)
+{
+	uint8x8_t ga = vdup_n_u8(alpha);
+	uint8x8x4_t s, d;
+	uint8x8_t ia;
+	u32 i, j;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = vld4_u8((const u8 *)(src + i));
+		d = vld4_u8((const u8 *)(dst + i));
+		if (alpha != 255) {
+			for (j = 0; j < 4; j++)
+				s.val[j] = neon_mul_div255(s.val[j], ga);
+		}
+		ia = vmvn_u8(s.val[3]);
+		for (j = 0; j < 4; j++)
+			d.val[j] = vqadd_u8(s.val[j],
+					    neon_mul_div255(d.val[j], ia));
+		vst4_u8((u8 *)(dst + i), d);
+	}
+	scalar_over(dst + i, src + i, n - i, alpha);
+}
+
+static inline uint16x4_t neon_pixel16(u32 p)
+{
+	return vget_low_u16(vmovl_u8(vcreate_u8(p)));
+}
+
+/* vrshr(m, 8) is (m + 128) >> 8 */
+static inline uint16x4_t neon_lerp2(uint16x4_t a, uint16x4_t b, u32 w)
+{
+	return vrshr_n_u16(vmla_n_u16(vmul_n_u16(a, 256 - w), b, w), 8);
+}
+
+static void neon_lerp(u32 *dst, const u32 *r0, const u32 *r1, u32 n,
+		      s64 fx, s32 step, u32 sw, u32 fy)
+{
+	uint16x4_t t, b;
+	uint8x8_t p;
+	u32 i, x, x1, w;
+
+	for (i = 0; i < n; i++, fx += step) {
+		x = lerp_col(fx, sw, &x1, &w);
+		t = neon_lerp2(neon_pixel16(r0[x]), neon_pixel16(r0[x1]), w);
+		b = neon_lerp2(neon_pixel16(r1[x]), neon_pixel16(r1[x1]), w);
+		p = vmovn_u16(vcombine_u16(neon_lerp2(t, b, fy), t));
+		vst1_lane_u32(dst + i, vreinterpret_u32_u8(p), 0);
+	}
+}
+
+static const struct pixel_impl neon_impl = {
+	.name = "neon",
+	.supported = neon_supported,
+	.fill = neon_fill,
+	.set_alpha = neon_set_alpha,
+	.premultiply = neon_premultiply,
+	.over = neon_over,
+	.lerp = neon_lerp,
+};
+#endif
+
+/* best first */
+static const struct pixel_impl *impls[] = {
+#ifdef PIXEL_X86
+	&avx2_impl,
+	&sse2_impl,
+#endif
+#ifdef PIXEL_NEON
+	&neon_impl,
+#endif
+	&scalar_impl,
+};
+
+static const struct pixel_impl *cur_impl;
+
+static const struct pixel_impl *pixel_impl_find(const char *name)
+{
+	u32 i;
+
+	for (i = 0; i < ARRAY_SIZE(impls); i++) {
+		if (name && strcmp(name, impls[i]->name))
+			continue;
+		if (impls[i]->supported())
+			return impls[i];
+	}
+
+	return NULL;
+}
+
+/* racing first callers all store the same pointer */
+static const struct pixel_impl *pixel_impl_get(void)
+{
+	const struct pixel_impl *impl;
+	const char *name;
+
+	impl = __atomic_load_n(&cur_impl, __ATOMIC_ACQUIRE);
+	if (impl)
+		return impl;
+
+	name = getenv("CLOVER_PIXEL_IMPL");
+	if (name) {
+		impl = pixel_impl_find(name);
+		if (!impl)
+			clv_warn("pixel implementation %s not available",
+				 name);
+	}
+	if (!impl)
+		impl = pixel_impl_find(NULL);
+
+	__atomic_store_n(&cur_impl, impl, __ATOMIC_RELEASE);
+	return impl;
+}
+
+const char *clv_pixel_impl(void)
+{
+	return pixel_impl_get()->name;
+}
+
+s32 clv_pixel_select(const char *name)
+{
+	const struct pixel_impl *impl = pixel_impl_find(name);
+
+	if (!impl)
+		return -1;
+
+	__atomic_store_n(&cur_impl, impl, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void clv_pixel_fill32(void *dst, u32 stride, u32 w, u32 h, u32 value)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	u8 *p = dst;
+	u32 i;
+
+	if (stride == w * 4) {
+		impl->fill((u32 *)p, w * h, value);
+		return;
+	}
+
+	for (i = 0; i < h; i++, p += stride)
+		impl->fill((u32 *)p, w, value);
+}
+
+/* the C library already picks a vector memcpy, only the rows are ours */
+void clv_pixel_copy_rect(void *dst, u32 dst_stride,
+			 const void *src, u32 src_stride, u32 bytes, u32 h)
+{
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 i;
+
+	if (dst_stride == bytes && src_stride == bytes) {
+		memcpy(d, s, (size_t)bytes * h);
+		return;
+	}
+
+	for (i = 0; i < h; i++, d += dst_stride, s += src_stride)
+		memcpy(d, s, bytes);
+}
+
+void clv_pixel_premultiply(void *dst, u32 dst_stride,
+			   const void *src, u32 src_stride, u32 w, u32 h)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 i;
+
+	for (i = 0; i < h; i++, d += dst_stride, s += src_stride)
+		impl->premultiply((u32 *)d, (const u32 *)s, w, 0);
+}
+
+void clv_pixel_xrgb_to_argb(void *dst, u32 dst_stride,
+			    const void *src, u32 src_stride, u32 w, u32 h)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 i;
+
+	for (i = 0; i < h; i++, d += dst_stride, s += src_stride)
+		impl->set_alpha((u32 *)d, (const u32 *)s, w);
+}
+
+void clv_pixel_argb_to_xrgb(void *dst, u32 dst_stride,
+			    const void *src, u32 src_stride, u32 w, u32 h)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 i;
+
+	for (i = 0; i < h; i++, d += dst_stride, s += src_stride)
+		impl->premultiply((u32 *)d, (const u32 *)s, w, ALPHA_MASK);
+}
+
+void clv_pixel_over(void *dst, u32 dst_stride,
+		    const void *src, u32 src_stride, u32 w, u32 h, u8 alpha)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	const u8 *s = src;
+	u8 *d = dst;
+	u32 i;
+
+	for (i = 0; i < h; i++, d += dst_stride, s += src_stride)
+		impl->over((u32 *)d, (const u32 *)s, w, alpha);
+}
+
+void clv_pixel_scale_bilinear(void *dst, u32 dst_stride, u32 dw, u32 dh,
+			      const void *src, u32 src_stride, u32 sw, u32 sh,
+			      struct clv_box *box)
+{
+	const struct pixel_impl *impl = pixel_impl_get();
+	const u8 *s = src;
+	s32 x1, y1, x2, y2, y;
+	s32 step_x, step_y;
+	u32 r0, r1, wy;
+	s64 fy;
+	u8 *d;
+
+	if (!dw || !dh || !sw || !sh)
+		return;
+
+	x1 = MAX(box->p1.x, 0);
+	y1 = MAX(box->p1.y, 0);
+	x2 = MIN(box->p2.x, (s32)dw);
+	y2 = MIN(box->p2.y, (s32)dh);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	/* dst pixel centre x + 0.5 lands on src (x + 0.5) * step - 0.5 */
+	step_x = ((u64)sw << 16) / dw;
+	step_y = ((u64)sh << 16) / dh;
+
+	d = (u8 *)dst + y1 * dst_stride + x1 * 4;
+	for (y = y1; y < y2; y++, d += dst_stride) {
+		fy = (s64)y * step_y + step_y / 2 - 32768;
+		r0 = lerp_col(fy, sh, &r1, &wy);
+		impl->lerp((u32 *)d, (const u32 *)(s + r0 * src_stride),
+			   (const u32 *)(s + r1 * src_stride), x2 - x1,
+			   (s64)x1 * step_x + step_x / 2 - 32768, step_x,
+			   sw, wy);
+	}
+}
+
+void clv_pixel_copy_i420(u8 *const dst[3], const u32 dst_stride[3],
+			 u8 *const src[3], const u32 src_stride[3],
+			 u32 w, u32 h)
+{
+	u32 cw = (w + 1) / 2, ch = (h + 1) / 2;
+
+	clv_pixel_copy_rect(dst[0], dst_stride[0], src[0], src_stride[0],
+			    w, h);
+	clv_pixel_copy_rect(dst[1], dst_stride[1], src[1], src_stride[1],
+			    cw, ch);
+	clv_pixel_copy_rect(dst[2], dst_stride[2], src[2], src_stride[2],
+			    cw, ch);
+}
+
+void clv_pixel_copy_nv12(u8 *const dst[2], const u32 dst_stride[2],
+			 u8 *const src[2], const u32 src_stride[2],
+			 u32 w, u32 h)
+{
+	clv_pixel_copy_rect(dst[0], dst_stride[0], src[0], src_stride[0],
+			    w, h);
+	clv_pixel_copy_rect(dst[1], dst_stride[1], src[1], src_stride[1],
+			    (w + 1) / 2 * 2, (h + 1) / 2);
+}
@@ -0,0 +1,75 @@
+#ifndef CLOVER_PIXEL_H
+#define CLOVER_PIXEL_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * CPU pixel kernels.
+ *
+ * 32 bit pixels are little endian ARGB8888 / XRGB8888 words. Strides are in
+ * bytes, widths in pixels unless noted. The implementation is picked once on
+ * the first call from what the CPU supports (AVX2, SSE2, NEON or scalar),
+ * CLOVER_PIXEL_IMPL=<name> forces one. All of them give the same result.
+ */
+
+/* fill a w x h rect of 32 bit pixels with value */
+void clv_pixel_fill32(void *dst, u32 stride, u32 w, u32 h, u32 value);
+
+/* copy h rows of bytes bytes each */
+void clv_pixel_copy_rect(void *dst, u32 dst_stride,
+			 const void *src, u32 src_stride, u32 bytes, u32 h);
+
+/* straight alpha ARGB to premultiplied ARGB, dst may be src */
+void clv_pixel_premultiply(void *dst, u32 dst_stride,
+			   const void *src, u32 src_stride, u32 w, u32 h);
+
+/* the undefined X byte becomes an opaque alpha, dst may be src */
+void clv_pixel_xrgb_to_argb(void *dst, u32 dst_stride,
+			    const void *src, u32 src_stride, u32 w, u32 h);
+
+/* straight alpha ARGB flattened on black, dst may be src */
+void clv_pixel_argb_to_xrgb(void *dst, u32 dst_stride,
+			    const void *src, u32 src_stride, u32 w, u32 h);
+
+/*
+ * Premultiplied ARGB src over dst, src scaled by alpha (0 - 255) first.
+ * An opaque src with alpha 255 is better copied.
+ */
+void clv_pixel_over(void *dst, u32 dst_stride,
+		    const void *src, u32 src_stride, u32 w, u32 h, u8 alpha);
+
+/*
+ * Bilinear scale of a sw x sh src to a dw x dh dst, only the pixels of
+ * the dst inside box are written. Pixel centres are mapped onto each
+ * other and the src edges are clamped, so that painting a dst in several
+ * boxes gives the same result as painting it at once.
+ */
+void clv_pixel_scale_bilinear(void *dst, u32 dst_stride, u32 dw, u32 dh,
+			      const void *src, u32 src_stride, u32 sw, u32 sh,
+			      struct clv_box *box);
+
+/*
+ * Planar YUV 4:2:0 copies, w x h is the size of the luma plane. The chroma
+ * planes are rounded up, I420 has three planes (Y, U, V), NV12 two (Y, UV).
+ */
+void clv_pixel_copy_i420(u8 *const dst[3], const u32 dst_stride[3],
+			 u8 *const src[3], const u32 src_stride[3],
+			 u32 w, u32 h);
+void clv_pixel_copy_nv12(u8 *const dst[2], const u32 dst_stride[2],
+			 u8 *const src[2], const u32 src_stride[2],
+			 u32 w, u32 h);
+
+/* name of the implementation in use */
+const char *clv_pixel_impl(void);
+/* "scalar", "sse2", "avx2" or "neon", returns -1 if the CPU lacks it */
+s32 clv_pixel_select(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
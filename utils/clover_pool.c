@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_pool.h>
+
+struct clv_pool_chunk {
+	struct clv_pool_chunk *next;
+	u8 data[0] __attribute__((aligned(sizeof(void *) * 2)));
+};
+
+void clv_pool_init(struct clv_pool *pool, u32 obj_size, u32 count_per_chunk)
+{
+	u32 align = sizeof(void *) * 2;
+
+	memset(pool, 0, sizeof(*pool));
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+	pool->obj_size = (obj_size + align - 1) & ~(align - 1);
+	pool->count_per_chunk = count_per_chunk ? count_per_chunk : 1;
+}
+
+void clv_pool_release(struct clv_pool *pool)
+{
+	struct clv_pool_chunk *chunk, *next;
+
+	if (pool->count_objs)
+		clv_warn("release pool with %u objects in use",
+			 pool->count_objs);
+
+	for (chunk = pool->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	pool->chunks = NULL;
+	pool->free_list = NULL;
+	pool->count_objs = 0;
+}
+
+static s32 clv_pool_grow(struct clv_pool *pool)
+{
+	struct clv_pool_chunk *chunk;
+	u8 *obj;
+	u32 i;
+
+	chunk = malloc(sizeof(*chunk) + pool->obj_size * pool->count_per_chunk);
+	if (!chunk)
+		return -1;
+
+	chunk->next = pool->chunks;
+	pool->chunks = chunk;
+
+	for (i = 0; i < pool->count_per_chunk; i++) {
+		obj = chunk->data + i * pool->obj_size;
+		*((void **)obj) = pool->free_list;
+		pool->free_list = obj;
+	}
+
+	return 0;
+}
+
+void *clv_pool_alloc(struct clv_pool *pool)
+{
+	void *obj;
+
+	if (!pool->free_list) {
+		if (clv_pool_grow(pool) < 0) {
+			clv_err("not enough memory to grow pool.");
+			return NULL;
+		}
+	}
+
+	obj = pool->free_list;
+	pool->free_list = *((void **)obj);
+	memset(obj, 0, pool->obj_size);
+	pool->count_objs++;
+
+	return obj;
+}
+
+void clv_pool_free(struct clv_pool *pool, void *obj)
+{
+	if (!obj)
+		return;
+
+	*((void **)obj) = pool->free_list;
+	pool->free_list = obj;
+	pool->count_objs--;
+}
@@ -0,0 +1,38 @@
+#ifndef CLOVER_POOL_H
+#define CLOVER_POOL_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed size object pool.
+ *
+ * Objects are carved from chunks of count_per_chunk objects. A released
+ * object is pushed onto the free list and is handed out again by the next
+ * allocation, so a steady state alloc / free pattern never reaches malloc.
+ * Chunks are only returned to the system by clv_pool_release.
+ */
+struct clv_pool_chunk;
+
+struct clv_pool {
+	u32 obj_size;
+	u32 count_per_chunk;
+	void *free_list;
+	struct clv_pool_chunk *chunks;
+	u32 count_objs; /* objects in use */
+};
+
+void clv_pool_init(struct clv_pool *pool, u32 obj_size, u32 count_per_chunk);
+void clv_pool_release(struct clv_pool *pool);
+/* returns a zeroed object */
+void *clv_pool_alloc(struct clv_pool *pool);
+void clv_pool_free(struct clv_pool *pool, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -18,1062 +18,491 @@
  */
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
-#include <assert.h>
 #include <clover_utils.h>
 #include <clover_log.h>
 #include <clover_protocal.h>
 
-u8 *clv_server_create_linkup_cmd(u64 link_id, u32 *n)
+/*
+ * All the commands but INPUT_EVT share one fixed layout, see
+ * struct clv_cmd_head. A command is described by the tag and the size of
+ * its payload, the codec below is driven by this table only.
+ */
+struct clv_cmd_layout {
+	enum clv_tag tag;
+	u32 size; /* payload size, 0: no fixed layout */
+	s32 (*check)(const void *payload);
+	const char *name;
+};
+
+static s32 transaction_check(const void *payload)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, size_result, size_map, *map, *head;
-	u8 *p;
+	const struct clv_transaction_info *t = payload;
 
-	size_map = CLV_CMD_MAP_SIZE;
-	size_result = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_result + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
+	if (t->count_entries > CLV_TRANSACTION_MAX_ENTRIES)
+		return -1;
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_LINK_ID_ACK_SHIFT);
+	return 0;
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_result + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_result = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_LINK_ID_ACK_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_result - p;
-	tlv_result->tag = CLV_TAG_RESULT;
-	tlv_result->length = sizeof(u64);
-	*((u64 *)(&tlv_result->payload[0])) = link_id;
-	*n = size;
+#define CMD_RESULT(shift, str) \
+	[shift] = { CLV_TAG_RESULT, sizeof(u64), NULL, str }
+
+static const struct clv_cmd_layout cmd_layouts[CLV_CMD_LAST_SHIFT] = {
+	CMD_RESULT(CLV_CMD_LINK_ID_ACK_SHIFT, "LINKID_CMD"),
+	[CLV_CMD_CREATE_SURFACE_SHIFT] = {
+		CLV_TAG_CREATE_SURFACE, sizeof(struct clv_surface_info),
+		NULL, "CREATE_SURFACE_CMD",
+	},
+	CMD_RESULT(CLV_CMD_CREATE_SURFACE_ACK_SHIFT, "CREATE_SURFACE_ACK_CMD"),
+	[CLV_CMD_CREATE_VIEW_SHIFT] = {
+		CLV_TAG_CREATE_VIEW, sizeof(struct clv_view_info),
+		NULL, "CREATE_VIEW_CMD",
+	},
+	CMD_RESULT(CLV_CMD_CREATE_VIEW_ACK_SHIFT, "CREATE_VIEW_ACK_CMD"),
+	[CLV_CMD_CREATE_BO_SHIFT] = {
+		CLV_TAG_CREATE_BO, sizeof(struct clv_bo_info),
+		NULL, "CREATE_BO_CMD",
+	},
+	CMD_RESULT(CLV_CMD_CREATE_BO_ACK_SHIFT, "CREATE_BO_ACK_CMD"),
+	CMD_RESULT(CLV_CMD_DESTROY_BO_SHIFT, "DESTROY_BO_CMD"),
+	CMD_RESULT(CLV_CMD_DESTROY_BO_ACK_SHIFT, "DESTROY_BO_ACK_CMD"),
+	[CLV_CMD_COMMIT_SHIFT] = {
+		CLV_TAG_COMMIT_INFO, sizeof(struct clv_commit_info),
+		NULL, "COMMIT_CMD",
+	},
+	CMD_RESULT(CLV_CMD_COMMIT_ACK_SHIFT, "COMMIT_ACK_CMD"),
+	CMD_RESULT(CLV_CMD_BO_COMPLETE_SHIFT, "BO_COMPLETE_CMD"),
+	[CLV_CMD_INPUT_EVT_SHIFT] = {
+		CLV_TAG_INPUT, 0, NULL, "INPUT_EVT_CMD",
+	},
+	[CLV_CMD_DESTROY_SHIFT] = {
+		CLV_TAG_DESTROY, sizeof(u64), NULL, "DESTROY_CMD",
+	},
+	CMD_RESULT(CLV_CMD_DESTROY_ACK_SHIFT, "DESTROY_ACK_CMD"),
+	[CLV_CMD_SHELL_SHIFT] = {
+		CLV_TAG_SHELL, sizeof(struct clv_shell_info),
+		NULL, "SHELL_CMD",
+	},
+	CMD_RESULT(CLV_CMD_HPD_SHIFT, "HPD_CMD"),
+	[CLV_CMD_TRANSACTION_SHIFT] = {
+		CLV_TAG_TRANSACTION, sizeof(struct clv_transaction_info),
+		transaction_check, "TRANSACTION_CMD",
+	},
+	CMD_RESULT(CLV_CMD_FRAME_SHIFT, "FRAME_CMD"),
+	CMD_RESULT(CLV_CMD_FRAME_DONE_SHIFT, "FRAME_DONE_CMD"),
+};
+
+static inline const struct clv_cmd_layout *cmd_layout(
+					enum clv_cmd_shift shift)
+{
+	if ((u32)shift >= CLV_CMD_LAST_SHIFT || !cmd_layouts[shift].size)
+		return NULL;
 
-	return p;
+	return &cmd_layouts[shift];
 }
 
-u8 *clv_dup_linkup_cmd(u8 *dst, u8 *src, u32 n, u64 link_id)
+u32 clv_cmd_size(enum clv_cmd_shift shift)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_link_id;
-	u32 *map;
+	const struct clv_cmd_layout *l = cmd_layout(shift);
 
-	memcpy(dst, src, n);
+	if (!l)
+		return 0;
 
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_link_id = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_LINK_ID_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_link_id->payload[0])) = link_id;
-	return dst;
+	return CLV_CMD_SIZE(l->size);
 }
 
-u64 clv_client_parse_link_id(u8 *data)
+u32 clv_cmd_encode(u8 *dst, u32 size, enum clv_cmd_shift shift,
+		   const void *payload)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
+	const struct clv_cmd_layout *l = cmd_layout(shift);
+	struct clv_cmd_head *h = (struct clv_cmd_head *)dst;
+	u32 n;
 
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_LINK_ID_ACK_SHIFT))) {
-		clv_err("not link id cmd");
+	if (!l)
 		return 0;
-	}
 
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_LINK_ID_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_LINK_ID_ACK_SHIFT - CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
+	n = CLV_CMD_SIZE(l->size);
+	if (size < n)
 		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+
+	memset(h, 0, sizeof(*h));
+	h->flag = 1 << shift;
+	h->win.tag = CLV_TAG_WIN;
+	h->win.length = n - sizeof(u32) - sizeof(struct clv_tlv);
+	h->map.tag = CLV_TAG_MAP;
+	h->map.length = sizeof(h->map_offs);
+	h->map_offs[shift - CLV_CMD_OFFSET] = CLV_CMD_PAYLOAD_OFFS;
+	h->payload.tag = l->tag;
+	h->payload.length = l->size;
+	memcpy(dst + sizeof(*h), payload, l->size);
+
+	return n;
 }
 
-u8 *clv_client_create_surface_cmd(struct clv_surface_info *s, u32 *n)
+u8 *clv_cmd_payload(u8 *data, u32 n, enum clv_cmd_shift shift)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_surface_create;
-	u32 size, size_surface_create, size_map, *map, *head;
-	u8 *p;
+	const struct clv_cmd_layout *l = cmd_layout(shift);
+	struct clv_cmd_head *h = (struct clv_cmd_head *)data;
 
-	size_map = CLV_CMD_MAP_SIZE;
-	size_surface_create = sizeof(*tlv) + sizeof(*s);
-	size = sizeof(*tlv) + size_map + size_surface_create + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
+	if (!l || n < CLV_CMD_SIZE(l->size))
 		return NULL;
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_CREATE_SURFACE_SHIFT);
+	if (!(h->flag & (1 << shift)))
+		return NULL;
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_surface_create + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_surface_create = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_SURFACE_SHIFT - CLV_CMD_OFFSET]
-		= (u8 *)tlv_surface_create - p;
-	tlv_surface_create->tag = CLV_TAG_CREATE_SURFACE;
-	tlv_surface_create->length = sizeof(*s);
-	memcpy(&tlv_surface_create->payload[0], s, sizeof(*s));
-	*n = size;
+	if (h->win.tag != CLV_TAG_WIN || h->win.length != CLV_CMD_SIZE(l->size)
+			- sizeof(u32) - sizeof(struct clv_tlv))
+		return NULL;
 
-	return p;
-}
+	if (h->map.tag != CLV_TAG_MAP || h->map.length != sizeof(h->map_offs))
+		return NULL;
 
-u8 *clv_dup_create_surface_cmd(u8 *dst, u8 *src, u32 n,
-			       struct clv_surface_info *s)
-{
-	struct clv_tlv *tlv, *tlv_map, *tlv_surface_create;
-	u32 *map;
+	if (h->map_offs[shift - CLV_CMD_OFFSET] != CLV_CMD_PAYLOAD_OFFS)
+		return NULL;
 
-	memcpy(dst, src, n);
+	if (h->payload.tag != l->tag || h->payload.length != l->size)
+		return NULL;
 
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_surface_create = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_SURFACE_SHIFT-CLV_CMD_OFFSET]);
-	memcpy(&tlv_surface_create->payload[0], s, sizeof(*s));
-	return dst;
+	return data + sizeof(*h);
 }
 
-s32 clv_server_parse_create_surface_cmd(u8 *data, struct clv_surface_info *s)
+s32 clv_cmd_decode(u8 *data, u32 n, enum clv_cmd_shift shift, void *payload)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_surface_create;
-	u32 size, *head, *map;
+	const struct clv_cmd_layout *l = cmd_layout(shift);
+	u8 *p = clv_cmd_payload(data, n, shift);
 
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_SURFACE_SHIFT)))
+	if (!p)
 		return -1;
 
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_SURFACE_SHIFT - CLV_CMD_OFFSET] >= size)
-		return -1;
-	tlv_surface_create = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_SURFACE_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_surface_create->tag != CLV_TAG_CREATE_SURFACE)
+	/* the payload is not aligned in the command, check the copy */
+	memcpy(payload, p, l->size);
+	if (l->check && l->check(payload) < 0)
 		return -1;
-	if (tlv_surface_create->length != sizeof(*s))
-		return -1;
-	memcpy(s, &tlv_surface_create->payload[0], sizeof(*s));
+
 	return 0;
 }
 
-u8 *clv_server_create_surface_id_cmd(u64 surface_id, u32 *n)
+const char *clv_cmd_name(u32 flag)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_surface_id;
-	u32 size, size_surface_id, size_map, *map, *head;
-	u8 *p;
+	s32 shift = ffs(flag) - 1;
 
-	size_map = CLV_CMD_MAP_SIZE;
-	size_surface_id = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_surface_id + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
+	if (shift < 0 || shift >= CLV_CMD_LAST_SHIFT)
 		return NULL;
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_CREATE_SURFACE_ACK_SHIFT);
+	return cmd_layouts[shift].name;
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_surface_id + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_surface_id = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_SURFACE_ACK_SHIFT - CLV_CMD_OFFSET]
-		= (u8 *)tlv_surface_id - p;
-	tlv_surface_id->tag = CLV_TAG_RESULT;
-	tlv_surface_id->length = sizeof(u64);
-	*((u64 *)(&tlv_surface_id->payload[0])) = surface_id;
-	*n = size;
+/*
+ * The helpers below keep the per-command API. The buffers created by
+ * clv_*_create_*() are templates, the dup helpers re-encode into dst and
+ * never allocate. The parse helpers trust the length in the WIN TLV, the
+ * caller has already bounded it by its receive buffer.
+ */
+static inline u32 cmd_len(u8 *data)
+{
+	struct clv_tlv *tlv = (struct clv_tlv *)(data + sizeof(u32));
 
-	return p;
+	return sizeof(u32) + sizeof(*tlv) + tlv->length;
 }
 
-u8 *clv_dup_surface_id_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id)
+static u8 *cmd_create(enum clv_cmd_shift shift, const void *payload, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_surface_id;
-	u32 *map;
+	u32 size = clv_cmd_size(shift);
+	u8 *p;
 
-	memcpy(dst, src, n);
+	p = malloc(size);
+	if (!p)
+		return NULL;
 
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_surface_id = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_SURFACE_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_surface_id->payload[0])) = surface_id;
+	*n = clv_cmd_encode(p, size, shift, payload);
+	return p;
+}
+
+static inline u8 *cmd_dup(u8 *dst, u32 n, enum clv_cmd_shift shift,
+			  const void *payload)
+{
+	(void)clv_cmd_encode(dst, n, shift, payload);
 	return dst;
 }
 
-u64 clv_client_parse_surface_id(u8 *data)
+static inline s32 cmd_parse(u8 *data, enum clv_cmd_shift shift,
+			    void *payload)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
+	return clv_cmd_decode(data, cmd_len(data), shift, payload);
+}
 
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_SURFACE_ACK_SHIFT)))
-		return 0;
+static inline u64 cmd_parse_u64(u8 *data, enum clv_cmd_shift shift)
+{
+	u64 v;
 
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_SURFACE_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_SURFACE_ACK_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
+	if (cmd_parse(data, shift, &v) < 0)
 		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+
+	return v;
 }
 
-u8 *clv_client_create_view_cmd(struct clv_view_info *v, u32 *n)
+u8 *clv_server_create_linkup_cmd(u64 link_id, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_view_create;
-	u32 size, size_view_create, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_view_create = sizeof(*tlv) + sizeof(*v);
-	size = sizeof(*tlv) + size_map + size_view_create + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
+	return cmd_create(CLV_CMD_LINK_ID_ACK_SHIFT, &link_id, n);
+}
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_CREATE_VIEW_SHIFT);
+u8 *clv_dup_linkup_cmd(u8 *dst, u8 *src, u32 n, u64 link_id)
+{
+	return cmd_dup(dst, n, CLV_CMD_LINK_ID_ACK_SHIFT, &link_id);
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_view_create + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_view_create = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_VIEW_SHIFT - CLV_CMD_OFFSET]
-		= (u8 *)tlv_view_create - p;
-	tlv_view_create->tag = CLV_TAG_CREATE_VIEW;
-	tlv_view_create->length = sizeof(*v);
-	memcpy(&tlv_view_create->payload[0], v, sizeof(*v));
-	*n = size;
+u64 clv_client_parse_link_id(u8 *data)
+{
+	if (!((*(u32 *)data) & (1 << CLV_CMD_LINK_ID_ACK_SHIFT))) {
+		clv_err("not link id cmd");
+		return 0;
+	}
 
-	return p;
+	return cmd_parse_u64(data, CLV_CMD_LINK_ID_ACK_SHIFT);
 }
 
-u8 *clv_dup_create_view_cmd(u8 *dst, u8 *src, u32 n, struct clv_view_info *v)
+u8 *clv_client_create_surface_cmd(struct clv_surface_info *s, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_view_create;
-	u32 *map;
-
-	memcpy(dst, src, n);
+	return cmd_create(CLV_CMD_CREATE_SURFACE_SHIFT, s, n);
+}
 
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_view_create = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_VIEW_SHIFT-CLV_CMD_OFFSET]);
-	memcpy(&tlv_view_create->payload[0], v, sizeof(*v));
-	return dst;
+u8 *clv_dup_create_surface_cmd(u8 *dst, u8 *src, u32 n,
+			       struct clv_surface_info *s)
+{
+	return cmd_dup(dst, n, CLV_CMD_CREATE_SURFACE_SHIFT, s);
 }
 
-s32 clv_server_parse_create_view_cmd(u8 *data, struct clv_view_info *v)
+s32 clv_server_parse_create_surface_cmd(u8 *data, struct clv_surface_info *s)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_view_create;
-	u32 size, *head, *map;
+	return cmd_parse(data, CLV_CMD_CREATE_SURFACE_SHIFT, s);
+}
 
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_VIEW_SHIFT)))
-		return -1;
+u8 *clv_server_create_surface_id_cmd(u64 surface_id, u32 *n)
+{
+	return cmd_create(CLV_CMD_CREATE_SURFACE_ACK_SHIFT, &surface_id, n);
+}
 
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_VIEW_SHIFT - CLV_CMD_OFFSET] >= size)
-		return -1;
-	tlv_view_create = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_VIEW_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_view_create->tag != CLV_TAG_CREATE_VIEW)
-		return -1;
-	if (tlv_view_create->length != sizeof(*v))
-		return -1;
-	memcpy(v, &tlv_view_create->payload[0], sizeof(*v));
-	return 0;
+u8 *clv_dup_surface_id_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id)
+{
+	return cmd_dup(dst, n, CLV_CMD_CREATE_SURFACE_ACK_SHIFT, &surface_id);
 }
 
-u8 *clv_server_create_view_id_cmd(u64 view_id, u32 *n)
+u64 clv_client_parse_surface_id(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_view_id;
-	u32 size, size_view_id, size_map, *map, *head;
-	u8 *p;
+	return cmd_parse_u64(data, CLV_CMD_CREATE_SURFACE_ACK_SHIFT);
+}
 
-	size_map = CLV_CMD_MAP_SIZE;
-	size_view_id = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_view_id + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
+u8 *clv_client_create_view_cmd(struct clv_view_info *v, u32 *n)
+{
+	return cmd_create(CLV_CMD_CREATE_VIEW_SHIFT, v, n);
+}
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_CREATE_VIEW_ACK_SHIFT);
+u8 *clv_dup_create_view_cmd(u8 *dst, u8 *src, u32 n, struct clv_view_info *v)
+{
+	return cmd_dup(dst, n, CLV_CMD_CREATE_VIEW_SHIFT, v);
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_view_id + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_view_id = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_VIEW_ACK_SHIFT - CLV_CMD_OFFSET]
-		= (u8 *)tlv_view_id - p;
-	tlv_view_id->tag = CLV_TAG_RESULT;
-	tlv_view_id->length = sizeof(u64);
-	*((u64 *)(&tlv_view_id->payload[0])) = view_id;
-	*n = size;
+s32 clv_server_parse_create_view_cmd(u8 *data, struct clv_view_info *v)
+{
+	return cmd_parse(data, CLV_CMD_CREATE_VIEW_SHIFT, v);
+}
 
-	return p;
+u8 *clv_server_create_view_id_cmd(u64 view_id, u32 *n)
+{
+	return cmd_create(CLV_CMD_CREATE_VIEW_ACK_SHIFT, &view_id, n);
 }
 
 u8 *clv_dup_view_id_cmd(u8 *dst, u8 *src, u32 n, u64 view_id)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_view_id;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_view_id = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_VIEW_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_view_id->payload[0])) = view_id;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_CREATE_VIEW_ACK_SHIFT, &view_id);
 }
 
 u64 clv_client_parse_view_id(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_VIEW_ACK_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_VIEW_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_VIEW_ACK_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_CREATE_VIEW_ACK_SHIFT);
 }
 
 u8 *clv_client_create_bo_cmd(struct clv_bo_info *b, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_create;
-	u32 size, size_bo_create, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_bo_create = sizeof(*tlv) + sizeof(*b);
-	size = sizeof(*tlv) + size_map + size_bo_create + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = 1 << CLV_CMD_CREATE_BO_SHIFT;
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_bo_create + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_bo_create = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_BO_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_bo_create - p;
-	tlv_bo_create->tag = CLV_TAG_CREATE_BO;
-	tlv_bo_create->length = sizeof(*b);
-	memcpy(&tlv_bo_create->payload[0], b, sizeof(*b));
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_CREATE_BO_SHIFT, b, n);
 }
 
 u8 *clv_dup_create_bo_cmd(u8 *dst, u8 *src, u32 n, struct clv_bo_info *b)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_create;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_bo_create = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_BO_SHIFT-CLV_CMD_OFFSET]);
-	memcpy(&tlv_bo_create->payload[0], b, sizeof(*b));
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_CREATE_BO_SHIFT, b);
 }
 
 s32 clv_server_parse_create_bo_cmd(u8 *data, struct clv_bo_info *b)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_create;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_BO_SHIFT)))
-		return -1;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_BO_SHIFT - CLV_CMD_OFFSET] >= size)
-		return -1;
-	tlv_bo_create = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_BO_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_bo_create->tag != CLV_TAG_CREATE_BO)
-		return -1;
-	if (tlv_bo_create->length != sizeof(*b))
-		return -1;
-	memcpy(b, &tlv_bo_create->payload[0], sizeof(*b));
-	return 0;
+	return cmd_parse(data, CLV_CMD_CREATE_BO_SHIFT, b);
 }
 
 u8 *clv_server_create_bo_id_cmd(u64 bo_id, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_id;
-	u32 size, size_bo_id, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_bo_id = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_bo_id + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = 1 << CLV_CMD_CREATE_BO_ACK_SHIFT;
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_bo_id + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_bo_id = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_CREATE_BO_ACK_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_bo_id - p;
-	tlv_bo_id->tag = CLV_TAG_RESULT;
-	tlv_bo_id->length = sizeof(u64);
-	*((u64 *)(&tlv_bo_id->payload[0])) = bo_id;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_CREATE_BO_ACK_SHIFT, &bo_id, n);
 }
 
 u8 *clv_dup_bo_id_cmd(u8 *dst, u8 *src, u32 n, u64 bo_id)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_id;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_bo_id = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_CREATE_BO_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_bo_id->payload[0])) = bo_id;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_CREATE_BO_ACK_SHIFT, &bo_id);
 }
 
 u64 clv_client_parse_bo_id(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_CREATE_BO_ACK_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_CREATE_BO_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_CREATE_BO_ACK_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_CREATE_BO_ACK_SHIFT);
 }
 
-/********************************************************/
 u8 *clv_client_destroy_bo_cmd(u64 bo_id, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_id;
-	u32 size, size_bo_id, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_bo_id = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_bo_id + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_DESTROY_BO_SHIFT);
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_bo_id + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_bo_id = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_DESTROY_BO_SHIFT - CLV_CMD_OFFSET]
-		= (u8 *)tlv_bo_id - p;
-	tlv_bo_id->tag = CLV_TAG_RESULT;
-	tlv_bo_id->length = sizeof(u64);
-	*((u64 *)(&tlv_bo_id->payload[0])) = bo_id;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_DESTROY_BO_SHIFT, &bo_id, n);
 }
 
 u8 *clv_dup_destroy_bo_cmd(u8 *dst, u8 *src, u32 n, u64 bo_id)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_bo_id;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_bo_id = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_DESTROY_BO_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_bo_id->payload[0])) = bo_id;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_DESTROY_BO_SHIFT, &bo_id);
 }
 
 u64 clv_server_parse_destroy_bo_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_DESTROY_BO_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_DESTROY_BO_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_DESTROY_BO_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_DESTROY_BO_SHIFT);
 }
 
-/********************************************************/
-
 u8 *clv_client_create_commit_req_cmd(struct clv_commit_info *c, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_commit;
-	u32 size, size_commit, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_commit = sizeof(*tlv) + sizeof(*c);
-	size = sizeof(*tlv) + size_map + size_commit + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_COMMIT_SHIFT);
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_commit + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_commit = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_COMMIT_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_commit - p;
-	tlv_commit->tag = CLV_TAG_COMMIT_INFO;
-	tlv_commit->length = sizeof(*c);
-	memcpy(&tlv_commit->payload[0], c, sizeof(*c));
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_COMMIT_SHIFT, c, n);
 }
 
 u8 *clv_dup_commit_req_cmd(u8 *dst, u8 *src, u32 n, struct clv_commit_info *c)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_commit;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_commit = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_COMMIT_SHIFT-CLV_CMD_OFFSET]);
-	memcpy(&tlv_commit->payload[0], c, sizeof(*c));
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_COMMIT_SHIFT, c);
 }
 
 s32 clv_server_parse_commit_req_cmd(u8 *data, struct clv_commit_info *c)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_commit;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_COMMIT_SHIFT)))
-		return -1;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_COMMIT_SHIFT - CLV_CMD_OFFSET] >= size)
-		return -1;
-	tlv_commit = (struct clv_tlv *)(data
-			+ map[CLV_CMD_COMMIT_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_commit->tag != CLV_TAG_COMMIT_INFO)
-		return -1;
-	if (tlv_commit->length != sizeof(*c))
-		return -1;
-	memcpy(c, &tlv_commit->payload[0], sizeof(*c));
-	return 0;
+	return cmd_parse(data, CLV_CMD_COMMIT_SHIFT, c);
 }
 
-u8 *clv_server_create_commit_ack_cmd(u64 ret, u32 *n)
+u8 *clv_client_create_transaction_cmd(struct clv_transaction_info *t, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, size_result, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_result = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_result + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
+	return cmd_create(CLV_CMD_TRANSACTION_SHIFT, t, n);
+}
 
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_COMMIT_ACK_SHIFT);
+u8 *clv_dup_transaction_cmd(u8 *dst, u8 *src, u32 n,
+			    struct clv_transaction_info *t)
+{
+	return cmd_dup(dst, n, CLV_CMD_TRANSACTION_SHIFT, t);
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_result + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_result = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_COMMIT_ACK_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_result - p;
-	tlv_result->tag = CLV_TAG_RESULT;
-	tlv_result->length = sizeof(u64);
-	*((u64 *)(&tlv_result->payload[0])) = ret;
-	*n = size;
+s32 clv_server_parse_transaction_cmd(u8 *data, struct clv_transaction_info *t)
+{
+	return cmd_parse(data, CLV_CMD_TRANSACTION_SHIFT, t);
+}
 
-	return p;
+u8 *clv_server_create_commit_ack_cmd(u64 ret, u32 *n)
+{
+	return cmd_create(CLV_CMD_COMMIT_ACK_SHIFT, &ret, n);
 }
 
 u8 *clv_dup_commit_ack_cmd(u8 *dst, u8 *src, u32 n, u64 ret)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_result = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_COMMIT_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_result->payload[0])) = ret;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_COMMIT_ACK_SHIFT, &ret);
 }
 
 u64 clv_client_parse_commit_ack_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_COMMIT_ACK_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_COMMIT_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_COMMIT_ACK_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_COMMIT_ACK_SHIFT);
 }
 
 u8 *clv_server_create_bo_complete_cmd(u64 ret, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, size_result, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_result = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_result + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_BO_COMPLETE_SHIFT);
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_result + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_result = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_BO_COMPLETE_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_result - p;
-	tlv_result->tag = CLV_TAG_RESULT;
-	tlv_result->length = sizeof(u64);
-	*((u64 *)(&tlv_result->payload[0])) = ret;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_BO_COMPLETE_SHIFT, &ret, n);
 }
 
 u8 *clv_dup_bo_complete_cmd(u8 *dst, u8 *src, u32 n, u64 ret)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_result = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_BO_COMPLETE_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_result->payload[0])) = ret;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_BO_COMPLETE_SHIFT, &ret);
 }
 
 u64 clv_client_parse_bo_complete_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
+	return cmd_parse_u64(data, CLV_CMD_BO_COMPLETE_SHIFT);
+}
 
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_BO_COMPLETE_SHIFT)))
-		return 0;
+u8 *clv_client_create_frame_cmd(u64 surface_id, u32 *n)
+{
+	return cmd_create(CLV_CMD_FRAME_SHIFT, &surface_id, n);
+}
 
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_BO_COMPLETE_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_BO_COMPLETE_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+u8 *clv_dup_frame_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id)
+{
+	return cmd_dup(dst, n, CLV_CMD_FRAME_SHIFT, &surface_id);
 }
 
-u8 *clv_create_shell_cmd(struct clv_shell_info *s, u32 *n)
+u64 clv_server_parse_frame_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_shell;
-	u32 size, size_shell, size_map, *map, *head;
-	u8 *p;
+	return cmd_parse_u64(data, CLV_CMD_FRAME_SHIFT);
+}
 
-	size_map = CLV_CMD_MAP_SIZE;
-	size_shell = sizeof(*tlv) + sizeof(*s);
-	size = sizeof(*tlv) + size_map + size_shell + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
+u8 *clv_server_create_frame_done_cmd(u64 surface_id, u32 *n)
+{
+	return cmd_create(CLV_CMD_FRAME_DONE_SHIFT, &surface_id, n);
+}
 
-	head = (u32 *)p;
-	*head = 1 << CLV_CMD_SHELL_SHIFT;
+u8 *clv_dup_frame_done_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id)
+{
+	return cmd_dup(dst, n, CLV_CMD_FRAME_DONE_SHIFT, &surface_id);
+}
 
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_shell + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_shell = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_SHELL_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_shell - p;
-	tlv_shell->tag = CLV_TAG_SHELL;
-	tlv_shell->length = sizeof(*s);
-	memcpy(&tlv_shell->payload[0], s, sizeof(*s));
-	*n = size;
+u64 clv_client_parse_frame_done_cmd(u8 *data)
+{
+	return cmd_parse_u64(data, CLV_CMD_FRAME_DONE_SHIFT);
+}
 
-	return p;
+u8 *clv_create_shell_cmd(struct clv_shell_info *s, u32 *n)
+{
+	return cmd_create(CLV_CMD_SHELL_SHIFT, s, n);
 }
 
 u8 *clv_dup_shell_cmd(u8 *dst, u8 *src, u32 n, struct clv_shell_info *s)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_shell;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_shell = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_SHELL_SHIFT-CLV_CMD_OFFSET]);
-	memcpy(&tlv_shell->payload[0], s, sizeof(*s));
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_SHELL_SHIFT, s);
 }
 
 s32 clv_parse_shell_cmd(u8 *data, struct clv_shell_info *s)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_shell;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_SHELL_SHIFT)))
-		return -1;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_SHELL_SHIFT - CLV_CMD_OFFSET] >= size)
-		return -1;
-	tlv_shell = (struct clv_tlv *)(data
-			+ map[CLV_CMD_SHELL_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_shell->tag != CLV_TAG_SHELL)
-		return -1;
-	if (tlv_shell->length != sizeof(*s))
-		return -1;
-	memcpy(s, &tlv_shell->payload[0], sizeof(*s));
-	return 0;
+	return cmd_parse(data, CLV_CMD_SHELL_SHIFT, s);
 }
 
 u8 *clv_client_create_destroy_cmd(u64 link_id, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_destroy;
-	u32 size, size_destroy, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_destroy = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_destroy + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_DESTROY_SHIFT);
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_destroy + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_destroy = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_DESTROY_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_destroy - p;
-	tlv_destroy->tag = CLV_TAG_DESTROY;
-	tlv_destroy->length = sizeof(u64);
-	*((u64 *)(&tlv_destroy->payload[0])) = link_id;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_DESTROY_SHIFT, &link_id, n);
 }
 
 u8 *clv_dup_destroy_cmd(u8 *dst, u8 *src, u32 n, u64 link_id)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_destroy;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_destroy = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_DESTROY_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_destroy->payload[0])) = link_id;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_DESTROY_SHIFT, &link_id);
 }
 
 u64 clv_server_parse_destroy_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_destroy;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_DESTROY_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_DESTROY_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_destroy = (struct clv_tlv *)(data
-			+ map[CLV_CMD_DESTROY_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_destroy->tag != CLV_TAG_DESTROY)
-		return 0;
-	if (tlv_destroy->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_destroy->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_DESTROY_SHIFT);
 }
 
 u8 *clv_server_create_destroy_ack_cmd(u64 ret, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, size_result, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_result = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_result + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = (1 << CLV_CMD_DESTROY_ACK_SHIFT);
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_result + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_result = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_DESTROY_ACK_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_result - p;
-	tlv_result->tag = CLV_TAG_RESULT;
-	tlv_result->length = sizeof(u64);
-	*((u64 *)(&tlv_result->payload[0])) = ret;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_DESTROY_ACK_SHIFT, &ret, n);
 }
 
 u8 *clv_dup_destroy_ack_cmd(u8 *dst, u8 *src, u32 n, u64 ret)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_result = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_DESTROY_ACK_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_result->payload[0])) = ret;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_DESTROY_ACK_SHIFT, &ret);
 }
 
 u64 clv_client_parse_destroy_ack_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_DESTROY_ACK_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_DESTROY_ACK_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_DESTROY_ACK_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_DESTROY_ACK_SHIFT);
 }
 
 u8 *clv_server_create_input_evt_cmd(struct clv_input_event *evts,
@@ -1114,6 +543,7 @@ u8 *clv_server_fill_input_evt_cmd(u8 *dst, struct clv_input_event *evts,
 		return NULL;
 	tlv->length = count_evts * sizeof(struct clv_input_event);
 	memcpy(&tlv->payload[0], evts, tlv->length);
+	*n = sizeof(u32) + sizeof(*tlv) + tlv->length;
 	return dst;
 }
 
@@ -1128,8 +558,10 @@ struct clv_input_event *clv_client_parse_input_evt_cmd(u8 *data,
 		return NULL;
 
 	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_INPUT);
-	assert(!(tlv->length % sizeof(struct clv_input_event)));
+	if (tlv->tag != CLV_TAG_INPUT)
+		return NULL;
+	if (tlv->length % sizeof(struct clv_input_event))
+		return NULL;
 	*count_evts = tlv->length / sizeof(struct clv_input_event);
 	return (struct clv_input_event *)(&tlv->payload[0]);
 }
@@ -1137,40 +569,16 @@ struct clv_input_event *clv_client_parse_input_evt_cmd(u8 *data,
 void clv_cmd_dump(u8 *data)
 {
 	struct clv_tlv *tlv;
+	const char *name;
 	u32 head;
 	s32 i;
 
 	clv_debug("Dump command");
 	head = *((u32 *)data);
 	tlv = (struct clv_tlv *)(data + sizeof(u32));
-	if (head & (1 << CLV_CMD_LINK_ID_ACK_SHIFT)) {
-		clv_debug("LINKID_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_SURFACE_SHIFT)) {
-		clv_debug("CREATE_SURFACE_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_SURFACE_ACK_SHIFT)) {
-		clv_debug("CREATE_SURFACE_ACK_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_VIEW_SHIFT)) {
-		clv_debug("CREATE_VIEW_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_VIEW_ACK_SHIFT)) {
-		clv_debug("CREATE_VIEW_ACK_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_BO_SHIFT)) {
-		clv_debug("CREATE_BO_CMD");
-	} else if (head & (1 << CLV_CMD_CREATE_BO_ACK_SHIFT)) {
-		clv_debug("CREATE_BO_ACK_CMD");
-	} else if (head & (1 << CLV_CMD_COMMIT_SHIFT)) {
-		clv_debug("COMMIT_CMD");
-	} else if (head & (1 << CLV_CMD_COMMIT_ACK_SHIFT)) {
-		clv_debug("COMMIT_ACK_CMD");
-	} else if (head & (1 << CLV_CMD_BO_COMPLETE_SHIFT)) {
-		clv_debug("BO_COMPLETE_CMD");
-	} else if (head & (1 << CLV_CMD_INPUT_EVT_SHIFT)) {
-		clv_debug("INPUT_EVT_CMD");
-	} else if (head & (1 << CLV_CMD_DESTROY_SHIFT)) {
-		clv_debug("DESTROY_CMD");
-	} else if (head & (1 << CLV_CMD_DESTROY_ACK_SHIFT)) {
-		clv_debug("DESTROY_ACK_CMD");
-	} else if (head & (1 << CLV_CMD_SHELL_SHIFT)) {
-		clv_debug("SHELL_CMD");
+	name = clv_cmd_name(head);
+	if (name) {
+		clv_debug("%s", name);
 	} else {
 		clv_err("unknown command 0x%08X", head);
 	}
@@ -1186,75 +594,15 @@ void clv_cmd_dump(u8 *data)
 
 u8 *clv_server_create_hpd_cmd(u64 hpd_info, u32 *n)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_hpd;
-	u32 size, size_hpd, size_map, *map, *head;
-	u8 *p;
-
-	size_map = CLV_CMD_MAP_SIZE;
-	size_hpd = sizeof(*tlv) + sizeof(u64);
-	size = sizeof(*tlv) + size_map + size_hpd + sizeof(u32);
-	p = calloc(1, size);
-	if (!p)
-		return NULL;
-
-	head = (u32 *)p;
-	*head = 1 << CLV_CMD_HPD_SHIFT;
-
-	tlv = (struct clv_tlv *)(p+sizeof(u32));
-	tlv->tag = CLV_TAG_WIN;
-	tlv->length = size_hpd + size_map;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	tlv_hpd = (struct clv_tlv *)(&tlv->payload[0] + size_map);
-	tlv_map->tag = CLV_TAG_MAP;
-	tlv_map->length = CLV_CMD_MAP_SIZE - sizeof(struct clv_tlv);
-	map = (u32 *)(&tlv_map->payload[0]);
-	map[CLV_CMD_HPD_SHIFT - CLV_CMD_OFFSET] = (u8 *)tlv_hpd - p;
-	tlv_hpd->tag = CLV_TAG_RESULT;
-	tlv_hpd->length = sizeof(u64);
-	*((u64 *)(&tlv_hpd->payload[0])) = hpd_info;
-	*n = size;
-
-	return p;
+	return cmd_create(CLV_CMD_HPD_SHIFT, &hpd_info, n);
 }
 
 u8 *clv_dup_hpd_cmd(u8 *dst, u8 *src, u32 n, u64 hpd_info)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_hpd;
-	u32 *map;
-
-	memcpy(dst, src, n);
-
-	tlv = (struct clv_tlv *)(dst+sizeof(u32));
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	tlv_hpd = (struct clv_tlv *)(dst
-			+ map[CLV_CMD_HPD_SHIFT-CLV_CMD_OFFSET]);
-	*((u32 *)(&tlv_hpd->payload[0])) = hpd_info;
-	return dst;
+	return cmd_dup(dst, n, CLV_CMD_HPD_SHIFT, &hpd_info);
 }
 
 u64 clv_client_parse_hpd_cmd(u8 *data)
 {
-	struct clv_tlv *tlv, *tlv_map, *tlv_result;
-	u32 size, *head, *map;
-
-	head = (u32 *)data;
-	if (!((*head) & (1 << CLV_CMD_HPD_SHIFT)))
-		return 0;
-
-	tlv = (struct clv_tlv *)(data+sizeof(u32));
-	assert(tlv->tag == CLV_TAG_WIN);
-	size = sizeof(*tlv) + sizeof(u32) + tlv->length;
-	tlv_map = (struct clv_tlv *)(&tlv->payload[0]);
-	map = (u32 *)(&tlv_map->payload[0]);
-	if (map[CLV_CMD_HPD_SHIFT - CLV_CMD_OFFSET] >= size)
-		return 0;
-	tlv_result = (struct clv_tlv *)(data
-			+ map[CLV_CMD_HPD_SHIFT-CLV_CMD_OFFSET]);
-	if (tlv_result->tag != CLV_TAG_RESULT)
-		return 0;
-	if (tlv_result->length != sizeof(u64))
-		return 0;
-	return *((u64 *)(&tlv_result->payload[0]));
+	return cmd_parse_u64(data, CLV_CMD_HPD_SHIFT);
 }
-
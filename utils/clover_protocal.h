@@ -64,7 +64,10 @@ enum clv_cmd_shift {
 	CLV_CMD_COMMIT_SHIFT,
 	/* server feeds back the result of BO's attaching operation */
 	CLV_CMD_COMMIT_ACK_SHIFT,
-	/* server notify client the BO (not DRM DMA-BUF) is no longer in use */
+	/*
+	 * server notify client the BO (not DRM DMA-BUF) is no longer in use
+	 * the result carries the surface id which the BO was commited to.
+	 */
 	CLV_CMD_BO_COMPLETE_SHIFT,
 	/* mouse & kbd event report */
 	CLV_CMD_INPUT_EVT_SHIFT,
@@ -81,6 +84,28 @@ enum clv_cmd_shift {
 	/* <---------------- Clover setting utils ---------------> */
 	CLV_CMD_SHELL_SHIFT,
 	CLV_CMD_HPD_SHIFT,
+
+	/*
+	 * Client commits the new state of several surfaces at once.
+	 * The whole transaction is applied at the next repaint boundary, and
+	 * only one repaint is scheduled for it.
+	 * Server feeds back the result with CLV_CMD_COMMIT_ACK.
+	 */
+	CLV_CMD_TRANSACTION_SHIFT,
+
+	/*
+	 * Client asks to be notified when it is a good time to draw the next
+	 * frame of the given surface. The request takes effect with the
+	 * surface's next commit.
+	 */
+	CLV_CMD_FRAME_SHIFT,
+	/*
+	 * server notify client the repaint which used the surface's latest
+	 * buffer has been shown, the result carries the surface id.
+	 * Not sent while the surface is fully occluded or only on disabled
+	 * outputs, the notification is delayed until it becomes visible.
+	 */
+	CLV_CMD_FRAME_DONE_SHIFT,
 	CLV_CMD_LAST_SHIFT,
 };
 
@@ -95,6 +120,7 @@ enum clv_tag {
 	CLV_TAG_COMMIT_INFO, /* clv_commit_info */
 	CLV_TAG_SHELL, /* clv_shell_info */
 	CLV_TAG_DESTROY,
+	CLV_TAG_TRANSACTION, /* clv_transaction_info */
 };
 
 struct clv_tlv {
@@ -131,12 +157,41 @@ struct clv_tlv {
 #define CLV_CMD_MAP_SIZE (sizeof(struct clv_tlv) \
 			+ (CLV_CMD_LAST_SHIFT - CLV_CMD_OFFSET) * sizeof(u32))
 
+/*
+ * Every command but CLV_CMD_INPUT_EVT carries a single payload TLV right
+ * after the map, so its layout is fixed and can be read and written as a
+ * plain struct. The payload follows the head.
+ */
+struct clv_cmd_head {
+	u32 flag;
+	struct clv_tlv win;
+	struct clv_tlv map;
+	u32 map_offs[CLV_CMD_LAST_SHIFT - CLV_CMD_OFFSET];
+	struct clv_tlv payload;
+};
+
+#define CLV_CMD_PAYLOAD_OFFS (sizeof(u32) + sizeof(struct clv_tlv) \
+			+ CLV_CMD_MAP_SIZE)
+#define CLV_CMD_SIZE(payload_size) (sizeof(struct clv_cmd_head) \
+			+ (payload_size))
+
+/*
+ * Surface IDs are scoped to the client connection, a client may create
+ * more than one surface on a single link.
+ *
+ * If parent_id is not zero, the surface is created as a sub-surface of the
+ * given parent. A sub-surface is positioned relative to its parent, and its
+ * commits are cached until the parent is commited, so that the parent and
+ * all its sub-surfaces are updated in the same frame.
+ */
 struct clv_surface_info {
 	u64 surface_id;
 	s32 is_opaque;
 	struct clv_rect damage;
 	u32 width, height;
 	struct clv_rect opaque;
+	u64 parent_id; /* 0: top level surface */
+	s32 sub_x, sub_y; /* sub-surface position relative to parent */
 };
 
 enum clv_view_type {
@@ -147,6 +202,7 @@ enum clv_view_type {
 
 struct clv_view_info {
 	u64 view_id;
+	u64 surface_id; /* 0: the last surface created on this link */
 	enum clv_view_type type;
 	struct clv_rect area;
 	float alpha;
@@ -184,11 +240,13 @@ struct clv_bo_info {
 };
 
 struct clv_commit_info {
+	u64 surface_id; /* 0: the last surface created on this link */
 	u64 bo_id;
 	struct clv_rect bo_damage;
 
 	s32 shown; /* 0: hide / 1: show */
 
+	/* relative to parent if the surface is a sub-surface */
 	s32 view_x, view_y;
 	s32 view_hot_x, view_hot_y;
 	u32 view_width, view_height;
@@ -197,10 +255,33 @@ struct clv_commit_info {
 	s32 delta_z;
 };
 
+/* which part of the state a transaction entry changes */
+enum clv_commit_flag {
+	CLV_COMMIT_BUFFER = (1 << 0), /* bo_id & bo_damage */
+	CLV_COMMIT_POSITION = (1 << 1), /* view_x & view_y & hot spot */
+	CLV_COMMIT_SIZE = (1 << 2), /* view_width & view_height */
+	CLV_COMMIT_ALPHA = (1 << 3),
+	CLV_COMMIT_Z = (1 << 4), /* delta_z */
+};
+
+struct clv_transaction_entry {
+	u32 flags; /* enum clv_commit_flag */
+	float alpha;
+	struct clv_commit_info commit;
+};
+
+#define CLV_TRANSACTION_MAX_ENTRIES 16
+
+struct clv_transaction_info {
+	u32 count_entries;
+	struct clv_transaction_entry entries[CLV_TRANSACTION_MAX_ENTRIES];
+};
+
 enum clv_shell_cmd {
 	CLV_SHELL_DEBUG_SETTING,
 	CLV_SHELL_CANVAS_LAYOUT_SETTING,
 	CLV_SHELL_CANVAS_LAYOUT_QUERY,
+	CLV_SHELL_REPAINT_TIMELINE_DUMP,
 };
 
 struct clv_canvas_layout {
@@ -242,6 +323,33 @@ struct clv_input_event {
 	} v;
 };
 
+/*
+ * Input event with its kernel timestamp. The input server only sends it to
+ * the subscribers which asked for it, see INPUT_CMD_TYPE_SUBSCRIBE_TIMESTAMP.
+ */
+struct clv_input_event_ts {
+	struct clv_input_event evt;
+	u32 reserved;
+	u64 time; /* kernel timestamp, CLOCK_MONOTONIC in us */
+};
+
+/*
+ * Table driven codec of the fixed layout commands, no allocation.
+ *
+ * clv_cmd_size() returns the encoded size of a command, 0 if it has no
+ * fixed layout. clv_cmd_encode() writes the command into dst and returns
+ * its size, 0 if dst is too small. clv_cmd_payload() validates the command
+ * of n bytes and returns its payload in place, NULL if it is malformed.
+ * The payload is not aligned, access it with memcpy.
+ * clv_cmd_decode() copies the validated payload out, -1 if malformed.
+ */
+u32 clv_cmd_size(enum clv_cmd_shift shift);
+u32 clv_cmd_encode(u8 *dst, u32 size, enum clv_cmd_shift shift,
+		   const void *payload);
+u8 *clv_cmd_payload(u8 *data, u32 n, enum clv_cmd_shift shift);
+s32 clv_cmd_decode(u8 *data, u32 n, enum clv_cmd_shift shift, void *payload);
+const char *clv_cmd_name(u32 flag);
+
 u8 *clv_server_create_linkup_cmd(u64 link_id, u32 *n);
 u8 *clv_dup_linkup_cmd(u8 *dst, u8 *src, u32 n, u64 link_id);
 u64 clv_client_parse_link_id(u8 *data);
@@ -267,6 +375,10 @@ u64 clv_client_parse_bo_id(u8 *data);
 u8 *clv_client_create_commit_req_cmd(struct clv_commit_info *c, u32 *n);
 u8 *clv_dup_commit_req_cmd(u8 *dst, u8 *src, u32 n, struct clv_commit_info *c);
 s32 clv_server_parse_commit_req_cmd(u8 *data, struct clv_commit_info *c);
+u8 *clv_client_create_transaction_cmd(struct clv_transaction_info *t, u32 *n);
+u8 *clv_dup_transaction_cmd(u8 *dst, u8 *src, u32 n,
+			    struct clv_transaction_info *t);
+s32 clv_server_parse_transaction_cmd(u8 *data, struct clv_transaction_info *t);
 u8 *clv_server_create_commit_ack_cmd(u64 ret, u32 *n);
 u8 *clv_dup_commit_ack_cmd(u8 *dst, u8 *src, u32 n, u64 ret);
 u64 clv_client_parse_commit_ack_cmd(u8 *data);
@@ -286,9 +398,17 @@ u8 *clv_server_create_input_evt_cmd(struct clv_input_event *evts,
 				    u32 count_evts, u32 *n);
 u8 *clv_server_fill_input_evt_cmd(u8 *dst, struct clv_input_event *evts,
 				  u32 count_evts, u32 *n, u32 max_size);
+struct clv_input_event *clv_client_parse_input_evt_cmd(u8 *data,
+						       u32 *count_evts);
 u8 *clv_client_destroy_bo_cmd(u64 bo_id, u32 *n);
 u8 *clv_dup_destroy_bo_cmd(u8 *dst, u8 *src, u32 n, u64 bo_id);
 u64 clv_server_parse_destroy_bo_cmd(u8 *data);
+u8 *clv_client_create_frame_cmd(u64 surface_id, u32 *n);
+u8 *clv_dup_frame_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id);
+u64 clv_server_parse_frame_cmd(u8 *data);
+u8 *clv_server_create_frame_done_cmd(u64 surface_id, u32 *n);
+u8 *clv_dup_frame_done_cmd(u8 *dst, u8 *src, u32 n, u64 surface_id);
+u64 clv_client_parse_frame_done_cmd(u8 *data);
 void clv_cmd_dump(u8 *data);
 
 #define set_hpd_info(pinfo, index, on) do { \
@@ -325,8 +445,20 @@ enum input_cmd_type {
 	INPUT_CMD_TYPE_UNKNOWN = 0,
 	INPUT_CMD_TYPE_SET_CURSOR,
 	INPUT_CMD_TYPE_SET_CURSOR_RANGE,
+	INPUT_CMD_TYPE_SUBSCRIBE_RING, /* see clover_input_ring.h */
+	INPUT_CMD_TYPE_SUBSCRIBE_TIMESTAMP,
 };
 
+/*
+ * The input server sends each batch of events on the socket as its length
+ * in bytes followed by the clv_input_event records. Once a subscriber asked
+ * for INPUT_CMD_TYPE_SUBSCRIBE_TIMESTAMP, the server sends the length
+ * CLV_INPUT_TIMESTAMP_SWITCH in place of a batch, then the size of a record
+ * as u32, and only clv_input_event_ts records after that. A subscriber
+ * which does not know that record size must hang up.
+ */
+#define CLV_INPUT_TIMESTAMP_SWITCH 0xFFFFFFFE
+
 #define MAX_DESKTOP_NR 8
 struct input_cmd {
 	enum input_cmd_type type;
@@ -341,6 +473,9 @@ struct input_cmd {
 			s32 count_rects;
 			s32 map[MAX_DESKTOP_NR];
 		} range;
+		struct {
+			u32 size; /* count of records, 0 for the default */
+		} ring;
 	} c;
 };
 
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_queue.h>
+
+s32 clv_spsc_queue_init(struct clv_spsc_queue *q, u32 size)
+{
+	u32 n = 1;
+
+	memset(q, 0, sizeof(*q));
+	while (n < size)
+		n <<= 1;
+
+	q->slots = calloc(n, sizeof(void *));
+	if (!q->slots)
+		return -1;
+	q->mask = n - 1;
+
+	return 0;
+}
+
+void clv_spsc_queue_release(struct clv_spsc_queue *q)
+{
+	free(q->slots);
+	q->slots = NULL;
+	q->mask = 0;
+	q->head = q->tail = 0;
+}
+
+s32 clv_spsc_queue_push(struct clv_spsc_queue *q, void *item)
+{
+	u32 tail = q->tail;
+	u32 head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head > q->mask)
+		return -1;
+
+	q->slots[tail & q->mask] = item;
+	/* publish the slot before the new tail */
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void *clv_spsc_queue_pop(struct clv_spsc_queue *q)
+{
+	u32 head = q->head;
+	u32 tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+	void *item;
+
+	if (head == tail)
+		return NULL;
+
+	item = q->slots[head & q->mask];
+	/* the slot may be reused by the producer once head moves */
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+	return item;
+}
+
+void clv_mpsc_queue_init(struct clv_mpsc_queue *q)
+{
+	q->stub.next = NULL;
+	q->head = &q->stub;
+	q->tail = &q->stub;
+}
+
+void clv_mpsc_queue_push(struct clv_mpsc_queue *q, struct clv_mpsc_node *n)
+{
+	struct clv_mpsc_node *prev;
+
+	n->next = NULL;
+	prev = __atomic_exchange_n(&q->head, n, __ATOMIC_ACQ_REL);
+	/* the consumer cannot see n until prev is linked to it */
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+struct clv_mpsc_node *clv_mpsc_queue_pop(struct clv_mpsc_queue *q)
+{
+	struct clv_mpsc_node *tail = q->tail;
+	struct clv_mpsc_node *next;
+	struct clv_mpsc_node *head;
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &q->stub) {
+		if (!next)
+			return NULL;
+		q->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+	if (tail != head)
+		return NULL; /* a push is in progress */
+
+	/* tail is the last node, put the stub behind it to detach it */
+	clv_mpsc_queue_push(q, &q->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
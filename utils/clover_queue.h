@@ -0,0 +1,63 @@
+#ifndef CLOVER_QUEUE_H
+#define CLOVER_QUEUE_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CLV_CACHELINE_SIZE 64
+
+/*
+ * Lock-free single producer / single consumer ring of pointers.
+ *
+ * Exactly one thread may push and exactly one thread may pop. The producer
+ * only writes tail and the consumer only writes head, each index sits in
+ * its own cache line so the two sides never bounce the same line.
+ * The queue does not block, pair it with a semaphore or an eventfd when the
+ * consumer has to sleep.
+ */
+struct clv_spsc_queue {
+	void **slots;
+	u32 mask;
+
+	u32 head __attribute__((aligned(CLV_CACHELINE_SIZE)));
+	u32 tail __attribute__((aligned(CLV_CACHELINE_SIZE)));
+};
+
+/* size is rounded up to a power of two */
+s32 clv_spsc_queue_init(struct clv_spsc_queue *q, u32 size);
+void clv_spsc_queue_release(struct clv_spsc_queue *q);
+/* returns -1 if the queue is full */
+s32 clv_spsc_queue_push(struct clv_spsc_queue *q, void *item);
+/* returns NULL if the queue is empty */
+void *clv_spsc_queue_pop(struct clv_spsc_queue *q);
+
+/*
+ * Intrusive multiple producer / single consumer queue.
+ *
+ * Push is wait-free, one atomic exchange, and may be called from any
+ * thread. Pop belongs to a single consumer thread. Pop may return NULL while
+ * a producer is half way through a push, the producer is expected to wake
+ * the consumer up again once the push returns.
+ */
+struct clv_mpsc_node {
+	struct clv_mpsc_node *next;
+};
+
+struct clv_mpsc_queue {
+	struct clv_mpsc_node *head __attribute__((aligned(CLV_CACHELINE_SIZE)));
+	struct clv_mpsc_node *tail __attribute__((aligned(CLV_CACHELINE_SIZE)));
+	struct clv_mpsc_node stub;
+};
+
+void clv_mpsc_queue_init(struct clv_mpsc_queue *q);
+void clv_mpsc_queue_push(struct clv_mpsc_queue *q, struct clv_mpsc_node *n);
+struct clv_mpsc_node *clv_mpsc_queue_pop(struct clv_mpsc_queue *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
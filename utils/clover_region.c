@@ -6,6 +6,14 @@
 #include <clover_log.h>
 #include <clover_region.h>
 
+#if defined(__SSE2__)
+#define REGION_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define REGION_NEON
+#include <arm_neon.h>
+#endif
+
 static struct clv_box empty_box = {
 	.p1 = {
 		.x = 0,
@@ -39,7 +47,12 @@ static struct clv_region_data *broken_data_ptr = &broken_data;
 #define BAD_BOX(box) (((box)->p1.x > (box)->p2.x) \
 			|| ((box)->p1.y < (box)->p2.y))
 
-#define FREE_DATA(reg) if ((reg)->data && (reg)->data->size) free((reg)->data)
+/* the storage in the region, for up to CLV_REGION_INLINE_BOXES boxes */
+#define REGION_INLINE(reg) (&(reg)->small.hdr)
+#define DATA_ON_HEAP(reg) ((reg)->data && (reg)->data->size \
+			   && (reg)->data != REGION_INLINE(reg) \
+			   && !(reg)->arena)
+#define FREE_DATA(reg) if (DATA_ON_HEAP(reg)) free((reg)->data)
 #define REGION_NIL(reg) ((reg)->data && !(reg)->data->count_boxes)
 #define REGION_NAR(reg) ((reg)->data == broken_data_ptr)
 #define REGION_COUNT_BOXES(reg) ((reg)->data ? (reg)->data->count_boxes : 1)
@@ -107,7 +120,7 @@ static struct clv_region_data *broken_data_ptr = &broken_data;
 
 #define DOWNSIZE(reg, count_boxes) do { \
 	if (((count_boxes) < ((reg)->data->size >> 1)) \
-			&& ((reg)->data->size > 50)) { \
+			&& ((reg)->data->size > 50) && !(reg)->arena) { \
 		struct clv_region_data * new_data; \
 		u32 data_size = REGION_SZOF(count_boxes); \
 		if (!data_size) { \
@@ -163,12 +176,14 @@ void clv_region_init(struct clv_region *region)
 {
 	region->extents = *empty_box_ptr;
 	region->data = empty_data_ptr;
+	region->arena = NULL;
 }
 
 void clv_region_init_rect(struct clv_region *region,
 			     s32 x, s32 y,
 			     u32 w, u32 h)
 {
+	region->arena = NULL;
 	region->extents.p1.x = x;
 	region->extents.p1.y = y;
 	region->extents.p2.x = x + w;
@@ -196,16 +211,52 @@ static u32 REGION_SZOF(u32 n)
 	return size + sizeof(struct clv_region_data);
 }
 
-static struct clv_region_data * alloc_data(u32 n)
+static struct clv_region_data * alloc_data(struct clv_region *region, u32 n)
 {
 	u32 sz = REGION_SZOF(n);
 
 	if (!sz)
 		return NULL;
 
+	if (region->arena)
+		return clv_arena_alloc(region->arena, sz);
+
 	return malloc(sz);
 }
 
+/* arena data is only dropped with the arena */
+static void free_data(struct clv_region *region, struct clv_region_data *data)
+{
+	if (!region->arena)
+		free(data);
+}
+
+/* room for n boxes, in the region itself while they fit */
+static struct clv_region_data *region_data_alloc(struct clv_region *region,
+						 u32 n)
+{
+	struct clv_region_data *data;
+
+	if (n <= CLV_REGION_INLINE_BOXES) {
+		data = REGION_INLINE(region);
+		data->size = CLV_REGION_INLINE_BOXES;
+		return data;
+	}
+
+	data = alloc_data(region, n);
+	if (data)
+		data->size = n;
+
+	return data;
+}
+
+/* fix up a region struct copied from old, data may point into old */
+static void region_moved(struct clv_region *region, struct clv_region *old)
+{
+	if (old->data == REGION_INLINE(old))
+		region->data = REGION_INLINE(region);
+}
+
 static s32 set_break(struct clv_region *region)
 {
 	FREE_DATA(region);
@@ -222,13 +273,13 @@ static s32 box_alloc(struct clv_region *region, s32 n)
 
 	if (!region->data) {
 		n++;
-		region->data = alloc_data(n);
+		region->data = region_data_alloc(region, n);
 		if (!region->data)
 			return set_break(region);
 		region->data->count_boxes = 1;
 		*(REGION_BOX_PTR(region)) = region->extents;
 	} else if (!region->data->size) {
-		region->data = alloc_data(n);
+		region->data = region_data_alloc(region, n);
 		if (!region->data)
 			return set_break(region);
 		region->data->count_boxes = 0;
@@ -242,19 +293,25 @@ static s32 box_alloc(struct clv_region *region, s32 n)
 		data_size = REGION_SZOF(n);
 		if (!data_size) {
 			data = NULL;
+		} else if (region->data == REGION_INLINE(region)
+			   || region->arena) {
+			/* outgrown the inline boxes, or no realloc in arena */
+			data = alloc_data(region, n);
+			if (data)
+				memcpy(data, region->data,
+				       REGION_SZOF(region->data->count_boxes));
 		} else {
 			data = (struct clv_region_data *)
-				realloc(region->data, REGION_SZOF(n));
+				realloc(region->data, data_size);
 		}
 
 		if (!data)
 			return set_break(region);
 
 		region->data = data;
+		region->data->size = n;
 	}
 
-	region->data->size = n;
-
 	return 0;
 }
 
@@ -375,6 +432,7 @@ static s32 region_op(struct clv_region *new_reg,
 	s32 r2y1;
 	s32 new_size;
 	s32 count_boxes;
+	struct clv_box saved[CLV_REGION_INLINE_BOXES];
 
 	/*
 	 * Break any region computed from a broken region
@@ -409,6 +467,23 @@ static s32 region_op(struct clv_region *new_reg,
 		new_reg->data = empty_data_ptr;
 	}
 
+	/*
+	 * The inline boxes of new_reg are about to be refilled, read the
+	 * source boxes from a copy.
+	 */
+	if (old_data && old_data == REGION_INLINE(new_reg)) {
+		memcpy(saved, old_data + 1,
+		       old_data->count_boxes * sizeof(struct clv_box));
+		if (new_reg == reg1) {
+			r1 = saved;
+			r1_end = saved + old_data->count_boxes;
+		} else {
+			r2 = saved;
+			r2_end = saved + old_data->count_boxes;
+		}
+		old_data = NULL;
+	}
+
 	/* guess at new size */
 	if (count_boxes > new_size)
 		new_size = count_boxes;
@@ -422,7 +497,7 @@ static s32 region_op(struct clv_region *new_reg,
 
 	if (new_size > new_reg->data->size) {
 		if (box_alloc(new_reg, new_size) < 0) {
-			free(old_data);
+			free_data(new_reg, old_data);
 			return -1;
 		}
 	}
@@ -579,7 +654,7 @@ static s32 region_op(struct clv_region *new_reg,
 		APPEND_REGIONS(new_reg, r2_band_end, r2_end);
 	}
 
-	free(old_data);
+	free_data(new_reg, old_data);
 
 	if (!(count_boxes = new_reg->data->count_boxes)) {
 		FREE_DATA(new_reg);
@@ -595,29 +670,42 @@ static s32 region_op(struct clv_region *new_reg,
 	return 0;
 
 bail:
-	free(old_data);
+	free_data(new_reg, old_data);
 
 	return set_break(new_reg);
 }
 
-/* sort boxes array into ascending (y1, x1) order */
+#define BOX_LESS(a, b) ((a)->p1.y < (b)->p1.y \
+	|| ((a)->p1.y == (b)->p1.y && (a)->p1.x < (b)->p1.x))
+
+/* partitions up to this size are left to insertion sort */
+#define SORT_INSERTION_MAX 16
+
+static void insertion_sort_boxes(struct clv_box boxes[], s32 count_boxes)
+{
+	struct clv_box t;
+	s32 i, j;
+
+	for (i = 1; i < count_boxes; i++) {
+		t = boxes[i];
+		for (j = i; j > 0 && BOX_LESS(&t, &boxes[j - 1]); j--)
+			boxes[j] = boxes[j - 1];
+		boxes[j] = t;
+	}
+}
+
+/*
+ * sort boxes array into ascending (y1, x1) order
+ *
+ * Quick sort down to small partitions, which insertion sort finishes. It
+ * recurses into the smaller side only, so the depth stays logarithmic.
+ */
 static void quick_sort_boxes(struct clv_box boxes[], s32 count_boxes)
 {
 	s32 y1, x1, i, j;
 	struct clv_box *r;
 
-	/* always called with count_boxes > 1 */
-	do {
-		/* the condition of recursive calling's termination */
-		if (count_boxes == 2) {
-			if (boxes[0].p1.y > boxes[1].p1.y
-				|| (boxes[0].p1.y == boxes[1].p1.y
-					&& boxes[0].p1.x > boxes[1].p1.x)) {
-				EXCHANGE_BOXES(0, 1, boxes);
-			}
-			return;
-		}
-
+	while (count_boxes > SORT_INSERTION_MAX) {
 		/* place the middle element to the location 0 */
 		EXCHANGE_BOXES(0, count_boxes >> 1, boxes);
 		x1 = boxes[0].p1.x;
@@ -648,11 +736,17 @@ static void quick_sort_boxes(struct clv_box boxes[], s32 count_boxes)
 		} while (i < j);
 		EXCHANGE_BOXES(0, j, boxes);
 
-		if (count_boxes - j - 1 > 1)
+		if (j < count_boxes - j - 1) {
+			quick_sort_boxes(boxes, j);
+			boxes += j + 1;
+			count_boxes -= j + 1;
+		} else {
 			quick_sort_boxes(&boxes[j + 1], count_boxes - j - 1);
+			count_boxes = j;
+		}
+	}
 
-		count_boxes = j;
-	} while (count_boxes > 1);
+	insertion_sort_boxes(boxes, count_boxes);
 }
 
 static s32 region_subtract_o(struct clv_region *region,
@@ -908,6 +1002,7 @@ static s32 validate(struct clv_region *badreg)
 	ri[0].prev_band = 0;
 	ri[0].cur_band = 0;
 	ri[0].reg = *badreg;
+	region_moved(&ri[0].reg, badreg);
 	box = REGION_BOX_PTR(&ri[0].reg);
 	ri[0].reg.extents = *box;
 	ri[0].reg.data->count_boxes = 1;
@@ -974,16 +1069,18 @@ static s32 validate(struct clv_region *badreg)
 			if (data_size / size_ri != sizeof(region_info_t))
 				goto bail;
 
-			if (ri == stack_regions) {
-				rit = malloc(data_size);
-				if (!rit)
-					goto bail;
-				memcpy(rit, ri, num_ri * sizeof(region_info_t));
-			} else {
-				rit = (region_info_t *)realloc(ri, data_size);
-				if (!rit)
-					goto bail;
-			}
+			/*
+			 * Not realloc, the regions holding inline boxes are
+			 * fixed up from the old array.
+			 */
+			rit = malloc(data_size);
+			if (!rit)
+				goto bail;
+			memcpy(rit, ri, num_ri * sizeof(region_info_t));
+			for (j = 0; j < num_ri; j++)
+				region_moved(&rit[j].reg, &ri[j].reg);
+			if (ri != stack_regions)
+				free(ri);
 			ri = rit;
 			rit = &ri[num_ri];
 		}
@@ -992,6 +1089,7 @@ static s32 validate(struct clv_region *badreg)
 		rit->cur_band = 0;
 		rit->reg.extents = *box;
 		rit->reg.data = (struct clv_region_data *)NULL;
+		rit->reg.arena = badreg->arena;
 
 		/* MUST force allocation */
 		if (box_alloc(&rit->reg, (i + num_ri) / num_ri) < 0)
@@ -1051,6 +1149,7 @@ next_rect:
 	}
 
 	*badreg = ri[0].reg;
+	region_moved(badreg, &ri[0].reg);
 
 	if (ri != stack_regions)
 		free(ri);
@@ -1134,6 +1233,7 @@ void clv_region_init_with_extents(struct clv_region *region,
 	}
 	region->extents = *extents;
 	region->data = NULL;
+	region->arena = NULL;
 }
 
 void clv_region_fini(struct clv_region *region)
@@ -1141,6 +1241,96 @@ void clv_region_fini(struct clv_region *region)
 	FREE_DATA(region);
 }
 
+void clv_region_set_arena(struct clv_region *region, struct clv_arena *arena)
+{
+	region->arena = arena;
+}
+
+/*
+ * A box is four s32, x1 y1 x2 y2, one vector. The loops below take a box
+ * per vector, on every lane at once.
+ */
+
+/* the least x1 and the greatest x2 of n > 0 boxes */
+static void boxes_x_range(const struct clv_box *box, u32 n, s32 *x1, s32 *x2)
+{
+#if defined(REGION_SSE2)
+	__m128i lo, hi, v, m;
+	u32 i;
+
+	lo = hi = _mm_loadu_si128((const __m128i *)box);
+	for (i = 1; i < n; i++) {
+		v = _mm_loadu_si128((const __m128i *)(box + i));
+		/* no pminsd / pmaxsd before SSE4.1 */
+		m = _mm_cmplt_epi32(v, lo);
+		lo = _mm_or_si128(_mm_and_si128(m, v), _mm_andnot_si128(m, lo));
+		m = _mm_cmpgt_epi32(v, hi);
+		hi = _mm_or_si128(_mm_and_si128(m, v), _mm_andnot_si128(m, hi));
+	}
+	*x1 = _mm_cvtsi128_si32(lo);
+	*x2 = _mm_cvtsi128_si32(_mm_srli_si128(hi, 8));
+#elif defined(REGION_NEON)
+	int32x4_t lo, hi, v;
+	u32 i;
+
+	lo = hi = vld1q_s32((const s32 *)box);
+	for (i = 1; i < n; i++) {
+		v = vld1q_s32((const s32 *)(box + i));
+		lo = vminq_s32(lo, v);
+		hi = vmaxq_s32(hi, v);
+	}
+	*x1 = vgetq_lane_s32(lo, 0);
+	*x2 = vgetq_lane_s32(hi, 2);
+#else
+	u32 i;
+
+	*x1 = box->p1.x;
+	*x2 = box->p2.x;
+	for (i = 1; i < n; i++) {
+		if (box[i].p1.x < *x1)
+			*x1 = box[i].p1.x;
+		if (box[i].p2.x > *x2)
+			*x2 = box[i].p2.x;
+	}
+#endif
+}
+
+static void boxes_translate(struct clv_box *box, u32 n, s32 x, s32 y)
+{
+#if defined(REGION_SSE2)
+	__m128i d = _mm_set_epi32(y, x, y, x);
+	__m128i *p = (__m128i *)box;
+	u32 i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		_mm_storeu_si128(p + i, _mm_add_epi32(
+				_mm_loadu_si128(p + i), d));
+		_mm_storeu_si128(p + i + 1, _mm_add_epi32(
+				_mm_loadu_si128(p + i + 1), d));
+	}
+	if (i < n)
+		_mm_storeu_si128(p + i, _mm_add_epi32(
+				_mm_loadu_si128(p + i), d));
+#elif defined(REGION_NEON)
+	const s32 delta[4] = { x, y, x, y };
+	int32x4_t d = vld1q_s32(delta);
+	s32 *p = (s32 *)box;
+	u32 i;
+
+	for (i = 0; i < n; i++, p += 4)
+		vst1q_s32(p, vaddq_s32(vld1q_s32(p), d));
+#else
+	u32 i;
+
+	for (i = 0; i < n; i++) {
+		box[i].p1.x += x;
+		box[i].p1.y += y;
+		box[i].p2.x += x;
+		box[i].p2.y += y;
+	}
+#endif
+}
+
 static void set_extents(struct clv_region *region)
 {
 	struct clv_box *box, *box_end;
@@ -1157,20 +1347,13 @@ static void set_extents(struct clv_region *region)
 	box = REGION_BOX_PTR(region);
 	box_end = REGION_BOX_END(region);
 
-	region->extents.p1.x = box->p1.x;
 	region->extents.p1.y = box->p1.y;
-	region->extents.p2.x = box_end->p2.x;
 	region->extents.p2.y = box_end->p2.y;
 
 	assert(region->extents.p1.y < region->extents.p2.y);
-	
-	while (box <= box_end) {
-		if (box->p1.x < region->extents.p1.x)
-			region->extents.p1.x = box->p1.x;
-		if (box->p2.x > region->extents.p2.x)
-			region->extents.p2.x = box->p2.x;
-		box++;
-	}
+
+	boxes_x_range(box, region->data->count_boxes, &region->extents.p1.x,
+		      &region->extents.p2.x);
 
 	assert(region->extents.p1.x < region->extents.p2.x);
 }
@@ -1178,23 +1361,11 @@ static void set_extents(struct clv_region *region)
 void clv_region_translate(struct clv_region *region,
 			     s32 x, s32 y)
 {
-	u32 count_boxes;
-	struct clv_box *box;
-
-	region->extents.p1.x = region->extents.p1.x + x;
-	region->extents.p1.y = region->extents.p1.y + y;
-	region->extents.p2.x = region->extents.p2.x + x;
-	region->extents.p2.y = region->extents.p2.y + y;
-
-	if (region->data && (count_boxes = region->data->count_boxes)) {
-		for (box = REGION_BOX_PTR(region); count_boxes--;
-				box++) {
-			box->p1.x += x;
-			box->p1.y += y;
-			box->p2.x += x;
-			box->p2.y += y;
-		}
-	}
+	boxes_translate(&region->extents, 1, x, y);
+
+	if (region->data && region->data->count_boxes)
+		boxes_translate(REGION_BOX_PTR(region),
+				region->data->count_boxes, x, y);
 }
 
 s32 clv_region_copy(struct clv_region *dst, struct clv_region *src)
@@ -1213,12 +1384,10 @@ s32 clv_region_copy(struct clv_region *dst, struct clv_region *src)
 	if (!dst->data || (dst->data->size < src->data->count_boxes)) {
 		FREE_DATA(dst);
 
-		dst->data = alloc_data(src->data->count_boxes);
+		dst->data = region_data_alloc(dst, src->data->count_boxes);
 
 		if (!dst->data)
 			return set_break(dst);
-
-		dst->data->size = src->data->count_boxes;
 	}
 
 	dst->data->count_boxes = src->data->count_boxes;
@@ -2,20 +2,36 @@
 #define CLOVER_REGION_H
 
 #include <clover_utils.h>
+#include <clover_arena.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* boxes a region holds without allocating */
+#define CLV_REGION_INLINE_BOXES 4
+
 struct clv_region_data {
 	u32 size;
 	u32 count_boxes;
 	struct clv_box boxes[0];
 };
 
+/*
+ * A region of up to CLV_REGION_INLINE_BOXES boxes keeps them in small, data
+ * then points into the region itself. So a region is never copied by
+ * assignment, use clv_region_copy.
+ *
+ * Larger ones take their boxes from the heap, or from arena if it is set.
+ */
 struct clv_region {
 	struct clv_box extents;
 	struct clv_region_data *data;
+	struct clv_arena *arena;
+	struct {
+		struct clv_region_data hdr;
+		struct clv_box boxes[CLV_REGION_INLINE_BOXES];
+	} small;
 };
 
 void clv_region_init(struct clv_region *region);
@@ -30,6 +46,12 @@ void clv_region_init_with_extents(struct clv_region *region,
 
 void clv_region_fini(struct clv_region *region);
 
+/*
+ * Take the boxes of region from arena from now on, right after it is
+ * initialised. The region must not be used once the arena is reset.
+ */
+void clv_region_set_arena(struct clv_region *region, struct clv_arena *arena);
+
 void clv_region_translate(struct clv_region *region, s32 x, s32 y);
 
 s32 clv_region_copy(struct clv_region *dst, struct clv_region *src);
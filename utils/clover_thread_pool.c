@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_queue.h>
+#include <clover_thread_pool.h>
+
+/* [begin, end) of the indices left to a thread, begin in the low word */
+struct pool_range {
+	u64 v;
+} __attribute__((aligned(CLV_CACHELINE_SIZE)));
+
+struct pool_worker {
+	struct clv_thread_pool *pool;
+	u32 id;
+	pthread_t thread;
+};
+
+struct clv_thread_pool {
+	u32 count_threads;
+	struct pool_worker workers[CLV_THREAD_POOL_MAX];
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	u32 gen; /* bumped for every job */
+	s32 live; /* the job of gen may still be joined */
+	u32 active; /* workers on the job */
+	s32 quit;
+
+	/* the job, published to the workers by the stores of the ranges */
+	void (*fn)(void *data, u32 index);
+	void *data;
+	u32 count;
+	u32 done __attribute__((aligned(CLV_CACHELINE_SIZE)));
+
+	struct pool_range ranges[CLV_THREAD_POOL_MAX];
+};
+
+static inline u64 range_pack(u32 begin, u32 end)
+{
+	return ((u64)end << 32) | begin;
+}
+
+static s32 range_pop_front(struct pool_range *r, u32 *index)
+{
+	u64 v = __atomic_load_n(&r->v, __ATOMIC_ACQUIRE);
+	u32 begin, end;
+
+	do {
+		begin = (u32)v;
+		end = v >> 32;
+		if (begin >= end)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&r->v, &v,
+					      range_pack(begin + 1, end), 1,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_ACQUIRE));
+
+	*index = begin;
+	return 1;
+}
+
+/* take [mid, end) of a range, the owner keeps [begin, mid) */
+static s32 range_steal_half(struct pool_range *r, u32 *begin_out,
+			    u32 *end_out)
+{
+	u64 v = __atomic_load_n(&r->v, __ATOMIC_ACQUIRE);
+	u32 begin, end, mid;
+
+	do {
+		begin = (u32)v;
+		end = v >> 32;
+		if (begin >= end)
+			return 0;
+		mid = begin + (end - begin) / 2;
+	} while (!__atomic_compare_exchange_n(&r->v, &v,
+					      range_pack(begin, mid), 1,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_ACQUIRE));
+
+	*begin_out = mid;
+	*end_out = end;
+	return 1;
+}
+
+static void pool_run_one(struct clv_thread_pool *pool, u32 index)
+{
+	pool->fn(pool->data, index);
+
+	if (__atomic_add_fetch(&pool->done, 1, __ATOMIC_ACQ_REL)
+			== pool->count) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+/* run indices until no thread has any left */
+static void pool_work(struct clv_thread_pool *pool, u32 id)
+{
+	struct pool_range *own = &pool->ranges[id];
+	u32 index, begin, end, i;
+	s32 stolen;
+
+	for (;;) {
+		while (range_pop_front(own, &index))
+			pool_run_one(pool, index);
+
+		stolen = 0;
+		for (i = 1; i < pool->count_threads; i++) {
+			if (!range_steal_half(&pool->ranges[(id + i)
+						% pool->count_threads],
+					      &begin, &end))
+				continue;
+			/* nobody steals from an empty range, just store it */
+			__atomic_store_n(&own->v, range_pack(begin + 1, end),
+					 __ATOMIC_RELEASE);
+			pool_run_one(pool, begin);
+			stolen = 1;
+			break;
+		}
+		if (!stolen)
+			return;
+	}
+}
+
+static void *pool_worker_proc(void *data)
+{
+	struct pool_worker *w = data;
+	struct clv_thread_pool *pool = w->pool;
+	u32 seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		/* a job already over is not joined, its ranges may be reset */
+		while (!pool->quit && (pool->gen == seen || !pool->live))
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->gen;
+		pool->active++;
+		pthread_mutex_unlock(&pool->lock);
+		pool_work(pool, w->id);
+		pthread_mutex_lock(&pool->lock);
+		if (!--pool->active)
+			pthread_cond_broadcast(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+struct clv_thread_pool *clv_thread_pool_create(u32 count_threads)
+{
+	struct clv_thread_pool *pool;
+	s32 online;
+	u32 i;
+
+	if (!count_threads) {
+		online = sysconf(_SC_NPROCESSORS_ONLN);
+		count_threads = online > 0 ? online : 1;
+	}
+	if (count_threads > CLV_THREAD_POOL_MAX)
+		count_threads = CLV_THREAD_POOL_MAX;
+
+	if (posix_memalign((void **)&pool, CLV_CACHELINE_SIZE, sizeof(*pool)))
+		return NULL;
+	memset(pool, 0, sizeof(*pool));
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	/* worker 0 is whoever calls run */
+	pool->count_threads = 1;
+	for (i = 1; i < count_threads; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		if (pthread_create(&pool->workers[i].thread, NULL,
+				   pool_worker_proc, &pool->workers[i])) {
+			clv_warn("failed to create pool thread %u", i);
+			break;
+		}
+		pool->count_threads++;
+	}
+
+	return pool;
+}
+
+void clv_thread_pool_destroy(struct clv_thread_pool *pool)
+{
+	u32 i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 1; i < pool->count_threads; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+u32 clv_thread_pool_count_threads(struct clv_thread_pool *pool)
+{
+	return pool->count_threads;
+}
+
+void clv_thread_pool_run(struct clv_thread_pool *pool,
+			 void (*fn)(void *data, u32 index),
+			 void *data, u32 count)
+{
+	u32 i, n = pool->count_threads;
+
+	if (!count)
+		return;
+
+	if (n == 1 || count == 1) {
+		for (i = 0; i < count; i++)
+			fn(data, i);
+		return;
+	}
+
+	pool->fn = fn;
+	pool->data = data;
+	pool->count = count;
+	__atomic_store_n(&pool->done, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < n; i++)
+		__atomic_store_n(&pool->ranges[i].v,
+				 range_pack((u64)count * i / n,
+					    (u64)count * (i + 1) / n),
+				 __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->gen++;
+	pool->live = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, 0);
+
+	/* no worker may still be looking at the ranges once we return */
+	pthread_mutex_lock(&pool->lock);
+	while (__atomic_load_n(&pool->done, __ATOMIC_ACQUIRE) < count
+	       || pool->active)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pool->live = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,42 @@
+#ifndef CLOVER_THREAD_POOL_H
+#define CLOVER_THREAD_POOL_H
+
+#include <clover_utils.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Work-stealing thread pool for data parallel jobs.
+ *
+ * clv_thread_pool_run calls fn once for every index of [0, count) and
+ * returns when all the calls are done. The indices are dealt out in one
+ * contiguous range per thread, the calling thread being one of them. A
+ * thread takes the indices at the front of its own range, once it is empty
+ * it steals the back half of the range of another thread. Jobs of uneven
+ * cost so keep every thread busy without a shared queue.
+ *
+ * The calls of fn run concurrently. fn must not run a job on the same pool,
+ * and only one thread may run jobs on a pool at a time.
+ */
+
+#define CLV_THREAD_POOL_MAX 32
+
+struct clv_thread_pool;
+
+/* count_threads includes the caller of run, 0 means one per online CPU */
+struct clv_thread_pool *clv_thread_pool_create(u32 count_threads);
+void clv_thread_pool_destroy(struct clv_thread_pool *pool);
+
+u32 clv_thread_pool_count_threads(struct clv_thread_pool *pool);
+
+void clv_thread_pool_run(struct clv_thread_pool *pool,
+			 void (*fn)(void *data, u32 index),
+			 void *data, u32 count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_protocal.h>
+
+/*
+ * Fuzz entry points of the command parsers.
+ *
+ * The first byte of the input selects the parser, the rest is the command
+ * as it comes from the socket. Like the IPC worker, the command is received
+ * into a fixed buffer and dropped if the length in the WIN TLV exceeds it.
+ *
+ * libFuzzer:
+ *     make fuzz_protocol CC=clang \
+ *         FUZZ_CFLAGS="-DCLV_LIBFUZZER -fsanitize=fuzzer,address"
+ * AFL or replay of a crash, the input is read from the files given or
+ * from stdin:
+ *     make fuzz_protocol CC=afl-gcc
+ */
+
+#define RX_BUF_SIZE (32 * 1024)
+
+static u8 rx_buf[RX_BUF_SIZE];
+
+static void fuzz_create_surface(u8 *data, u32 n)
+{
+	struct clv_surface_info si;
+
+	(void)clv_server_parse_create_surface_cmd(data, &si);
+}
+
+static void fuzz_create_view(u8 *data, u32 n)
+{
+	struct clv_view_info vi;
+
+	(void)clv_server_parse_create_view_cmd(data, &vi);
+}
+
+static void fuzz_create_bo(u8 *data, u32 n)
+{
+	struct clv_bo_info bi;
+
+	(void)clv_server_parse_create_bo_cmd(data, &bi);
+}
+
+static void fuzz_destroy_bo(u8 *data, u32 n)
+{
+	(void)clv_server_parse_destroy_bo_cmd(data);
+}
+
+static void fuzz_commit(u8 *data, u32 n)
+{
+	struct clv_commit_info ci;
+
+	(void)clv_server_parse_commit_req_cmd(data, &ci);
+}
+
+static void fuzz_transaction(u8 *data, u32 n)
+{
+	struct clv_transaction_info ti;
+
+	(void)clv_server_parse_transaction_cmd(data, &ti);
+}
+
+static void fuzz_frame(u8 *data, u32 n)
+{
+	(void)clv_server_parse_frame_cmd(data);
+}
+
+static void fuzz_destroy(u8 *data, u32 n)
+{
+	(void)clv_server_parse_destroy_cmd(data);
+}
+
+static void fuzz_shell(u8 *data, u32 n)
+{
+	struct clv_shell_info si;
+
+	(void)clv_parse_shell_cmd(data, &si);
+}
+
+static void fuzz_input_evt(u8 *data, u32 n)
+{
+	u32 count;
+
+	(void)clv_client_parse_input_evt_cmd(data, &count);
+}
+
+/* the generic codec, with the length actually received */
+static void fuzz_cmd_payload(u8 *data, u32 n)
+{
+	u32 shift;
+
+	for (shift = 0; shift < CLV_CMD_LAST_SHIFT; shift++)
+		(void)clv_cmd_payload(data, n, shift);
+}
+
+static void (*targets[])(u8 *data, u32 n) = {
+	fuzz_create_surface,
+	fuzz_create_view,
+	fuzz_create_bo,
+	fuzz_destroy_bo,
+	fuzz_commit,
+	fuzz_transaction,
+	fuzz_frame,
+	fuzz_destroy,
+	fuzz_shell,
+	fuzz_input_evt,
+	fuzz_cmd_payload,
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct clv_tlv *tlv;
+	u32 n;
+
+	if (size < 1 + sizeof(u32) + sizeof(*tlv) || size - 1 > RX_BUF_SIZE)
+		return 0;
+
+	n = size - 1;
+	memcpy(rx_buf, data + 1, n);
+	memset(rx_buf + n, 0, RX_BUF_SIZE - n);
+	tlv = (struct clv_tlv *)(rx_buf + sizeof(u32));
+	if (tlv->length > RX_BUF_SIZE - sizeof(u32) - sizeof(*tlv))
+		return 0;
+
+	targets[data[0] % ARRAY_SIZE(targets)](rx_buf,
+				sizeof(u32) + sizeof(*tlv) + tlv->length);
+
+	return 0;
+}
+
+#ifndef CLV_LIBFUZZER
+static void run_file(FILE *fp)
+{
+	static u8 buf[RX_BUF_SIZE + 1];
+	size_t n;
+
+	n = fread(buf, 1, sizeof(buf), fp);
+	LLVMFuzzerTestOneInput(buf, n);
+}
+
+s32 main(s32 argc, char **argv)
+{
+	FILE *fp;
+	s32 i;
+
+	if (argc < 2) {
+		run_file(stdin);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		fp = fopen(argv[i], "rb");
+		if (!fp) {
+			perror(argv[i]);
+			return 1;
+		}
+		run_file(fp);
+		fclose(fp);
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/input.h>
+#include <clover_utils.h>
+#include <clover_log.h>
+#include <clover_input_ring.h>
+
+/*
+ * Functional test of the input ring, producer and consumer in one process.
+ *
+ * The consumer maps the ring from copies of the fds the input server hands
+ * over, and checks what it pops against what was pushed: the order across
+ * the wrap of the ring, the doorbell written on the empty to non-empty edge
+ * only, what is held back or dropped once the ring is full, and how the
+ * motion is folded meanwhile.
+ *
+ * usage: test_input_ring
+ */
+
+#define RING_SIZE 16
+#define OUT_SIZE (2 * CLV_INPUT_RING_BACKLOG_MAX)
+
+static struct clv_input_ring prod, cons;
+static struct clv_input_event_ts out[OUT_SIZE];
+
+static s32 ring_open(void)
+{
+	if (clv_input_ring_create(&prod, RING_SIZE) < 0)
+		return -1;
+
+	if (clv_input_ring_map(&cons, dup(prod.fd), dup(prod.efd)) < 0) {
+		clv_input_ring_release(&prod);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void ring_close(void)
+{
+	clv_input_ring_release(&cons);
+	clv_input_ring_release(&prod);
+}
+
+/* a key press and its SYN_REPORT, seq in the key code */
+static void key_batch(struct clv_input_event_ts *evts, u32 seq)
+{
+	memset(evts, 0, sizeof(*evts));
+	evts[0].evt.type = EV_KEY;
+	evts[0].evt.code = seq;
+	evts[0].evt.v.value = 1;
+	evts[0].time = seq;
+	clv_input_make_syn(&evts[1], &evts[0]);
+}
+
+static void motion_batch(struct clv_input_event_ts *evts, u16 x, u16 y,
+			 s16 dx, s16 dy)
+{
+	memset(evts, 0, sizeof(*evts));
+	evts[0].evt.type = EV_ABS;
+	evts[0].evt.code = ABS_X | ABS_Y;
+	evts[0].evt.v.pos.x = x;
+	evts[0].evt.v.pos.y = y;
+	evts[0].evt.v.pos.dx = dx;
+	evts[0].evt.v.pos.dy = dy;
+	evts[0].time = x;
+	clv_input_make_syn(&evts[1], &evts[0]);
+}
+
+static u32 push_keys(u32 seq, u32 count)
+{
+	struct clv_input_event_ts evts[2];
+	u32 queued = 0, i;
+
+	for (i = 0; i < count; i++) {
+		key_batch(evts, seq + i);
+		queued += clv_input_ring_push(&prod, evts, 2);
+	}
+
+	return queued;
+}
+
+/* pop until nothing is queued nor held, like a subscriber keeping up */
+static u32 drain(void)
+{
+	u32 n = 0;
+
+	while (n < OUT_SIZE) {
+		n += clv_input_ring_pop(&cons, out + n, OUT_SIZE - n);
+		if (!clv_input_ring_flush(&prod)
+		    && !clv_input_ring_queued(&prod))
+			break;
+	}
+
+	return n;
+}
+
+/* out[from..n) are the key batches seq, seq + 1, ... */
+static s32 check_keys(u32 from, u32 n, u32 seq)
+{
+	u32 i;
+
+	for (i = from; i < n; i += 2) {
+		if (out[i].evt.type != EV_KEY || out[i].evt.code != seq
+		    || out[i].time != seq)
+			return -1;
+		if (out[i + 1].evt.type != EV_SYN
+		    || out[i + 1].evt.code != SYN_REPORT)
+			return -1;
+		seq++;
+	}
+
+	return 0;
+}
+
+static s32 check_motion(struct clv_input_event_ts *evt, u16 x, u16 y,
+			s16 dx, s16 dy)
+{
+	if (!clv_input_is_motion(evt) || evt->evt.v.pos.x != x
+	    || evt->evt.v.pos.y != y || evt->evt.v.pos.dx != dx
+	    || evt->evt.v.pos.dy != dy || evt->time != x)
+		return -1;
+
+	return evt[1].evt.type == EV_SYN ? 0 : -1;
+}
+
+static s32 doorbell_rung(void)
+{
+	u64 v;
+
+	return read(cons.efd, &v, sizeof(v)) == sizeof(v);
+}
+
+/* many times around the ring, popping behind the producer */
+static s32 test_order(void)
+{
+	u32 seq = 0, n;
+
+	while (seq < 4000) {
+		if (push_keys(seq, 3) != 6)
+			return -1;
+		n = clv_input_ring_pop(&cons, out, 5);
+		n += clv_input_ring_pop(&cons, out + n, OUT_SIZE - n);
+		if (n != 6 || check_keys(0, n, seq) < 0)
+			return -1;
+		seq += 3;
+	}
+
+	return 0;
+}
+
+static s32 test_doorbell(void)
+{
+	if (doorbell_rung())
+		return -1;
+
+	/* empty to non-empty */
+	push_keys(0, 1);
+	if (!doorbell_rung())
+		return -1;
+
+	/* not empty, the consumer is awake */
+	push_keys(1, 1);
+	if (doorbell_rung())
+		return -1;
+
+	/* popped partly, still not empty */
+	if (clv_input_ring_pop(&cons, out, 2) != 2)
+		return -1;
+	push_keys(2, 1);
+	if (doorbell_rung())
+		return -1;
+
+	/* seen empty, rung again */
+	if (drain() != 4)
+		return -1;
+	push_keys(3, 1);
+	if (!doorbell_rung())
+		return -1;
+
+	return 0;
+}
+
+static s32 test_overflow(void)
+{
+	u32 batches = RING_SIZE / 2, held = CLV_INPUT_RING_BACKLOG_MAX / 2;
+	u32 n;
+
+	/* held back in order, not lost */
+	if (push_keys(0, batches + 10) != (batches + 10) * 2)
+		return -1;
+	if (clv_input_ring_queued(&prod) != RING_SIZE
+	    || prod.shared->overflow)
+		return -1;
+	n = drain();
+	if (n != (batches + 10) * 2 || check_keys(0, n, 0) < 0)
+		return -1;
+
+	/* the backlog is full, the last batch is dropped and counted */
+	if (push_keys(0, batches + held + 1) != (batches + held) * 2)
+		return -1;
+	if (prod.shared->overflow != 2)
+		return -1;
+	n = drain();
+	if (n != (batches + held) * 2 || check_keys(0, n, 0) < 0)
+		return -1;
+
+	return 0;
+}
+
+static s32 test_motion(void)
+{
+	u32 batches = RING_SIZE / 2, n, i;
+	struct clv_input_event_ts evts[2];
+
+	/* folded while the ring is full, the key after it stays after it */
+	push_keys(0, batches);
+	for (i = 1; i <= 10; i++) {
+		motion_batch(evts, i, i, 1, -1);
+		if (clv_input_ring_push(&prod, evts, 2))
+			return -1;
+	}
+	if (prod.shared->coalesced != 20)
+		return -1;
+	push_keys(batches, 1);
+
+	n = drain();
+	if (n != batches * 2 + 4 || check_keys(0, batches * 2, 0) < 0)
+		return -1;
+	if (check_motion(&out[batches * 2], 10, 10, 10, -10) < 0)
+		return -1;
+	if (check_keys(batches * 2 + 2, n, batches) < 0)
+		return -1;
+
+	/* deltas which would overflow are not folded */
+	push_keys(0, batches);
+	motion_batch(evts, 1, 1, 30000, -30000);
+	clv_input_ring_push(&prod, evts, 2);
+	motion_batch(evts, 2, 2, 30000, -30000);
+	clv_input_ring_push(&prod, evts, 2);
+	motion_batch(evts, 3, 3, 1, 1);
+	clv_input_ring_push(&prod, evts, 2);
+
+	n = drain();
+	if (n != batches * 2 + 4 || prod.shared->overflow)
+		return -1;
+	if (check_motion(&out[batches * 2], 1, 1, 30000, -30000) < 0)
+		return -1;
+	if (check_motion(&out[batches * 2 + 2], 3, 3, 30001, -29999) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* a consumer built with another record does not map the ring */
+static s32 test_rec_size(void)
+{
+	struct clv_input_ring ring;
+
+	prod.shared->rec_size = sizeof(struct clv_input_event);
+	if (!clv_input_ring_map(&ring, dup(prod.fd), dup(prod.efd))) {
+		clv_input_ring_release(&ring);
+		return -1;
+	}
+
+	return 0;
+}
+
+struct test_case {
+	const char *name;
+	s32 (*run)(void);
+};
+
+static struct test_case cases[] = {
+	{ "order", test_order },
+	{ "doorbell", test_doorbell },
+	{ "overflow", test_overflow },
+	{ "motion", test_motion },
+	{ "record size", test_rec_size },
+};
+
+s32 main(s32 argc, char **argv)
+{
+	s32 failed = 0, ret;
+	u32 i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		if (ring_open() < 0) {
+			fprintf(stderr, "failed to create input ring\n");
+			return 1;
+		}
+		ret = cases[i].run();
+		ring_close();
+		printf("%-28s %s\n", cases[i].name, ret < 0 ? "FAILED" : "ok");
+		if (ret < 0)
+			failed = 1;
+	}
+
+	return failed;
+}